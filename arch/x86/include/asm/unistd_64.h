@@ -663,6 +663,14 @@ __SYSCALL(__NR_rt_tgsigqueueinfo, sys_rt_tgsigqueueinfo)
 __SYSCALL(__NR_perf_event_open, sys_perf_event_open)
 #define __NR_recvmmsg				299
 __SYSCALL(__NR_recvmmsg, sys_recvmmsg)
+#define __NR_sendmmsg				300
+__SYSCALL(__NR_sendmmsg, sys_sendmmsg)
+#define __NR_io_uring_setup			301
+__SYSCALL(__NR_io_uring_setup, sys_io_uring_setup)
+#define __NR_io_uring_enter			302
+__SYSCALL(__NR_io_uring_enter, sys_io_uring_enter)
+#define __NR_io_uring_register			303
+__SYSCALL(__NR_io_uring_register, sys_io_uring_register)
 
 #ifndef __NO_STUBS
 #define __ARCH_WANT_OLD_READDIR
@@ -16,6 +16,7 @@
 #include <linux/module.h>
 #include <linux/err.h>
 #include <linux/slab.h>
+#include <linux/genhd.h>
 #include "blk-cgroup.h"
 
 static DEFINE_SPINLOCK(blkio_list_lock);
@@ -163,9 +164,13 @@ blkiocg_weight_write(struct cgroup *cgroup, struct cftype *cftype, u64 val)
 	spin_lock_irq(&blkcg->lock);
 	blkcg->weight = (unsigned int)val;
 	hlist_for_each_entry(blkg, n, &blkcg->blkg_list, blkcg_node) {
-		list_for_each_entry(blkiop, &blkio_list, list)
+		list_for_each_entry(blkiop, &blkio_list, list) {
+			if (blkiop->plid != blkg->plid ||
+			    !blkiop->ops.blkio_update_group_weight_fn)
+				continue;
 			blkiop->ops.blkio_update_group_weight_fn(blkg,
 					blkcg->weight);
+		}
 	}
 	spin_unlock_irq(&blkcg->lock);
 	spin_unlock(&blkio_list_lock);
@@ -186,7 +191,7 @@ static int blkiocg_##__VAR##_read(struct cgroup *cgroup,		\
 	blkcg = cgroup_to_blkio_cgroup(cgroup);				\
 	rcu_read_lock();						\
 	hlist_for_each_entry_rcu(blkg, n, &blkcg->blkg_list, blkcg_node) {\
-		if (blkg->dev)						\
+		if (blkg->dev && blkg->plid == BLKIO_POLICY_PROP)	\
 			seq_printf(m, "%u:%u %lu\n", MAJOR(blkg->dev),	\
 				 MINOR(blkg->dev), blkg->__VAR);	\
 	}								\
@@ -202,6 +207,198 @@ SHOW_FUNCTION_PER_GROUP(dequeue);
 #endif
 #undef SHOW_FUNCTION_PER_GROUP
 
+#ifdef CONFIG_BLK_DEV_THROTTLING
+atomic_t blkio_throtl_nr_rules = ATOMIC_INIT(0);
+EXPORT_SYMBOL_GPL(blkio_throtl_nr_rules);
+
+enum blkio_throtl_file {
+	BLKIO_THROTL_read_bps,
+	BLKIO_THROTL_write_bps,
+	BLKIO_THROTL_read_iops,
+	BLKIO_THROTL_write_iops,
+};
+
+static struct blkio_policy_node *
+blkio_policy_search_node(struct blkio_cgroup *blkcg, dev_t dev)
+{
+	struct blkio_policy_node *pn;
+
+	list_for_each_entry(pn, &blkcg->policy_list, node) {
+		if (pn->dev == dev)
+			return pn;
+	}
+
+	return NULL;
+}
+
+/*
+ * Limits for a new throttling group.  Called with the queue lock held,
+ * which nests outside blkcg->lock.
+ */
+void blkcg_get_throtl_limits(struct blkio_cgroup *blkcg, dev_t dev,
+			     u64 *bps, unsigned int *iops)
+{
+	struct blkio_policy_node *pn;
+	unsigned long flags;
+
+	spin_lock_irqsave(&blkcg->lock, flags);
+	pn = blkio_policy_search_node(blkcg, dev);
+	if (pn) {
+		bps[READ] = pn->bps[READ];
+		bps[WRITE] = pn->bps[WRITE];
+		iops[READ] = pn->iops[READ];
+		iops[WRITE] = pn->iops[WRITE];
+	} else {
+		bps[READ] = bps[WRITE] = 0;
+		iops[READ] = iops[WRITE] = 0;
+	}
+	spin_unlock_irqrestore(&blkcg->lock, flags);
+}
+EXPORT_SYMBOL_GPL(blkcg_get_throtl_limits);
+
+static u64 blkio_policy_node_val(struct blkio_policy_node *pn, int file)
+{
+	switch (file) {
+	case BLKIO_THROTL_read_bps:
+		return pn->bps[READ];
+	case BLKIO_THROTL_write_bps:
+		return pn->bps[WRITE];
+	case BLKIO_THROTL_read_iops:
+		return pn->iops[READ];
+	default:
+		return pn->iops[WRITE];
+	}
+}
+
+static int blkiocg_throtl_read(struct cgroup *cgroup, struct cftype *cft,
+			       struct seq_file *m)
+{
+	struct blkio_cgroup *blkcg = cgroup_to_blkio_cgroup(cgroup);
+	struct blkio_policy_node *pn;
+	u64 val;
+
+	spin_lock_irq(&blkcg->lock);
+	list_for_each_entry(pn, &blkcg->policy_list, node) {
+		val = blkio_policy_node_val(pn, cft->private);
+		if (val)
+			seq_printf(m, "%u:%u %llu\n", MAJOR(pn->dev),
+				   MINOR(pn->dev), (unsigned long long)val);
+	}
+	spin_unlock_irq(&blkcg->lock);
+	return 0;
+}
+
+/*
+ * "major:minor value" sets a limit on a whole disk, a value of 0
+ * removes it.
+ */
+static int blkiocg_throtl_write(struct cgroup *cgroup, struct cftype *cft,
+				const char *buffer)
+{
+	struct blkio_cgroup *blkcg;
+	struct blkio_policy_node *pn, *new;
+	struct blkio_policy_type *blkiop;
+	struct blkio_group *blkg;
+	struct hlist_node *n;
+	struct gendisk *disk;
+	unsigned int major, minor;
+	unsigned long long val;
+	unsigned int iops[2];
+	u64 bps[2];
+	int partno;
+	dev_t dev;
+
+	if (sscanf(buffer, "%u:%u %llu", &major, &minor, &val) != 3)
+		return -EINVAL;
+	if ((cft->private == BLKIO_THROTL_read_iops ||
+	     cft->private == BLKIO_THROTL_write_iops) && val > UINT_MAX)
+		return -EINVAL;
+
+	dev = MKDEV(major, minor);
+	disk = get_gendisk(dev, &partno);
+	if (!disk)
+		return -ENODEV;
+	put_disk(disk);
+	if (partno)
+		return -EINVAL;
+
+	new = kzalloc(sizeof(*new), GFP_KERNEL);
+	if (!new)
+		return -ENOMEM;
+
+	blkcg = cgroup_to_blkio_cgroup(cgroup);
+	spin_lock(&blkio_list_lock);
+	spin_lock_irq(&blkcg->lock);
+
+	pn = blkio_policy_search_node(blkcg, dev);
+	if (!pn) {
+		if (!val)
+			goto out;
+		pn = new;
+		new = NULL;
+		pn->dev = dev;
+		list_add(&pn->node, &blkcg->policy_list);
+		atomic_inc(&blkio_throtl_nr_rules);
+	}
+
+	switch (cft->private) {
+	case BLKIO_THROTL_read_bps:
+		pn->bps[READ] = val;
+		break;
+	case BLKIO_THROTL_write_bps:
+		pn->bps[WRITE] = val;
+		break;
+	case BLKIO_THROTL_read_iops:
+		pn->iops[READ] = val;
+		break;
+	case BLKIO_THROTL_write_iops:
+		pn->iops[WRITE] = val;
+		break;
+	}
+
+	bps[READ] = pn->bps[READ];
+	bps[WRITE] = pn->bps[WRITE];
+	iops[READ] = pn->iops[READ];
+	iops[WRITE] = pn->iops[WRITE];
+
+	if (!bps[READ] && !bps[WRITE] && !iops[READ] && !iops[WRITE]) {
+		list_del(&pn->node);
+		kfree(pn);
+		atomic_dec(&blkio_throtl_nr_rules);
+	}
+
+	hlist_for_each_entry(blkg, n, &blkcg->blkg_list, blkcg_node) {
+		if (blkg->dev != dev)
+			continue;
+		list_for_each_entry(blkiop, &blkio_list, list) {
+			if (blkiop->plid != blkg->plid ||
+			    !blkiop->ops.blkio_update_group_throtl_fn)
+				continue;
+			blkiop->ops.blkio_update_group_throtl_fn(blkg->key,
+							blkg, bps, iops);
+		}
+	}
+out:
+	spin_unlock_irq(&blkcg->lock);
+	spin_unlock(&blkio_list_lock);
+	kfree(new);
+	return 0;
+}
+
+static void blkio_free_policy_nodes(struct blkio_cgroup *blkcg)
+{
+	struct blkio_policy_node *pn, *tmp;
+
+	list_for_each_entry_safe(pn, tmp, &blkcg->policy_list, node) {
+		list_del(&pn->node);
+		kfree(pn);
+		atomic_dec(&blkio_throtl_nr_rules);
+	}
+}
+#else
+static inline void blkio_free_policy_nodes(struct blkio_cgroup *blkcg) { }
+#endif
+
 #ifdef CONFIG_DEBUG_BLK_CGROUP
 void blkiocg_update_blkio_group_dequeue_stats(struct blkio_group *blkg,
 			unsigned long dequeue)
@@ -231,6 +428,36 @@ struct cftype blkio_files[] = {
 		.read_seq_string = blkiocg_dequeue_read,
        },
 #endif
+#ifdef CONFIG_BLK_DEV_THROTTLING
+	{
+		.name = "throttle.read_bps_device",
+		.private = BLKIO_THROTL_read_bps,
+		.read_seq_string = blkiocg_throtl_read,
+		.write_string = blkiocg_throtl_write,
+		.max_write_len = 256,
+	},
+	{
+		.name = "throttle.write_bps_device",
+		.private = BLKIO_THROTL_write_bps,
+		.read_seq_string = blkiocg_throtl_read,
+		.write_string = blkiocg_throtl_write,
+		.max_write_len = 256,
+	},
+	{
+		.name = "throttle.read_iops_device",
+		.private = BLKIO_THROTL_read_iops,
+		.read_seq_string = blkiocg_throtl_read,
+		.write_string = blkiocg_throtl_write,
+		.max_write_len = 256,
+	},
+	{
+		.name = "throttle.write_iops_device",
+		.private = BLKIO_THROTL_write_iops,
+		.read_seq_string = blkiocg_throtl_read,
+		.write_string = blkiocg_throtl_write,
+		.max_write_len = 256,
+	},
+#endif
 };
 
 static int blkiocg_populate(struct cgroup_subsys *subsys, struct cgroup *cgroup)
@@ -272,11 +499,15 @@ remove_entry:
 	 * of callback function.
 	 */
 	spin_lock(&blkio_list_lock);
-	list_for_each_entry(blkiop, &blkio_list, list)
+	list_for_each_entry(blkiop, &blkio_list, list) {
+		if (blkiop->plid != blkg->plid)
+			continue;
 		blkiop->ops.blkio_unlink_group_fn(key, blkg);
+	}
 	spin_unlock(&blkio_list_lock);
 	goto remove_entry;
 done:
+	blkio_free_policy_nodes(blkcg);
 	free_css_id(&blkio_subsys, &blkcg->css);
 	rcu_read_unlock();
 	if (blkcg != &blkio_root_cgroup)
@@ -306,6 +537,7 @@ blkiocg_create(struct cgroup_subsys *subsys, struct cgroup *cgroup)
 done:
 	spin_lock_init(&blkcg->lock);
 	INIT_HLIST_HEAD(&blkcg->blkg_list);
+	INIT_LIST_HEAD(&blkcg->policy_list);
 
 	return &blkcg->css;
 }
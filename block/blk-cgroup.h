@@ -15,6 +15,11 @@
 
 #include <linux/cgroup.h>
 
+enum blkio_policy_id {
+	BLKIO_POLICY_PROP = 0,		/* Proportional Bandwidth division */
+	BLKIO_POLICY_THROTL,		/* Throttling */
+};
+
 #if defined(CONFIG_BLK_CGROUP) || defined(CONFIG_BLK_CGROUP_MODULE)
 
 #ifndef CONFIG_BLK_CGROUP
@@ -28,6 +33,18 @@ struct blkio_cgroup {
 	unsigned int weight;
 	spinlock_t lock;
 	struct hlist_head blkg_list;
+	struct list_head policy_list;	/* per device throttling rules */
+};
+
+/*
+ * Throttling limits of a cgroup on one device, indexed by READ/WRITE.
+ * Zero means unlimited.
+ */
+struct blkio_policy_node {
+	struct list_head node;
+	dev_t dev;
+	u64 bps[2];
+	unsigned int iops[2];
 };
 
 struct blkio_group {
@@ -43,6 +60,8 @@ struct blkio_group {
 #endif
 	/* The device MKDEV(major, minor), this group has been created for */
 	dev_t   dev;
+	/* The policy which owns this group */
+	enum blkio_policy_id plid;
 
 	/* total disk time and nr sectors dispatched by this group */
 	unsigned long time;
@@ -52,15 +71,19 @@ struct blkio_group {
 typedef void (blkio_unlink_group_fn) (void *key, struct blkio_group *blkg);
 typedef void (blkio_update_group_weight_fn) (struct blkio_group *blkg,
 						unsigned int weight);
+typedef void (blkio_update_group_throtl_fn) (void *key,
+			struct blkio_group *blkg, u64 *bps, unsigned int *iops);
 
 struct blkio_policy_ops {
 	blkio_unlink_group_fn *blkio_unlink_group_fn;
 	blkio_update_group_weight_fn *blkio_update_group_weight_fn;
+	blkio_update_group_throtl_fn *blkio_update_group_throtl_fn;
 };
 
 struct blkio_policy_type {
 	struct list_head list;
 	struct blkio_policy_ops ops;
+	enum blkio_policy_id plid;
 };
 
 /* Blkio controller policy registration */
@@ -107,6 +130,12 @@ extern struct blkio_group *blkiocg_lookup_group(struct blkio_cgroup *blkcg,
 						void *key);
 void blkiocg_update_blkio_group_stats(struct blkio_group *blkg,
 			unsigned long time, unsigned long sectors);
+#ifdef CONFIG_BLK_DEV_THROTTLING
+/* Number of throttling rules set in all cgroups */
+extern atomic_t blkio_throtl_nr_rules;
+void blkcg_get_throtl_limits(struct blkio_cgroup *blkcg, dev_t dev,
+			     u64 *bps, unsigned int *iops);
+#endif
 #else
 struct cgroup;
 static inline struct blkio_cgroup *
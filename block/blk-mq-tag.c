@@ -0,0 +1,127 @@
+/*
+ * Tag allocation for the multiqueue block layer.  Every hardware queue
+ * has a fixed set of tags, one per preallocated request.  Allocation is
+ * a lockless search of a bitmap, started from a per-cpu hint so that
+ * cpus sharing a hardware queue mostly touch different words of it.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+
+#include "blk-mq.h"
+
+struct blk_mq_tags {
+	unsigned int		nr_tags;
+	unsigned int		*alloc_hint;	/* per-cpu search start */
+	wait_queue_head_t	wait;
+	unsigned long		map[0];
+};
+
+static int __blk_mq_get_tag(struct blk_mq_tags *tags, unsigned int start)
+{
+	unsigned int tag = start;
+	int wrapped = 0;
+
+	for (;;) {
+		tag = find_next_zero_bit(tags->map, tags->nr_tags, tag);
+		if (tag >= tags->nr_tags) {
+			if (wrapped || !start)
+				return -1;
+			wrapped = 1;
+			tag = 0;
+			continue;
+		}
+		if (wrapped && tag >= start)
+			return -1;
+		if (!test_and_set_bit(tag, tags->map))
+			return tag;
+		tag++;
+	}
+}
+
+/*
+ * Returns a free tag, or -1 if all tags are in use.
+ */
+int blk_mq_get_tag(struct blk_mq_tags *tags)
+{
+	unsigned int *hint;
+	int tag;
+
+	hint = per_cpu_ptr(tags->alloc_hint, get_cpu());
+	tag = __blk_mq_get_tag(tags, *hint);
+	if (tag >= 0)
+		*hint = tag + 1 < tags->nr_tags ? tag + 1 : 0;
+	put_cpu();
+
+	return tag;
+}
+
+void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag)
+{
+	BUG_ON(tag >= tags->nr_tags);
+
+	clear_bit(tag, tags->map);
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(&tags->wait))
+		wake_up(&tags->wait);
+}
+
+bool blk_mq_has_free_tags(struct blk_mq_tags *tags)
+{
+	return find_first_zero_bit(tags->map, tags->nr_tags) < tags->nr_tags;
+}
+
+bool blk_mq_tags_busy(struct blk_mq_tags *tags)
+{
+	return find_first_bit(tags->map, tags->nr_tags) < tags->nr_tags;
+}
+
+/*
+ * Sleep until a tag is freed.  @cond is checked again after queueing on
+ * the wait queue, so a tag put in between is not missed.
+ */
+void blk_mq_wait_tags(struct blk_mq_tags *tags,
+		      bool (*cond)(struct blk_mq_tags *))
+{
+	DEFINE_WAIT(wait);
+
+	prepare_to_wait(&tags->wait, &wait, TASK_UNINTERRUPTIBLE);
+	if (!cond(tags))
+		io_schedule();
+	finish_wait(&tags->wait, &wait);
+}
+
+struct blk_mq_tags *blk_mq_init_tags(unsigned int nr_tags, int node)
+{
+	struct blk_mq_tags *tags;
+	unsigned int cpu;
+
+	tags = kzalloc_node(sizeof(*tags) +
+			    BITS_TO_LONGS(nr_tags) * sizeof(unsigned long),
+			    GFP_KERNEL, node);
+	if (!tags)
+		return NULL;
+
+	tags->alloc_hint = alloc_percpu(unsigned int);
+	if (!tags->alloc_hint) {
+		kfree(tags);
+		return NULL;
+	}
+
+	/* spread the cpus over the map */
+	for_each_possible_cpu(cpu)
+		*per_cpu_ptr(tags->alloc_hint, cpu) =
+			(cpu * nr_tags / nr_cpu_ids) % nr_tags;
+
+	tags->nr_tags = nr_tags;
+	init_waitqueue_head(&tags->wait);
+	return tags;
+}
+
+void blk_mq_free_tags(struct blk_mq_tags *tags)
+{
+	free_percpu(tags->alloc_hint);
+	kfree(tags);
+}
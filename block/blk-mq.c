@@ -0,0 +1,763 @@
+/*
+ * Multiqueue block layer.
+ *
+ * Requests are queued on a per-cpu software queue and dispatched through
+ * one of a driver's hardware queues, without the queue_lock and without
+ * an io scheduler.  Every hardware queue owns a preallocated set of
+ * requests, indexed by tag, and completions are run on the cpu that
+ * submitted the request.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/cpu.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/writeback.h>
+
+#include <trace/events/block.h>
+
+#include "blk.h"
+#include "blk-mq.h"
+
+static DEFINE_MUTEX(all_q_mutex);
+static LIST_HEAD(all_q_list);
+
+#define QUEUE_FLAG_MQ_DEFAULT	((1 << QUEUE_FLAG_IO_STAT) |		\
+				 (1 << QUEUE_FLAG_CLUSTER) |		\
+				 (1 << QUEUE_FLAG_SAME_COMP))
+
+/**
+ * blk_mq_map_queue - default cpu to hardware queue mapping
+ * @q:		request queue
+ * @cpu:	submitting cpu
+ */
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q, const int cpu)
+{
+	return q->queue_hw_ctx[q->mq_map[cpu]];
+}
+EXPORT_SYMBOL(blk_mq_map_queue);
+
+static void blk_mq_rq_init(struct blk_mq_ctx *ctx, struct request *rq,
+			   int rw)
+{
+	struct request_queue *q = ctx->queue;
+	int tag = rq->tag;
+
+	blk_rq_init(q, rq);
+	rq->tag = tag;
+	rq->mq_ctx = ctx;
+	rq->cmd_flags = rw;
+	if (blk_queue_io_stat(q))
+		rq->cmd_flags |= REQ_IO_STAT;
+}
+
+static struct request *blk_mq_get_request(struct request_queue *q, int rw,
+					  bool wait)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	int tag;
+
+	for (;;) {
+		ctx = per_cpu_ptr(q->queue_ctx, get_cpu());
+		hctx = q->mq_ops->map_queue(q, ctx->cpu);
+		tag = blk_mq_get_tag(hctx->tags);
+		put_cpu();
+
+		if (tag >= 0) {
+			rq = hctx->rqs[tag];
+			blk_mq_rq_init(ctx, rq, rw);
+			return rq;
+		}
+		if (!wait)
+			return NULL;
+
+		/*
+		 * Make sure what is queued gets to the driver, so that
+		 * completions free up tags, then wait for one.
+		 */
+		blk_mq_run_hw_queue(hctx, false);
+		blk_mq_wait_tags(hctx->tags, blk_mq_has_free_tags);
+	}
+}
+
+/**
+ * blk_mq_alloc_request - allocate a request outside of the bio path
+ * @q:		request queue
+ * @rw:		READ or WRITE
+ * @gfp:	allocation mask; with __GFP_WAIT, sleep until a tag is free
+ */
+struct request *blk_mq_alloc_request(struct request_queue *q, int rw,
+				     gfp_t gfp)
+{
+	return blk_mq_get_request(q, rw, gfp & __GFP_WAIT);
+}
+EXPORT_SYMBOL(blk_mq_alloc_request);
+
+/**
+ * blk_mq_free_request - return a request and its tag to its queue
+ * @rq:		request to free
+ *
+ * Callers normally go through blk_put_request(), which honours the
+ * request's reference count.
+ */
+void blk_mq_free_request(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	struct blk_mq_hw_ctx *hctx = q->mq_ops->map_queue(q, rq->mq_ctx->cpu);
+
+	/* this is a bio leak */
+	WARN_ON(rq->bio != NULL);
+
+	rq->mq_ctx = NULL;
+	blk_mq_put_tag(hctx->tags, rq->tag);
+}
+EXPORT_SYMBOL(blk_mq_free_request);
+
+/**
+ * blk_mq_end_io - complete a request in full
+ * @rq:		request to complete
+ * @error:	%0 for success, < %0 for error
+ */
+void blk_mq_end_io(struct request *rq, int error)
+{
+	if (blk_update_request(rq, error, blk_rq_bytes(rq)))
+		BUG();
+
+	if (unlikely(laptop_mode) && blk_fs_request(rq))
+		laptop_io_completion();
+
+	blk_account_io_done(rq);
+
+	if (rq->end_io)
+		rq->end_io(rq, error);
+	else
+		__blk_put_request(rq->q, rq);
+}
+EXPORT_SYMBOL(blk_mq_end_io);
+
+#if defined(CONFIG_SMP) && defined(CONFIG_USE_GENERIC_SMP_HELPERS)
+static void blk_mq_complete_remote(void *data)
+{
+	struct request *rq = data;
+
+	rq->q->mq_ops->complete(rq);
+}
+
+/**
+ * blk_mq_complete_request - end a request from the driver's completion path
+ * @rq:		request to complete
+ *
+ * Description:
+ *     Runs the ->complete() handler of the queue on the cpu that submitted
+ *     @rq, where its data and the waiter are likely to be cache hot.
+ *     Callable from interrupt context.
+ */
+void blk_mq_complete_request(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	int cpu = get_cpu();
+	int ccpu = rq->mq_ctx->cpu;
+
+	if (cpu != ccpu && cpu_online(ccpu) &&
+	    test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags)) {
+		rq->csd.func = blk_mq_complete_remote;
+		rq->csd.info = rq;
+		rq->csd.flags = 0;
+		__smp_call_function_single(ccpu, &rq->csd, 0);
+	} else
+		q->mq_ops->complete(rq);
+	put_cpu();
+}
+#else
+void blk_mq_complete_request(struct request *rq)
+{
+	rq->q->mq_ops->complete(rq);
+}
+#endif
+EXPORT_SYMBOL(blk_mq_complete_request);
+
+/*
+ * Pull the requests off the software queues of @hctx and hand them to
+ * the driver, until it is out of requests or out of resources.
+ */
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	LIST_HEAD(rq_list);
+	int bit, ret, queued = 0;
+
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	hctx->run++;
+
+	for_each_set_bit(bit, hctx->ctx_map, hctx->nr_ctx) {
+		if (!test_and_clear_bit(bit, hctx->ctx_map))
+			continue;
+		ctx = hctx->ctxs[bit];
+		spin_lock(&ctx->lock);
+		list_splice_tail_init(&ctx->rq_list, &rq_list);
+		spin_unlock(&ctx->lock);
+	}
+
+	/* requests the driver turned down last time go first */
+	if (!list_empty_careful(&hctx->dispatch)) {
+		spin_lock(&hctx->lock);
+		list_splice_init(&hctx->dispatch, &rq_list);
+		spin_unlock(&hctx->lock);
+	}
+
+	while (!list_empty(&rq_list)) {
+		rq = list_first_entry(&rq_list, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+
+		trace_block_rq_issue(q, rq);
+		ret = q->mq_ops->queue_rq(hctx, rq);
+		if (ret == BLK_MQ_RQ_QUEUE_OK) {
+			queued++;
+			continue;
+		}
+		if (ret == BLK_MQ_RQ_QUEUE_BUSY) {
+			list_add(&rq->queuelist, &rq_list);
+			break;
+		}
+
+		WARN_ON(ret != BLK_MQ_RQ_QUEUE_ERROR);
+		blk_mq_end_io(rq, -EIO);
+	}
+
+	hctx->queued += queued;
+	if (queued && q->mq_ops->commit_rqs)
+		q->mq_ops->commit_rqs(hctx);
+
+	if (list_empty(&rq_list))
+		return;
+
+	spin_lock(&hctx->lock);
+	list_splice(&rq_list, &hctx->dispatch);
+	spin_unlock(&hctx->lock);
+
+	/*
+	 * The driver stopped the queue before returning BUSY; if it has
+	 * already restarted it, that run may have missed the requests we
+	 * just put back.
+	 */
+	if (!test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+		kblockd_schedule_work(q, &hctx->run_work);
+}
+
+static void blk_mq_run_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx =
+		container_of(work, struct blk_mq_hw_ctx, run_work);
+
+	__blk_mq_run_hw_queue(hctx);
+}
+
+/**
+ * blk_mq_run_hw_queue - dispatch the requests queued on a hardware queue
+ * @hctx:	hardware queue
+ * @async:	leave the work to kblockd
+ *
+ * Description:
+ *     ->queue_rq() is always called from process context.  A synchronous
+ *     run from interrupt context is turned into an asynchronous one.
+ */
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
+{
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	if (!async && !in_interrupt())
+		__blk_mq_run_hw_queue(hctx);
+	else
+		kblockd_schedule_work(hctx->queue, &hctx->run_work);
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+void blk_mq_run_hw_queues(struct request_queue *q, bool async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		blk_mq_run_hw_queue(hctx, async);
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queues);
+
+/**
+ * blk_mq_stop_hw_queue - stop dispatching to a hardware queue
+ * @hctx:	hardware queue
+ *
+ * Description:
+ *     Used by a driver that ran out of resources in ->queue_rq(); it must
+ *     restart the queue from its completion path.
+ */
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+void blk_mq_start_stopped_hw_queues(struct request_queue *q, bool async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			continue;
+
+		clear_bit(BLK_MQ_S_STOPPED, &hctx->state);
+		blk_mq_run_hw_queue(hctx, async);
+	}
+}
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+static void __blk_mq_insert_request(struct blk_mq_hw_ctx *hctx,
+				    struct request *rq, bool at_head)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+
+	trace_block_rq_insert(hctx->queue, rq);
+
+	spin_lock(&ctx->lock);
+	if (at_head)
+		list_add(&rq->queuelist, &ctx->rq_list);
+	else
+		list_add_tail(&rq->queuelist, &ctx->rq_list);
+	set_bit(ctx->index_hw, hctx->ctx_map);
+	spin_unlock(&ctx->lock);
+}
+
+/**
+ * blk_mq_insert_request - queue a prepared request
+ * @rq:		request from blk_mq_alloc_request()
+ * @at_head:	insert at the head of its software queue
+ * @run_queue:	dispatch right away
+ * @async:	dispatch from kblockd instead of the caller's context
+ */
+void blk_mq_insert_request(struct request *rq, bool at_head, bool run_queue,
+			   bool async)
+{
+	struct request_queue *q = rq->q;
+	struct blk_mq_hw_ctx *hctx = q->mq_ops->map_queue(q, rq->mq_ctx->cpu);
+
+	__blk_mq_insert_request(hctx, rq, at_head);
+	if (run_queue)
+		blk_mq_run_hw_queue(hctx, async);
+}
+EXPORT_SYMBOL(blk_mq_insert_request);
+
+/*
+ * Barriers.  There is no single dispatch queue to hold back behind a
+ * barrier, so unless the device keeps order by itself (QUEUE_ORDERED_TAG)
+ * the submitter runs the ordered sequence synchronously: wait for the
+ * requests in flight, then issue flush, barrier write and flush one at a
+ * time.
+ */
+struct blk_mq_sync {
+	struct completion	done;
+	int			error;
+};
+
+static void blk_mq_end_sync_rq(struct request *rq, int error)
+{
+	struct blk_mq_sync *sync = rq->end_io_data;
+
+	sync->error = error;
+	__blk_put_request(rq->q, rq);
+	complete(&sync->done);
+}
+
+static int blk_mq_execute_sync(struct request *rq)
+{
+	struct blk_mq_sync sync;
+
+	init_completion(&sync.done);
+	sync.error = 0;
+	rq->end_io = blk_mq_end_sync_rq;
+	rq->end_io_data = &sync;
+
+	blk_mq_insert_request(rq, true, true, false);
+	wait_for_completion(&sync.done);
+
+	return sync.error;
+}
+
+static bool blk_mq_tags_idle(struct blk_mq_tags *tags)
+{
+	return !blk_mq_tags_busy(tags);
+}
+
+static void blk_mq_drain_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		blk_mq_run_hw_queue(hctx, false);
+		while (blk_mq_tags_busy(hctx->tags))
+			blk_mq_wait_tags(hctx->tags, blk_mq_tags_idle);
+	}
+}
+
+static int blk_mq_flush(struct request_queue *q, struct gendisk *disk)
+{
+	struct request *rq = blk_mq_get_request(q, WRITE, true);
+
+	rq->cmd_flags |= REQ_HARDBARRIER;
+	rq->rq_disk = disk;
+	q->prepare_flush_fn(q, rq);
+
+	return blk_mq_execute_sync(rq);
+}
+
+/*
+ * The barrier write is issued from a clone, so that the original bio is
+ * only completed once the whole sequence is done.
+ */
+static int blk_mq_bar(struct request_queue *q, struct bio *bio, bool fua)
+{
+	struct request *rq;
+	struct bio *clone;
+	int err;
+
+	clone = bio_clone(bio, GFP_NOIO);
+	rq = blk_mq_get_request(q, bio_data_dir(bio), true);
+	init_request_from_bio(rq, clone);
+	if (fua)
+		rq->cmd_flags |= REQ_FUA;
+	drive_stat_acct(rq, 1);
+
+	err = blk_mq_execute_sync(rq);
+	if (!err && !test_bit(BIO_UPTODATE, &clone->bi_flags))
+		err = -EIO;
+	bio_put(clone);
+
+	return err;
+}
+
+static void blk_mq_ordered(struct request_queue *q, struct bio *bio)
+{
+	struct gendisk *disk = bio->bi_bdev->bd_disk;
+	unsigned int ordered = q->next_ordered;
+	int err = 0;
+
+	/* an empty barrier has nothing to write and nothing to flush after */
+	if (!bio_has_data(bio))
+		ordered &= ~(QUEUE_ORDERED_DO_BAR | QUEUE_ORDERED_DO_POSTFLUSH);
+
+	blk_mq_drain_queue(q);
+
+	if (ordered & QUEUE_ORDERED_DO_PREFLUSH)
+		err = blk_mq_flush(q, disk);
+	if (!err && (ordered & QUEUE_ORDERED_DO_BAR))
+		err = blk_mq_bar(q, bio, ordered & QUEUE_ORDERED_DO_FUA);
+	if (!err && (ordered & QUEUE_ORDERED_DO_POSTFLUSH))
+		err = blk_mq_flush(q, disk);
+
+	bio_endio(bio, err);
+}
+
+static int blk_mq_make_request(struct request_queue *q, struct bio *bio)
+{
+	struct request *rq;
+	int rw = bio_data_dir(bio);
+
+	blk_queue_bounce(q, &bio);
+
+	if (unlikely(bio_rw_flagged(bio, BIO_RW_BARRIER))) {
+		if (q->next_ordered == QUEUE_ORDERED_NONE) {
+			bio_endio(bio, -EOPNOTSUPP);
+			return 0;
+		}
+		if (q->next_ordered != QUEUE_ORDERED_TAG ||
+		    !bio_has_data(bio)) {
+			blk_mq_ordered(q, bio);
+			return 0;
+		}
+	}
+
+	if (bio_rw_flagged(bio, BIO_RW_SYNCIO))
+		rw |= REQ_RW_SYNC;
+
+	trace_block_getrq(q, bio, rw);
+	rq = blk_mq_get_request(q, rw, true);
+	init_request_from_bio(rq, bio);
+	drive_stat_acct(rq, 1);
+
+	blk_mq_insert_request(rq, false, true, false);
+	return 0;
+}
+
+/*
+ * Spread the possible cpus evenly over the hardware queues, keeping
+ * neighbouring cpu numbers on the same queue.
+ */
+static void blk_mq_init_queue_map(unsigned int *map, unsigned int nr_queues)
+{
+	unsigned int nr_cpus = num_possible_cpus();
+	unsigned int i, cpu = 0;
+
+	for_each_possible_cpu(i)
+		map[i] = cpu++ * nr_queues / nr_cpus;
+}
+
+static void blk_mq_free_rqs(struct blk_mq_hw_ctx *hctx, unsigned int depth)
+{
+	unsigned int i;
+
+	if (hctx->rqs) {
+		for (i = 0; i < depth; i++)
+			kfree(hctx->rqs[i]);
+		kfree(hctx->rqs);
+	}
+	if (hctx->tags)
+		blk_mq_free_tags(hctx->tags);
+}
+
+static int blk_mq_init_rqs(struct blk_mq_hw_ctx *hctx, struct blk_mq_reg *reg)
+{
+	size_t rq_size = sizeof(struct request) + reg->cmd_size;
+	unsigned int i;
+
+	hctx->tags = blk_mq_init_tags(reg->queue_depth, reg->numa_node);
+	if (!hctx->tags)
+		return -ENOMEM;
+
+	hctx->rqs = kzalloc_node(reg->queue_depth * sizeof(struct request *),
+				 GFP_KERNEL, reg->numa_node);
+	if (!hctx->rqs)
+		return -ENOMEM;
+
+	for (i = 0; i < reg->queue_depth; i++) {
+		hctx->rqs[i] = kzalloc_node(rq_size, GFP_KERNEL,
+					    reg->numa_node);
+		if (!hctx->rqs[i])
+			return -ENOMEM;
+		hctx->rqs[i]->tag = i;
+	}
+
+	return 0;
+}
+
+static void blk_mq_free_hw_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	for (i = 0; i < q->nr_hw_queues; i++) {
+		hctx = q->queue_hw_ctx[i];
+		if (!hctx)
+			continue;
+
+		if (hctx->queue) {
+			cancel_work_sync(&hctx->run_work);
+			if (q->mq_ops->exit_hctx)
+				q->mq_ops->exit_hctx(hctx, i);
+		}
+		blk_mq_free_rqs(hctx, q->queue_depth);
+		kfree(hctx->ctxs);
+		kfree(hctx->ctx_map);
+		kfree(hctx);
+	}
+}
+
+static int blk_mq_init_hw_queues(struct request_queue *q,
+				 struct blk_mq_reg *reg, void *driver_data)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	for (i = 0; i < q->nr_hw_queues; i++) {
+		hctx = kzalloc_node(sizeof(*hctx), GFP_KERNEL, reg->numa_node);
+		if (!hctx)
+			return -ENOMEM;
+		q->queue_hw_ctx[i] = hctx;
+
+		spin_lock_init(&hctx->lock);
+		INIT_LIST_HEAD(&hctx->dispatch);
+		INIT_WORK(&hctx->run_work, blk_mq_run_work_fn);
+		hctx->queue_num = i;
+		hctx->numa_node = reg->numa_node;
+
+		hctx->ctxs = kmalloc_node(nr_cpu_ids * sizeof(void *),
+					  GFP_KERNEL, reg->numa_node);
+		hctx->ctx_map = kzalloc_node(BITS_TO_LONGS(nr_cpu_ids) *
+					     sizeof(unsigned long),
+					     GFP_KERNEL, reg->numa_node);
+		if (!hctx->ctxs || !hctx->ctx_map)
+			return -ENOMEM;
+
+		if (blk_mq_init_rqs(hctx, reg))
+			return -ENOMEM;
+
+		if (reg->ops->init_hctx &&
+		    reg->ops->init_hctx(hctx, driver_data, i))
+			return -ENOMEM;
+		hctx->queue = q;
+	}
+
+	return 0;
+}
+
+static void blk_mq_init_cpu_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	unsigned int i;
+
+	for_each_possible_cpu(i) {
+		ctx = per_cpu_ptr(q->queue_ctx, i);
+
+		memset(ctx, 0, sizeof(*ctx));
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->rq_list);
+		ctx->cpu = i;
+		ctx->queue = q;
+
+		hctx = q->mq_ops->map_queue(q, i);
+		ctx->index_hw = hctx->nr_ctx;
+		hctx->ctxs[hctx->nr_ctx++] = ctx;
+	}
+}
+
+/**
+ * blk_mq_init_queue - set up a multiqueue request queue
+ * @reg:	hardware queue count, depth and driver operations
+ * @driver_data: stored in ->queuedata and passed to ->init_hctx()
+ *
+ * Description:
+ *     The queue has no io scheduler and no queue_lock on the submission
+ *     path.  It is torn down with blk_cleanup_queue() as usual.
+ *
+ *     Function returns a pointer to the initialized request queue, or
+ *     %NULL if it didn't succeed.
+ */
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data)
+{
+	struct request_queue *q;
+
+	if (!reg->nr_hw_queues || !reg->ops->queue_rq ||
+	    !reg->ops->map_queue || !reg->queue_depth ||
+	    reg->queue_depth > BLK_MQ_MAX_DEPTH)
+		return NULL;
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		return NULL;
+
+	q->node = reg->numa_node;
+	q->mq_ops = reg->ops;
+	q->queuedata = driver_data;
+	q->nr_hw_queues = reg->nr_hw_queues;
+	q->queue_depth = reg->queue_depth;
+	q->queue_flags = QUEUE_FLAG_MQ_DEFAULT;
+	INIT_LIST_HEAD(&q->all_q_node);
+
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	q->mq_map = kzalloc_node(nr_cpu_ids * sizeof(unsigned int),
+				 GFP_KERNEL, reg->numa_node);
+	q->queue_hw_ctx = kzalloc_node(reg->nr_hw_queues * sizeof(void *),
+				       GFP_KERNEL, reg->numa_node);
+	if (!q->queue_ctx || !q->mq_map || !q->queue_hw_ctx)
+		goto err;
+
+	blk_mq_init_queue_map(q->mq_map, reg->nr_hw_queues);
+	if (blk_mq_init_hw_queues(q, reg, driver_data))
+		goto err;
+	blk_mq_init_cpu_queues(q);
+
+	blk_queue_make_request(q, blk_mq_make_request);
+	q->nr_requests = reg->queue_depth * reg->nr_hw_queues;
+
+	mutex_lock(&all_q_mutex);
+	list_add_tail(&q->all_q_node, &all_q_list);
+	mutex_unlock(&all_q_mutex);
+
+	return q;
+err:
+	blk_put_queue(q);
+	return NULL;
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/*
+ * Called when the last reference to the queue is dropped.
+ */
+void blk_mq_free_queue(struct request_queue *q)
+{
+	mutex_lock(&all_q_mutex);
+	list_del_init(&q->all_q_node);
+	mutex_unlock(&all_q_mutex);
+
+	if (q->queue_hw_ctx)
+		blk_mq_free_hw_queues(q);
+	kfree(q->queue_hw_ctx);
+	kfree(q->mq_map);
+	if (q->queue_ctx)
+		free_percpu(q->queue_ctx);
+}
+
+/*
+ * Requests left on the software queue of a dead cpu go straight to the
+ * dispatch list of their hardware queue.
+ */
+static void blk_mq_drain_cpu(struct request_queue *q, unsigned int cpu)
+{
+	struct blk_mq_ctx *ctx = per_cpu_ptr(q->queue_ctx, cpu);
+	struct blk_mq_hw_ctx *hctx = q->mq_ops->map_queue(q, cpu);
+	LIST_HEAD(rq_list);
+
+	spin_lock(&ctx->lock);
+	list_splice_init(&ctx->rq_list, &rq_list);
+	clear_bit(ctx->index_hw, hctx->ctx_map);
+	spin_unlock(&ctx->lock);
+
+	if (list_empty(&rq_list))
+		return;
+
+	spin_lock(&hctx->lock);
+	list_splice_tail(&rq_list, &hctx->dispatch);
+	spin_unlock(&hctx->lock);
+
+	blk_mq_run_hw_queue(hctx, true);
+}
+
+static int __cpuinit blk_mq_cpu_notify(struct notifier_block *self,
+				       unsigned long action, void *hcpu)
+{
+	struct request_queue *q;
+
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN) {
+		mutex_lock(&all_q_mutex);
+		list_for_each_entry(q, &all_q_list, all_q_node)
+			blk_mq_drain_cpu(q, (unsigned long) hcpu);
+		mutex_unlock(&all_q_mutex);
+	}
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block __cpuinitdata blk_mq_cpu_notifier = {
+	.notifier_call	= blk_mq_cpu_notify,
+};
+
+static __init int blk_mq_init(void)
+{
+	register_hotcpu_notifier(&blk_mq_cpu_notifier);
+	return 0;
+}
+subsys_initcall(blk_mq_init);
@@ -0,0 +1,34 @@
+#ifndef INT_BLK_MQ_H
+#define INT_BLK_MQ_H
+
+/*
+ * Per-cpu software submission queue.
+ */
+struct blk_mq_ctx {
+	struct {
+		spinlock_t		lock;
+		struct list_head	rq_list;
+	} ____cacheline_aligned_in_smp;
+
+	unsigned int		cpu;
+	unsigned int		index_hw;	/* bit in hctx->ctx_map */
+	struct request_queue	*queue;
+};
+
+void blk_mq_free_queue(struct request_queue *q);
+
+/*
+ * Tag allocation
+ */
+struct blk_mq_tags;
+
+struct blk_mq_tags *blk_mq_init_tags(unsigned int nr_tags, int node);
+void blk_mq_free_tags(struct blk_mq_tags *tags);
+int blk_mq_get_tag(struct blk_mq_tags *tags);
+void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag);
+bool blk_mq_has_free_tags(struct blk_mq_tags *tags);
+bool blk_mq_tags_busy(struct blk_mq_tags *tags);
+void blk_mq_wait_tags(struct blk_mq_tags *tags,
+		      bool (*cond)(struct blk_mq_tags *));
+
+#endif
@@ -82,6 +82,22 @@ void blk_queue_lld_busy(struct request_queue *q, lld_busy_fn *fn)
 }
 EXPORT_SYMBOL_GPL(blk_queue_lld_busy);
 
+/**
+ * blk_queue_poll - set the completion polling function of a queue
+ * @q:		queue
+ * @fn:		poll function
+ *
+ * @fn reaps the completions the driver finds on its completion queue,
+ * without waiting for an interrupt, and returns how many it found.  It
+ * is called from process context with no locks held.  Polling is off
+ * until enabled through the queue's io_poll sysfs attribute.
+ */
+void blk_queue_poll(struct request_queue *q, poll_fn *fn)
+{
+	q->poll_fn = fn;
+}
+EXPORT_SYMBOL_GPL(blk_queue_poll);
+
 /**
  * blk_set_default_limits - reset limits to default values
  * @lim:  the queue_limits structure to reset
@@ -0,0 +1,617 @@
+/*
+ * Interface for controlling IO bandwidth on a request queue
+ *
+ * Bios are checked against the read/write bytes per second and IOs per
+ * second limits of the submitting task's blkio cgroup on the device in
+ * generic_make_request(), before they reach the io scheduler.  A bio
+ * over the limit is held on its group and resubmitted from kblockd once
+ * the group's timer says it fits, so the limits work with any elevator
+ * and for bio based drivers as well.
+ */
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/timer.h>
+#include "blk-cgroup.h"
+#include "blk.h"
+
+/* Limits are enforced over slices of this length, renewed as they run out */
+static unsigned long throtl_slice = HZ/10;	/* 100 ms */
+
+struct throtl_data;
+
+struct throtl_grp {
+	struct blkio_group blkg;
+	struct hlist_node tg_node;	/* on throtl_data->tg_list */
+	struct throtl_data *td;
+
+	/* bios over the limit, by READ/WRITE */
+	struct bio_list bio_lists[2];
+	unsigned int nr_queued[2];
+
+	/* limits, 0 is unlimited; only changed under the queue lock */
+	u64 bps[2];
+	unsigned int iops[2];
+
+	/* limits written to the cgroup, applied by the dispatch work */
+	spinlock_t limits_lock;
+	u64 new_bps[2];
+	unsigned int new_iops[2];
+	bool limits_changed;
+
+	/* dispatched in the current slice */
+	u64 bytes_disp[2];
+	unsigned int io_disp[2];
+	unsigned long slice_start[2];
+	unsigned long slice_end[2];
+
+	/* fires when the bio at the head of a list is allowed to go */
+	struct timer_list timer;
+	struct rcu_head rcu_head;
+};
+
+struct throtl_data {
+	struct hlist_head tg_list;
+	struct throtl_grp root_tg;
+	struct request_queue *queue;
+
+	/* bios left behind by groups that went away */
+	struct bio_list orphans;
+
+	struct work_struct dispatch_work;
+};
+
+static inline struct throtl_grp *tg_of_blkg(struct blkio_group *blkg)
+{
+	if (blkg)
+		return container_of(blkg, struct throtl_grp, blkg);
+
+	return NULL;
+}
+
+static void throtl_tg_timer_fn(unsigned long data)
+{
+	struct throtl_data *td = (struct throtl_data *)data;
+
+	kblockd_schedule_work(td->queue, &td->dispatch_work);
+}
+
+static void throtl_init_tg(struct throtl_data *td, struct throtl_grp *tg)
+{
+	INIT_HLIST_NODE(&tg->tg_node);
+	bio_list_init(&tg->bio_lists[READ]);
+	bio_list_init(&tg->bio_lists[WRITE]);
+	setup_timer(&tg->timer, throtl_tg_timer_fn, (unsigned long)td);
+	spin_lock_init(&tg->limits_lock);
+	tg->blkg.plid = BLKIO_POLICY_THROTL;
+	tg->td = td;
+}
+
+static dev_t throtl_queue_dev(struct throtl_data *td)
+{
+	struct backing_dev_info *bdi = &td->queue->backing_dev_info;
+	unsigned int major, minor;
+
+	if (!bdi->dev || !dev_name(bdi->dev))
+		return 0;
+
+	sscanf(dev_name(bdi->dev), "%u:%u", &major, &minor);
+	return MKDEV(major, minor);
+}
+
+/*
+ * The device number is not known until the disk is registered, and the
+ * rules are per device, so a group created before that picks up its
+ * limits later.
+ */
+static void throtl_tg_set_dev(struct throtl_data *td, struct throtl_grp *tg,
+			      struct blkio_cgroup *blkcg)
+{
+	dev_t dev;
+
+	if (tg->blkg.dev)
+		return;
+
+	dev = throtl_queue_dev(td);
+	if (!dev)
+		return;
+
+	tg->blkg.dev = dev;
+	blkcg_get_throtl_limits(blkcg, dev, tg->bps, tg->iops);
+}
+
+/*
+ * Find the group of the current task, creating it if needed.  Falls back
+ * to the root group if the allocation fails.  Called with the queue lock
+ * held.
+ */
+static struct throtl_grp *throtl_get_tg(struct throtl_data *td)
+{
+	struct blkio_cgroup *blkcg;
+	struct throtl_grp *tg;
+	dev_t dev;
+
+	rcu_read_lock();
+	blkcg = cgroup_to_blkio_cgroup(task_cgroup(current, blkio_subsys_id));
+	if (blkcg == &blkio_root_cgroup) {
+		tg = &td->root_tg;
+		throtl_tg_set_dev(td, tg, blkcg);
+		goto out;
+	}
+
+	tg = tg_of_blkg(blkiocg_lookup_group(blkcg, td));
+	if (tg) {
+		throtl_tg_set_dev(td, tg, blkcg);
+		goto out;
+	}
+
+	tg = kzalloc_node(sizeof(*tg), GFP_ATOMIC, td->queue->node);
+	if (!tg) {
+		tg = &td->root_tg;
+		goto out;
+	}
+
+	throtl_init_tg(td, tg);
+	dev = throtl_queue_dev(td);
+	if (dev)
+		blkcg_get_throtl_limits(blkcg, dev, tg->bps, tg->iops);
+	blkiocg_add_blkio_group(blkcg, &tg->blkg, td, dev);
+	hlist_add_head(&tg->tg_node, &td->tg_list);
+out:
+	rcu_read_unlock();
+	return tg;
+}
+
+static void throtl_start_new_slice(struct throtl_grp *tg, bool rw)
+{
+	tg->bytes_disp[rw] = 0;
+	tg->io_disp[rw] = 0;
+	tg->slice_start[rw] = jiffies;
+	tg->slice_end[rw] = jiffies + throtl_slice;
+}
+
+static inline void throtl_extend_slice(struct throtl_grp *tg, bool rw,
+				       unsigned long jiffy_end)
+{
+	tg->slice_end[rw] = roundup(jiffy_end, throtl_slice);
+}
+
+static inline bool throtl_slice_used(struct throtl_grp *tg, bool rw)
+{
+	return time_after_eq(jiffies, tg->slice_end[rw]);
+}
+
+/*
+ * Forget the budget of the whole slices that have passed, so that a
+ * group which keeps a backlog does not run on one ever growing slice.
+ */
+static void throtl_trim_slice(struct throtl_grp *tg, bool rw)
+{
+	unsigned long nr_slices, time_elapsed;
+	unsigned int io_trim;
+	u64 bytes_trim, tmp;
+
+	if (throtl_slice_used(tg, rw))
+		return;
+
+	time_elapsed = jiffies - tg->slice_start[rw];
+	nr_slices = time_elapsed / throtl_slice;
+	if (!nr_slices)
+		return;
+
+	tmp = tg->bps[rw] * throtl_slice * nr_slices;
+	do_div(tmp, HZ);
+	bytes_trim = tmp;
+
+	tmp = (u64)tg->iops[rw] * throtl_slice * nr_slices;
+	do_div(tmp, HZ);
+	io_trim = tmp;
+
+	if (!bytes_trim && !io_trim)
+		return;
+
+	if (tg->bytes_disp[rw] >= bytes_trim)
+		tg->bytes_disp[rw] -= bytes_trim;
+	else
+		tg->bytes_disp[rw] = 0;
+
+	if (tg->io_disp[rw] >= io_trim)
+		tg->io_disp[rw] -= io_trim;
+	else
+		tg->io_disp[rw] = 0;
+
+	tg->slice_start[rw] += nr_slices * throtl_slice;
+}
+
+static bool tg_within_iops_limit(struct throtl_grp *tg, struct bio *bio,
+				 unsigned long *wait)
+{
+	bool rw = bio_data_dir(bio);
+	unsigned long jiffy_elapsed, jiffy_wait, jiffy_elapsed_rnd;
+	u64 tmp;
+
+	if (!tg->iops[rw])
+		return true;
+
+	jiffy_elapsed = jiffy_elapsed_rnd = jiffies - tg->slice_start[rw];
+
+	/* the slice has just started, count it as one whole slice */
+	if (!jiffy_elapsed)
+		jiffy_elapsed_rnd = throtl_slice;
+	jiffy_elapsed_rnd = roundup(jiffy_elapsed_rnd, throtl_slice);
+
+	tmp = (u64)tg->iops[rw] * jiffy_elapsed_rnd;
+	do_div(tmp, HZ);
+
+	if (tg->io_disp[rw] + 1 <= tmp) {
+		*wait = 0;
+		return true;
+	}
+
+	/* time at which the next IO fits */
+	jiffy_wait = ((tg->io_disp[rw] + 1) * HZ) / tg->iops[rw] + 1;
+	if (jiffy_wait > jiffy_elapsed)
+		jiffy_wait = jiffy_wait - jiffy_elapsed;
+	else
+		jiffy_wait = 1;
+
+	*wait = jiffy_wait;
+	return false;
+}
+
+static bool tg_within_bps_limit(struct throtl_grp *tg, struct bio *bio,
+				unsigned long *wait)
+{
+	bool rw = bio_data_dir(bio);
+	u64 bytes_allowed, extra_bytes, tmp;
+	unsigned long jiffy_elapsed, jiffy_wait, jiffy_elapsed_rnd;
+
+	if (!tg->bps[rw])
+		return true;
+
+	jiffy_elapsed = jiffy_elapsed_rnd = jiffies - tg->slice_start[rw];
+
+	/* the slice has just started, count it as one whole slice */
+	if (!jiffy_elapsed)
+		jiffy_elapsed_rnd = throtl_slice;
+	jiffy_elapsed_rnd = roundup(jiffy_elapsed_rnd, throtl_slice);
+
+	tmp = tg->bps[rw] * jiffy_elapsed_rnd;
+	do_div(tmp, HZ);
+	bytes_allowed = tmp;
+
+	if (tg->bytes_disp[rw] + bio->bi_size <= bytes_allowed) {
+		*wait = 0;
+		return true;
+	}
+
+	/* time needed to earn the missing bytes */
+	extra_bytes = tg->bytes_disp[rw] + bio->bi_size - bytes_allowed;
+	jiffy_wait = div64_u64(extra_bytes * HZ, tg->bps[rw]);
+	if (!jiffy_wait)
+		jiffy_wait = 1;
+
+	/* plus the rest of the current slice, already counted above */
+	*wait = jiffy_wait + (jiffy_elapsed_rnd - jiffy_elapsed);
+	return false;
+}
+
+/*
+ * Can @bio go now?  If not, *@wait is set to the number of jiffies
+ * until it can.
+ */
+static bool tg_may_dispatch(struct throtl_grp *tg, struct bio *bio,
+			    unsigned long *wait)
+{
+	bool rw = bio_data_dir(bio);
+	unsigned long bps_wait = 0, iops_wait = 0, max_wait;
+
+	if (!tg->bps[rw] && !tg->iops[rw]) {
+		*wait = 0;
+		return true;
+	}
+
+	/*
+	 * Start a new slice if the last one is over and nothing is
+	 * waiting, otherwise make sure the current one still covers at
+	 * least one slice from now.
+	 */
+	if (throtl_slice_used(tg, rw) && !tg->nr_queued[rw])
+		throtl_start_new_slice(tg, rw);
+	else if (time_before(tg->slice_end[rw], jiffies + throtl_slice))
+		throtl_extend_slice(tg, rw, jiffies + throtl_slice);
+
+	if (tg_within_bps_limit(tg, bio, &bps_wait) &&
+	    tg_within_iops_limit(tg, bio, &iops_wait)) {
+		*wait = 0;
+		return true;
+	}
+
+	max_wait = max(bps_wait, iops_wait);
+	*wait = max_wait;
+
+	if (time_before(tg->slice_end[rw], jiffies + max_wait))
+		throtl_extend_slice(tg, rw, jiffies + max_wait);
+
+	return false;
+}
+
+static void throtl_charge_bio(struct throtl_grp *tg, struct bio *bio)
+{
+	bool rw = bio_data_dir(bio);
+
+	tg->bytes_disp[rw] += bio->bi_size;
+	tg->io_disp[rw]++;
+}
+
+static void throtl_schedule_tg(struct throtl_grp *tg, unsigned long wait)
+{
+	unsigned long expires = jiffies + wait;
+
+	if (!timer_pending(&tg->timer) ||
+	    time_before(expires, tg->timer.expires))
+		mod_timer(&tg->timer, expires);
+}
+
+/*
+ * Move the bios of @tg that fit in its limits onto @bl, and arm its
+ * timer for the first one that does not.
+ */
+static void throtl_dispatch_tg(struct throtl_grp *tg, struct bio_list *bl)
+{
+	unsigned long wait;
+	struct bio *bio;
+	int rw;
+
+	if (tg->limits_changed) {
+		spin_lock(&tg->limits_lock);
+		tg->bps[READ] = tg->new_bps[READ];
+		tg->bps[WRITE] = tg->new_bps[WRITE];
+		tg->iops[READ] = tg->new_iops[READ];
+		tg->iops[WRITE] = tg->new_iops[WRITE];
+		tg->limits_changed = false;
+		spin_unlock(&tg->limits_lock);
+
+		throtl_start_new_slice(tg, READ);
+		throtl_start_new_slice(tg, WRITE);
+	}
+
+	for (rw = READ; rw <= WRITE; rw++) {
+		if (!tg->nr_queued[rw])
+			continue;
+
+		while ((bio = bio_list_peek(&tg->bio_lists[rw]))) {
+			if (!tg_may_dispatch(tg, bio, &wait)) {
+				throtl_schedule_tg(tg, wait);
+				break;
+			}
+
+			bio = bio_list_pop(&tg->bio_lists[rw]);
+			tg->nr_queued[rw]--;
+			throtl_charge_bio(tg, bio);
+			bio->bi_flags |= 1 << BIO_THROTTLED;
+			bio_list_add(bl, bio);
+		}
+
+		throtl_trim_slice(tg, rw);
+	}
+}
+
+static void throtl_dispatch_work(struct work_struct *work)
+{
+	struct throtl_data *td =
+		container_of(work, struct throtl_data, dispatch_work);
+	struct request_queue *q = td->queue;
+	struct bio_list bio_list_on_stack;
+	struct throtl_grp *tg;
+	struct hlist_node *n;
+	struct bio *bio;
+
+	bio_list_init(&bio_list_on_stack);
+
+	spin_lock_irq(q->queue_lock);
+	bio_list_for_each(bio, &td->orphans)
+		bio->bi_flags |= 1 << BIO_THROTTLED;
+	bio_list_merge(&bio_list_on_stack, &td->orphans);
+	bio_list_init(&td->orphans);
+
+	hlist_for_each_entry(tg, n, &td->tg_list, tg_node)
+		throtl_dispatch_tg(tg, &bio_list_on_stack);
+	spin_unlock_irq(q->queue_lock);
+
+	while ((bio = bio_list_pop(&bio_list_on_stack)))
+		generic_make_request(bio);
+}
+
+static void throtl_free_tg(struct rcu_head *head)
+{
+	kfree(container_of(head, struct throtl_grp, rcu_head));
+}
+
+/*
+ * Take @tg off the queue.  Its waiting bios are passed on unthrottled.
+ * Called with the queue lock held.
+ */
+static void throtl_destroy_tg(struct throtl_data *td, struct throtl_grp *tg)
+{
+	BUG_ON(hlist_unhashed(&tg->tg_node));
+
+	hlist_del_init(&tg->tg_node);
+	del_timer_sync(&tg->timer);
+
+	if (tg->nr_queued[READ] || tg->nr_queued[WRITE]) {
+		bio_list_merge(&td->orphans, &tg->bio_lists[READ]);
+		bio_list_merge(&td->orphans, &tg->bio_lists[WRITE]);
+		tg->nr_queued[READ] = tg->nr_queued[WRITE] = 0;
+		kblockd_schedule_work(td->queue, &td->dispatch_work);
+	}
+
+	/* lookups walk the cgroup's group list under rcu */
+	if (tg != &td->root_tg)
+		call_rcu(&tg->rcu_head, throtl_free_tg);
+}
+
+/*
+ * The cgroup of @blkg is going away.  Called under rcu_read_lock(), which
+ * keeps @key, the throtl_data, valid.
+ */
+static void throtl_unlink_blkio_group(void *key, struct blkio_group *blkg)
+{
+	struct throtl_data *td = key;
+	unsigned long flags;
+
+	spin_lock_irqsave(td->queue->queue_lock, flags);
+	throtl_destroy_tg(td, tg_of_blkg(blkg));
+	spin_unlock_irqrestore(td->queue->queue_lock, flags);
+}
+
+/*
+ * New limits written to the cgroup.  Called under blkcg->lock, which
+ * nests inside the queue lock, so only stash them here.  The dispatch
+ * work installs them under the queue lock, which the limit checks rely
+ * on, then restarts the slices and reconsiders the waiting bios.
+ */
+static void throtl_update_blkio_group_throtl(void *key,
+			struct blkio_group *blkg, u64 *bps, unsigned int *iops)
+{
+	struct throtl_data *td = key;
+	struct throtl_grp *tg = tg_of_blkg(blkg);
+	unsigned long flags;
+
+	spin_lock_irqsave(&tg->limits_lock, flags);
+	tg->new_bps[READ] = bps[READ];
+	tg->new_bps[WRITE] = bps[WRITE];
+	tg->new_iops[READ] = iops[READ];
+	tg->new_iops[WRITE] = iops[WRITE];
+	tg->limits_changed = true;
+	spin_unlock_irqrestore(&tg->limits_lock, flags);
+
+	kblockd_schedule_work(td->queue, &td->dispatch_work);
+}
+
+static struct blkio_policy_type blkio_policy_throtl = {
+	.ops = {
+		.blkio_unlink_group_fn = throtl_unlink_blkio_group,
+		.blkio_update_group_throtl_fn =
+					throtl_update_blkio_group_throtl,
+	},
+	.plid = BLKIO_POLICY_THROTL,
+};
+
+/**
+ * blk_throtl_bio - apply the cgroup limits to a bio
+ * @q:		queue the bio is submitted to
+ * @bio:	the bio
+ *
+ * Returns true if @bio was held back; it is resubmitted later.
+ */
+bool blk_throtl_bio(struct request_queue *q, struct bio *bio)
+{
+	struct throtl_data *td;
+	struct throtl_grp *tg;
+	bool rw = bio_data_dir(bio);
+	unsigned long wait = 0;
+	bool throttled = false;
+
+	/*
+	 * Resubmitted after waiting here, it was charged already.  Clear
+	 * the flag so that a queue the bio is remapped to throttles it too.
+	 */
+	if (bio_flagged(bio, BIO_THROTTLED)) {
+		bio->bi_flags &= ~(1 << BIO_THROTTLED);
+		return false;
+	}
+
+	if (!q->td || !atomic_read(&blkio_throtl_nr_rules))
+		return false;
+
+	spin_lock_irq(q->queue_lock);
+	td = q->td;
+	if (unlikely(!td))
+		goto out;
+
+	tg = throtl_get_tg(td);
+
+	/*
+	 * Bios of one direction leave a group in order: if some are
+	 * waiting already, this one waits behind them.
+	 */
+	if (!tg->nr_queued[rw]) {
+		if (tg_may_dispatch(tg, bio, &wait)) {
+			throtl_charge_bio(tg, bio);
+			throtl_trim_slice(tg, rw);
+			goto out;
+		}
+		throtl_schedule_tg(tg, wait);
+	}
+
+	bio_list_add(&tg->bio_lists[rw], bio);
+	tg->nr_queued[rw]++;
+	throttled = true;
+out:
+	spin_unlock_irq(q->queue_lock);
+	return throttled;
+}
+
+int blk_throtl_init(struct request_queue *q)
+{
+	struct throtl_data *td;
+
+	td = kzalloc_node(sizeof(*td), GFP_KERNEL, q->node);
+	if (!td)
+		return -ENOMEM;
+
+	INIT_HLIST_HEAD(&td->tg_list);
+	bio_list_init(&td->orphans);
+	INIT_WORK(&td->dispatch_work, throtl_dispatch_work);
+	td->queue = q;
+
+	throtl_init_tg(td, &td->root_tg);
+	blkiocg_add_blkio_group(&blkio_root_cgroup, &td->root_tg.blkg, td, 0);
+	hlist_add_head(&td->root_tg.tg_node, &td->tg_list);
+
+	q->td = td;
+	return 0;
+}
+
+void blk_throtl_exit(struct request_queue *q)
+{
+	struct throtl_data *td = q->td;
+	struct hlist_node *pos, *n;
+	struct throtl_grp *tg;
+	struct bio *bio;
+
+	if (!td)
+		return;
+
+	spin_lock_irq(q->queue_lock);
+	hlist_for_each_entry_safe(tg, pos, n, &td->tg_list, tg_node) {
+		/*
+		 * If the cgroup removal path got to the group first, it
+		 * destroys it as well.
+		 */
+		if (!blkiocg_del_blkio_group(&tg->blkg))
+			throtl_destroy_tg(td, tg);
+	}
+	q->td = NULL;
+	spin_unlock_irq(q->queue_lock);
+
+	/* Wait for unlinks in progress and for lookups of the root group */
+	synchronize_rcu();
+	cancel_work_sync(&td->dispatch_work);
+
+	/* the queue is dead, nothing left behind can be issued */
+	while ((bio = bio_list_pop(&td->orphans)))
+		bio_endio(bio, -ENODEV);
+
+	kfree(td);
+}
+
+static int __init throtl_init(void)
+{
+	blkio_policy_register(&blkio_policy_throtl);
+	return 0;
+}
+
+module_init(throtl_init);
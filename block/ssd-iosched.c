@@ -0,0 +1,528 @@
+/*
+ *  SSD i/o scheduler.
+ *
+ *  For devices without a seek penalty.  There is no sorting and no idling:
+ *  whenever the driver asks for a request, it gets one.  Fairness between
+ *  processes comes from a deficit round robin over per-process queues,
+ *  with a budget of sectors per round, and sync requests are served ahead
+ *  of async ones, subject to per-class expiry times.
+ *
+ *  See Documentation/block/ssd-iosched.txt
+ */
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/hash.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+
+static const int sync_expire = HZ / 50;	/* latency target of a sync request */
+static const int async_expire = HZ / 2;	/* ditto for async, these are SOFT! */
+static const int async_starved = 4;	/* max sync dispatches ahead of async */
+static const int quantum = 256;		/* sectors a process may dispatch per
+					   round before the next one's turn */
+
+enum {
+	SSD_ASYNC = 0,
+	SSD_SYNC = 1,
+};
+
+#define SSD_HASH_SHIFT		6
+#define SSD_HIST_BUCKETS	24
+
+/*
+ * Requests of one process (thread group), one fifo per class.
+ */
+struct ssd_queue {
+	struct hlist_node hash;
+	pid_t tgid;
+	int ref;			/* allocated requests */
+
+	struct list_head fifo[2];
+	struct list_head active[2];	/* on ssd_data->active[] */
+	int deficit[2];			/* sectors left in this round */
+};
+
+struct ssd_data {
+	struct request_queue *queue;
+
+	/* processes with requests queued, in round robin order */
+	struct list_head active[2];
+	struct hlist_head hash[1 << SSD_HASH_SHIFT];
+
+	/* requests allocated while no private data could be set up */
+	struct ssd_queue shared_queue;
+
+	unsigned int starved;		/* sync dispatches while async waits */
+
+	/* completion latency from insertion, log2 buckets in usecs */
+	u64 lat_hist[2][SSD_HIST_BUCKETS];
+
+	/*
+	 * settings that change how the i/o scheduler behaves
+	 */
+	int fifo_expire[2];
+	int async_starved;
+	int quantum;
+};
+
+static inline u32 ssd_now_us(void)
+{
+	return (u32)ktime_to_us(ktime_get());
+}
+
+static inline int ssd_class(struct request *rq)
+{
+	return rq_is_sync(rq) ? SSD_SYNC : SSD_ASYNC;
+}
+
+static inline struct ssd_queue *
+ssd_rq_queue(struct ssd_data *sd, struct request *rq)
+{
+	struct ssd_queue *sq = rq->elevator_private;
+
+	return sq ? sq : &sd->shared_queue;
+}
+
+static void ssd_init_ssd_queue(struct ssd_queue *sq, pid_t tgid)
+{
+	INIT_HLIST_NODE(&sq->hash);
+	INIT_LIST_HEAD(&sq->fifo[SSD_ASYNC]);
+	INIT_LIST_HEAD(&sq->fifo[SSD_SYNC]);
+	INIT_LIST_HEAD(&sq->active[SSD_ASYNC]);
+	INIT_LIST_HEAD(&sq->active[SSD_SYNC]);
+	sq->tgid = tgid;
+}
+
+static struct ssd_queue *ssd_find_queue(struct ssd_data *sd, pid_t tgid)
+{
+	struct hlist_head *head = &sd->hash[hash_32(tgid, SSD_HASH_SHIFT)];
+	struct ssd_queue *sq;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(sq, n, head, hash) {
+		if (sq->tgid == tgid)
+			return sq;
+	}
+
+	return NULL;
+}
+
+/*
+ * Attach the submitting process' queue to a new request.  Called without
+ * the queue lock.
+ */
+static int
+ssd_set_request(struct request_queue *q, struct request *rq, gfp_t gfp_mask)
+{
+	struct ssd_data *sd = q->elevator->elevator_data;
+	pid_t tgid = current->tgid;
+	struct ssd_queue *sq, *new = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(q->queue_lock, flags);
+	sq = ssd_find_queue(sd, tgid);
+	if (!sq) {
+		/* allocate outside the lock, then look again */
+		spin_unlock_irqrestore(q->queue_lock, flags);
+		new = kmalloc_node(sizeof(*new), gfp_mask, q->node);
+		spin_lock_irqsave(q->queue_lock, flags);
+
+		sq = ssd_find_queue(sd, tgid);
+		if (!sq && new) {
+			sq = new;
+			new = NULL;
+			ssd_init_ssd_queue(sq, tgid);
+			sq->ref = 0;
+			sq->deficit[SSD_ASYNC] = sq->deficit[SSD_SYNC] = 0;
+			hlist_add_head(&sq->hash,
+				       &sd->hash[hash_32(tgid, SSD_HASH_SHIFT)]);
+		}
+	}
+	if (sq)
+		sq->ref++;
+	spin_unlock_irqrestore(q->queue_lock, flags);
+
+	/* lost a race with another thread of the process */
+	kfree(new);
+
+	/* without memory, fall back to the shared queue */
+	rq->elevator_private = sq;
+	return 0;
+}
+
+static void ssd_put_request(struct request *rq)
+{
+	struct ssd_queue *sq = rq->elevator_private;
+
+	if (!sq)
+		return;
+
+	rq->elevator_private = NULL;
+	if (--sq->ref)
+		return;
+
+	BUG_ON(!list_empty(&sq->fifo[SSD_ASYNC]) ||
+	       !list_empty(&sq->fifo[SSD_SYNC]));
+	hlist_del(&sq->hash);
+	kfree(sq);
+}
+
+/*
+ * Only merge requests and bios of the same process, so that one process
+ * is not charged for another's io.
+ */
+static int ssd_allow_merge(struct request_queue *q, struct request *rq,
+			   struct bio *bio)
+{
+	struct ssd_queue *sq = rq->elevator_private;
+
+	return !sq || sq->tgid == current->tgid;
+}
+
+static void ssd_add_request(struct request_queue *q, struct request *rq)
+{
+	struct ssd_data *sd = q->elevator->elevator_data;
+	struct ssd_queue *sq = ssd_rq_queue(sd, rq);
+	const int class = ssd_class(rq);
+
+	/* insertion time in usecs, for the latency histograms */
+	rq->elevator_private2 = (void *)(unsigned long)ssd_now_us();
+
+	rq_set_fifo_time(rq, jiffies + sd->fifo_expire[class]);
+	list_add_tail(&rq->queuelist, &sq->fifo[class]);
+
+	if (list_empty(&sq->active[class])) {
+		sq->deficit[class] = sd->quantum;
+		list_add_tail(&sq->active[class], &sd->active[class]);
+	}
+}
+
+static void ssd_remove_request(struct ssd_data *sd, struct request *rq)
+{
+	struct ssd_queue *sq = ssd_rq_queue(sd, rq);
+	const int class = ssd_class(rq);
+
+	rq_fifo_clear(rq);
+
+	if (list_empty(&sq->fifo[class])) {
+		list_del_init(&sq->active[class]);
+		sq->deficit[class] = 0;
+	}
+}
+
+static void
+ssd_merged_requests(struct request_queue *q, struct request *req,
+		    struct request *next)
+{
+	struct ssd_data *sd = q->elevator->elevator_data;
+
+	/*
+	 * if next expires before rq, assign its expire time to rq
+	 * and move into next position (next will be deleted) in fifo
+	 */
+	if (!list_empty(&req->queuelist) && !list_empty(&next->queuelist) &&
+	    ssd_rq_queue(sd, req) == ssd_rq_queue(sd, next) &&
+	    ssd_class(req) == ssd_class(next)) {
+		if (time_before(rq_fifo_time(next), rq_fifo_time(req))) {
+			list_move(&req->queuelist, &next->queuelist);
+			rq_set_fifo_time(req, rq_fifo_time(next));
+		}
+	}
+
+	/*
+	 * kill knowledge of next, this one is a goner
+	 */
+	ssd_remove_request(sd, next);
+}
+
+/*
+ * The oldest request of @class if it is past its expiry time.
+ */
+static struct request *ssd_expired_request(struct ssd_data *sd, int class)
+{
+	struct request *rq, *oldest = NULL;
+	struct ssd_queue *sq;
+
+	list_for_each_entry(sq, &sd->active[class], active[class]) {
+		rq = rq_entry_fifo(sq->fifo[class].next);
+		if (!oldest || time_before(rq_fifo_time(rq), rq_fifo_time(oldest)))
+			oldest = rq;
+	}
+
+	if (oldest && time_after(jiffies, rq_fifo_time(oldest)))
+		return oldest;
+
+	return NULL;
+}
+
+/*
+ * Deficit round robin: the first process with budget left in this round
+ * gets to dispatch its oldest request of @class.
+ */
+static struct request *ssd_next_request(struct ssd_data *sd, int class)
+{
+	struct ssd_queue *sq;
+
+	for (;;) {
+		sq = list_first_entry(&sd->active[class], struct ssd_queue,
+				      active[class]);
+		if (sq->deficit[class] > 0)
+			break;
+
+		sq->deficit[class] += sd->quantum;
+		list_move_tail(&sq->active[class], &sd->active[class]);
+	}
+
+	return rq_entry_fifo(sq->fifo[class].next);
+}
+
+static void ssd_move_to_dispatch(struct ssd_data *sd, struct request *rq)
+{
+	struct ssd_queue *sq = ssd_rq_queue(sd, rq);
+	const int class = ssd_class(rq);
+
+	sq->deficit[class] -= max_t(unsigned int, blk_rq_sectors(rq), 1);
+	ssd_remove_request(sd, rq);
+	elv_dispatch_add_tail(sd->queue, rq);
+}
+
+static int ssd_dispatch_requests(struct request_queue *q, int force)
+{
+	struct ssd_data *sd = q->elevator->elevator_data;
+	const int sync = !list_empty(&sd->active[SSD_SYNC]);
+	const int async = !list_empty(&sd->active[SSD_ASYNC]);
+	struct request *rq;
+
+	if (sync) {
+		/* a sync request past its latency target goes first */
+		rq = ssd_expired_request(sd, SSD_SYNC);
+		if (rq)
+			goto dispatch;
+
+		if (async && (sd->starved++ >= sd->async_starved ||
+			      ssd_expired_request(sd, SSD_ASYNC)))
+			goto dispatch_async;
+
+		rq = ssd_next_request(sd, SSD_SYNC);
+		goto dispatch;
+	}
+
+	if (async) {
+dispatch_async:
+		sd->starved = 0;
+
+		rq = ssd_expired_request(sd, SSD_ASYNC);
+		if (!rq)
+			rq = ssd_next_request(sd, SSD_ASYNC);
+		goto dispatch;
+	}
+
+	return 0;
+
+dispatch:
+	ssd_move_to_dispatch(sd, rq);
+	return 1;
+}
+
+static int ssd_queue_empty(struct request_queue *q)
+{
+	struct ssd_data *sd = q->elevator->elevator_data;
+
+	return list_empty(&sd->active[SSD_SYNC]) &&
+		list_empty(&sd->active[SSD_ASYNC]);
+}
+
+static void ssd_completed_request(struct request_queue *q, struct request *rq)
+{
+	struct ssd_data *sd = q->elevator->elevator_data;
+	u32 start = (unsigned long)rq->elevator_private2;
+	u32 lat = ssd_now_us() - start;
+	int bucket = lat ? min(ilog2(lat) + 1, SSD_HIST_BUCKETS - 1) : 0;
+
+	sd->lat_hist[rq_data_dir(rq)][bucket]++;
+}
+
+static void ssd_exit_queue(struct elevator_queue *e)
+{
+	struct ssd_data *sd = e->elevator_data;
+
+	BUG_ON(!list_empty(&sd->active[SSD_SYNC]));
+	BUG_ON(!list_empty(&sd->active[SSD_ASYNC]));
+
+	kfree(sd);
+}
+
+/*
+ * initialize elevator private data (ssd_data).
+ */
+static void *ssd_init_queue(struct request_queue *q)
+{
+	struct ssd_data *sd;
+	int i;
+
+	sd = kmalloc_node(sizeof(*sd), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!sd)
+		return NULL;
+
+	sd->queue = q;
+	INIT_LIST_HEAD(&sd->active[SSD_ASYNC]);
+	INIT_LIST_HEAD(&sd->active[SSD_SYNC]);
+	for (i = 0; i < ARRAY_SIZE(sd->hash); i++)
+		INIT_HLIST_HEAD(&sd->hash[i]);
+	ssd_init_ssd_queue(&sd->shared_queue, 0);
+
+	sd->fifo_expire[SSD_SYNC] = sync_expire;
+	sd->fifo_expire[SSD_ASYNC] = async_expire;
+	sd->async_starved = async_starved;
+	sd->quantum = quantum;
+	return sd;
+}
+
+/*
+ * sysfs parts below
+ */
+
+static ssize_t
+ssd_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+ssd_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR, __CONV)				\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct ssd_data *sd = e->elevator_data;				\
+	int __data = __VAR;						\
+	if (__CONV)							\
+		__data = jiffies_to_msecs(__data);			\
+	return ssd_var_show(__data, (page));				\
+}
+SHOW_FUNCTION(ssd_sync_expire_show, sd->fifo_expire[SSD_SYNC], 1);
+SHOW_FUNCTION(ssd_async_expire_show, sd->fifo_expire[SSD_ASYNC], 1);
+SHOW_FUNCTION(ssd_async_starved_show, sd->async_starved, 0);
+SHOW_FUNCTION(ssd_quantum_show, sd->quantum, 0);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct ssd_data *sd = e->elevator_data;				\
+	int __data;							\
+	int ret = ssd_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	if (__CONV)							\
+		*(__PTR) = msecs_to_jiffies(__data);			\
+	else								\
+		*(__PTR) = __data;					\
+	return ret;							\
+}
+STORE_FUNCTION(ssd_sync_expire_store, &sd->fifo_expire[SSD_SYNC], 0, INT_MAX, 1);
+STORE_FUNCTION(ssd_async_expire_store, &sd->fifo_expire[SSD_ASYNC], 0, INT_MAX, 1);
+STORE_FUNCTION(ssd_async_starved_store, &sd->async_starved, 0, INT_MAX, 0);
+STORE_FUNCTION(ssd_quantum_store, &sd->quantum, 1, INT_MAX, 0);
+#undef STORE_FUNCTION
+
+/*
+ * One line per bucket: the bucket's upper bound in usecs and the number
+ * of requests completed within it.  The last bucket has no bound.
+ */
+static ssize_t ssd_lat_hist_show(u64 *hist, char *page)
+{
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < SSD_HIST_BUCKETS - 1; i++)
+		len += sprintf(page + len, "%lu %llu\n", 1UL << i,
+			       (unsigned long long)hist[i]);
+	len += sprintf(page + len, "inf %llu\n",
+		       (unsigned long long)hist[SSD_HIST_BUCKETS - 1]);
+
+	return len;
+}
+
+/* writing anything clears the histogram */
+#define LAT_HIST_FUNCTION(__NAME, __DIR)				\
+static ssize_t ssd_##__NAME##_show(struct elevator_queue *e, char *page) \
+{									\
+	struct ssd_data *sd = e->elevator_data;				\
+	return ssd_lat_hist_show(sd->lat_hist[__DIR], page);		\
+}									\
+static ssize_t ssd_##__NAME##_store(struct elevator_queue *e,		\
+				    const char *page, size_t count)	\
+{									\
+	struct ssd_data *sd = e->elevator_data;				\
+	memset(sd->lat_hist[__DIR], 0, sizeof(sd->lat_hist[__DIR]));	\
+	return count;							\
+}
+LAT_HIST_FUNCTION(read_lat_hist, READ);
+LAT_HIST_FUNCTION(write_lat_hist, WRITE);
+#undef LAT_HIST_FUNCTION
+
+#define SSD_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, ssd_##name##_show, \
+				      ssd_##name##_store)
+
+static struct elv_fs_entry ssd_attrs[] = {
+	SSD_ATTR(sync_expire),
+	SSD_ATTR(async_expire),
+	SSD_ATTR(async_starved),
+	SSD_ATTR(quantum),
+	SSD_ATTR(read_lat_hist),
+	SSD_ATTR(write_lat_hist),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_ssd = {
+	.ops = {
+		.elevator_allow_merge_fn =	ssd_allow_merge,
+		.elevator_merge_req_fn =	ssd_merged_requests,
+		.elevator_dispatch_fn =		ssd_dispatch_requests,
+		.elevator_add_req_fn =		ssd_add_request,
+		.elevator_queue_empty_fn =	ssd_queue_empty,
+		.elevator_completed_req_fn =	ssd_completed_request,
+		.elevator_set_req_fn =		ssd_set_request,
+		.elevator_put_req_fn =		ssd_put_request,
+		.elevator_init_fn =		ssd_init_queue,
+		.elevator_exit_fn =		ssd_exit_queue,
+	},
+
+	.elevator_attrs = ssd_attrs,
+	.elevator_name = "ssd",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init ssd_init(void)
+{
+	elv_register(&iosched_ssd);
+
+	return 0;
+}
+
+static void __exit ssd_exit(void)
+{
+	elv_unregister(&iosched_ssd);
+}
+
+module_init(ssd_init);
+module_exit(ssd_exit);
+
+MODULE_DESCRIPTION("SSD IO scheduler");
+MODULE_LICENSE("GPL");
@@ -2,6 +2,8 @@
 #include <linux/spinlock.h>
 #include <linux/slab.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/moduleparam.h>
 #include <linux/hdreg.h>
 #include <linux/virtio.h>
 #include <linux/virtio_blk.h>
@@ -11,6 +13,10 @@
 
 static int major, index;
 
+static unsigned int virtblk_queue_depth = 64;
+module_param_named(queue_depth, virtblk_queue_depth, uint, 0444);
+MODULE_PARM_DESC(queue_depth, "Requests in flight per device (default 64)");
+
 struct virtio_blk
 {
 	spinlock_t lock;
@@ -24,8 +30,6 @@ struct virtio_blk
 	/* Request tracking. */
 	struct list_head reqs;
 
-	mempool_t *pool;
-
 	/* What host tells us, plus 2 for header & tailer. */
 	unsigned int sg_elems;
 
@@ -42,54 +46,88 @@ struct virtblk_req
 	u8 status;
 };
 
-static void blk_done(struct virtqueue *vq)
+/*
+ * Runs on the cpu that submitted the request.
+ */
+static void virtblk_request_done(struct request *req)
+{
+	struct virtblk_req *vbr = blk_mq_rq_to_pdu(req);
+	int error;
+
+	switch (vbr->status) {
+	case VIRTIO_BLK_S_OK:
+		error = 0;
+		break;
+	case VIRTIO_BLK_S_UNSUPP:
+		error = -ENOTTY;
+		break;
+	default:
+		error = -EIO;
+		break;
+	}
+
+	if (blk_pc_request(req)) {
+		req->resid_len = vbr->in_hdr.residual;
+		req->sense_len = vbr->in_hdr.sense_len;
+		req->errors = vbr->in_hdr.errors;
+	}
+
+	blk_mq_end_io(req, error);
+}
+
+/*
+ * Complete everything the host has handed back, returns how many.
+ */
+static int virtblk_reap(struct virtio_blk *vblk)
 {
-	struct virtio_blk *vblk = vq->vdev->priv;
 	struct virtblk_req *vbr;
 	unsigned int len;
 	unsigned long flags;
+	int found = 0;
 
 	spin_lock_irqsave(&vblk->lock, flags);
 	while ((vbr = vblk->vq->vq_ops->get_buf(vblk->vq, &len)) != NULL) {
-		int error;
+		list_del(&vbr->list);
+		blk_mq_complete_request(vbr->req);
+		found++;
+	}
+	spin_unlock_irqrestore(&vblk->lock, flags);
 
-		switch (vbr->status) {
-		case VIRTIO_BLK_S_OK:
-			error = 0;
-			break;
-		case VIRTIO_BLK_S_UNSUPP:
-			error = -ENOTTY;
-			break;
-		default:
-			error = -EIO;
-			break;
-		}
+	return found;
+}
 
-		if (blk_pc_request(vbr->req)) {
-			vbr->req->resid_len = vbr->in_hdr.residual;
-			vbr->req->sense_len = vbr->in_hdr.sense_len;
-			vbr->req->errors = vbr->in_hdr.errors;
-		}
+static void blk_done(struct virtqueue *vq)
+{
+	struct virtio_blk *vblk = vq->vdev->priv;
+
+	virtblk_reap(vblk);
 
-		__blk_end_request_all(vbr->req, error);
-		list_del(&vbr->list);
-		mempool_free(vbr, vblk->pool);
-	}
 	/* In case queue is stopped waiting for more buffers. */
-	blk_start_queue(vblk->disk->queue);
-	spin_unlock_irqrestore(&vblk->lock, flags);
+	blk_mq_start_stopped_hw_queues(vblk->disk->queue, true);
+}
+
+/*
+ * Called by a task spinning for its own request, with polling enabled on
+ * the queue.  The virtqueue callback still runs: whichever side gets to
+ * a buffer first completes it.
+ */
+static int virtblk_poll(struct request_queue *q)
+{
+	struct virtio_blk *vblk = q->queuedata;
+	int found;
+
+	found = virtblk_reap(vblk);
+	if (found)
+		blk_mq_start_stopped_hw_queues(q, true);
+
+	return found;
 }
 
 static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
 		   struct request *req)
 {
 	unsigned long num, out = 0, in = 0;
-	struct virtblk_req *vbr;
-
-	vbr = mempool_alloc(vblk->pool, GFP_ATOMIC);
-	if (!vbr)
-		/* When another request finishes we'll try again. */
-		return false;
+	struct virtblk_req *vbr = blk_mq_rq_to_pdu(req);
 
 	vbr->req = req;
 	switch (req->cmd_type) {
@@ -151,38 +189,54 @@ static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
 		}
 	}
 
-	if (vblk->vq->vq_ops->add_buf(vblk->vq, vblk->sg, out, in, vbr) < 0) {
-		mempool_free(vbr, vblk->pool);
+	if (vblk->vq->vq_ops->add_buf(vblk->vq, vblk->sg, out, in, vbr) < 0)
 		return false;
-	}
 
 	list_add_tail(&vbr->list, &vblk->reqs);
 	return true;
 }
 
-static void do_virtblk_request(struct request_queue *q)
+static int virtblk_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *req)
 {
+	struct request_queue *q = hctx->queue;
 	struct virtio_blk *vblk = q->queuedata;
-	struct request *req;
-	unsigned int issued = 0;
+	unsigned long flags;
 
-	while ((req = blk_peek_request(q)) != NULL) {
-		BUG_ON(req->nr_phys_segments + 2 > vblk->sg_elems);
+	BUG_ON(req->nr_phys_segments + 2 > vblk->sg_elems);
 
-		/* If this request fails, stop queue and wait for something to
-		   finish to restart it. */
-		if (!do_req(q, vblk, req)) {
-			blk_stop_queue(q);
-			break;
-		}
-		blk_start_request(req);
-		issued++;
+	spin_lock_irqsave(&vblk->lock, flags);
+	/* If this request fails, stop queue and wait for something to
+	   finish to restart it. */
+	if (!do_req(q, vblk, req)) {
+		blk_mq_stop_hw_queue(hctx);
+		spin_unlock_irqrestore(&vblk->lock, flags);
+		return BLK_MQ_RQ_QUEUE_BUSY;
 	}
+	spin_unlock_irqrestore(&vblk->lock, flags);
 
-	if (issued)
-		vblk->vq->vq_ops->kick(vblk->vq);
+	return BLK_MQ_RQ_QUEUE_OK;
 }
 
+/*
+ * Tell the host about everything queued in this run with a single kick.
+ */
+static void virtblk_commit_rqs(struct blk_mq_hw_ctx *hctx)
+{
+	struct virtio_blk *vblk = hctx->queue->queuedata;
+	unsigned long flags;
+
+	spin_lock_irqsave(&vblk->lock, flags);
+	vblk->vq->vq_ops->kick(vblk->vq);
+	spin_unlock_irqrestore(&vblk->lock, flags);
+}
+
+static struct blk_mq_ops virtio_mq_ops = {
+	.queue_rq	= virtblk_queue_rq,
+	.commit_rqs	= virtblk_commit_rqs,
+	.map_queue	= blk_mq_map_queue,
+	.complete	= virtblk_request_done,
+};
+
 static void virtblk_prepare_flush(struct request_queue *q, struct request *req)
 {
 	req->cmd_type = REQ_TYPE_LINUX_BLOCK;
@@ -243,6 +297,13 @@ static int index_to_minor(int index)
 
 static int __devinit virtblk_probe(struct virtio_device *vdev)
 {
+	struct blk_mq_reg reg = {
+		.ops		= &virtio_mq_ops,
+		.nr_hw_queues	= 1,
+		.queue_depth	= virtblk_queue_depth,
+		.cmd_size	= sizeof(struct virtblk_req),
+		.numa_node	= NUMA_NO_NODE,
+	};
 	struct virtio_blk *vblk;
 	struct request_queue *q;
 	int err;
@@ -283,27 +344,19 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 		goto out_free_vblk;
 	}
 
-	vblk->pool = mempool_create_kmalloc_pool(1,sizeof(struct virtblk_req));
-	if (!vblk->pool) {
-		err = -ENOMEM;
-		goto out_free_vq;
-	}
-
 	/* FIXME: How many partitions?  How long is a piece of string? */
 	vblk->disk = alloc_disk(1 << PART_BITS);
 	if (!vblk->disk) {
 		err = -ENOMEM;
-		goto out_mempool;
+		goto out_free_vq;
 	}
 
-	q = vblk->disk->queue = blk_init_queue(do_virtblk_request, &vblk->lock);
+	q = vblk->disk->queue = blk_mq_init_queue(&reg, vblk);
 	if (!q) {
 		err = -ENOMEM;
 		goto out_put_disk;
 	}
 
-	q->queuedata = vblk;
-
 	if (index < 26) {
 		sprintf(vblk->disk->disk_name, "vd%c", 'a' + index % 26);
 	} else if (index < (26 + 1) * 26) {
@@ -353,6 +406,9 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 	/* No need to bounce any requests */
 	blk_queue_bounce_limit(q, BLK_BOUNCE_ANY);
 
+	/* Completions can be reaped without waiting for the callback */
+	blk_queue_poll(q, virtblk_poll);
+
 	/* No real sector limit. */
 	blk_queue_max_hw_sectors(q, -1U);
 
@@ -407,8 +463,6 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 
 out_put_disk:
 	put_disk(vblk->disk);
-out_mempool:
-	mempool_destroy(vblk->pool);
 out_free_vq:
 	vdev->config->del_vqs(vdev);
 out_free_vblk:
@@ -430,7 +484,6 @@ static void __devexit virtblk_remove(struct virtio_device *vdev)
 	del_gendisk(vblk->disk);
 	blk_cleanup_queue(vblk->disk->queue);
 	put_disk(vblk->disk);
-	mempool_destroy(vblk->pool);
 	vdev->config->del_vqs(vdev);
 	kfree(vblk);
 }
@@ -463,6 +516,12 @@ static struct virtio_driver __refdata virtio_blk = {
 
 static int __init init(void)
 {
+	if (!virtblk_queue_depth || virtblk_queue_depth > BLK_MQ_MAX_DEPTH) {
+		printk(KERN_ERR "virtio_blk: queue_depth must be 1 to %u\n",
+		       BLK_MQ_MAX_DEPTH);
+		return -EINVAL;
+	}
+
 	major = register_blkdev(0, "virtblk");
 	if (major < 0)
 		return major;
@@ -114,11 +114,10 @@ static void aio_free_ring(struct kioctx *ctx)
 	info->nr = 0;
 }
 
-static int aio_setup_ring(struct kioctx *ctx)
+static int aio_setup_ring(struct kioctx *ctx, unsigned nr_events)
 {
 	struct aio_ring *ring;
 	struct aio_ring_info *info = &ctx->ring_info;
-	unsigned nr_events = ctx->max_reqs;
 	unsigned long size;
 	int nr_pages;
 
@@ -211,6 +210,7 @@ static void ctx_rcu_free(struct rcu_head *head)
 	struct kioctx *ctx = container_of(head, struct kioctx, rcu_head);
 	unsigned nr_events = ctx->max_reqs;
 
+	free_percpu(ctx->cpu);
 	kmem_cache_free(kioctx_cachep, ctx);
 
 	if (nr_events) {
@@ -277,16 +277,30 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 
 	atomic_set(&ctx->users, 1);
 	spin_lock_init(&ctx->ctx_lock);
-	spin_lock_init(&ctx->ring_info.ring_lock);
+	mutex_init(&ctx->ring_info.ring_lock);
 	init_waitqueue_head(&ctx->wait);
 
 	INIT_LIST_HEAD(&ctx->active_reqs);
 	INIT_LIST_HEAD(&ctx->run_list);
 	INIT_DELAYED_WORK(&ctx->wq, aio_kick_handler);
 
-	if (aio_setup_ring(ctx) < 0)
+	ctx->cpu = alloc_percpu(struct kioctx_cpu);
+	if (!ctx->cpu)
+		goto out_freectx;
+
+	/*
+	 * Up to twice req_batch - 1 slots can sit in each cpu's cache, make
+	 * the ring big enough that nr_events requests still fit in the rest.
+	 * Only the nr_events asked for are charged against aio-max-nr.
+	 */
+	if (aio_setup_ring(ctx, max(nr_events, num_possible_cpus() * 4) * 2) < 0)
 		goto out_freectx;
 
+	atomic_set(&ctx->reqs_available, ctx->ring_info.nr - 1);
+	ctx->req_batch = (ctx->ring_info.nr - 1) / (num_possible_cpus() * 4);
+	if (ctx->req_batch < 1)
+		ctx->req_batch = 1;
+
 	/* limit the number of system wide aios */
 	do {
 		spin_lock_bh(&aio_nr_lock);
@@ -323,6 +337,7 @@ out_cleanup:
 
 out_freectx:
 	mmdrop(mm);
+	free_percpu(ctx->cpu);
 	kmem_cache_free(kioctx_cachep, ctx);
 	ctx = ERR_PTR(-ENOMEM);
 
@@ -429,6 +444,119 @@ void exit_aio(struct mm_struct *mm)
 	}
 }
 
+/*
+ * aio_wake_function:
+ *	Wait queue callback for an iocb whose retry method returned
+ *	-EIOCBRETRY after queueing iocb->ki_wait on a page bit (see
+ *	current->io_wait).  Like wake_bit_function, but instead of waking
+ *	a task it kicks the iocb for its next retry.
+ */
+static int aio_wake_function(wait_queue_t *wait, unsigned mode,
+			     int sync, void *arg)
+{
+	struct wait_bit_queue *wait_bit
+		= container_of(wait, struct wait_bit_queue, wait);
+	struct kiocb *iocb = container_of(wait_bit, struct kiocb, ki_wait);
+	struct wait_bit_key *key = arg;
+
+	if (wait_bit->key.flags != key->flags ||
+			wait_bit->key.bit_nr != key->bit_nr ||
+			test_bit(key->bit_nr, key->flags))
+		return 0;
+
+	list_del_init(&wait->task_list);
+	kick_iocb(iocb);
+	return 1;
+}
+
+/*
+ * put_reqs_available:
+ *	Give back ring slots, to this cpu's cache first.  Whatever goes
+ *	beyond two batches is returned to the shared count.
+ */
+static void put_reqs_available(struct kioctx *ctx, unsigned nr)
+{
+	struct kioctx_cpu *kcpu;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	kcpu = this_cpu_ptr(ctx->cpu);
+	kcpu->reqs_available += nr;
+	while (kcpu->reqs_available >= ctx->req_batch * 2) {
+		kcpu->reqs_available -= ctx->req_batch;
+		atomic_add(ctx->req_batch, &ctx->reqs_available);
+	}
+	local_irq_restore(flags);
+}
+
+static int __get_reqs_available(struct kioctx *ctx)
+{
+	struct kioctx_cpu *kcpu;
+	unsigned long flags;
+	int ret = 0;
+
+	local_irq_save(flags);
+	kcpu = this_cpu_ptr(ctx->cpu);
+	if (!kcpu->reqs_available) {
+		int old, take, avail = atomic_read(&ctx->reqs_available);
+
+		do {
+			if (avail <= 0)
+				goto out;
+			take = min_t(int, avail, ctx->req_batch);
+			old = avail;
+			avail = atomic_cmpxchg(&ctx->reqs_available,
+					       old, old - take);
+		} while (avail != old);
+
+		kcpu->reqs_available += take;
+	}
+
+	ret = 1;
+	kcpu->reqs_available--;
+out:
+	local_irq_restore(flags);
+	return ret;
+}
+
+/*
+ * refill_reqs_available:
+ *	Events hold their ring slot until they are reaped, by io_getevents()
+ *	or by userspace moving ring->head.  Return the slots of the events
+ *	reaped since the last refill.  Called when slots run out, so that
+ *	neither completion nor reaping has to account for them.
+ */
+static void refill_reqs_available(struct kioctx *ctx)
+{
+	struct aio_ring_info *info = &ctx->ring_info;
+	struct aio_ring *ring;
+	unsigned head, events_in_ring, refill = 0;
+
+	spin_lock_irq(&ctx->ctx_lock);
+	ring = kmap_atomic(info->ring_pages[0], KM_USER0);
+	head = ring->head % info->nr;
+	kunmap_atomic(ring, KM_USER0);
+
+	events_in_ring = (info->tail + info->nr - head) % info->nr;
+	if (info->completed_events > events_in_ring) {
+		refill = info->completed_events - events_in_ring;
+		info->completed_events = events_in_ring;
+	}
+	spin_unlock_irq(&ctx->ctx_lock);
+
+	if (refill)
+		put_reqs_available(ctx, refill);
+}
+
+static int get_reqs_available(struct kioctx *ctx)
+{
+	if (__get_reqs_available(ctx))
+		return 1;
+
+	refill_reqs_available(ctx);
+	return __get_reqs_available(ctx);
+}
+
 /* aio_get_req
  *	Allocate a slot for an aio request.  Increments the users count
  * of the kioctx so that the kioctx stays around until all requests are
@@ -442,8 +570,6 @@ void exit_aio(struct mm_struct *mm)
 static struct kiocb *__aio_get_req(struct kioctx *ctx)
 {
 	struct kiocb *req = NULL;
-	struct aio_ring *ring;
-	int okay = 0;
 
 	req = kmem_cache_alloc(kiocb_cachep, GFP_KERNEL);
 	if (unlikely(!req))
@@ -459,26 +585,22 @@ static struct kiocb *__aio_get_req(struct kioctx *ctx)
 	req->private = NULL;
 	req->ki_iovec = NULL;
 	INIT_LIST_HEAD(&req->ki_run_list);
+	init_waitqueue_func_entry(&req->ki_wait.wait, aio_wake_function);
+	INIT_LIST_HEAD(&req->ki_wait.wait.task_list);
+	req->ki_wait_head = NULL;
 	req->ki_eventfd = NULL;
 
-	/* Check if the completion queue has enough free space to
-	 * accept an event from this io.
-	 */
-	spin_lock_irq(&ctx->ctx_lock);
-	ring = kmap_atomic(ctx->ring_info.ring_pages[0], KM_USER0);
-	if (ctx->reqs_active < aio_ring_avail(&ctx->ring_info, ring)) {
-		list_add(&req->ki_list, &ctx->active_reqs);
-		ctx->reqs_active++;
-		okay = 1;
-	}
-	kunmap_atomic(ring, KM_USER0);
-	spin_unlock_irq(&ctx->ctx_lock);
-
-	if (!okay) {
+	/* Reserve room in the completion ring for the event of this io. */
+	if (!get_reqs_available(ctx)) {
 		kmem_cache_free(kiocb_cachep, req);
-		req = NULL;
+		return NULL;
 	}
 
+	spin_lock_irq(&ctx->ctx_lock);
+	list_add(&req->ki_list, &ctx->active_reqs);
+	ctx->reqs_active++;
+	spin_unlock_irq(&ctx->ctx_lock);
+
 	return req;
 }
 
@@ -700,6 +822,7 @@ static ssize_t aio_run_iocb(struct kiocb *iocb)
 	/* Quit retrying if the i/o has been cancelled */
 	if (kiocbIsCancelled(iocb)) {
 		ret = -EINTR;
+		kiocb_dequeue_wait(iocb);
 		aio_complete(iocb, ret, 0);
 		/* must not access the iocb after this */
 		goto out;
@@ -707,10 +830,20 @@ static ssize_t aio_run_iocb(struct kiocb *iocb)
 
 	/*
 	 * Now we are all set to call the retry method in async
-	 * context.
+	 * context.  Page waits it runs into may queue ki_wait and
+	 * return -EIOCBRETRY instead of blocking.
 	 */
+	current->io_wait = &iocb->ki_wait;
 	ret = retry(iocb);
+	current->io_wait = NULL;
 
+	/*
+	 * A retry that made progress may return with ki_wait still on a
+	 * page waitqueue.  Only -EIOCBRETRY leaves it there for the kick;
+	 * otherwise the iocb may be freed, so take it off now.
+	 */
+	if (ret != -EIOCBRETRY)
+		kiocb_dequeue_wait(iocb);
 	if (ret != -EIOCBRETRY && ret != -EIOCBQUEUED)
 		aio_complete(iocb, ret, 0);
 out:
@@ -942,8 +1075,10 @@ int aio_complete(struct kiocb *iocb, long res, long res2)
 	 * cancelled requests don't get events, userland was given one
 	 * when the event got cancelled.
 	 */
-	if (kiocbIsCancelled(iocb))
+	if (kiocbIsCancelled(iocb)) {
+		put_reqs_available(ctx, 1);
 		goto put_rq;
+	}
 
 	ring = kmap_atomic(info->ring_pages[0], KM_IRQ1);
 
@@ -968,6 +1103,7 @@ int aio_complete(struct kiocb *iocb, long res, long res2)
 
 	info->tail = tail;
 	ring->tail = tail;
+	info->completed_events++;
 
 	put_aio_ring_event(event, KM_IRQ0);
 	kunmap_atomic(ring, KM_IRQ1);
@@ -1002,46 +1138,87 @@ put_rq:
 }
 EXPORT_SYMBOL(aio_complete);
 
-/* aio_read_evt
- *	Pull an event off of the ioctx's event ring.  Returns the number of 
- *	events fetched (0 or 1 ;-)
- *	FIXME: make this use cmpxchg.
- *	TODO: make the ringbuffer user mmap()able (requires FIXME).
+/*
+ * aio_events_pending:
+ *	Whether the ring holds events that have not been reaped.
  */
-static int aio_read_evt(struct kioctx *ioctx, struct io_event *ent)
+static int aio_events_pending(struct kioctx *ctx)
 {
-	struct aio_ring_info *info = &ioctx->ring_info;
+	struct aio_ring_info *info = &ctx->ring_info;
 	struct aio_ring *ring;
-	unsigned long head;
-	int ret = 0;
+	unsigned head;
 
 	ring = kmap_atomic(info->ring_pages[0], KM_USER0);
-	dprintk("in aio_read_evt h%lu t%lu m%lu\n",
-		 (unsigned long)ring->head, (unsigned long)ring->tail,
-		 (unsigned long)ring->nr);
+	head = ring->head;
+	kunmap_atomic(ring, KM_USER0);
 
-	if (ring->head == ring->tail)
-		goto out;
+	return head % info->nr != ACCESS_ONCE(info->tail);
+}
 
-	spin_lock(&info->ring_lock);
+/*
+ * aio_read_events_ring:
+ *	Copy up to @nr events from the ring to userspace and move the
+ *	head past them.  Events are copied a page worth at a time, with no
+ *	spinlock held: the tail is only read, ordered against the event
+ *	writes in aio_complete().  Returns the number of events copied, or
+ *	-EFAULT if none could be.
+ */
+static long aio_read_events_ring(struct kioctx *ctx,
+				 struct io_event __user *event, long nr)
+{
+	struct aio_ring_info *info = &ctx->ring_info;
+	struct aio_ring *ring;
+	unsigned head, tail;
+	long ret = 0;
+	int fault = 0;
+
+	mutex_lock(&info->ring_lock);
 
+	ring = kmap_atomic(info->ring_pages[0], KM_USER0);
 	head = ring->head % info->nr;
-	if (head != ring->tail) {
-		struct io_event *evp = aio_ring_event(info, head, KM_USER1);
-		*ent = *evp;
-		head = (head + 1) % info->nr;
-		smp_mb(); /* finish reading the event before updatng the head */
+	kunmap_atomic(ring, KM_USER0);
+
+	tail = ACCESS_ONCE(info->tail);
+	smp_rmb(); /* read the tail before the events it covers */
+
+	while (ret < nr && head != tail) {
+		struct io_event *ev;
+		struct page *page;
+		unsigned pos;
+		long avail;
+
+		avail = (head < tail ? tail : info->nr) - head;
+		avail = min(avail, nr - ret);
+
+		pos = head + AIO_EVENTS_OFFSET;
+		page = info->ring_pages[pos / AIO_EVENTS_PER_PAGE];
+		pos %= AIO_EVENTS_PER_PAGE;
+		avail = min_t(long, avail, AIO_EVENTS_PER_PAGE - pos);
+
+		ev = kmap(page);
+		fault = copy_to_user(event + ret, ev + pos,
+				     sizeof(*ev) * avail);
+		kunmap(page);
+		if (unlikely(fault)) {
+			dprintk("aio: lost events due to EFAULT.\n");
+			break;
+		}
+
+		ret += avail;
+		head = (head + avail) % info->nr;
+	}
+
+	if (ret) {
+		ring = kmap_atomic(info->ring_pages[0], KM_USER0);
+		smp_mb(); /* finish reading the events before updating the head */
 		ring->head = head;
-		ret = 1;
-		put_aio_ring_event(evp, KM_USER1);
+		kunmap_atomic(ring, KM_USER0);
 	}
-	spin_unlock(&info->ring_lock);
 
-out:
-	kunmap_atomic(ring, KM_USER0);
-	dprintk("leaving aio_read_evt: %d  h%lu t%lu\n", ret,
-		 (unsigned long)ring->head, (unsigned long)ring->tail);
-	return ret;
+	mutex_unlock(&info->ring_lock);
+
+	pr_debug("aio_read_events_ring: %ld h%u t%u\n", ret, head, tail);
+	return ret ? ret : (fault ? -EFAULT : 0);
 }
 
 struct aio_timeout {
@@ -1088,43 +1265,19 @@ static int read_events(struct kioctx *ctx,
 	long			start_jiffies = jiffies;
 	struct task_struct	*tsk = current;
 	DECLARE_WAITQUEUE(wait, tsk);
-	int			ret;
+	long			ret;
 	int			i = 0;
-	struct io_event		ent;
 	struct aio_timeout	to;
 	int			retry = 0;
 
-	/* needed to zero any padding within an entry (there shouldn't be 
-	 * any, but C is fun!
-	 */
-	memset(&ent, 0, sizeof(ent));
 retry:
-	ret = 0;
-	while (likely(i < nr)) {
-		ret = aio_read_evt(ctx, &ent);
-		if (unlikely(ret <= 0))
-			break;
-
-		dprintk("read event: %Lx %Lx %Lx %Lx\n",
-			ent.data, ent.obj, ent.res, ent.res2);
-
-		/* Could we split the check in two? */
-		ret = -EFAULT;
-		if (unlikely(copy_to_user(event, &ent, sizeof(ent)))) {
-			dprintk("aio: lost an event due to EFAULT.\n");
-			break;
-		}
-		ret = 0;
-
-		/* Good, event copied to userland, update counts. */
-		event ++;
-		i ++;
-	}
+	ret = aio_read_events_ring(ctx, event + i, nr - i);
+	if (unlikely(ret < 0))
+		return i ? i : ret;
+	i += ret;
 
 	if (min_nr <= i)
 		return i;
-	if (ret)
-		return ret;
 
 	/* End fast path */
 
@@ -1145,50 +1298,38 @@ retry:
 		set_timeout(start_jiffies, &to, &ts);
 	}
 
-	while (likely(i < nr)) {
-		add_wait_queue_exclusive(&ctx->wait, &wait);
-		do {
-			set_task_state(tsk, TASK_INTERRUPTIBLE);
-			ret = aio_read_evt(ctx, &ent);
-			if (ret)
-				break;
-			if (min_nr <= i)
-				break;
-			if (unlikely(ctx->dead)) {
-				ret = -EINVAL;
-				break;
-			}
-			if (to.timed_out)	/* Only check after read evt */
-				break;
-			/* Try to only show up in io wait if there are ops
-			 *  in flight */
-			if (ctx->reqs_active)
-				io_schedule();
-			else
-				schedule();
-			if (signal_pending(tsk)) {
-				ret = -EINTR;
+	ret = 0;
+	add_wait_queue_exclusive(&ctx->wait, &wait);
+	while (i < min_nr) {
+		set_task_state(tsk, TASK_INTERRUPTIBLE);
+		if (aio_events_pending(ctx)) {
+			__set_task_state(tsk, TASK_RUNNING);
+			ret = aio_read_events_ring(ctx, event + i, nr - i);
+			if (unlikely(ret < 0))
 				break;
-			}
-			/*ret = aio_read_evt(ctx, &ent);*/
-		} while (1) ;
-
-		set_task_state(tsk, TASK_RUNNING);
-		remove_wait_queue(&ctx->wait, &wait);
-
-		if (unlikely(ret <= 0))
+			i += ret;
+			ret = 0;
+			continue;
+		}
+		if (unlikely(ctx->dead)) {
+			ret = -EINVAL;
 			break;
-
-		ret = -EFAULT;
-		if (unlikely(copy_to_user(event, &ent, sizeof(ent)))) {
-			dprintk("aio: lost an event due to EFAULT.\n");
+		}
+		if (to.timed_out)	/* Only check after read evt */
+			break;
+		/* Try to only show up in io wait if there are ops
+		 *  in flight */
+		if (ctx->reqs_active)
+			io_schedule();
+		else
+			schedule();
+		if (signal_pending(tsk)) {
+			ret = -EINTR;
 			break;
 		}
-
-		/* Good, event copied to userland, update counts. */
-		event ++;
-		i ++;
 	}
+	set_task_state(tsk, TASK_RUNNING);
+	remove_wait_queue(&ctx->wait, &wait);
 
 	if (timeout)
 		clear_timeout(&to);
@@ -1632,6 +1773,7 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	return 0;
 
 out_put_req:
+	put_reqs_available(ctx, 1);	/* no event will use the slot */
 	aio_put_req(req);	/* drop extra ref to req */
 	aio_put_req(req);	/* drop i/o ref to req */
 	return ret;
@@ -0,0 +1,1753 @@
+/*
+ *	fs/io_uring.c
+ *
+ *	Asynchronous I/O through submission and completion rings that are
+ *	shared between the application and the kernel.
+ *
+ *	The application fills in submission queue entries (sqes) and moves
+ *	the SQ tail; the kernel consumes them, moves the SQ head and posts
+ *	one completion queue entry (cqe) per request at the CQ tail.  Both
+ *	rings are mmapped, so with the SQ polling thread and a busy-looping
+ *	reader no system call is needed in steady state.
+ *
+ *	Requests are first tried inline without blocking.  Anything that
+ *	would block is handed to a small pool of per-ring kernel threads
+ *	that borrow the submitter's mm and credentials.  Poll requests are
+ *	armed on the file's wait queue and completed from a worker when
+ *	the wakeup arrives.
+ *
+ *	Workers are started on demand: the first when a request that may
+ *	need one is submitted, more while punted requests outnumber the
+ *	idle workers.  A ring has at most min(sq_entries, 2 * online cpus)
+ *	of them, and each is charged to the ring owner's RLIMIT_NPROC
+ *	like a forked task.
+ */
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/errno.h>
+#include <linux/syscalls.h>
+#include <linux/compat.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/fdtable.h>
+#include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/mmu_context.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/kthread.h>
+#include <linux/poll.h>
+#include <linux/uio.h>
+#include <linux/net.h>
+#include <linux/socket.h>
+#include <linux/anon_inodes.h>
+#include <linux/log2.h>
+#include <linux/cred.h>
+#include <linux/io_uring.h>
+
+#include <asm/io.h>
+#include <asm/uaccess.h>
+
+#define IORING_MAX_ENTRIES	4096
+#define IORING_MAX_FIXED_FILES	1024
+#define IORING_MAX_BUF_SIZE	(1UL << 30)
+
+struct io_uring {
+	u32 head ____cacheline_aligned_in_smp;
+	u32 tail ____cacheline_aligned_in_smp;
+};
+
+/*
+ * Layout of the SQ ring as the application sees it; the offsets of the
+ * fields are handed out in io_uring_params.sq_off.  array[] holds indices
+ * into the separately mapped sqe array.
+ */
+struct io_sq_ring {
+	struct io_uring		r;
+	u32			ring_mask;
+	u32			ring_entries;
+	u32			dropped;
+	u32			flags;
+	u32			array[];
+};
+
+struct io_cq_ring {
+	struct io_uring		r;
+	u32			ring_mask;
+	u32			ring_entries;
+	u32			overflow;
+	struct io_uring_cqe	cqes[];
+};
+
+struct io_mapped_ubuf {
+	unsigned long		ubuf;
+	size_t			len;
+	void			*kaddr;
+	struct page		**pages;
+	unsigned int		nr_pages;
+};
+
+struct io_ring_ctx {
+	unsigned int		flags;
+
+	/* submission side, serialized by uring_lock */
+	struct mutex		uring_lock;
+	struct io_sq_ring	*sq_ring;
+	struct io_uring_sqe	*sq_sqes;
+	unsigned		cached_sq_head;
+	unsigned		sq_entries;
+	unsigned		sq_mask;
+
+	/* completion side */
+	spinlock_t		completion_lock;
+	struct io_cq_ring	*cq_ring;
+	unsigned		cached_cq_tail;
+	unsigned		cq_entries;
+	unsigned		cq_mask;
+	wait_queue_head_t	wait;		/* io_uring_enter() waiters */
+	wait_queue_head_t	cq_wait;	/* poll(2) on the ring fd */
+
+	/* armed poll requests, under completion_lock */
+	struct list_head	cancel_list;
+
+	/* async workers */
+	spinlock_t		work_lock;
+	struct list_head	work_list;	/* queued requests */
+	struct list_head	active_list;	/* requests a worker runs */
+	wait_queue_head_t	work_wait;
+	wait_queue_head_t	files_wait;
+	unsigned int		nr_queued;	/* on work_list */
+	unsigned int		nr_idle;	/* workers not running a request */
+	struct task_struct	**workers;	/* grown under uring_lock */
+	unsigned int		nr_workers;
+	unsigned int		max_workers;
+	unsigned long		nproc_limit;	/* owner's RLIMIT_NPROC */
+	int			dying;
+
+	/* SQ polling thread */
+	struct task_struct	*sqo_thread;
+	wait_queue_head_t	sqo_wait;
+	unsigned long		sq_thread_idle;
+	struct files_struct	*sqo_files;	/* under work_lock */
+
+	struct mm_struct	*mm;		/* mm_count held */
+	const struct cred	*creds;
+
+	/* requests allocated and not yet freed */
+	atomic_t		inflight;
+	wait_queue_head_t	inflight_wait;
+
+	struct file		**user_files;
+	unsigned int		nr_user_files;
+	struct io_mapped_ubuf	*user_bufs;
+	unsigned int		nr_user_bufs;
+
+	size_t			sq_ring_size;
+	size_t			sqes_size;
+	size_t			cq_ring_size;
+};
+
+#define REQ_F_FIXED_FILE	1	/* ctx owns the file reference */
+#define REQ_F_FILES		2	/* req->files is used by the worker */
+
+struct io_kiocb {
+	struct io_ring_ctx	*ctx;
+	struct file		*file;
+	struct io_uring_sqe	sqe;		/* private copy */
+	unsigned int		flags;
+	atomic_t		refs;
+
+	struct list_head	work;		/* work_list or active_list */
+	struct task_struct	*worker;
+	struct files_struct	*files;
+	int			cancelled;
+
+	/* IORING_OP_POLL_ADD */
+	struct list_head	list;		/* ctx->cancel_list */
+	wait_queue_head_t	*poll_head;
+	wait_queue_t		poll_wait;
+	unsigned int		poll_events;
+	int			poll_canceled;
+};
+
+static struct kmem_cache *req_cachep;
+
+static const struct file_operations io_uring_fops;
+
+static void *io_mem_alloc(size_t size)
+{
+	return (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO | __GFP_NOWARN,
+					get_order(size));
+}
+
+static void io_mem_free(void *ptr, size_t size)
+{
+	if (ptr)
+		free_pages((unsigned long)ptr, get_order(size));
+}
+
+/*
+ * Completion side
+ */
+
+static unsigned io_cqring_events(struct io_ring_ctx *ctx)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+
+	return ACCESS_ONCE(ring->r.tail) - ACCESS_ONCE(ring->r.head);
+}
+
+/*
+ * Post one cqe, or count an overflow if the application has not made
+ * room.  Called with completion_lock held.
+ */
+static void io_cqring_fill_event(struct io_ring_ctx *ctx, u64 user_data,
+				 long res)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+	struct io_uring_cqe *cqe;
+	unsigned tail = ctx->cached_cq_tail;
+
+	if (tail - ACCESS_ONCE(ring->r.head) == ring->ring_entries) {
+		ring->overflow++;
+		return;
+	}
+	/* the slot is free only once the head has been seen to pass it */
+	smp_mb();
+
+	cqe = &ring->cqes[tail & ctx->cq_mask];
+	cqe->user_data = user_data;
+	cqe->res = res;
+	cqe->flags = 0;
+
+	/* the cqe must be visible before the tail that covers it */
+	smp_wmb();
+	ring->r.tail = ++ctx->cached_cq_tail;
+}
+
+static void io_cqring_ev_posted(struct io_ring_ctx *ctx)
+{
+	if (waitqueue_active(&ctx->wait))
+		wake_up(&ctx->wait);
+	if (waitqueue_active(&ctx->cq_wait))
+		wake_up_interruptible(&ctx->cq_wait);
+}
+
+static void io_cqring_add_event(struct io_ring_ctx *ctx, u64 user_data,
+				long res)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->completion_lock, flags);
+	io_cqring_fill_event(ctx, user_data, res);
+	spin_unlock_irqrestore(&ctx->completion_lock, flags);
+
+	io_cqring_ev_posted(ctx);
+}
+
+/*
+ * Requests
+ */
+
+static struct io_kiocb *io_get_req(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req;
+
+	req = kmem_cache_alloc(req_cachep, GFP_KERNEL);
+	if (!req)
+		return NULL;
+
+	req->ctx = ctx;
+	req->file = NULL;
+	req->flags = 0;
+	atomic_set(&req->refs, 1);
+	INIT_LIST_HEAD(&req->work);
+	req->worker = NULL;
+	req->files = NULL;
+	req->cancelled = 0;
+	INIT_LIST_HEAD(&req->list);
+	req->poll_head = NULL;
+	req->poll_canceled = 0;
+	atomic_inc(&ctx->inflight);
+	return req;
+}
+
+static void io_free_req(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+
+	if (req->file && !(req->flags & REQ_F_FIXED_FILE))
+		fput(req->file);
+	kmem_cache_free(req_cachep, req);
+
+	if (atomic_dec_and_test(&ctx->inflight))
+		wake_up(&ctx->inflight_wait);
+}
+
+static void io_put_req(struct io_kiocb *req)
+{
+	if (atomic_dec_and_test(&req->refs))
+		io_free_req(req);
+}
+
+static void io_complete_req(struct io_kiocb *req, long res)
+{
+	/* a worker interrupted by cancellation must not leak restarts */
+	if (res == -ERESTARTSYS || res == -ERESTARTNOINTR ||
+	    res == -ERESTARTNOHAND || res == -ERESTART_RESTARTBLOCK)
+		res = -EINTR;
+
+	io_cqring_add_event(req->ctx, req->sqe.user_data, res);
+	io_put_req(req);
+}
+
+/*
+ * Async workers
+ */
+
+static void io_queue_async(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->work_lock, flags);
+	list_add_tail(&req->work, &ctx->work_list);
+	ctx->nr_queued++;
+	spin_unlock_irqrestore(&ctx->work_lock, flags);
+
+	wake_up(&ctx->work_wait);
+}
+
+/*
+ * Hand @req to a worker that will run it with req->files installed as
+ * its file table.  Only accept needs this, to install the new fd.
+ */
+static long io_queue_async_files(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct files_struct *files;
+
+	spin_lock_irq(&ctx->work_lock);
+	if (ctx->flags & IORING_SETUP_SQPOLL)
+		files = ctx->sqo_files;
+	else
+		files = current->files;
+	if (!files) {
+		spin_unlock_irq(&ctx->work_lock);
+		return -EBADF;
+	}
+	req->files = files;
+	req->flags |= REQ_F_FILES;
+	list_add_tail(&req->work, &ctx->work_list);
+	ctx->nr_queued++;
+	spin_unlock_irq(&ctx->work_lock);
+
+	wake_up(&ctx->work_wait);
+	return -EIOCBQUEUED;
+}
+
+static long io_issue_sqe(struct io_kiocb *req, bool force_nonblock);
+static void io_poll_complete_work(struct io_kiocb *req);
+
+static void io_run_work(struct io_kiocb *req, bool has_mm)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct files_struct *old_files = NULL;
+	long ret;
+
+	if (req->sqe.opcode == IORING_OP_POLL_ADD) {
+		/* off the list first, a re-armed poll may be queued again */
+		spin_lock_irq(&ctx->work_lock);
+		list_del_init(&req->work);
+		spin_unlock_irq(&ctx->work_lock);
+		io_poll_complete_work(req);
+		return;
+	}
+
+	if (req->cancelled || ctx->dying) {
+		ret = -ECANCELED;
+	} else if (!has_mm) {
+		ret = -EFAULT;
+	} else {
+		if (req->flags & REQ_F_FILES) {
+			task_lock(current);
+			old_files = current->files;
+			current->files = req->files;
+			task_unlock(current);
+		}
+		ret = io_issue_sqe(req, false);
+		if (req->flags & REQ_F_FILES) {
+			task_lock(current);
+			current->files = old_files;
+			task_unlock(current);
+		}
+	}
+
+	spin_lock_irq(&ctx->work_lock);
+	list_del_init(&req->work);
+	spin_unlock_irq(&ctx->work_lock);
+	if (req->flags & REQ_F_FILES)
+		wake_up(&ctx->files_wait);
+
+	io_complete_req(req, ret);
+}
+
+static int io_worker(void *data)
+{
+	struct io_ring_ctx *ctx = data;
+	struct mm_struct *mm = NULL;
+	const struct cred *old_cred;
+	mm_segment_t old_fs;
+	struct io_kiocb *req;
+	bool busy = false;
+
+	/* SIGKILL interrupts a blocking request being cancelled */
+	allow_signal(SIGKILL);
+	old_cred = override_creds(ctx->creds);
+	old_fs = get_fs();
+	set_fs(USER_DS);
+
+	for (;;) {
+		spin_lock_irq(&ctx->work_lock);
+		if (busy) {
+			ctx->nr_idle++;
+			busy = false;
+		}
+		if (list_empty(&ctx->work_list)) {
+			spin_unlock_irq(&ctx->work_lock);
+			/* don't pin the mm while idle, it keeps exit waiting */
+			if (mm) {
+				unuse_mm(mm);
+				mmput(mm);
+				mm = NULL;
+			}
+			if (kthread_should_stop())
+				break;
+			wait_event_interruptible(ctx->work_wait,
+						 !list_empty(&ctx->work_list) ||
+						 kthread_should_stop());
+			flush_signals(current);
+			continue;
+		}
+		req = list_first_entry(&ctx->work_list, struct io_kiocb, work);
+		list_move_tail(&req->work, &ctx->active_list);
+		req->worker = current;
+		ctx->nr_queued--;
+		ctx->nr_idle--;
+		busy = true;
+		spin_unlock_irq(&ctx->work_lock);
+
+		if (!mm && atomic_inc_not_zero(&ctx->mm->mm_users)) {
+			mm = ctx->mm;
+			use_mm(mm);
+		}
+		io_run_work(req, mm != NULL);
+		flush_signals(current);
+		cond_resched();
+	}
+
+	set_fs(old_fs);
+	revert_creds(old_cred);
+	return 0;
+}
+
+/*
+ * Start one more worker.  It counts as idle until it picks up a request.
+ * Called with uring_lock held, or before the ring is published.
+ */
+static int io_add_worker(struct io_ring_ctx *ctx)
+{
+	struct user_struct *user = ctx->creds->user;
+	struct task_struct *tsk;
+
+	if (ctx->nr_workers >= ctx->max_workers)
+		return -EAGAIN;
+	if (atomic_read(&user->processes) >= ctx->nproc_limit)
+		return -EAGAIN;
+
+	spin_lock_irq(&ctx->work_lock);
+	ctx->nr_idle++;
+	spin_unlock_irq(&ctx->work_lock);
+
+	tsk = kthread_run(io_worker, ctx, "io_uring-w%u", ctx->nr_workers);
+	if (IS_ERR(tsk)) {
+		spin_lock_irq(&ctx->work_lock);
+		ctx->nr_idle--;
+		spin_unlock_irq(&ctx->work_lock);
+		return PTR_ERR(tsk);
+	}
+	atomic_inc(&user->processes);
+	ctx->workers[ctx->nr_workers++] = tsk;
+	return 0;
+}
+
+/*
+ * A request was just punted or armed.  Add a worker if queued requests
+ * outnumber the idle ones; failing that, the existing workers get to
+ * them in turn.  Called with uring_lock held.
+ */
+static void io_grow_workers(struct io_ring_ctx *ctx)
+{
+	bool grow;
+
+	if (ctx->nr_workers >= ctx->max_workers)
+		return;
+
+	spin_lock_irq(&ctx->work_lock);
+	grow = ctx->nr_queued > ctx->nr_idle;
+	spin_unlock_irq(&ctx->work_lock);
+	if (grow)
+		io_add_worker(ctx);
+}
+
+/*
+ * Cancel punted requests that run with @files as their file table, or
+ * all punted requests if @files is NULL.  Queued ones complete with
+ * -ECANCELED; running ones are interrupted.
+ */
+static void io_cancel_async(struct io_ring_ctx *ctx, struct files_struct *files)
+{
+	struct io_kiocb *req;
+
+	spin_lock_irq(&ctx->work_lock);
+	list_for_each_entry(req, &ctx->work_list, work)
+		if (!files || req->files == files)
+			req->cancelled = 1;
+	list_for_each_entry(req, &ctx->active_list, work) {
+		if (files && req->files != files)
+			continue;
+		req->cancelled = 1;
+		send_sig(SIGKILL, req->worker, 1);
+	}
+	spin_unlock_irq(&ctx->work_lock);
+}
+
+static bool io_files_busy(struct io_ring_ctx *ctx, struct files_struct *files)
+{
+	struct io_kiocb *req;
+	bool busy = false;
+
+	spin_lock_irq(&ctx->work_lock);
+	list_for_each_entry(req, &ctx->work_list, work)
+		if (req->files == files)
+			busy = true;
+	list_for_each_entry(req, &ctx->active_list, work)
+		if (req->files == files)
+			busy = true;
+	spin_unlock_irq(&ctx->work_lock);
+	return busy;
+}
+
+/*
+ * Poll
+ */
+
+struct io_poll_table {
+	poll_table		pt;
+	struct io_kiocb		*req;
+	int			error;
+};
+
+static void io_poll_queue_proc(struct file *file, wait_queue_head_t *head,
+			       poll_table *p)
+{
+	struct io_poll_table *pt = container_of(p, struct io_poll_table, pt);
+
+	/* only one wait queue per request */
+	if (unlikely(pt->req->poll_head)) {
+		pt->error = -EINVAL;
+		return;
+	}
+
+	pt->error = 0;
+	pt->req->poll_head = head;
+	add_wait_queue(head, &pt->req->poll_wait);
+}
+
+/*
+ * Called with the wait queue lock held, possibly from interrupt context,
+ * so the completion itself (which may drop the last file reference) is
+ * left to a worker.
+ */
+static int io_poll_wake(wait_queue_t *wait, unsigned mode, int sync, void *key)
+{
+	struct io_kiocb *req = container_of(wait, struct io_kiocb, poll_wait);
+	unsigned long mask = (unsigned long)key;
+
+	if (mask && !(mask & req->poll_events))
+		return 0;
+
+	list_del_init(&wait->task_list);
+	io_queue_async(req);
+	return 1;
+}
+
+static void io_poll_complete_work(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct file *file = req->file;
+	unsigned int mask = 0;
+
+	if (!req->poll_canceled)
+		mask = file->f_op->poll(file, NULL) & req->poll_events;
+
+	spin_lock_irq(&ctx->completion_lock);
+	if (!mask && !req->poll_canceled) {
+		/*
+		 * Spurious wakeup: re-arm.  The wait entry goes back on the
+		 * queue before readiness is checked again, so a wakeup in
+		 * between is not lost.  Either path may then queue the
+		 * request again, so hold a reference across it.
+		 */
+		atomic_inc(&req->refs);
+		add_wait_queue(req->poll_head, &req->poll_wait);
+		spin_unlock_irq(&ctx->completion_lock);
+
+		mask = file->f_op->poll(file, NULL) & req->poll_events;
+		if (!mask) {
+			io_put_req(req);
+			return;
+		}
+
+		spin_lock_irq(&ctx->completion_lock);
+		spin_lock(&req->poll_head->lock);
+		/* woken or cancelled and queued again meanwhile? */
+		if (list_empty(&req->poll_wait.task_list))
+			mask = 0;
+		else
+			list_del_init(&req->poll_wait.task_list);
+		spin_unlock(&req->poll_head->lock);
+		if (!mask) {
+			spin_unlock_irq(&ctx->completion_lock);
+			io_put_req(req);
+			return;
+		}
+		io_put_req(req);
+	}
+	list_del_init(&req->list);
+	io_cqring_fill_event(ctx, req->sqe.user_data,
+			     req->poll_canceled ? -ECANCELED : mask);
+	spin_unlock_irq(&ctx->completion_lock);
+
+	io_cqring_ev_posted(ctx);
+	io_put_req(req);
+}
+
+static long io_poll_add(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct file *file = req->file;
+	struct io_poll_table ipt;
+	unsigned int mask;
+	bool cancel = false;
+	long ret;
+
+	if (req->sqe.addr || req->sqe.len || req->sqe.off || req->sqe.buf_index)
+		return -EINVAL;
+	if (!file->f_op->poll)
+		return DEFAULT_POLLMASK & req->sqe.poll_events;
+
+	req->poll_events = req->sqe.poll_events | POLLERR | POLLHUP;
+	init_waitqueue_func_entry(&req->poll_wait, io_poll_wake);
+
+	ipt.pt.qproc = io_poll_queue_proc;
+	ipt.pt.key = req->poll_events;
+	ipt.req = req;
+	ipt.error = -EINVAL;	/* same as no support for polling */
+
+	/* the wakeup may complete the request while we look at it */
+	atomic_inc(&req->refs);
+
+	mask = file->f_op->poll(file, &ipt.pt) & req->poll_events;
+
+	spin_lock_irq(&ctx->completion_lock);
+	if (likely(req->poll_head)) {
+		spin_lock(&req->poll_head->lock);
+		if (unlikely(list_empty(&req->poll_wait.task_list))) {
+			/* already woken and handed to a worker */
+			if (ipt.error)
+				cancel = true;
+			ipt.error = 0;
+			mask = 0;
+		}
+		if (mask || ipt.error)
+			list_del_init(&req->poll_wait.task_list);
+		else if (cancel)
+			req->poll_canceled = 1;
+		else
+			list_add_tail(&req->list, &ctx->cancel_list);
+		spin_unlock(&req->poll_head->lock);
+	}
+	spin_unlock_irq(&ctx->completion_lock);
+
+	if (mask)
+		ret = mask;
+	else if (ipt.error)
+		ret = ipt.error;
+	else
+		ret = -EIOCBQUEUED;
+
+	io_put_req(req);
+	return ret;
+}
+
+/* Called with completion_lock held */
+static void io_poll_remove_one(struct io_kiocb *req)
+{
+	req->poll_canceled = 1;
+
+	spin_lock(&req->poll_head->lock);
+	if (!list_empty(&req->poll_wait.task_list)) {
+		list_del_init(&req->poll_wait.task_list);
+		io_queue_async(req);
+	}
+	spin_unlock(&req->poll_head->lock);
+
+	list_del_init(&req->list);
+}
+
+static void io_poll_remove_all(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req;
+
+	spin_lock_irq(&ctx->completion_lock);
+	while (!list_empty(&ctx->cancel_list)) {
+		req = list_first_entry(&ctx->cancel_list, struct io_kiocb,
+				       list);
+		io_poll_remove_one(req);
+	}
+	spin_unlock_irq(&ctx->completion_lock);
+}
+
+/*
+ * Find an armed poll request by the user_data it was submitted with and
+ * cancel it.  The cancelled request completes with -ECANCELED.
+ */
+static long io_poll_remove(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_kiocb *poll_req, *next;
+	long ret = -ENOENT;
+
+	if (req->sqe.ioprio || req->sqe.off || req->sqe.len ||
+	    req->sqe.buf_index || req->sqe.poll_events)
+		return -EINVAL;
+
+	spin_lock_irq(&ctx->completion_lock);
+	list_for_each_entry_safe(poll_req, next, &ctx->cancel_list, list) {
+		if (req->sqe.addr == poll_req->sqe.user_data) {
+			io_poll_remove_one(poll_req);
+			ret = 0;
+			break;
+		}
+	}
+	spin_unlock_irq(&ctx->completion_lock);
+
+	return ret;
+}
+
+/*
+ * Operations
+ */
+
+static long io_rw(struct io_kiocb *req, int rw)
+{
+	struct file *file = req->file;
+	const struct iovec __user *iov;
+	loff_t pos = 0;
+
+	if (file->f_mode & FMODE_PREAD)
+		pos = req->sqe.off;
+
+	iov = (const struct iovec __user *)(unsigned long)req->sqe.addr;
+	if (rw == READ)
+		return vfs_readv(file, iov, req->sqe.len, &pos);
+	return vfs_writev(file, iov, req->sqe.len, &pos);
+}
+
+/*
+ * Fixed buffers were pinned and mapped at registration.  Buffered I/O is
+ * done through the kernel mapping, so the user pages are neither looked
+ * up nor faulted on again; O_DIRECT pins the pages itself and gets the
+ * user address.
+ *
+ * The kernel mapping is passed under KERNEL_DS, which is only safe for
+ * a ->read/->write that just copies the data.  Some character devices
+ * follow user pointers embedded in the buffer, so buffered fixed I/O is
+ * limited to regular files backed by the page cache.
+ */
+static long io_rw_fixed(struct io_kiocb *req, int rw)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct file *file = req->file;
+	struct io_mapped_ubuf *imu;
+	unsigned long buf_addr = req->sqe.addr;
+	size_t len = req->sqe.len;
+	unsigned int index = req->sqe.buf_index;
+	mm_segment_t old_fs;
+	char __user *buf;
+	loff_t pos = 0;
+	long ret;
+
+	if (unlikely(index >= ctx->nr_user_bufs))
+		return -EFAULT;
+	imu = &ctx->user_bufs[index];
+	if (buf_addr + len < buf_addr || buf_addr < imu->ubuf ||
+	    buf_addr + len > imu->ubuf + imu->len)
+		return -EFAULT;
+
+	if (file->f_mode & FMODE_PREAD)
+		pos = req->sqe.off;
+
+	old_fs = get_fs();
+	if (file->f_flags & O_DIRECT) {
+		buf = (char __user *)buf_addr;
+	} else {
+		struct inode *inode = file->f_path.dentry->d_inode;
+
+		if (!S_ISREG(inode->i_mode) ||
+		    !file->f_mapping->a_ops->readpage)
+			return -EINVAL;
+		buf = (char __user *)imu->kaddr + (buf_addr - imu->ubuf);
+		set_fs(KERNEL_DS);
+	}
+	if (rw == READ)
+		ret = vfs_read(file, buf, len, &pos);
+	else
+		ret = vfs_write(file, buf, len, &pos);
+	set_fs(old_fs);
+
+	return ret;
+}
+
+static long io_fsync(struct io_kiocb *req)
+{
+	loff_t end = req->sqe.off + req->sqe.len;
+
+	if (req->sqe.addr || req->sqe.ioprio || req->sqe.buf_index)
+		return -EINVAL;
+	if (req->sqe.fsync_flags & ~IORING_FSYNC_DATASYNC)
+		return -EINVAL;
+
+	return vfs_fsync_range(req->file, req->file->f_path.dentry,
+			       req->sqe.off, req->sqe.len ? end : LLONG_MAX,
+			       req->sqe.fsync_flags & IORING_FSYNC_DATASYNC);
+}
+
+static long io_sendrecvmsg(struct io_kiocb *req, bool force_nonblock)
+{
+	struct file *file = req->file;
+	struct msghdr __user *msg;
+	struct socket *sock;
+	unsigned int flags;
+	int err;
+	long ret;
+
+	sock = sock_from_file(file, &err);
+	if (!sock)
+		return err;
+
+	msg = (struct msghdr __user *)(unsigned long)req->sqe.addr;
+	flags = req->sqe.msg_flags & ~MSG_CMSG_COMPAT;
+
+	if (force_nonblock)
+		flags |= MSG_DONTWAIT;
+	if (req->sqe.opcode == IORING_OP_SENDMSG)
+		ret = __sys_sendmsg_sock(sock, msg, flags);
+	else
+		ret = __sys_recvmsg_sock(sock, msg, flags);
+
+	/* only punt if the caller asked for a blocking operation */
+	if (force_nonblock && ret == -EAGAIN &&
+	    !(req->sqe.msg_flags & MSG_DONTWAIT) &&
+	    !(file->f_flags & O_NONBLOCK)) {
+		io_queue_async(req);
+		return -EIOCBQUEUED;
+	}
+	return ret;
+}
+
+static long io_accept(struct io_kiocb *req, bool force_nonblock)
+{
+	struct file *file = req->file;
+	struct sockaddr __user *addr;
+	int __user *addr_len;
+	long ret;
+
+	if (req->sqe.ioprio || req->sqe.len || req->sqe.buf_index)
+		return -EINVAL;
+
+	addr = (struct sockaddr __user *)(unsigned long)req->sqe.addr;
+	addr_len = (int __user *)(unsigned long)req->sqe.off;
+
+	if (!force_nonblock)
+		return __sys_accept4_file(file, file->f_flags, addr, addr_len,
+					  req->sqe.accept_flags);
+
+	/* the SQ thread has no file table of its own to install into */
+	if (!(req->ctx->flags & IORING_SETUP_SQPOLL)) {
+		ret = __sys_accept4_file(file, file->f_flags | O_NONBLOCK,
+					 addr, addr_len, req->sqe.accept_flags);
+		if (ret != -EAGAIN || (file->f_flags & O_NONBLOCK))
+			return ret;
+	}
+	return io_queue_async_files(req);
+}
+
+/*
+ * Run the operation described by req->sqe.  With @force_nonblock the
+ * caller is the submitter, and anything that would block is queued to a
+ * worker instead; -EIOCBQUEUED means the request completes later.
+ */
+static long io_issue_sqe(struct io_kiocb *req, bool force_nonblock)
+{
+	struct file *file = req->file;
+
+	switch (req->sqe.opcode) {
+	case IORING_OP_NOP:
+		return 0;
+	case IORING_OP_READV:
+	case IORING_OP_WRITEV:
+	case IORING_OP_READ_FIXED:
+	case IORING_OP_WRITE_FIXED:
+		if (force_nonblock && !(file->f_flags & O_NONBLOCK))
+			break;
+		if (req->sqe.opcode == IORING_OP_READV)
+			return io_rw(req, READ);
+		if (req->sqe.opcode == IORING_OP_WRITEV)
+			return io_rw(req, WRITE);
+		if (req->sqe.opcode == IORING_OP_READ_FIXED)
+			return io_rw_fixed(req, READ);
+		return io_rw_fixed(req, WRITE);
+	case IORING_OP_FSYNC:
+		if (force_nonblock)
+			break;
+		return io_fsync(req);
+	case IORING_OP_POLL_REMOVE:
+		return io_poll_remove(req);
+	case IORING_OP_SENDMSG:
+	case IORING_OP_RECVMSG:
+		return io_sendrecvmsg(req, force_nonblock);
+	case IORING_OP_ACCEPT:
+		return io_accept(req, force_nonblock);
+	default:
+		return -EINVAL;
+	}
+
+	io_queue_async(req);
+	return -EIOCBQUEUED;
+}
+
+/*
+ * Submission side
+ */
+
+static int io_req_set_file(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	int fd = req->sqe.fd;
+
+	if (req->sqe.opcode == IORING_OP_NOP ||
+	    req->sqe.opcode == IORING_OP_POLL_REMOVE)
+		return 0;
+
+	if (req->sqe.flags & IOSQE_FIXED_FILE) {
+		if (unlikely(!ctx->user_files ||
+			     (unsigned)fd >= ctx->nr_user_files))
+			return -EBADF;
+		req->file = ctx->user_files[fd];
+		req->flags |= REQ_F_FIXED_FILE;
+		return 0;
+	}
+
+	/* the SQ thread can't look up the application's descriptors */
+	if (ctx->flags & IORING_SETUP_SQPOLL)
+		return -EBADF;
+
+	req->file = fget(fd);
+	if (unlikely(!req->file))
+		return -EBADF;
+	/* a ring holding itself would never be released */
+	if (unlikely(req->file->f_op == &io_uring_fops)) {
+		fput(req->file);
+		req->file = NULL;
+		return -EBADF;
+	}
+	return 0;
+}
+
+static void io_submit_sqe(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	long ret;
+
+	if (unlikely(req->sqe.flags & ~IOSQE_FIXED_FILE)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	ret = io_req_set_file(req);
+	if (unlikely(ret))
+		goto out;
+
+	/*
+	 * Anything on a file may be punted, and a poll wakeup can't start
+	 * a thread, so there must be a worker before the request is tried.
+	 */
+	if (req->file && unlikely(!ctx->nr_workers)) {
+		ret = io_add_worker(ctx);
+		if (ret)
+			goto out;
+	}
+
+	if (req->sqe.opcode == IORING_OP_POLL_ADD)
+		ret = io_poll_add(req);
+	else
+		ret = io_issue_sqe(req, true);
+	if (ret == -EIOCBQUEUED) {
+		io_grow_workers(ctx);
+		return;
+	}
+out:
+	io_complete_req(req, ret);
+}
+
+static unsigned io_sqring_entries(struct io_ring_ctx *ctx)
+{
+	return ACCESS_ONCE(ctx->sq_ring->r.tail) - ctx->cached_sq_head;
+}
+
+/*
+ * Consume up to @to_submit sqes.  Each one is copied before the SQ head
+ * is moved past it, so the application may reuse the slot as soon as it
+ * sees the new head.  Called with uring_lock held.
+ */
+static int io_submit_sqes(struct io_ring_ctx *ctx, unsigned int to_submit)
+{
+	struct io_sq_ring *ring = ctx->sq_ring;
+	unsigned head, tail;
+	int submitted = 0;
+
+	head = ctx->cached_sq_head;
+	tail = ACCESS_ONCE(ring->r.tail);
+	/* read the sqes only after the tail that publishes them */
+	smp_rmb();
+
+	while (submitted < to_submit && head != tail) {
+		unsigned index = ACCESS_ONCE(ring->array[head & ctx->sq_mask]);
+		struct io_kiocb *req;
+
+		if (unlikely(index >= ctx->sq_entries)) {
+			ring->dropped++;
+			head++;
+			continue;
+		}
+
+		req = io_get_req(ctx);
+		if (unlikely(!req)) {
+			if (!submitted)
+				submitted = -EAGAIN;
+			break;
+		}
+		memcpy(&req->sqe, &ctx->sq_sqes[index], sizeof(req->sqe));
+		head++;
+
+		io_submit_sqe(req);
+		submitted++;
+	}
+
+	if (head != ctx->cached_sq_head) {
+		ctx->cached_sq_head = head;
+		smp_mb();
+		ring->r.head = head;
+	}
+	return submitted;
+}
+
+static int io_sq_thread(void *data)
+{
+	struct io_ring_ctx *ctx = data;
+	struct mm_struct *mm = NULL;
+	const struct cred *old_cred;
+	mm_segment_t old_fs;
+	unsigned long timeout;
+	DEFINE_WAIT(wait);
+
+	old_cred = override_creds(ctx->creds);
+	old_fs = get_fs();
+	set_fs(USER_DS);
+
+	timeout = jiffies + ctx->sq_thread_idle;
+	while (!kthread_should_stop()) {
+		unsigned int to_submit = io_sqring_entries(ctx);
+
+		if (!to_submit) {
+			/* keep spinning until the ring has been idle a while */
+			if (time_before(jiffies, timeout)) {
+				cond_resched();
+				continue;
+			}
+
+			if (mm) {
+				unuse_mm(mm);
+				mmput(mm);
+				mm = NULL;
+			}
+
+			prepare_to_wait(&ctx->sqo_wait, &wait,
+					TASK_INTERRUPTIBLE);
+			ctx->sq_ring->flags |= IORING_SQ_NEED_WAKEUP;
+			/* set the flag before the tail is checked again */
+			smp_mb();
+			if (!io_sqring_entries(ctx) && !kthread_should_stop())
+				schedule();
+			finish_wait(&ctx->sqo_wait, &wait);
+
+			ctx->sq_ring->flags &= ~IORING_SQ_NEED_WAKEUP;
+			timeout = jiffies + ctx->sq_thread_idle;
+			continue;
+		}
+
+		/* without the mm, requests that touch user memory fail */
+		if (!mm && atomic_inc_not_zero(&ctx->mm->mm_users)) {
+			mm = ctx->mm;
+			use_mm(mm);
+		}
+
+		mutex_lock(&ctx->uring_lock);
+		io_submit_sqes(ctx, min(to_submit, ctx->sq_entries));
+		mutex_unlock(&ctx->uring_lock);
+
+		timeout = jiffies + ctx->sq_thread_idle;
+	}
+
+	if (mm) {
+		unuse_mm(mm);
+		mmput(mm);
+	}
+	set_fs(old_fs);
+	revert_creds(old_cred);
+	return 0;
+}
+
+static int io_cqring_wait(struct io_ring_ctx *ctx, unsigned min_events)
+{
+	int ret;
+
+	if (io_cqring_events(ctx) >= min_events)
+		return 0;
+
+	ret = wait_event_interruptible(ctx->wait,
+				       io_cqring_events(ctx) >= min_events);
+	if (ret == -ERESTARTSYS)
+		ret = -EINTR;
+	return ret;
+}
+
+/*
+ * Registered files and buffers
+ */
+
+static void io_sqe_files_unregister(struct io_ring_ctx *ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < ctx->nr_user_files; i++)
+		fput(ctx->user_files[i]);
+	kfree(ctx->user_files);
+	ctx->user_files = NULL;
+	ctx->nr_user_files = 0;
+}
+
+static int io_sqe_files_register(struct io_ring_ctx *ctx, void __user *arg,
+				 unsigned nr_args)
+{
+	__s32 __user *fds = arg;
+	struct file *file;
+	int ret = 0;
+	__s32 fd;
+
+	if (ctx->user_files)
+		return -EBUSY;
+	if (!nr_args || nr_args > IORING_MAX_FIXED_FILES)
+		return -EINVAL;
+
+	ctx->user_files = kcalloc(nr_args, sizeof(struct file *), GFP_KERNEL);
+	if (!ctx->user_files)
+		return -ENOMEM;
+
+	while (ctx->nr_user_files < nr_args) {
+		ret = -EFAULT;
+		if (get_user(fd, &fds[ctx->nr_user_files]))
+			break;
+		ret = -EBADF;
+		file = fget(fd);
+		if (!file)
+			break;
+		/* a ring holding itself would never be released */
+		if (file->f_op == &io_uring_fops) {
+			fput(file);
+			break;
+		}
+		ctx->user_files[ctx->nr_user_files++] = file;
+		ret = 0;
+	}
+
+	if (ret)
+		io_sqe_files_unregister(ctx);
+	return ret;
+}
+
+static void io_sqe_buffer_release(struct io_mapped_ubuf *imu)
+{
+	unsigned int i;
+
+	if (imu->kaddr)
+		vunmap((void *)((unsigned long)imu->kaddr & PAGE_MASK));
+	for (i = 0; i < imu->nr_pages; i++) {
+		/* the kernel may have written them through the mapping */
+		set_page_dirty_lock(imu->pages[i]);
+		put_page(imu->pages[i]);
+	}
+	if (is_vmalloc_addr(imu->pages))
+		vfree(imu->pages);
+	else
+		kfree(imu->pages);
+}
+
+static void io_sqe_buffers_unregister(struct io_ring_ctx *ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < ctx->nr_user_bufs; i++)
+		io_sqe_buffer_release(&ctx->user_bufs[i]);
+	kfree(ctx->user_bufs);
+	ctx->user_bufs = NULL;
+	ctx->nr_user_bufs = 0;
+}
+
+static int io_sqe_buffer_map(struct io_mapped_ubuf *imu, struct iovec *iov)
+{
+	unsigned long ubuf = (unsigned long)iov->iov_base;
+	unsigned long start, end;
+	size_t size;
+	int ret;
+
+	start = ubuf >> PAGE_SHIFT;
+	end = (ubuf + iov->iov_len + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	imu->nr_pages = 0;
+
+	size = (end - start) * sizeof(struct page *);
+	if (size > PAGE_SIZE)
+		imu->pages = vmalloc(size);
+	else
+		imu->pages = kmalloc(size, GFP_KERNEL);
+	if (!imu->pages)
+		return -ENOMEM;
+
+	down_read(&current->mm->mmap_sem);
+	ret = get_user_pages(current, current->mm, ubuf & PAGE_MASK,
+			     end - start, 1, 0, imu->pages, NULL);
+	up_read(&current->mm->mmap_sem);
+	if (ret > 0)
+		imu->nr_pages = ret;
+	if (ret != end - start)
+		return ret < 0 ? ret : -EFAULT;
+
+	imu->kaddr = vmap(imu->pages, imu->nr_pages, VM_MAP, PAGE_KERNEL);
+	if (!imu->kaddr)
+		return -ENOMEM;
+	imu->kaddr += ubuf & ~PAGE_MASK;
+	imu->ubuf = ubuf;
+	imu->len = iov->iov_len;
+	return 0;
+}
+
+static int io_sqe_buffers_register(struct io_ring_ctx *ctx, void __user *arg,
+				   unsigned nr_args)
+{
+	struct iovec __user *uiov = arg;
+	unsigned long total_pages = 0;
+	struct iovec iov;
+	int ret = 0;
+
+	if (ctx->user_bufs)
+		return -EBUSY;
+	if (!nr_args || nr_args > UIO_MAXIOV)
+		return -EINVAL;
+
+	ctx->user_bufs = kcalloc(nr_args, sizeof(struct io_mapped_ubuf),
+				 GFP_KERNEL);
+	if (!ctx->user_bufs)
+		return -ENOMEM;
+
+	while (ctx->nr_user_bufs < nr_args) {
+		struct io_mapped_ubuf *imu = &ctx->user_bufs[ctx->nr_user_bufs];
+		unsigned long ubuf;
+
+		ret = -EFAULT;
+		if (copy_from_user(&iov, &uiov[ctx->nr_user_bufs], sizeof(iov)))
+			break;
+		ubuf = (unsigned long)iov.iov_base;
+		ret = -EFAULT;
+		if (!ubuf || !iov.iov_len ||
+		    iov.iov_len > IORING_MAX_BUF_SIZE ||
+		    ubuf + iov.iov_len < ubuf)
+			break;
+
+		total_pages += PAGE_ALIGN(ubuf + iov.iov_len) / PAGE_SIZE -
+			       ubuf / PAGE_SIZE;
+		ret = -ENOMEM;
+		if (!capable(CAP_IPC_LOCK) &&
+		    total_pages > rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT)
+			break;
+
+		/* counted first so a partial mapping is released too */
+		ctx->nr_user_bufs++;
+		ret = io_sqe_buffer_map(imu, &iov);
+		if (ret)
+			break;
+	}
+
+	if (ret)
+		io_sqe_buffers_unregister(ctx);
+	return ret;
+}
+
+/*
+ * Setup and teardown
+ */
+
+static int io_allocate_rings(struct io_ring_ctx *ctx, struct io_uring_params *p)
+{
+	ctx->sq_ring_size = sizeof(struct io_sq_ring) +
+			    p->sq_entries * sizeof(u32);
+	ctx->sq_ring = io_mem_alloc(ctx->sq_ring_size);
+	if (!ctx->sq_ring)
+		return -ENOMEM;
+
+	ctx->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+	ctx->sq_sqes = io_mem_alloc(ctx->sqes_size);
+	if (!ctx->sq_sqes)
+		return -ENOMEM;
+
+	ctx->cq_ring_size = sizeof(struct io_cq_ring) +
+			    p->cq_entries * sizeof(struct io_uring_cqe);
+	ctx->cq_ring = io_mem_alloc(ctx->cq_ring_size);
+	if (!ctx->cq_ring)
+		return -ENOMEM;
+
+	ctx->sq_entries = ctx->sq_ring->ring_entries = p->sq_entries;
+	ctx->sq_mask = ctx->sq_ring->ring_mask = p->sq_entries - 1;
+	ctx->cq_entries = ctx->cq_ring->ring_entries = p->cq_entries;
+	ctx->cq_mask = ctx->cq_ring->ring_mask = p->cq_entries - 1;
+	return 0;
+}
+
+/*
+ * Workers are only sized here; io_add_worker() starts them on demand.
+ * Threads count against the owner's RLIMIT_NPROC with the same
+ * exemptions as fork.
+ */
+static int io_start_threads(struct io_ring_ctx *ctx, struct io_uring_params *p)
+{
+	struct task_struct *tsk;
+
+	ctx->max_workers = min_t(unsigned int, p->sq_entries,
+				 2 * num_online_cpus());
+	ctx->workers = kcalloc(ctx->max_workers, sizeof(struct task_struct *),
+			       GFP_KERNEL);
+	if (!ctx->workers)
+		return -ENOMEM;
+
+	ctx->nproc_limit = RLIM_INFINITY;
+	if (!capable(CAP_SYS_ADMIN) && !capable(CAP_SYS_RESOURCE) &&
+	    ctx->creds->user != INIT_USER)
+		ctx->nproc_limit = rlimit(RLIMIT_NPROC);
+
+	if (!(ctx->flags & IORING_SETUP_SQPOLL))
+		return 0;
+
+	ctx->sq_thread_idle = msecs_to_jiffies(p->sq_thread_idle);
+	if (!ctx->sq_thread_idle)
+		ctx->sq_thread_idle = HZ;
+
+	tsk = kthread_create(io_sq_thread, ctx, "io_uring-sq");
+	if (IS_ERR(tsk))
+		return PTR_ERR(tsk);
+	if (ctx->flags & IORING_SETUP_SQ_AFF)
+		kthread_bind(tsk, p->sq_thread_cpu);
+	ctx->sqo_thread = tsk;
+	wake_up_process(tsk);
+	return 0;
+}
+
+static void io_ring_ctx_free(struct io_ring_ctx *ctx)
+{
+	unsigned int i;
+
+	if (ctx->sqo_thread)
+		kthread_stop(ctx->sqo_thread);
+
+	/* cancelled polls are completed by the workers */
+	io_poll_remove_all(ctx);
+
+	ctx->dying = 1;
+	for (i = 0; i < ctx->nr_workers; i++)
+		send_sig(SIGKILL, ctx->workers[i], 1);
+	for (i = 0; i < ctx->nr_workers; i++)
+		kthread_stop(ctx->workers[i]);
+	atomic_sub(ctx->nr_workers, &ctx->creds->user->processes);
+	kfree(ctx->workers);
+
+	WARN_ON(atomic_read(&ctx->inflight));
+
+	io_sqe_files_unregister(ctx);
+	io_sqe_buffers_unregister(ctx);
+
+	io_mem_free(ctx->sq_ring, ctx->sq_ring_size);
+	io_mem_free(ctx->sq_sqes, ctx->sqes_size);
+	io_mem_free(ctx->cq_ring, ctx->cq_ring_size);
+
+	put_cred(ctx->creds);
+	mmdrop(ctx->mm);
+	kfree(ctx);
+}
+
+static struct io_ring_ctx *io_ring_ctx_alloc(struct io_uring_params *p)
+{
+	struct io_ring_ctx *ctx;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return NULL;
+
+	ctx->flags = p->flags;
+	mutex_init(&ctx->uring_lock);
+	spin_lock_init(&ctx->completion_lock);
+	init_waitqueue_head(&ctx->wait);
+	init_waitqueue_head(&ctx->cq_wait);
+	INIT_LIST_HEAD(&ctx->cancel_list);
+	spin_lock_init(&ctx->work_lock);
+	INIT_LIST_HEAD(&ctx->work_list);
+	INIT_LIST_HEAD(&ctx->active_list);
+	init_waitqueue_head(&ctx->work_wait);
+	init_waitqueue_head(&ctx->files_wait);
+	init_waitqueue_head(&ctx->sqo_wait);
+	atomic_set(&ctx->inflight, 0);
+	init_waitqueue_head(&ctx->inflight_wait);
+
+	ctx->mm = current->mm;
+	atomic_inc(&ctx->mm->mm_count);
+	ctx->creds = get_current_cred();
+	if (ctx->flags & IORING_SETUP_SQPOLL)
+		ctx->sqo_files = current->files;
+	return ctx;
+}
+
+static long io_uring_setup(u32 entries, struct io_uring_params *p,
+			   struct io_uring_params __user *params)
+{
+	struct io_ring_ctx *ctx;
+	int ret;
+
+	if (!entries || entries > IORING_MAX_ENTRIES)
+		return -EINVAL;
+
+	if (p->flags & IORING_SETUP_SQPOLL) {
+		if (!capable(CAP_SYS_ADMIN))
+			return -EPERM;
+		if ((p->flags & IORING_SETUP_SQ_AFF) &&
+		    (p->sq_thread_cpu >= nr_cpu_ids ||
+		     !cpu_online(p->sq_thread_cpu)))
+			return -EINVAL;
+	} else if (p->flags & IORING_SETUP_SQ_AFF) {
+		return -EINVAL;
+	}
+
+	p->sq_entries = roundup_pow_of_two(entries);
+	p->cq_entries = 2 * p->sq_entries;
+
+	ctx = io_ring_ctx_alloc(p);
+	if (!ctx)
+		return -ENOMEM;
+
+	ret = io_allocate_rings(ctx, p);
+	if (ret)
+		goto err;
+	ret = io_start_threads(ctx, p);
+	if (ret)
+		goto err;
+
+	memset(&p->sq_off, 0, sizeof(p->sq_off));
+	p->sq_off.head = offsetof(struct io_sq_ring, r.head);
+	p->sq_off.tail = offsetof(struct io_sq_ring, r.tail);
+	p->sq_off.ring_mask = offsetof(struct io_sq_ring, ring_mask);
+	p->sq_off.ring_entries = offsetof(struct io_sq_ring, ring_entries);
+	p->sq_off.flags = offsetof(struct io_sq_ring, flags);
+	p->sq_off.dropped = offsetof(struct io_sq_ring, dropped);
+	p->sq_off.array = offsetof(struct io_sq_ring, array);
+
+	memset(&p->cq_off, 0, sizeof(p->cq_off));
+	p->cq_off.head = offsetof(struct io_cq_ring, r.head);
+	p->cq_off.tail = offsetof(struct io_cq_ring, r.tail);
+	p->cq_off.ring_mask = offsetof(struct io_cq_ring, ring_mask);
+	p->cq_off.ring_entries = offsetof(struct io_cq_ring, ring_entries);
+	p->cq_off.overflow = offsetof(struct io_cq_ring, overflow);
+	p->cq_off.cqes = offsetof(struct io_cq_ring, cqes);
+
+	ret = -EFAULT;
+	if (copy_to_user(params, p, sizeof(*p)))
+		goto err;
+
+	ret = anon_inode_getfd("[io_uring]", &io_uring_fops, ctx,
+			       O_RDWR | O_CLOEXEC);
+	if (ret < 0)
+		goto err;
+	return ret;
+err:
+	io_ring_ctx_free(ctx);
+	return ret;
+}
+
+/*
+ * Sets up an io_uring instance: an SQ ring of at least @entries entries
+ * and a CQ ring twice that size.  Returns a file descriptor that the
+ * rings are mmapped from and that is passed to io_uring_enter().
+ * No worker threads are started until requests need them.
+ */
+SYSCALL_DEFINE2(io_uring_setup, u32, entries,
+		struct io_uring_params __user *, params)
+{
+	struct io_uring_params p;
+	int i;
+
+	if (copy_from_user(&p, params, sizeof(p)))
+		return -EFAULT;
+	for (i = 0; i < ARRAY_SIZE(p.resv); i++)
+		if (p.resv[i])
+			return -EINVAL;
+	if (p.flags & ~(IORING_SETUP_SQPOLL | IORING_SETUP_SQ_AFF))
+		return -EINVAL;
+
+	return io_uring_setup(entries, &p, params);
+}
+
+/*
+ * Submits up to @to_submit sqes and, with IORING_ENTER_GETEVENTS, waits
+ * until at least @min_complete cqes are available.  With an SQ thread
+ * the submission is the thread's job and IORING_ENTER_SQ_WAKEUP wakes it.
+ */
+SYSCALL_DEFINE4(io_uring_enter, unsigned int, fd, u32, to_submit,
+		u32, min_complete, u32, flags)
+{
+	struct io_ring_ctx *ctx;
+	struct file *file;
+	int submitted = 0;
+	int ret = -EBADF;
+
+	if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP))
+		return -EINVAL;
+
+	file = fget(fd);
+	if (!file)
+		return -EBADF;
+
+	ret = -EOPNOTSUPP;
+	if (file->f_op != &io_uring_fops)
+		goto out_fput;
+
+	ctx = file->private_data;
+	ret = 0;
+	if (ctx->flags & IORING_SETUP_SQPOLL) {
+		if (flags & IORING_ENTER_SQ_WAKEUP)
+			wake_up(&ctx->sqo_wait);
+		submitted = to_submit;
+	} else if (to_submit) {
+		to_submit = min(to_submit, ctx->sq_entries);
+
+		mutex_lock(&ctx->uring_lock);
+		submitted = io_submit_sqes(ctx, to_submit);
+		mutex_unlock(&ctx->uring_lock);
+	}
+
+	if (flags & IORING_ENTER_GETEVENTS) {
+		min_complete = min(min_complete, ctx->cq_entries);
+		ret = io_cqring_wait(ctx, min_complete);
+	}
+
+out_fput:
+	fput(file);
+	return submitted ? submitted : ret;
+}
+
+/*
+ * Registration changes what in-flight requests may be using, so it
+ * waits for all of them to finish.  uring_lock keeps new ones out.
+ */
+SYSCALL_DEFINE4(io_uring_register, unsigned int, fd, unsigned int, opcode,
+		void __user *, arg, unsigned int, nr_args)
+{
+	struct io_ring_ctx *ctx;
+	struct file *file;
+	long ret;
+
+	file = fget(fd);
+	if (!file)
+		return -EBADF;
+
+	ret = -EOPNOTSUPP;
+	if (file->f_op != &io_uring_fops)
+		goto out_fput;
+
+	ctx = file->private_data;
+	mutex_lock(&ctx->uring_lock);
+
+	ret = wait_event_interruptible(ctx->inflight_wait,
+				       !atomic_read(&ctx->inflight));
+	if (ret) {
+		ret = -EINTR;
+		goto out_unlock;
+	}
+
+	switch (opcode) {
+	case IORING_REGISTER_BUFFERS:
+		ret = io_sqe_buffers_register(ctx, arg, nr_args);
+		break;
+	case IORING_UNREGISTER_BUFFERS:
+		ret = -EINVAL;
+		if (arg || nr_args)
+			break;
+		ret = -ENXIO;
+		if (!ctx->user_bufs)
+			break;
+		io_sqe_buffers_unregister(ctx);
+		ret = 0;
+		break;
+	case IORING_REGISTER_FILES:
+		ret = io_sqe_files_register(ctx, arg, nr_args);
+		break;
+	case IORING_UNREGISTER_FILES:
+		ret = -EINVAL;
+		if (arg || nr_args)
+			break;
+		ret = -ENXIO;
+		if (!ctx->user_files)
+			break;
+		io_sqe_files_unregister(ctx);
+		ret = 0;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+out_unlock:
+	mutex_unlock(&ctx->uring_lock);
+out_fput:
+	fput(file);
+	return ret;
+}
+
+/*
+ * File operations on the ring fd
+ */
+
+static unsigned int io_uring_poll(struct file *file, poll_table *wait)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+	unsigned int mask = 0;
+
+	poll_wait(file, &ctx->cq_wait, wait);
+	smp_rmb();
+	if (ACCESS_ONCE(ctx->sq_ring->r.tail) - ctx->cached_sq_head !=
+	    ctx->sq_entries)
+		mask |= POLLOUT | POLLWRNORM;
+	if (io_cqring_events(ctx))
+		mask |= POLLIN | POLLRDNORM;
+
+	return mask;
+}
+
+static int io_uring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+	loff_t offset = (loff_t)vma->vm_pgoff << PAGE_SHIFT;
+	unsigned long sz = vma->vm_end - vma->vm_start;
+	size_t size;
+	void *ptr;
+
+	switch (offset) {
+	case IORING_OFF_SQ_RING:
+		ptr = ctx->sq_ring;
+		size = ctx->sq_ring_size;
+		break;
+	case IORING_OFF_SQES:
+		ptr = ctx->sq_sqes;
+		size = ctx->sqes_size;
+		break;
+	case IORING_OFF_CQ_RING:
+		ptr = ctx->cq_ring;
+		size = ctx->cq_ring_size;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (sz > PAGE_ALIGN(size))
+		return -EINVAL;
+
+	return remap_pfn_range(vma, vma->vm_start,
+			       virt_to_phys(ptr) >> PAGE_SHIFT, sz,
+			       vma->vm_page_prot);
+}
+
+/*
+ * Accepts punted to a worker run with the submitter's file table.  It
+ * must not outlive the table, and every descriptor in it is flushed
+ * before the table is freed, so cancel and wait for them here.  An
+ * exiting task also cancels everything else it left blocked in the
+ * workers, since those hold its mm.
+ */
+static int io_uring_flush(struct file *file, fl_owner_t id)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+	struct files_struct *files = id;
+
+	spin_lock_irq(&ctx->work_lock);
+	if (ctx->sqo_files == files)
+		ctx->sqo_files = NULL;
+	spin_unlock_irq(&ctx->work_lock);
+
+	if (fatal_signal_pending(current) || (current->flags & PF_EXITING))
+		io_cancel_async(ctx, NULL);
+	else
+		io_cancel_async(ctx, files);
+
+	wait_event(ctx->files_wait, !io_files_busy(ctx, files));
+	return 0;
+}
+
+static int io_uring_release(struct inode *inode, struct file *file)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+
+	file->private_data = NULL;
+	io_ring_ctx_free(ctx);
+	return 0;
+}
+
+static const struct file_operations io_uring_fops = {
+	.release	= io_uring_release,
+	.flush		= io_uring_flush,
+	.mmap		= io_uring_mmap,
+	.poll		= io_uring_poll,
+};
+
+static int __init io_uring_init(void)
+{
+	req_cachep = KMEM_CACHE(io_kiocb, SLAB_HWCACHE_ALIGN | SLAB_PANIC);
+	return 0;
+}
+__initcall(io_uring_init);
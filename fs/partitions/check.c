@@ -266,7 +266,33 @@ ssize_t part_inflight_show(struct device *dev,
 {
 	struct hd_struct *p = dev_to_part(dev);
 
-	return sprintf(buf, "%8u %8u\n", p->in_flight[0], p->in_flight[1]);
+	return sprintf(buf, "%8u %8u\n", atomic_read(&p->in_flight[0]),
+		atomic_read(&p->in_flight[1]));
+}
+
+/*
+ * One line per latency bucket: its upper bound in usecs, then the number
+ * of reads, writes and discards that completed within it.
+ */
+ssize_t part_lat_hist_show(struct device *dev,
+			   struct device_attribute *attr, char *buf)
+{
+	struct hd_struct *p = dev_to_part(dev);
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < DISK_LAT_BUCKETS; i++) {
+		if (i < DISK_LAT_BUCKETS - 1)
+			len += sprintf(buf + len, "%8lu", 1UL << i);
+		else
+			len += sprintf(buf + len, "%8s", "inf");
+		len += sprintf(buf + len, " %8lu %8lu %8lu\n",
+			part_stat_read(p, lat_hist[DISK_LAT_READ][i]),
+			part_stat_read(p, lat_hist[DISK_LAT_WRITE][i]),
+			part_stat_read(p, lat_hist[DISK_LAT_DISCARD][i]));
+	}
+
+	return len;
 }
 
 #ifdef CONFIG_FAIL_MAKE_REQUEST
@@ -300,6 +326,7 @@ static DEVICE_ATTR(discard_alignment, S_IRUGO, part_discard_alignment_show,
 		   NULL);
 static DEVICE_ATTR(stat, S_IRUGO, part_stat_show, NULL);
 static DEVICE_ATTR(inflight, S_IRUGO, part_inflight_show, NULL);
+static DEVICE_ATTR(latency_hist, S_IRUGO, part_lat_hist_show, NULL);
 #ifdef CONFIG_FAIL_MAKE_REQUEST
 static struct device_attribute dev_attr_fail =
 	__ATTR(make-it-fail, S_IRUGO|S_IWUSR, part_fail_show, part_fail_store);
@@ -313,6 +340,7 @@ static struct attribute *part_attrs[] = {
 	&dev_attr_discard_alignment.attr,
 	&dev_attr_stat.attr,
 	&dev_attr_inflight.attr,
+	&dev_attr_latency_hist.attr,
 #ifdef CONFIG_FAIL_MAKE_REQUEST
 	&dev_attr_fail.attr,
 #endif
@@ -2,6 +2,8 @@
 #define __LINUX__AIO_H
 
 #include <linux/list.h>
+#include <linux/wait.h>
+#include <linux/mutex.h>
 #include <linux/workqueue.h>
 #include <linux/aio_abi.h>
 #include <linux/uio.h>
@@ -117,6 +119,9 @@ struct kiocb {
 
 	struct list_head	ki_list;	/* the aio core uses this
 						 * for cancellation */
+	struct wait_bit_queue	ki_wait;	/* -EIOCBRETRY waits on a page
+						 * bit, see current->io_wait */
+	wait_queue_head_t	*ki_wait_head;	/* queue ki_wait was put on */
 
 	/*
 	 * If the aio_resfd field of the userspace iocb is not zero,
@@ -141,6 +146,33 @@ struct kiocb {
 		(x)->ki_user_data = 0;                  \
 	} while (0)
 
+/*
+ * The wait entry through which the ki_retry method of @iocb may wait for
+ * a page instead of blocking, returning -EIOCBRETRY to have the iocb
+ * kicked later.  NULL when @iocb is not being retried by the AIO core.
+ */
+#define kiocb_io_wait(iocb)						\
+	(!is_sync_kiocb(iocb) && current->io_wait == &(iocb)->ki_wait ?	\
+	 current->io_wait : NULL)
+
+/*
+ * Take ki_wait off the page waitqueue it was put on, if it is still
+ * there.  Only the retry of @iocb, or the AIO core around it, may call
+ * this.
+ */
+static inline void kiocb_dequeue_wait(struct kiocb *iocb)
+{
+	wait_queue_head_t *q = iocb->ki_wait_head;
+	unsigned long flags;
+
+	if (q) {
+		spin_lock_irqsave(&q->lock, flags);
+		list_del_init(&iocb->ki_wait.wait.task_list);
+		spin_unlock_irqrestore(&q->lock, flags);
+		iocb->ki_wait_head = NULL;
+	}
+}
+
 #define AIO_RING_MAGIC			0xa10a10a1
 #define AIO_RING_COMPAT_FEATURES	1
 #define AIO_RING_INCOMPAT_FEATURES	0
@@ -159,22 +191,32 @@ struct aio_ring {
 	struct io_event		io_events[0];
 }; /* 128 bytes + ring size */
 
-#define aio_ring_avail(info, ring)	(((ring)->head + (info)->nr - 1 - (ring)->tail) % (info)->nr)
-
+/*
+ * The kernel only ever writes tail and userspace may reap events itself
+ * by advancing head, so that io_getevents() is not needed to consume
+ * them.  Events are visible once tail covers them (smp_wmb in
+ * aio_complete), and their slots are reused once head has passed them.
+ */
 #define AIO_RING_PAGES	8
 struct aio_ring_info {
 	unsigned long		mmap_base;
 	unsigned long		mmap_size;
 
 	struct page		**ring_pages;
-	spinlock_t		ring_lock;
+	struct mutex		ring_lock;	/* serializes kernel reapers */
 	long			nr_pages;
 
 	unsigned		nr, tail;
+	unsigned		completed_events; /* posted since the last
+						   * refill of reqs_available */
 
 	struct page		*internal_pages[AIO_RING_PAGES];
 };
 
+struct kioctx_cpu {
+	unsigned		reqs_available;
+};
+
 struct kioctx {
 	atomic_t		users;
 	int			dead;
@@ -195,6 +237,15 @@ struct kioctx {
 	/* sys_io_setup currently limits this to an unsigned int */
 	unsigned		max_reqs;
 
+	/*
+	 * Ring slots not held by a request in flight or by an event that
+	 * has not been reaped.  Cached per cpu in batches of req_batch so
+	 * that io_submit() rarely touches the shared count.
+	 */
+	struct kioctx_cpu __percpu *cpu;
+	unsigned		req_batch;
+	atomic_t		reqs_available;
+
 	struct aio_ring_info	ring_info;
 
 	struct delayed_work	wq;
@@ -0,0 +1,122 @@
+#ifndef BLK_MQ_H
+#define BLK_MQ_H
+
+#include <linux/blkdev.h>
+
+struct blk_mq_tags;
+struct blk_mq_ctx;
+
+/*
+ * A hardware dispatch queue.  Requests are collected here from the
+ * per-cpu software queues mapped to it and handed to ->queue_rq().
+ */
+struct blk_mq_hw_ctx {
+	struct {
+		spinlock_t		lock;
+		struct list_head	dispatch;	/* requests sent back
+							 * by a busy driver */
+	} ____cacheline_aligned_in_smp;
+
+	unsigned long		state;		/* BLK_MQ_S_* flags */
+	struct work_struct	run_work;
+
+	struct request_queue	*queue;
+	unsigned int		queue_num;
+	void			*driver_data;
+
+	unsigned int		nr_ctx;
+	struct blk_mq_ctx	**ctxs;
+	unsigned long		*ctx_map;	/* software queues with work */
+
+	struct blk_mq_tags	*tags;
+	struct request		**rqs;		/* preallocated, by tag */
+
+	unsigned long		queued;
+	unsigned long		run;
+
+	int			numa_node;
+};
+
+typedef int (queue_rq_fn)(struct blk_mq_hw_ctx *, struct request *);
+typedef void (commit_rqs_fn)(struct blk_mq_hw_ctx *);
+typedef struct blk_mq_hw_ctx *(map_queue_fn)(struct request_queue *,
+					      const int);
+typedef int (init_hctx_fn)(struct blk_mq_hw_ctx *, void *, unsigned int);
+typedef void (exit_hctx_fn)(struct blk_mq_hw_ctx *, unsigned int);
+
+struct blk_mq_ops {
+	/*
+	 * Queue request.  Called from process context, so it may sleep;
+	 * returns one of BLK_MQ_RQ_QUEUE_*.  A driver that returns BUSY
+	 * must have stopped the hardware queue, and restart it once it
+	 * can take requests again.
+	 */
+	queue_rq_fn		*queue_rq;
+
+	/*
+	 * Optional.  Called once a run has handed over all it could, if
+	 * ->queue_rq() accepted any request, so a driver can notify the
+	 * hardware once per batch rather than per request.
+	 */
+	commit_rqs_fn		*commit_rqs;
+
+	/* Map a cpu to a hardware queue, normally blk_mq_map_queue() */
+	map_queue_fn		*map_queue;
+
+	/*
+	 * Finish a request passed to blk_mq_complete_request(), on the
+	 * cpu that submitted it.  Normally ends in blk_mq_end_io().
+	 */
+	softirq_done_fn		*complete;
+
+	/* Optional per hardware queue setup and teardown */
+	init_hctx_fn		*init_hctx;
+	exit_hctx_fn		*exit_hctx;
+};
+
+struct blk_mq_reg {
+	struct blk_mq_ops	*ops;
+	unsigned int		nr_hw_queues;
+	unsigned int		queue_depth;	/* tags per hardware queue */
+	unsigned int		cmd_size;	/* per-request driver data */
+	int			numa_node;
+};
+
+enum {
+	BLK_MQ_RQ_QUEUE_OK	= 0,	/* queued fine */
+	BLK_MQ_RQ_QUEUE_BUSY	= 1,	/* requeue IO for later */
+	BLK_MQ_RQ_QUEUE_ERROR	= 2,	/* end IO with error */
+
+	BLK_MQ_S_STOPPED	= 0,
+
+	BLK_MQ_MAX_DEPTH	= 2048,
+};
+
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *, void *);
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *, const int);
+
+struct request *blk_mq_alloc_request(struct request_queue *, int, gfp_t);
+void blk_mq_free_request(struct request *);
+void blk_mq_insert_request(struct request *, bool, bool, bool);
+
+void blk_mq_end_io(struct request *, int);
+void blk_mq_complete_request(struct request *);
+
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *);
+void blk_mq_start_stopped_hw_queues(struct request_queue *, bool);
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *, bool);
+void blk_mq_run_hw_queues(struct request_queue *, bool);
+
+/*
+ * Driver command data is allocated right behind the request.
+ */
+static inline void *blk_mq_rq_to_pdu(struct request *rq)
+{
+	return (void *) rq + sizeof(*rq);
+}
+
+#define queue_for_each_hw_ctx(q, hctx, i)				\
+	for ((i) = 0; (i) < (q)->nr_hw_queues &&			\
+	     ({ hctx = (q)->queue_hw_ctx[i]; 1; }); (i)++)
+
+#endif
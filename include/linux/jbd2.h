@@ -578,12 +578,13 @@ struct transaction_s
 	struct list_head	t_inode_list;
 
 	/*
-	 * Protects info related to handles
+	 * Protects t_max_wait; the handle counters below are atomic
 	 */
 	spinlock_t		t_handle_lock;
 
 	/*
 	 * Longest time some handle had to wait for running transaction
+	 * [t_handle_lock]
 	 */
 	unsigned long		t_max_wait;
 
@@ -598,16 +599,18 @@ struct transaction_s
 	struct transaction_chp_stats_s t_chp_stats;
 
 	/*
-	 * Number of outstanding updates running on this transaction
-	 * [t_handle_lock]
+	 * Number of outstanding updates running on this transaction.
+	 * Raised only under a read lock of j_state_lock while the
+	 * transaction is T_RUNNING, so the commit code can wait for it to
+	 * drain after moving to T_LOCKED under the write lock. [none]
 	 */
-	int			t_updates;
+	atomic_t		t_updates;
 
 	/*
 	 * Number of buffers reserved for use by all handles in this transaction
-	 * handle but not yet modified. [t_handle_lock]
+	 * handle but not yet modified. [none]
 	 */
-	int			t_outstanding_credits;
+	atomic_t		t_outstanding_credits;
 
 	/*
 	 * Forward and backward links for the circular list of all transactions
@@ -627,9 +630,9 @@ struct transaction_s
 	ktime_t			t_start_time;
 
 	/*
-	 * How many handles used this transaction? [t_handle_lock]
+	 * How many handles used this transaction? [none]
 	 */
-	int t_handle_count;
+	atomic_t		t_handle_count;
 
 	/*
 	 * This transaction is being forced and some process is
@@ -717,6 +720,8 @@ jbd2_time_diff(unsigned long start, unsigned long end)
  * @j_transaction_sequence: Sequence number of the next transaction to grant
  * @j_commit_sequence: Sequence number of the most recently committed
  *  transaction
+ * @j_commit_durable: Sequence number of the most recent transaction whose
+ *  commit record is on disk
  * @j_commit_request: Sequence number of the most recent transaction wanting
  *     commit
  * @j_uuid: Uuid of client object.
@@ -764,7 +769,7 @@ struct journal_s
 	/*
 	 * Protect the various scalars in the journal
 	 */
-	spinlock_t		j_state_lock;
+	rwlock_t		j_state_lock;
 
 	/*
 	 * Number of processes waiting to create a barrier lock [j_state_lock]
@@ -893,6 +898,13 @@ struct journal_s
 	 */
 	tid_t			j_commit_sequence;
 
+	/*
+	 * Sequence number of the most recent transaction whose commit record
+	 * has reached the disk.  Runs ahead of j_commit_sequence while the
+	 * commit thread is still doing checkpoint processing. [j_state_lock]
+	 */
+	tid_t			j_commit_durable;
+
 	/*
 	 * Sequence number of the most recent transaction wanting commit
 	 * [j_state_lock]
@@ -1186,6 +1198,7 @@ int __jbd2_log_start_commit(journal_t *journal, tid_t tid);
 int jbd2_journal_start_commit(journal_t *journal, tid_t *tid);
 int jbd2_journal_force_commit_nested(journal_t *journal);
 int jbd2_log_wait_commit(journal_t *journal, tid_t tid);
+int jbd2_log_wait_finish(journal_t *journal, tid_t tid);
 int jbd2_log_do_checkpoint(journal_t *journal);
 
 void __jbd2_log_wait_for_space(journal_t *journal);
@@ -1256,8 +1269,8 @@ static inline int jbd_space_needed(journal_t *journal)
 {
 	int nblocks = journal->j_max_transaction_buffers;
 	if (journal->j_committing_transaction)
-		nblocks += journal->j_committing_transaction->
-					t_outstanding_credits;
+		nblocks += atomic_read(&journal->j_committing_transaction->
+					t_outstanding_credits);
 	return nblocks;
 }
 
@@ -0,0 +1,399 @@
+#ifndef _IP_SET_HASH_H
+#define _IP_SET_HASH_H
+
+/* Copyright (C) 2003-2010 Jozsef Kadlecsik <kadlec@blackhole.kfki.hu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* Generic part of the hash:ip and hash:net set types. Elements are
+ * addresses masked to a prefix length, hashed into chained buckets.
+ * Readers (the packet path) run under read_lock_bh(&set->lock), writers
+ * under write_lock_bh(&set->lock). The table is grown from process
+ * context only: userspace adds return -EAGAIN when the average chain
+ * length would exceed IPSET_HASH_MAX_CHAIN, the core then calls the
+ * resize function and retries.
+ */
+
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <net/ipv6.h>
+#include <linux/netfilter/ipset/ip_set.h>
+
+#define IPSET_DEFAULT_HASHSIZE		1024
+#define IPSET_MIMINAL_HASHSIZE		64
+#define IPSET_DEFAULT_MAXELEM		65536
+#define IPSET_HASH_MAX_CHAIN		4
+
+#define IPSET_HOST_MASK(family)		((family) == NFPROTO_IPV4 ? 32 : 128)
+
+/* A hash element */
+struct ip_set_hash_elem {
+	struct hlist_node node;
+	union nf_inet_addr ip;		/* address, masked to cidr */
+	u8 cidr;			/* prefix length */
+};
+
+/* The hash and its bookkeeping */
+struct ip_set_hash {
+	struct hlist_head *table;	/* the hash buckets */
+	u8 htable_bits;			/* size of table is 2^htable_bits */
+	u8 family;			/* NFPROTO_IPV4 or NFPROTO_IPV6 */
+	u8 netmask;			/* hash:ip: fixed mask, hash:net: 0 */
+	u8 ncidr;			/* number of entries in cidr[] */
+	u32 elements;			/* current element number */
+	u32 maxelem;			/* max elements in the hash */
+	u32 initval;			/* random jhash init value */
+	u8 cidr[129];			/* prefix lengths in use, longest first */
+	u32 nets[129];			/* number of elements per prefix length */
+};
+
+#define ip_set_htable_size(bits)	((u32)1 << (bits))
+
+static inline u32
+ip_set_hash_key(const struct ip_set_hash *h, const union nf_inet_addr *ip,
+		u8 cidr, u8 htable_bits)
+{
+	return jhash2((const u32 *)ip->all, h->family == NFPROTO_IPV4 ? 1 : 4,
+		      h->initval ^ cidr) & (ip_set_htable_size(htable_bits) - 1);
+}
+
+static inline bool
+ip_set_hash_addr_equal(const struct ip_set_hash *h,
+		       const union nf_inet_addr *a, const union nf_inet_addr *b)
+{
+	if (h->family == NFPROTO_IPV4)
+		return a->ip == b->ip;
+	return ipv6_addr_equal(&a->in6, &b->in6);
+}
+
+static inline struct ip_set_hash_elem *
+ip_set_hash_lookup(const struct ip_set_hash *h, const union nf_inet_addr *ip,
+		   u8 cidr)
+{
+	struct ip_set_hash_elem *e;
+	struct hlist_node *n;
+	u32 key = ip_set_hash_key(h, ip, cidr, h->htable_bits);
+
+	hlist_for_each_entry(e, n, &h->table[key], node)
+		if (e->cidr == cidr && ip_set_hash_addr_equal(h, &e->ip, ip))
+			return e;
+	return NULL;
+}
+
+/* Keep cidr[] sorted from the most specific prefix length down, so that
+ * lookups by packet address try the longest prefixes first. */
+static inline void
+ip_set_hash_add_cidr(struct ip_set_hash *h, u8 cidr)
+{
+	int i, j;
+
+	if (h->nets[cidr]++)
+		return;
+
+	for (i = 0; i < h->ncidr && h->cidr[i] > cidr; i++)
+		;
+	for (j = h->ncidr; j > i; j--)
+		h->cidr[j] = h->cidr[j - 1];
+	h->cidr[i] = cidr;
+	h->ncidr++;
+}
+
+static inline void
+ip_set_hash_del_cidr(struct ip_set_hash *h, u8 cidr)
+{
+	int i;
+
+	if (--h->nets[cidr])
+		return;
+
+	for (i = 0; i < h->ncidr && h->cidr[i] != cidr; i++)
+		;
+	h->ncidr--;
+	for (; i < h->ncidr; i++)
+		h->cidr[i] = h->cidr[i + 1];
+}
+
+/* Add an element: may_grow is set for userspace requests, which can
+ * sleep in the resize function when we return -EAGAIN. */
+static inline int
+ip_set_hash_add(struct ip_set_hash *h, const union nf_inet_addr *ip, u8 cidr,
+		bool may_grow)
+{
+	struct ip_set_hash_elem *e;
+
+	if (ip_set_hash_lookup(h, ip, cidr))
+		return -IPSET_ERR_EXIST;
+	if (h->elements >= h->maxelem)
+		return -IPSET_ERR_HASH_FULL;
+	if (may_grow &&
+	    h->elements >= ip_set_htable_size(h->htable_bits) *
+			   IPSET_HASH_MAX_CHAIN)
+		return -EAGAIN;
+
+	e = kmalloc(sizeof(*e), GFP_ATOMIC);
+	if (e == NULL)
+		return -ENOMEM;
+	e->ip = *ip;
+	e->cidr = cidr;
+	hlist_add_head(&e->node,
+		       &h->table[ip_set_hash_key(h, ip, cidr, h->htable_bits)]);
+	ip_set_hash_add_cidr(h, cidr);
+	h->elements++;
+	return 0;
+}
+
+static inline int
+ip_set_hash_del(struct ip_set_hash *h, const union nf_inet_addr *ip, u8 cidr)
+{
+	struct ip_set_hash_elem *e = ip_set_hash_lookup(h, ip, cidr);
+
+	if (e == NULL)
+		return -IPSET_ERR_EXIST;
+	hlist_del(&e->node);
+	kfree(e);
+	ip_set_hash_del_cidr(h, cidr);
+	h->elements--;
+	return 0;
+}
+
+/* Test an unmasked address against every prefix length in the set */
+static inline int
+ip_set_hash_test_cidrs(const struct ip_set_hash *h,
+		       const union nf_inet_addr *ip)
+{
+	union nf_inet_addr masked;
+	int i;
+
+	for (i = 0; i < h->ncidr; i++) {
+		masked = *ip;
+		ip_set_mask_addr(&masked, h->family, h->cidr[i]);
+		if (ip_set_hash_lookup(h, &masked, h->cidr[i]))
+			return 1;
+	}
+	return 0;
+}
+
+static inline int
+ip_set_hash_adt(struct ip_set_hash *h, enum ipset_adt adt,
+		const union nf_inet_addr *ip, u8 cidr, bool may_grow)
+{
+	switch (adt) {
+	case IPSET_ADD:
+		return ip_set_hash_add(h, ip, cidr, may_grow);
+	case IPSET_DEL:
+		return ip_set_hash_del(h, ip, cidr);
+	default:
+		return ip_set_hash_lookup(h, ip, cidr) != NULL;
+	}
+}
+
+/* Get the address attribute according to the family of the set */
+static inline int
+ip_set_hash_get_ip(const struct ip_set_hash *h, struct nlattr *nla,
+		   union nf_inet_addr *ip)
+{
+	memset(ip, 0, sizeof(*ip));
+	if (h->family == NFPROTO_IPV4)
+		return ip_set_get_ipaddr4(nla, &ip->ip);
+	return ip_set_get_ipaddr6(nla, ip);
+}
+
+static inline int
+ip_set_hash_create(struct ip_set *set,
+		   const struct ip_set_type_variant *variant,
+		   u32 hashsize, u32 maxelem, u8 netmask)
+{
+	struct ip_set_hash *h;
+	u8 htable_bits;
+
+	if (!(set->family == NFPROTO_IPV4 || set->family == NFPROTO_IPV6))
+		return -IPSET_ERR_INVALID_FAMILY;
+
+	if (hashsize < IPSET_MIMINAL_HASHSIZE)
+		hashsize = IPSET_MIMINAL_HASHSIZE;
+	if (hashsize > 1U << 30)
+		hashsize = 1U << 30;
+	htable_bits = ilog2(roundup_pow_of_two(hashsize));
+
+	h = kzalloc(sizeof(*h), GFP_KERNEL);
+	if (h == NULL)
+		return -ENOMEM;
+
+	h->table = ip_set_alloc(sizeof(struct hlist_head) << htable_bits);
+	if (h->table == NULL) {
+		kfree(h);
+		return -ENOMEM;
+	}
+	h->htable_bits = htable_bits;
+	h->family = set->family;
+	h->netmask = netmask;
+	h->maxelem = maxelem;
+	get_random_bytes(&h->initval, sizeof(h->initval));
+
+	set->data = h;
+	set->variant = variant;
+	return 0;
+}
+
+/* Double the number of buckets: called from process context without
+ * the set lock held, the elements are moved under the write lock. */
+static inline int
+ip_set_hash_resize(struct ip_set *set)
+{
+	struct ip_set_hash *h = set->data;
+	struct hlist_head *table, *orig;
+	struct ip_set_hash_elem *e;
+	struct hlist_node *n, *tmp;
+	u8 htable_bits = h->htable_bits + 1;
+	u32 i;
+
+	if (htable_bits > 30)
+		return -IPSET_ERR_HASH_FULL;
+
+	table = ip_set_alloc(sizeof(struct hlist_head) << htable_bits);
+	if (table == NULL)
+		return -ENOMEM;
+
+	write_lock_bh(&set->lock);
+	orig = h->table;
+	for (i = 0; i < ip_set_htable_size(h->htable_bits); i++) {
+		hlist_for_each_entry_safe(e, n, tmp, &orig[i], node) {
+			hlist_del(&e->node);
+			hlist_add_head(&e->node,
+				       &table[ip_set_hash_key(h, &e->ip, e->cidr,
+							      htable_bits)]);
+		}
+	}
+	h->table = table;
+	h->htable_bits = htable_bits;
+	write_unlock_bh(&set->lock);
+
+	ip_set_free(orig);
+	pr_debug("set %s resized to %u buckets\n",
+		 set->name, ip_set_htable_size(htable_bits));
+	return 0;
+}
+
+static inline void
+ip_set_hash_flush(struct ip_set *set)
+{
+	struct ip_set_hash *h = set->data;
+	struct ip_set_hash_elem *e;
+	struct hlist_node *n, *tmp;
+	u32 i;
+
+	for (i = 0; i < ip_set_htable_size(h->htable_bits); i++) {
+		hlist_for_each_entry_safe(e, n, tmp, &h->table[i], node)
+			kfree(e);
+		INIT_HLIST_HEAD(&h->table[i]);
+	}
+	memset(h->nets, 0, sizeof(h->nets));
+	h->ncidr = 0;
+	h->elements = 0;
+}
+
+static inline void
+ip_set_hash_destroy(struct ip_set *set)
+{
+	struct ip_set_hash *h = set->data;
+
+	ip_set_hash_flush(set);
+	ip_set_free(h->table);
+	kfree(h);
+	set->data = NULL;
+}
+
+static inline int
+ip_set_hash_head(struct ip_set *set, struct sk_buff *skb)
+{
+	const struct ip_set_hash *h = set->data;
+	struct nlattr *nested;
+	size_t memsize;
+
+	memsize = sizeof(*h) +
+		  (sizeof(struct hlist_head) << h->htable_bits) +
+		  h->elements * sizeof(struct ip_set_hash_elem);
+
+	nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
+	if (!nested)
+		goto nla_put_failure;
+	NLA_PUT_NET32(skb, IPSET_ATTR_HASHSIZE,
+		      htonl(ip_set_htable_size(h->htable_bits)));
+	NLA_PUT_NET32(skb, IPSET_ATTR_MAXELEM, htonl(h->maxelem));
+	if (h->netmask && h->netmask != IPSET_HOST_MASK(h->family))
+		NLA_PUT_U8(skb, IPSET_ATTR_NETMASK, h->netmask);
+	NLA_PUT_NET32(skb, IPSET_ATTR_ELEMENTS, htonl(h->elements));
+	/* The dump holds a reference itself */
+	NLA_PUT_NET32(skb, IPSET_ATTR_REFERENCES, htonl(set->ref - 1));
+	NLA_PUT_NET32(skb, IPSET_ATTR_MEMSIZE, htonl(memsize));
+	ipset_nest_end(skb, nested);
+
+	return 0;
+nla_put_failure:
+	return -EMSGSIZE;
+}
+
+/* List the elements, resuming at bucket cb->args[IPSET_CB_ARG0] and
+ * position cb->args[IPSET_CB_ARG1] within that bucket. A resize between
+ * two dump rounds may reorder the elements, the listing stays safe. */
+static inline int
+ip_set_hash_list(const struct ip_set *set, struct sk_buff *skb,
+		 struct netlink_callback *cb)
+{
+	const struct ip_set_hash *h = set->data;
+	const struct ip_set_hash_elem *e;
+	const struct hlist_node *n;
+	struct nlattr *atd, *nested;
+	unsigned long pos;
+
+	atd = ipset_nest_start(skb, IPSET_ATTR_ADT);
+	if (!atd)
+		return -EMSGSIZE;
+
+	for (; cb->args[IPSET_CB_ARG0] < ip_set_htable_size(h->htable_bits);
+	     cb->args[IPSET_CB_ARG0]++, cb->args[IPSET_CB_ARG1] = 0) {
+		pos = 0;
+		hlist_for_each_entry(e, n, &h->table[cb->args[IPSET_CB_ARG0]],
+				     node) {
+			if (pos++ < cb->args[IPSET_CB_ARG1])
+				continue;
+			nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
+			if (!nested)
+				goto message_full;
+			if (h->family == NFPROTO_IPV4)
+				NLA_PUT_IPADDR4(skb, IPSET_ATTR_IP, e->ip.ip);
+			else
+				NLA_PUT_IPADDR6(skb, IPSET_ATTR_IP, &e->ip.in6);
+			if (!h->netmask)
+				NLA_PUT_U8(skb, IPSET_ATTR_CIDR, e->cidr);
+			ipset_nest_end(skb, nested);
+			cb->args[IPSET_CB_ARG1] = pos;
+		}
+	}
+	ipset_nest_end(skb, atd);
+	cb->args[IPSET_CB_ARG0] = cb->args[IPSET_CB_ARG1] = 0;
+	return 0;
+
+nla_put_failure:
+	nla_nest_cancel(skb, nested);
+message_full:
+	ipset_nest_end(skb, atd);
+	return 1;
+}
+
+static inline bool
+ip_set_hash_same_set(const struct ip_set *a, const struct ip_set *b)
+{
+	const struct ip_set_hash *x = a->data;
+	const struct ip_set_hash *y = b->data;
+
+	/* Resizing changes htable_bits, so we ignore it */
+	return x->maxelem == y->maxelem && x->netmask == y->netmask;
+}
+
+#endif /* _IP_SET_HASH_H */
@@ -183,6 +183,8 @@ struct xt_counters_info {
 #ifdef __KERNEL__
 
 #include <linux/netdevice.h>
+#include <linux/percpu.h>
+#include <linux/seqlock.h>
 
 /**
  * struct xt_match_param - parameters for match extensions' match functions
@@ -398,13 +400,18 @@ struct xt_table_info {
 	unsigned int hook_entry[NF_INET_NUMHOOKS];
 	unsigned int underflow[NF_INET_NUMHOOKS];
 
-	/* ipt_entry tables: one per CPU */
-	/* Note : this field MUST be the last one, see XT_TABLE_INFO_SZ */
-	void *entries[1];
+	/*
+	 * Number of user chains. Since tables cannot have loops, at most
+	 * @stacksize jumps (number of user chains) can possibly be made.
+	 */
+	unsigned int stacksize;
+	unsigned int __percpu *stackptr;
+	void ***jumpstack;
+
+	/* ipt_entry table: shared by all CPUs, never written by packet path */
+	void *entries;
 };
 
-#define XT_TABLE_INFO_SZ (offsetof(struct xt_table_info, entries) \
-			  + nr_cpu_ids * sizeof(char *))
 extern int xt_register_target(struct xt_target *target);
 extern void xt_unregister_target(struct xt_target *target);
 extern int xt_register_targets(struct xt_target *target, unsigned int n);
@@ -449,71 +456,76 @@ extern struct xt_table_info *xt_alloc_table_info(unsigned int size);
 extern void xt_free_table_info(struct xt_table_info *info);
 
 /*
- * Per-CPU spinlock associated with per-cpu table entries, and
- * with a counter for the "reading" side that allows a recursive
- * reader to avoid taking the lock and deadlocking.
+ * Per-CPU sequence counter bumped by ip/arp/ip6 tables rule processing.
  *
- * "reading" is used by ip/arp/ip6 tables rule processing which runs per-cpu.
- * It needs to ensure that the rules are not being changed while the packet
- * is being processed. In some cases, the read lock will be acquired
- * twice on the same CPU; this is okay because of the count.
+ * The packet path never writes to the shared rule blob: it only updates
+ * its own CPU's rule counters, so it needs no lock.  The sequence count
+ * is odd while a CPU is inside a table walk, which lets
+ *  - get_counters() take a consistent 64bit snapshot of another CPU's
+ *    counters (retrying instead of stalling that CPU), and
+ *  - xt_replace_table() wait until no CPU can still be walking the old
+ *    table before it is handed back to be freed.
  *
- * "writing" is used when reading counters.
- *  During replace any readers that are using the old tables have to complete
- *  before freeing the old table. This is handled by the write locking
- *  necessary for reading the counters.
+ * A walk can be re-entered on the same CPU (e.g. a target emitting a
+ * packet that traverses another hook); only the outermost level touches
+ * the sequence.
  */
-struct xt_info_lock {
-	spinlock_t lock;
-	unsigned char readers;
-};
-DECLARE_PER_CPU(struct xt_info_lock, xt_info_locks);
+DECLARE_PER_CPU(seqcount_t, xt_recseq);
 
 /*
- * Note: we need to ensure that preemption is disabled before acquiring
- * the per-cpu-variable, so we do it as a two step process rather than
- * using "spin_lock_bh()".
- *
- * We _also_ need to disable bottom half processing before updating our
- * nesting count, to make sure that the only kind of re-entrancy is this
- * code being called by itself: since the count+lock is not an atomic
- * operation, we can allow no races.
- *
- * _Only_ that special combination of being per-cpu and never getting
- * re-entered asynchronously means that the count is safe.
+ * Must be called with bottom halves (and thus preemption) disabled.
+ * Returns 1 for the outermost level, 0 if re-entered.
  */
-static inline void xt_info_rdlock_bh(void)
+static inline unsigned int xt_write_recseq_begin(void)
 {
-	struct xt_info_lock *lock;
+	unsigned int addend;
 
-	local_bh_disable();
-	lock = &__get_cpu_var(xt_info_locks);
-	if (likely(!lock->readers++))
-		spin_lock(&lock->lock);
+	/* Low order bit of sequence is set if we are already inside. */
+	addend = (__this_cpu_read(xt_recseq.sequence) + 1) & 1;
+
+	/*
+	 * Like write_seqcount_begin(), but addend is 0 or 1; not testing
+	 * it avoids a conditional jump, addend is most likely 1.
+	 */
+	__this_cpu_add(xt_recseq.sequence, addend);
+	smp_wmb();
+
+	return addend;
 }
 
-static inline void xt_info_rdunlock_bh(void)
+static inline void xt_write_recseq_end(unsigned int addend)
 {
-	struct xt_info_lock *lock = &__get_cpu_var(xt_info_locks);
-
-	if (likely(!--lock->readers))
-		spin_unlock(&lock->lock);
-	local_bh_enable();
+	smp_wmb();
+	__this_cpu_add(xt_recseq.sequence, addend);
 }
 
 /*
- * The "writer" side needs to get exclusive access to the lock,
- * regardless of readers.  This must be called with bottom half
- * processing (and thus also preemption) disabled.
+ * Rule counters are kept out of the rule blob.  The kernel copy of each
+ * entry's struct xt_counters stores, in .pcnt, a pointer to a percpu
+ * struct xt_counters holding the real values; .bcnt is unused.
  */
-static inline void xt_info_wrlock(unsigned int cpu)
+static inline u64 xt_percpu_counter_alloc(void)
+{
+	return (unsigned long)alloc_percpu(struct xt_counters);
+}
+
+static inline void xt_percpu_counter_free(u64 pcnt)
+{
+	free_percpu((struct xt_counters __percpu *)(unsigned long)pcnt);
+}
+
+static inline struct xt_counters *
+xt_get_this_cpu_counter(const struct xt_counters *cnt)
 {
-	spin_lock(&per_cpu(xt_info_locks, cpu).lock);
+	return __this_cpu_ptr((struct xt_counters __percpu *)
+			      (unsigned long)cnt->pcnt);
 }
 
-static inline void xt_info_wrunlock(unsigned int cpu)
+static inline struct xt_counters *
+xt_get_per_cpu_counter(const struct xt_counters *cnt, unsigned int cpu)
 {
-	spin_unlock(&per_cpu(xt_info_locks, cpu).lock);
+	return per_cpu_ptr((struct xt_counters __percpu *)
+			   (unsigned long)cnt->pcnt, cpu);
 }
 
 /*
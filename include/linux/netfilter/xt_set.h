@@ -0,0 +1,30 @@
+#ifndef _XT_SET_H
+#define _XT_SET_H
+
+#include <linux/types.h>
+#include <linux/netfilter/ipset/ip_set.h>
+
+struct xt_set_info {
+	char name[IPSET_MAXNAMELEN];	/* name of the set */
+	__u8 dim;			/* dimension of the match */
+	__u8 flags;			/* IPSET_DIM_*_SRC, IPSET_INV_MATCH */
+};
+
+/* match and target infos */
+struct xt_set_info_match {
+	struct xt_set_info match_set;
+
+	/* Used internally by the kernel */
+	ip_set_id_t index;
+};
+
+struct xt_set_info_target {
+	struct xt_set_info add_set;	/* empty name: don't add */
+	struct xt_set_info del_set;	/* empty name: don't delete */
+
+	/* Used internally by the kernel */
+	ip_set_id_t add_index;
+	ip_set_id_t del_index;
+};
+
+#endif /*_XT_SET_H*/
@@ -98,6 +98,7 @@ struct exec_domain;
 struct futex_pi_state;
 struct robust_list_head;
 struct bio_list;
+struct blk_plug;
 struct fs_struct;
 struct bts_context;
 struct perf_event_context;
@@ -1408,6 +1409,13 @@ struct task_struct {
 /* stacked block device info */
 	struct bio_list *bio_list;
 
+#ifdef CONFIG_BLOCK
+/* stack plugging */
+	struct blk_plug *plug;
+#endif
+/* kiocb being retried: page waits queue this and return -EIOCBRETRY */
+	struct wait_bit_queue *io_wait;
+
 /* VM state */
 	struct reclaim_state *reclaim_state;
 
@@ -94,6 +94,7 @@
 struct net_device;
 struct scatterlist;
 struct pipe_inode_info;
+struct splice_pipe_desc;
 
 #if defined(CONFIG_NF_CONNTRACK) || defined(CONFIG_NF_CONNTRACK_MODULE)
 struct nf_conntrack {
@@ -237,6 +238,16 @@ enum {
 	SKB_GSO_TCPV6 = 1 << 4,
 
 	SKB_GSO_FCOE = 1 << 5,
+
+	/* The packet is GRE encapsulated: segment the inner packet. */
+	SKB_GSO_GRE = 1 << 6,
+
+	/* The packet is UDP encapsulated: segment the inner packet. */
+	SKB_GSO_UDP_TUNNEL = 1 << 7,
+
+	/* Datagrams of gso_size bytes each, every one with its own UDP
+	 * header; unlike SKB_GSO_UDP the IP packets are not fragments. */
+	SKB_GSO_UDP_L4 = 1 << 8,
 };
 
 #if BITS_PER_LONG > 32
@@ -298,9 +309,11 @@ typedef unsigned char *sk_buff_data_t;
  *	@tc_index: Traffic control index
  *	@tc_verd: traffic control verdict
  *	@ndisc_nodetype: router type (from link layer)
+ *	@ooo_okay: allow the mapping of a socket to a queue to be changed
  *	@dma_cookie: a cookie to one of several possible DMA operations
  *		done by skb DMA functions
  *	@secmark: security marking
+ *	@napi_id: id of the NAPI context this skb was received on
  *	@vlan_tci: vlan tag control information
  */
 
@@ -374,15 +387,19 @@ struct sk_buff {
 #ifdef CONFIG_IPV6_NDISC_NODETYPE
 	__u8			ndisc_nodetype:2;
 #endif
+	__u8			ooo_okay:1;
 	kmemcheck_bitfield_end(flags2);
 
-	/* 0/14 bit hole */
+	/* 0/13 bit hole */
 
 #ifdef CONFIG_NET_DMA
 	dma_cookie_t		dma_cookie;
 #endif
 #ifdef CONFIG_NETWORK_SECMARK
 	__u32			secmark;
+#endif
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	unsigned int		napi_id;
 #endif
 	union {
 		__u32		mark;
@@ -1757,6 +1774,8 @@ extern int	       skb_copy_datagram_const_iovec(const struct sk_buff *from,
 extern void	       skb_free_datagram(struct sock *sk, struct sk_buff *skb);
 extern void	       skb_free_datagram_locked(struct sock *sk,
 						struct sk_buff *skb);
+extern int	       __skb_kill_datagram(struct sock *sk, struct sk_buff *skb,
+					   unsigned int flags);
 extern int	       skb_kill_datagram(struct sock *sk, struct sk_buff *skb,
 					 unsigned int flags);
 extern __wsum	       skb_checksum(const struct sk_buff *skb, int offset,
@@ -1769,10 +1788,17 @@ extern __wsum	       skb_copy_and_csum_bits(const struct sk_buff *skb,
 					      int offset, u8 *to, int len,
 					      __wsum csum);
 extern int             skb_splice_bits(struct sk_buff *skb,
+						struct sock *sk,
 						unsigned int offset,
 						struct pipe_inode_info *pipe,
 						unsigned int len,
-						unsigned int flags);
+						unsigned int flags,
+						ssize_t (*splice_cb)(struct sock *,
+							struct pipe_inode_info *,
+							struct splice_pipe_desc *));
+extern ssize_t	       skb_socket_splice(struct sock *sk,
+					 struct pipe_inode_info *pipe,
+					 struct splice_pipe_desc *spd);
 extern void	       skb_copy_and_csum_dev(const struct sk_buff *skb, u8 *to);
 extern void	       skb_split(struct sk_buff *skb,
 				 struct sk_buff *skb1, const u32 len);
@@ -105,6 +105,7 @@ enum {
 #define TCP_COOKIE_TRANSACTIONS	15	/* TCP Cookie Transactions */
 #define TCP_THIN_LINEAR_TIMEOUTS 16      /* Use linear timeouts for thin streams*/
 #define TCP_THIN_DUPACK         17      /* Fast retrans. after 1 dupack */
+#define TCP_FASTOPEN		23	/* Enable FastOpen on listeners */
 
 /* for TCP_INFO socket option */
 #define TCPI_OPT_TIMESTAMPS	1
@@ -271,6 +272,7 @@ static inline void tcp_clear_options(struct tcp_options_received *rx_opt)
 #define TCP_NUM_SACKS 4
 
 struct tcp_cookie_values;
+struct tcp_fastopen_request;
 struct tcp_request_sock_ops;
 
 struct tcp_request_sock {
@@ -315,6 +317,10 @@ struct tcp_sock {
 	u32	rcv_tstamp;	/* timestamp of last received ACK (for keepalives) */
 	u32	lsndtime;	/* timestamp of last sent data packet (for restart window) */
 
+	/* TCP small queues */
+	struct list_head tsq_node; /* on the per-cpu tsq tasklet list */
+	unsigned long	tsq_flags;
+
 	/* Data for direct copy to user */
 	struct {
 		struct sk_buff_head	prequeue;
@@ -345,7 +351,8 @@ struct tcp_sock {
 	u8	nonagle     : 4,/* Disable Nagle algorithm?             */
 		thin_lto    : 1,/* Use linear timeouts for thin streams */
 		thin_dupack : 1,/* Fast retransmit on first dupack      */
-		unused      : 2;
+		syn_data    : 1,/* SYN includes data                    */
+		syn_fastopen: 1;/* SYN includes Fast Open option        */
 
 /* RTT measurement */
 	u32	srtt;		/* smoothed round trip time << 3	*/
@@ -420,6 +427,20 @@ struct tcp_sock {
 	int	undo_retrans;	/* number of undoable retransmissions. */
 	u32	total_retrans;	/* Total retransmits for entire connection */
 
+	u32	prior_cwnd;	/* Congestion window at start of Recovery. */
+	u32	prr_delivered;	/* Number of newly delivered packets to
+				 * receiver in Recovery. */
+	u32	prr_out;	/* Total number of pkts sent during Recovery. */
+
+/* Time based loss detection (RACK) */
+	struct {
+		u32	xmit_time;	/* Send time of the most recently sent
+					 * segment that has been delivered */
+		u32	end_seq;	/* Its end_seq, breaks send time ties */
+		u32	rtt;		/* RTT measured on that segment */
+		u8	advanced;	/* xmit_time moved since last loss check */
+	} rack;
+
 	u32	urg_seq;	/* Seq of received urgent pointer */
 	unsigned int		keepalive_time;	  /* time before keep alive takes place */
 	unsigned int		keepalive_intvl;  /* time interval between keep alive probes */
@@ -459,6 +480,20 @@ struct tcp_sock {
 	 * contains related tcp_cookie_transactions fields.
 	 */
 	struct tcp_cookie_values  *cookie_values;
+
+/* TCP Fast Open */
+	struct tcp_fastopen_request *fastopen_req; /* SYN data of a pending
+						    * active open */
+	struct sock	*fastopen_listener; /* Listener of a passive child
+					     * that is still in SYN_RECV */
+	int		fastopen_max_qlen;  /* Listener: TCP_FASTOPEN limit */
+	atomic_t	fastopen_qlen;	    /* Listener: pending children */
+};
+
+enum tsq_flags {
+	TSQ_THROTTLED,	/* tcp_write_xmit() stopped on the queue limit */
+	TSQ_QUEUED,	/* socket is on a tsq tasklet list */
+	TSQ_OWNED,	/* tasklet found the socket owned by the user */
 };
 
 static inline struct tcp_sock *tcp_sk(const struct sock *sk)
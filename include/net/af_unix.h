@@ -11,7 +11,8 @@ extern void unix_notinflight(struct file *fp);
 extern void unix_gc(void);
 extern void wait_for_unix_gc(void);
 
-#define UNIX_HASH_SIZE	256
+#define UNIX_HASH_BITS	8
+#define UNIX_HASH_SIZE	(1 << UNIX_HASH_BITS)
 
 extern unsigned int unix_tot_inflight;
 
@@ -28,6 +29,7 @@ struct unix_skb_parms {
 #ifdef CONFIG_SECURITY_NETWORK
 	u32			secid;		/* Security ID		*/
 #endif
+	u32			consumed;	/* Bytes already read	*/
 };
 
 #define UNIXCB(skb) 	(*(struct unix_skb_parms*)&((skb)->cb))
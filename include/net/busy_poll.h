@@ -0,0 +1,52 @@
+/*
+ * Socket busy polling: a reader that finds its receive queue empty
+ * runs the NAPI poll routine of the device queue its data last came
+ * from, instead of sleeping until the interrupt and softirq deliver it.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+#ifndef _NET_BUSY_POLL_H
+#define _NET_BUSY_POLL_H
+
+#include <linux/netdevice.h>
+#include <linux/sched.h>
+#include <net/sock.h>
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+
+extern unsigned int sysctl_net_busy_read;
+
+extern int sk_busy_loop(struct sock *sk, int nonblock);
+
+static inline int sk_can_busy_loop(struct sock *sk)
+{
+	return sk->sk_ll_usec && sk->sk_napi_id && !signal_pending(current);
+}
+
+/* Remember the NAPI context of the last packet queued to @sk. */
+static inline void sk_mark_napi_id(struct sock *sk, const struct sk_buff *skb)
+{
+	sk->sk_napi_id = skb->napi_id;
+}
+
+#else /* CONFIG_NET_RX_BUSY_POLL */
+
+static inline int sk_can_busy_loop(struct sock *sk)
+{
+	return 0;
+}
+
+static inline int sk_busy_loop(struct sock *sk, int nonblock)
+{
+	return 0;
+}
+
+static inline void sk_mark_napi_id(struct sock *sk, const struct sk_buff *skb)
+{
+}
+
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+#endif /* _NET_BUSY_POLL_H */
@@ -47,6 +47,8 @@ struct dst_entry {
 #define DST_NOXFRM		2
 #define DST_NOPOLICY		4
 #define DST_NOHASH		8
+#define DST_NOCACHE		16	/* freed on the last release, never
+					 * goes to the garbage list */
 	unsigned long		expires;
 
 	unsigned short		header_len;	/* more space at head required */
@@ -177,6 +179,7 @@ struct dst_entry * dst_clone(struct dst_entry * dst)
 }
 
 extern void dst_release(struct dst_entry *dst);
+extern int dst_release_rcu(struct dst_entry *dst);
 static inline void skb_dst_drop(struct sk_buff *skb)
 {
 	if (skb->_skb_dst)
@@ -200,6 +203,8 @@ extern int dst_discard(struct sk_buff *skb);
 extern void * dst_alloc(struct dst_ops * ops);
 extern void __dst_free(struct dst_entry * dst);
 extern struct dst_entry *dst_destroy(struct dst_entry * dst);
+extern void dst_ifdown(struct dst_entry *dst, struct net_device *dev,
+		       int unregister);
 
 static inline void dst_free(struct dst_entry * dst)
 {
@@ -32,6 +32,10 @@ extern struct request_sock *inet6_csk_search_req(const struct sock *sk,
 						 const struct in6_addr *laddr,
 						 const int iif);
 
+extern spinlock_t *inet6_csk_synq_lock(const struct sock *sk,
+				       const __be16 rport,
+				       const struct in6_addr *raddr);
+
 extern void inet6_csk_reqsk_queue_hash_add(struct sock *sk,
 					   struct request_sock *req,
 					   const unsigned long timeout);
@@ -14,6 +14,9 @@ struct sockaddr;
 struct socket;
 
 extern int			inet_release(struct socket *sock);
+extern int			__inet_stream_connect(struct socket *sock,
+						      struct sockaddr *uaddr,
+						      int addr_len, int flags);
 extern int			inet_stream_connect(struct socket *sock,
 						    struct sockaddr * uaddr,
 						    int addr_len, int flags);
@@ -245,6 +245,9 @@ extern struct request_sock *inet_csk_search_req(const struct sock *sk,
 						const __be16 rport,
 						const __be32 raddr,
 						const __be32 laddr);
+extern spinlock_t *inet_csk_synq_lock(const struct sock *sk,
+				      const __be16 rport,
+				      const __be32 raddr);
 extern int inet_csk_bind_conflict(const struct sock *sk,
 				  const struct inet_bind_bucket *tb);
 extern int inet_csk_get_port(struct sock *sk, unsigned short snum);
@@ -263,11 +266,14 @@ extern void inet_csk_reqsk_queue_hash_add(struct sock *sk,
 					  struct request_sock *req,
 					  unsigned long timeout);
 
+/* The keepalive timer is left to expire when the queue drains: it may be
+ * rearmed concurrently by a lockless inet_csk_reqsk_queue_added(), and
+ * inet_csk_reqsk_queue_prune() does not rearm it for an empty queue.
+ */
 static inline void inet_csk_reqsk_queue_removed(struct sock *sk,
 						struct request_sock *req)
 {
-	if (reqsk_queue_removed(&inet_csk(sk)->icsk_accept_queue, req) == 0)
-		inet_csk_delete_keepalive_timer(sk);
+	reqsk_queue_removed(&inet_csk(sk)->icsk_accept_queue, req);
 }
 
 static inline void inet_csk_reqsk_queue_added(struct sock *sk,
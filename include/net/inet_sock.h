@@ -40,6 +40,7 @@
  */
 struct ip_options {
 	__be32		faddr;
+	__be32		nexthop;
 	unsigned char	optlen;
 	unsigned char	srr;
 	unsigned char	rr;
@@ -105,6 +106,7 @@ struct rtable;
  * @mc_ttl - Multicasting TTL
  * @is_icsk - is this an inet_connection_sock?
  * @mc_index - Multicast device index
+ * @rx_dst_ifindex - Input device of sk->sk_rx_dst
  * @mc_list - Group array
  * @cork - info to build ip hdr on each ip frag while socket is corked
  */
@@ -138,6 +140,7 @@ struct inet_sock {
 				transparent:1,
 				mc_all:1;
 	int			mc_index;
+	int			rx_dst_ifindex;
 	__be32			mc_addr;
 	struct ip_mc_socklist	*mc_list;
 	struct {
@@ -148,6 +151,7 @@ struct inet_sock {
 		int			length; /* Total length of all frames */
 		__be32			addr;
 		struct flowi		fl;
+		__u16			gso_size; /* UDP_SEGMENT, 0 if off */
 	} cork;
 };
 
@@ -11,6 +11,7 @@
 #include <linux/init.h>
 #include <linux/jiffies.h>
 #include <linux/spinlock.h>
+#include <linux/seqlock.h>
 #include <asm/atomic.h>
 
 struct inet_peer {
@@ -26,6 +27,24 @@ struct inet_peer {
 	atomic_t		ip_id_count;	/* IP ID for the next packet */
 	__u32			tcp_ts;
 	__u32			tcp_ts_stamp;
+
+	/* State learned from ICMP that used to live in the route cache */
+	__u32			rate_tokens;	/* rate limiting for ICMP */
+	unsigned long		rate_last;
+	__u32			error_tokens;	/* redirect and unreachable limits */
+	unsigned long		error_last;
+	unsigned long		pmtu_expires;
+	__u32			pmtu_learned;
+	__be32			redirect_learned;
+	int			redirect_genid;
+
+	/* TCP Fast Open client state */
+	seqlock_t		tfo_lock;
+	__u16			tfo_mss;	/* MSS learned with the cookie */
+	__s8			tfo_cookie_len;
+	__u8			tfo_cookie[16];
+	__u16			tfo_syn_loss;	/* recurring SYN-data losses */
+	unsigned long		tfo_syn_loss_ts; /* jiffies of last loss */
 };
 
 void			inet_initpeers(void) __init;
@@ -36,6 +55,8 @@ struct inet_peer	*inet_getpeer(__be32 daddr, int create);
 /* can be called from BH context or outside */
 extern void inet_putpeer(struct inet_peer *p);
 
+extern bool inet_peer_xrlim_allow(struct inet_peer *peer, int timeout);
+
 /* can be called with or without local BH being disabled */
 static inline __u16	inet_getid(struct inet_peer *p, int more)
 {
@@ -199,6 +199,7 @@ extern int inet_peer_gc_maxtime;
 
 /* From ip_output.c */
 extern int sysctl_ip_dynaddr;
+extern int sysctl_ip_early_demux;
 
 extern void ipfrag_init(void);
 
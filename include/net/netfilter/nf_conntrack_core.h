@@ -13,6 +13,7 @@
 #define _NF_CONNTRACK_CORE_H
 
 #include <linux/netfilter.h>
+#include <linux/mutex.h>
 #include <net/netfilter/nf_conntrack_l3proto.h>
 #include <net/netfilter/nf_conntrack_l4proto.h>
 #include <net/netfilter/nf_conntrack_ecache.h>
@@ -76,4 +77,42 @@ print_tuple(struct seq_file *s, const struct nf_conntrack_tuple *tuple,
 
 extern spinlock_t nf_conntrack_lock ;
 
+/*
+ * Hash chains are protected by an array of stripe locks instead of
+ * nf_conntrack_lock, which only guards expectations, helpers and the dying
+ * list.  Table sizes are always a multiple of CONNTRACK_LOCKS, so each lock
+ * covers a contiguous range of buckets.
+ */
+#define CONNTRACK_LOCKS 1024
+
+extern spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS];
+extern struct mutex nf_conntrack_resize_mutex;
+
+static inline spinlock_t *nf_conntrack_bucket_lock(const struct net *net,
+						   unsigned int bucket)
+{
+	return &nf_conntrack_locks[bucket /
+				   (net->ct.htable_size / CONNTRACK_LOCKS)];
+}
+
+extern int nf_conntrack_hash_resize(struct net *net, unsigned int hashsize);
+
+/*
+ * Lockless table walkers (/proc, ctnetlink dumps) must take the table and
+ * its size as one pair, or a concurrent resize may have them index past
+ * the end of the table.  Call under rcu_read_lock().
+ */
+static inline void nf_conntrack_get_ht(const struct net *net,
+				       struct hlist_nulls_head **hash,
+				       unsigned int *hsize)
+{
+	unsigned int seq;
+
+	do {
+		seq = read_seqcount_begin(&net->ct.generation);
+		*hash = rcu_dereference(net->ct.hash);
+		*hsize = net->ct.htable_size;
+	} while (read_seqcount_retry(&net->ct.generation, seq));
+}
+
 #endif /* _NF_CONNTRACK_CORE_H */
@@ -90,25 +90,41 @@ static inline void reqsk_free(struct request_sock *req)
 
 extern int sysctl_max_syn_backlog;
 
+#define LISTEN_SOCK_SYN_LOCKS	32	/* must be a power of two */
+
 /** struct listen_sock - listen state
  *
  * @max_qlen_log - log_2 of maximal queued SYNs/REQUESTs
+ * @syn_locks - hashed locks serializing the syn_table buckets
+ *
+ * A request_sock, and the bucket it lives in, is only changed with the
+ * bucket's lock in syn_locks held, so that SYNs and handshake ACKs for
+ * different peers can be processed in parallel without the listener's
+ * lock.  qlen and qlen_young are atomic for the same reason.
  */
 struct listen_sock {
 	u8			max_qlen_log;
 	/* 3 bytes hole, try to use */
-	int			qlen;
-	int			qlen_young;
+	atomic_t		qlen;
+	atomic_t		qlen_young;
 	int			clock_hand;
 	u32			hash_rnd;
 	u32			nr_table_entries;
+	spinlock_t		syn_locks[LISTEN_SOCK_SYN_LOCKS];
 	struct request_sock	*syn_table[0];
 };
 
+static inline spinlock_t *reqsk_queue_syn_lock(struct listen_sock *lopt,
+					       u32 hash)
+{
+	return &lopt->syn_locks[hash & (LISTEN_SOCK_SYN_LOCKS - 1)];
+}
+
 /** struct request_sock_queue - queue of request_socks
  *
  * @rskq_accept_head - FIFO head of established children
  * @rskq_accept_tail - FIFO tail of established children
+ * @rskq_lock - protects the accept queue and sk_ack_backlog
  * @rskq_defer_accept - User waits for some data after accept()
  * @syn_wait_lock - serializer
  *
@@ -117,13 +133,16 @@ struct listen_sock {
  *
  * This lock is acquired in read mode only from listening_get_next() seq_file
  * op and it's acquired in write mode _only_ from code that is actively
- * changing rskq_accept_head. All readers that are holding the master sock lock
- * don't need to grab this lock in read mode too as rskq_accept_head. writes
- * are always protected from the main sock lock.
+ * linking or unlinking requests in the syn_table.  Writers also hold the
+ * bucket's lock in listen_sock.syn_locks, or the listener's lock.
+ *
+ * %rskq_lock is taken by softirq handlers that hand a child over to
+ * accept(), which no longer hold the listener's lock.
  */
 struct request_sock_queue {
 	struct request_sock	*rskq_accept_head;
 	struct request_sock	*rskq_accept_tail;
+	spinlock_t		rskq_lock;
 	rwlock_t		syn_wait_lock;
 	u8			rskq_defer_accept;
 	/* 3 bytes hole, try to pack */
@@ -139,9 +158,12 @@ extern void reqsk_queue_destroy(struct request_sock_queue *queue);
 static inline struct request_sock *
 	reqsk_queue_yank_acceptq(struct request_sock_queue *queue)
 {
-	struct request_sock *req = queue->rskq_accept_head;
+	struct request_sock *req;
 
+	spin_lock_bh(&queue->rskq_lock);
+	req = queue->rskq_accept_head;
 	queue->rskq_accept_head = NULL;
+	spin_unlock_bh(&queue->rskq_lock);
 	return req;
 }
 
@@ -165,6 +187,8 @@ static inline void reqsk_queue_add(struct request_sock_queue *queue,
 				   struct sock *child)
 {
 	req->sk = child;
+
+	spin_lock(&queue->rskq_lock);
 	sk_acceptq_added(parent);
 
 	if (queue->rskq_accept_head == NULL)
@@ -174,8 +198,10 @@ static inline void reqsk_queue_add(struct request_sock_queue *queue,
 
 	queue->rskq_accept_tail = req;
 	req->dl_next = NULL;
+	spin_unlock(&queue->rskq_lock);
 }
 
+/* Called with rskq_lock held */
 static inline struct request_sock *reqsk_queue_remove(struct request_sock_queue *queue)
 {
 	struct request_sock *req = queue->rskq_accept_head;
@@ -192,12 +218,17 @@ static inline struct request_sock *reqsk_queue_remove(struct request_sock_queue
 static inline struct sock *reqsk_queue_get_child(struct request_sock_queue *queue,
 						 struct sock *parent)
 {
-	struct request_sock *req = reqsk_queue_remove(queue);
-	struct sock *child = req->sk;
+	struct request_sock *req;
+	struct sock *child;
+
+	spin_lock_bh(&queue->rskq_lock);
+	req = reqsk_queue_remove(queue);
+	sk_acceptq_removed(parent);
+	spin_unlock_bh(&queue->rskq_lock);
 
+	child = req->sk;
 	WARN_ON(child == NULL);
 
-	sk_acceptq_removed(parent);
 	__reqsk_free(req);
 	return child;
 }
@@ -208,34 +239,34 @@ static inline int reqsk_queue_removed(struct request_sock_queue *queue,
 	struct listen_sock *lopt = queue->listen_opt;
 
 	if (req->retrans == 0)
-		--lopt->qlen_young;
+		atomic_dec(&lopt->qlen_young);
 
-	return --lopt->qlen;
+	return atomic_dec_return(&lopt->qlen);
 }
 
 static inline int reqsk_queue_added(struct request_sock_queue *queue)
 {
 	struct listen_sock *lopt = queue->listen_opt;
-	const int prev_qlen = lopt->qlen;
 
-	lopt->qlen_young++;
-	lopt->qlen++;
-	return prev_qlen;
+	atomic_inc(&lopt->qlen_young);
+	return atomic_inc_return(&lopt->qlen) - 1;
 }
 
 static inline int reqsk_queue_len(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt != NULL ? queue->listen_opt->qlen : 0;
+	return queue->listen_opt != NULL ?
+	       atomic_read(&queue->listen_opt->qlen) : 0;
 }
 
 static inline int reqsk_queue_len_young(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt->qlen_young;
+	return atomic_read(&queue->listen_opt->qlen_young);
 }
 
 static inline int reqsk_queue_is_full(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt->qlen >> queue->listen_opt->max_qlen_log;
+	return atomic_read(&queue->listen_opt->qlen) >>
+	       queue->listen_opt->max_qlen_log;
 }
 
 static inline void reqsk_queue_hash_req(struct request_sock_queue *queue,
@@ -243,15 +274,19 @@ static inline void reqsk_queue_hash_req(struct request_sock_queue *queue,
 					unsigned long timeout)
 {
 	struct listen_sock *lopt = queue->listen_opt;
+	spinlock_t *lock = reqsk_queue_syn_lock(lopt, hash);
 
 	req->expires = jiffies + timeout;
 	req->retrans = 0;
 	req->sk = NULL;
+
+	spin_lock(lock);
 	req->dl_next = lopt->syn_table[hash];
 
 	write_lock(&queue->syn_wait_lock);
 	lopt->syn_table[hash] = req;
 	write_unlock(&queue->syn_wait_lock);
+	spin_unlock(lock);
 }
 
 #endif /* _REQUEST_SOCK_H */
@@ -54,15 +54,21 @@ struct rtable {
 		struct dst_entry	dst;
 	} u;
 
-	/* Cache lookup keys */
+	/* Lookup keys */
 	struct flowi		fl;
 
 	struct in_device	*idev;
 	
 	int			rt_genid;
+	int			rt_peer_genid;
 	unsigned		rt_flags;
 	__u16			rt_type;
 
+	/* Input routes held by a FIB nexthop are shared by every flow
+	 * through it and carry no per-flow addresses: rt_dst, rt_src,
+	 * rt_spec_dst and the fl addresses are zero.  Use the packet
+	 * header, inet_iif() and ip_rt_spec_dst() instead.
+	 */
 	__be32			rt_dst;	/* Path destination	*/
 	__be32			rt_src;	/* Path source		*/
 	int			rt_iif;
@@ -73,6 +79,10 @@ struct rtable {
 	/* Miscellaneous cached information */
 	__be32			rt_spec_dst; /* RFC1122 specific destination */
 	struct inet_peer	*peer; /* long-living peer info */
+
+	/* Routes no nexthop holds, for taking a departing device from */
+	struct list_head	rt_uncached;
+	struct rt_uncached_list	*rt_uncached_list;
 };
 
 struct ip_rt_acct {
@@ -108,7 +118,6 @@ extern int		ip_rt_init(void);
 extern void		ip_rt_redirect(__be32 old_gw, __be32 dst, __be32 new_gw,
 				       __be32 src, struct net_device *dev);
 extern void		rt_cache_flush(struct net *net, int how);
-extern void		rt_cache_flush_batch(void);
 extern int		__ip_route_output_key(struct net *, struct rtable **, const struct flowi *flp);
 extern int		ip_route_output_key(struct net *, struct rtable **, struct flowi *flp);
 extern int		ip_route_output_flow(struct net *, struct rtable **rp, struct flowi *flp, struct sock *sk, int flags);
@@ -120,8 +129,10 @@ extern unsigned		inet_addr_type(struct net *net, __be32 addr);
 extern unsigned		inet_dev_addr_type(struct net *net, const struct net_device *dev, __be32 addr);
 extern void		ip_rt_multicast_event(struct in_device *);
 extern int		ip_rt_ioctl(struct net *, unsigned int cmd, void __user *arg);
-extern void		ip_rt_get_source(u8 *src, struct rtable *rt);
-extern int		ip_rt_dump(struct sk_buff *skb,  struct netlink_callback *cb);
+extern void		ip_rt_get_source(u8 *src, struct sk_buff *skb, struct rtable *rt);
+extern __be32		ip_rt_spec_dst(struct sk_buff *skb);
+extern void		rt_flush_dev(struct net_device *dev);
+extern void		ip_rt_nh_release(struct fib_nh *nh);
 
 struct in_ifaddr;
 extern void fib_add_ifaddr(struct in_ifaddr *);
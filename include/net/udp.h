@@ -144,6 +144,24 @@ static inline __wsum udp_csum_outgoing(struct sock *sk, struct sk_buff *skb)
 	return csum;
 }
 
+/* Most datagrams a single UDP_SEGMENT send may be split into. */
+#define UDP_MAX_SEGMENTS	(1 << 6UL)
+
+/**
+ * 	udp_cmsg_recv  -  report the segment size of a GRO datagram
+ * 	@msg:	message being received on a UDP_GRO socket
+ * 	@skb:	datagram being received
+ */
+static inline void udp_cmsg_recv(struct msghdr *msg, struct sk_buff *skb)
+{
+	int gso_size;
+
+	if (skb_is_gso(skb) && (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4)) {
+		gso_size = skb_shinfo(skb)->gso_size;
+		put_cmsg(msg, SOL_UDP, UDP_GRO, sizeof(gso_size), &gso_size);
+	}
+}
+
 /* hash routines shared between UDPv4/6 and UDP-Litev4/6 */
 static inline void udp_lib_hash(struct sock *sk)
 {
@@ -171,6 +189,7 @@ extern int	udp_sendmsg(struct kiocb *iocb, struct sock *sk,
 extern void	udp_flush_pending_frames(struct sock *sk);
 
 extern int	udp_rcv(struct sk_buff *skb);
+extern int	__udp_enqueue_schedule_skb(struct sock *sk, struct sk_buff *skb);
 extern int	udp_ioctl(struct sock *sk, int cmd, unsigned long arg);
 extern int	udp_disconnect(struct sock *sk, int flags);
 extern unsigned int udp_poll(struct file *file, struct socket *sock,
@@ -244,4 +263,31 @@ extern void udp_init(void);
 
 extern int udp4_ufo_send_check(struct sk_buff *skb);
 extern struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, int features);
+
+/**
+ *	struct udp_offload  -  GRO/GSO handlers of a UDP encapsulation
+ *
+ *	@port:         destination port the encapsulation listens on
+ *	@gro_receive:  called with the GRO offset at the tunnel header
+ *	@gro_complete: called with @nhoff at the tunnel header
+ *	@gso_segment:  called with skb->data at the tunnel header; usually
+ *	               a wrapper around skb_encap_gso_segment()
+ */
+struct udp_offload {
+	__be16			port;
+	struct sk_buff		**(*gro_receive)(struct sk_buff **head,
+						 struct sk_buff *skb);
+	int			(*gro_complete)(struct sk_buff *skb,
+						int nhoff);
+	struct sk_buff		*(*gso_segment)(struct sk_buff *skb,
+						int features);
+	struct list_head	list;
+};
+
+extern int udp_add_offload(struct udp_offload *uo);
+extern void udp_del_offload(struct udp_offload *uo);
+
+extern struct sk_buff **udp4_gro_receive(struct sk_buff **head,
+					 struct sk_buff *skb);
+extern int udp4_gro_complete(struct sk_buff *skb, int nhoff);
 #endif	/* _UDP_H */
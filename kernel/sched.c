@@ -3695,6 +3695,18 @@ pick_next_task(struct rq *rq)
 /*
  * schedule() is the main scheduler function.
  */
+static inline void sched_submit_work(struct task_struct *tsk)
+{
+	if (!tsk->state || (preempt_count() & PREEMPT_ACTIVE))
+		return;
+	/*
+	 * If we are going to sleep with plugged IO, submit it first: the
+	 * requests we are about to wait for may be sitting on our own plug.
+	 */
+	if (blk_needs_flush_plug(tsk))
+		blk_flush_plug(tsk);
+}
+
 asmlinkage void __sched schedule(void)
 {
 	struct task_struct *prev, *next;
@@ -3702,6 +3714,7 @@ asmlinkage void __sched schedule(void)
 	struct rq *rq;
 	int cpu;
 
+	sched_submit_work(current);
 need_resched:
 	preempt_disable();
 	cpu = smp_processor_id();
@@ -152,12 +152,9 @@ void remove_from_page_cache(struct page *page)
 	mem_cgroup_uncharge_cache_page(page);
 }
 
-static int sync_page(void *word)
+static void __sync_page(struct page *page)
 {
 	struct address_space *mapping;
-	struct page *page;
-
-	page = container_of((unsigned long *)word, struct page, flags);
 
 	/*
 	 * page_mapping() is being called without PG_locked held.
@@ -184,6 +181,11 @@ static int sync_page(void *word)
 	mapping = page_mapping(page);
 	if (mapping && mapping->a_ops && mapping->a_ops->sync_page)
 		mapping->a_ops->sync_page(page);
+}
+
+static int sync_page(void *word)
+{
+	__sync_page(container_of((unsigned long *)word, struct page, flags));
 	io_schedule();
 	return 0;
 }
@@ -510,6 +512,44 @@ void wait_on_page_bit(struct page *page, int bit_nr)
 }
 EXPORT_SYMBOL(wait_on_page_bit);
 
+/*
+ * Instead of sleeping until @page is unlocked, queue @wait (an iocb's
+ * ki_wait, from kiocb_io_wait()) on it so that the iocb is kicked at
+ * unlock time.  Returns -EIOCBRETRY if so, 0 if the page is not locked.
+ */
+static int wait_on_page_locked_async(struct page *page,
+				     struct wait_bit_queue *wait)
+{
+	struct kiocb *iocb = container_of(wait, struct kiocb, ki_wait);
+	wait_queue_head_t *q = page_waitqueue(page);
+	unsigned long flags;
+
+	/*
+	 * An earlier call in this retry may have left the entry on
+	 * another page's queue.  Take it off before changing its key.
+	 */
+	kiocb_dequeue_wait(iocb);
+
+	wait->key.flags = &page->flags;
+	wait->key.bit_nr = PG_locked;
+
+	spin_lock_irqsave(&q->lock, flags);
+	__add_wait_queue_tail(q, &wait->wait);
+	spin_unlock_irqrestore(&q->lock, flags);
+	iocb->ki_wait_head = q;
+
+	/* pairs with the barrier in unlock_page() */
+	smp_mb();
+	if (PageLocked(page)) {
+		__sync_page(page);
+		return -EIOCBRETRY;
+	}
+
+	/* a wakeup that raced with us only causes a spurious kick */
+	kiocb_dequeue_wait(iocb);
+	return 0;
+}
+
 /**
  * add_page_wait_queue - Add an arbitrary waiter to a page's wait queue
  * @page: Page defining the wait queue of interest
@@ -957,15 +997,21 @@ static void shrink_readahead_size_eio(struct file *filp,
  * @ppos:	current file position
  * @desc:	read_descriptor
  * @actor:	read method
+ * @io_wait:	wait entry of a retried AIO read, or NULL
  *
  * This is a generic file read routine, and uses the
  * mapping->a_ops->readpage() function for the actual low-level stuff.
  *
+ * With @io_wait, the read does not wait for pages under I/O: it queues
+ * @io_wait on the first such page and fails with -EIOCBRETRY, after the
+ * readahead for the rest of the request has been started.
+ *
  * This is really ugly. But the goto's actually try to clarify some
  * of the logic when it comes to error handling etc.
  */
 static void do_generic_file_read(struct file *filp, loff_t *ppos,
-		read_descriptor_t *desc, read_actor_t actor)
+		read_descriptor_t *desc, read_actor_t actor,
+		struct wait_bit_queue *io_wait)
 {
 	struct address_space *mapping = filp->f_mapping;
 	struct inode *inode = mapping->host;
@@ -1081,6 +1127,11 @@ page_ok:
 		goto out;
 
 page_not_up_to_date:
+		if (io_wait && wait_on_page_locked_async(page, io_wait)) {
+			error = -EIOCBRETRY;
+			goto readpage_error;
+		}
+
 		/* Get exclusive access to the page ... */
 		error = lock_page_killable(page);
 		if (unlikely(error))
@@ -1113,6 +1164,10 @@ readpage:
 		}
 
 		if (!PageUptodate(page)) {
+			if (io_wait && wait_on_page_locked_async(page, io_wait)) {
+				error = -EIOCBRETRY;
+				goto readpage_error;
+			}
 			error = lock_page_killable(page);
 			if (unlikely(error))
 				goto readpage_error;
@@ -1310,7 +1365,8 @@ generic_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
 		if (desc.count == 0)
 			continue;
 		desc.error = 0;
-		do_generic_file_read(filp, ppos, &desc, file_read_actor);
+		do_generic_file_read(filp, ppos, &desc, file_read_actor,
+				     kiocb_io_wait(iocb));
 		retval += desc.written;
 		if (desc.error) {
 			retval = retval ?: desc.error;
@@ -2184,8 +2240,37 @@ repeat:
 }
 EXPORT_SYMBOL(grab_cache_page_write_begin);
 
+/*
+ * Prepare a buffered write, retried by the AIO core, to the page at
+ * @index: rather than blocking in ->write_begin(), wait for the page to
+ * be unlocked through @io_wait.  If the write covers only part of a page
+ * that is not cached, start reading it in first.
+ */
+static int write_page_async_prepare(struct file *file, pgoff_t index,
+				    unsigned long offset, unsigned long bytes,
+				    struct wait_bit_queue *io_wait)
+{
+	struct address_space *mapping = file->f_mapping;
+	struct page *page;
+	int ret;
+
+	page = find_get_page(mapping, index);
+	if (!page && bytes < PAGE_CACHE_SIZE &&
+	    ((loff_t)index << PAGE_CACHE_SHIFT) < i_size_read(mapping->host)) {
+		force_page_cache_readahead(mapping, file, index, 1);
+		page = find_get_page(mapping, index);
+	}
+	if (!page)
+		return 0;
+
+	ret = wait_on_page_locked_async(page, io_wait);
+	page_cache_release(page);
+	return ret;
+}
+
 static ssize_t generic_perform_write(struct file *file,
-				struct iov_iter *i, loff_t pos)
+				struct iov_iter *i, loff_t pos,
+				struct wait_bit_queue *io_wait)
 {
 	struct address_space *mapping = file->f_mapping;
 	const struct address_space_operations *a_ops = mapping->a_ops;
@@ -2229,6 +2314,13 @@ again:
 			break;
 		}
 
+		if (io_wait) {
+			status = write_page_async_prepare(file, index, offset,
+							  bytes, io_wait);
+			if (status)
+				break;
+		}
+
 		status = a_ops->write_begin(file, mapping, pos, bytes, flags,
 						&page, &fsdata);
 		if (unlikely(status))
@@ -2285,7 +2377,7 @@ generic_file_buffered_write(struct kiocb *iocb, const struct iovec *iov,
 	struct iov_iter i;
 
 	iov_iter_init(&i, iov, nr_segs, count, written);
-	status = generic_perform_write(file, &i, pos);
+	status = generic_perform_write(file, &i, pos, kiocb_io_wait(iocb));
 
 	if (likely(status >= 0)) {
 		written += status;
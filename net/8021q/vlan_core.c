@@ -96,7 +96,7 @@ vlan_gro_common(struct napi_struct *napi, struct vlan_group *grp,
 	for (p = napi->gro_list; p; p = p->next) {
 		NAPI_GRO_CB(p)->same_flow =
 			p->dev == skb->dev && !compare_ether_header(
-				skb_mac_header(p), skb_gro_mac_header(skb));
+				skb_mac_header(p), skb_mac_header(skb));
 		NAPI_GRO_CB(p)->flush = 0;
 	}
 
@@ -128,6 +128,7 @@ gro_result_t vlan_gro_frags(struct napi_struct *napi, struct vlan_group *grp,
 		return GRO_DROP;
 
 	if (netpoll_rx_on(skb)) {
+		__skb_push(skb, ETH_HLEN);
 		skb->protocol = eth_type_trans(skb, skb->dev);
 		return vlan_hwaccel_receive_skb(skb, grp, vlan_tci)
 			? GRO_DROP : GRO_NORMAL;
@@ -56,6 +56,7 @@
 #include <net/checksum.h>
 #include <net/sock.h>
 #include <net/tcp_states.h>
+#include <net/busy_poll.h>
 #include <trace/events/skb.h>
 
 /*
@@ -196,6 +197,11 @@ struct sk_buff *__skb_recv_datagram(struct sock *sk, unsigned flags,
 		if (skb)
 			return skb;
 
+		/* wait_for_packet() returns at once if this found data */
+		if (sk_can_busy_loop(sk) &&
+		    sk_busy_loop(sk, flags & MSG_DONTWAIT))
+			continue;
+
 		/* User doesn't want to wait */
 		error = -EAGAIN;
 		if (!timeo)
@@ -236,7 +242,7 @@ void skb_free_datagram_locked(struct sock *sk, struct sk_buff *skb)
 EXPORT_SYMBOL(skb_free_datagram_locked);
 
 /**
- *	skb_kill_datagram - Free a datagram skbuff forcibly
+ *	__skb_kill_datagram - Free a datagram skbuff forcibly
  *	@sk: socket
  *	@skb: datagram skbuff
  *	@flags: MSG_ flags
@@ -253,10 +259,13 @@ EXPORT_SYMBOL(skb_free_datagram_locked);
  *	sk_receive_queue lock.  Therefore it must not be used in a
  *	context where that lock is acquired in an IRQ context.
  *
- *	It returns 0 if the packet was removed by us.
+ *	It returns 0 if the packet was removed by us.  Unlike
+ *	skb_kill_datagram() it leaves the socket's forward allocation
+ *	alone, for protocols that do not account memory under the
+ *	socket lock.
  */
-
-int skb_kill_datagram(struct sock *sk, struct sk_buff *skb, unsigned int flags)
+int __skb_kill_datagram(struct sock *sk, struct sk_buff *skb,
+			unsigned int flags)
 {
 	int err = 0;
 
@@ -273,11 +282,19 @@ int skb_kill_datagram(struct sock *sk, struct sk_buff *skb, unsigned int flags)
 
 	kfree_skb(skb);
 	atomic_inc(&sk->sk_drops);
-	sk_mem_reclaim_partial(sk);
 
 	return err;
 }
+EXPORT_SYMBOL(__skb_kill_datagram);
+
+/* As __skb_kill_datagram(), with the socket locked by the caller. */
+int skb_kill_datagram(struct sock *sk, struct sk_buff *skb, unsigned int flags)
+{
+	int err = __skb_kill_datagram(sk, skb, flags);
 
+	sk_mem_reclaim_partial(sk);
+	return err;
+}
 EXPORT_SYMBOL(skb_kill_datagram);
 
 /**
@@ -130,6 +130,7 @@
 #include <linux/jhash.h>
 #include <linux/random.h>
 #include <trace/events/napi.h>
+#include <net/busy_poll.h>
 
 #include "net-sysfs.h"
 
@@ -252,6 +253,110 @@ static RAW_NOTIFIER_HEAD(netdev_chain);
 DEFINE_PER_CPU(struct softnet_data, softnet_data);
 EXPORT_PER_CPU_SYMBOL(softnet_data);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/*
+ *	NAPI contexts are numbered so that sockets can find the one their
+ *	data arrives on.  Received packets are stamped with the id of the
+ *	NAPI context being polled on this cpu; id 0 means none.
+ */
+#define NAPI_HASH_BITS	8
+#define NAPI_HASH_MASK	((1 << NAPI_HASH_BITS) - 1)
+
+static struct hlist_head napi_hash[1 << NAPI_HASH_BITS];
+static DEFINE_SPINLOCK(napi_hash_lock);
+static unsigned int napi_gen_id;
+static DEFINE_PER_CPU(unsigned int, napi_rx_id);
+
+static int napi_id_in_use(unsigned int napi_id)
+{
+	struct napi_struct *napi;
+	struct hlist_node *node;
+
+	hlist_for_each_entry(napi, node, &napi_hash[napi_id & NAPI_HASH_MASK],
+			     napi_hash_node)
+		if (napi->napi_id == napi_id)
+			return 1;
+	return 0;
+}
+
+static void napi_hash_add(struct napi_struct *napi)
+{
+	spin_lock(&napi_hash_lock);
+	do {
+		if (unlikely(++napi_gen_id == 0))
+			napi_gen_id = 1;
+	} while (napi_id_in_use(napi_gen_id));
+	napi->napi_id = napi_gen_id;
+	hlist_add_head_rcu(&napi->napi_hash_node,
+			   &napi_hash[napi->napi_id & NAPI_HASH_MASK]);
+	spin_unlock(&napi_hash_lock);
+}
+
+/* Returns non-zero if the caller must wait for an RCU grace period. */
+static int napi_hash_del(struct napi_struct *napi)
+{
+	int hashed;
+
+	spin_lock(&napi_hash_lock);
+	hashed = !hlist_unhashed(&napi->napi_hash_node);
+	if (hashed)
+		hlist_del_init_rcu(&napi->napi_hash_node);
+	spin_unlock(&napi_hash_lock);
+	return hashed;
+}
+
+/* Must be called under rcu_read_lock(). */
+static struct napi_struct *napi_by_id(unsigned int napi_id)
+{
+	struct napi_struct *napi;
+	struct hlist_node *node;
+
+	hlist_for_each_entry_rcu(napi, node,
+				 &napi_hash[napi_id & NAPI_HASH_MASK],
+				 napi_hash_node)
+		if (napi->napi_id == napi_id)
+			return napi;
+	return NULL;
+}
+
+static inline void napi_rx_begin(struct napi_struct *napi)
+{
+	__get_cpu_var(napi_rx_id) = napi->napi_id;
+}
+
+static inline void napi_rx_end(void)
+{
+	__get_cpu_var(napi_rx_id) = 0;
+}
+
+static inline void skb_mark_napi_id(struct sk_buff *skb)
+{
+	if (!skb->napi_id)
+		skb->napi_id = __get_cpu_var(napi_rx_id);
+}
+#else
+static inline void napi_hash_add(struct napi_struct *napi)
+{
+}
+
+static inline int napi_hash_del(struct napi_struct *napi)
+{
+	return 0;
+}
+
+static inline void napi_rx_begin(struct napi_struct *napi)
+{
+}
+
+static inline void napi_rx_end(void)
+{
+}
+
+static inline void skb_mark_napi_id(struct sk_buff *skb)
+{
+}
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
 #ifdef CONFIG_LOCKDEP
 /*
  * register_netdevice() inits txq->_xmit_lock and sets lockdep class
@@ -1702,6 +1807,44 @@ out:
 }
 EXPORT_SYMBOL(skb_checksum_help);
 
+/**
+ *	skb_mac_gso_segment - mac layer segmentation handler.
+ *	@skb: buffer to segment
+ *	@features: features for the output path (see dev->features)
+ *
+ *	Hands the buffer to the gso_segment handler of the packet type in
+ *	skb->protocol.  skb->data must point at the network header and
+ *	skb->mac_len must cover everything between the mac header and it.
+ */
+struct sk_buff *skb_mac_gso_segment(struct sk_buff *skb, int features)
+{
+	struct sk_buff *segs = ERR_PTR(-EPROTONOSUPPORT);
+	struct packet_type *ptype;
+	__be16 type = skb->protocol;
+	int err;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(ptype,
+			&ptype_base[ntohs(type) & PTYPE_HASH_MASK], list) {
+		if (ptype->type == type && !ptype->dev && ptype->gso_segment) {
+			if (unlikely(skb->ip_summed != CHECKSUM_PARTIAL)) {
+				err = ptype->gso_send_check(skb);
+				segs = ERR_PTR(err);
+				if (err || skb_gso_ok(skb, features))
+					break;
+				__skb_push(skb, (skb->data -
+						 skb_network_header(skb)));
+			}
+			segs = ptype->gso_segment(skb, features);
+			break;
+		}
+	}
+	rcu_read_unlock();
+
+	return segs;
+}
+EXPORT_SYMBOL(skb_mac_gso_segment);
+
 /**
  *	skb_gso_segment - Perform segmentation on skb.
  *	@skb: buffer to segment
@@ -1714,9 +1857,7 @@ EXPORT_SYMBOL(skb_checksum_help);
  */
 struct sk_buff *skb_gso_segment(struct sk_buff *skb, int features)
 {
-	struct sk_buff *segs = ERR_PTR(-EPROTONOSUPPORT);
-	struct packet_type *ptype;
-	__be16 type = skb->protocol;
+	struct sk_buff *segs;
 	int err;
 
 	skb_reset_mac_header(skb);
@@ -1741,23 +1882,7 @@ struct sk_buff *skb_gso_segment(struct sk_buff *skb, int features)
 			return ERR_PTR(err);
 	}
 
-	rcu_read_lock();
-	list_for_each_entry_rcu(ptype,
-			&ptype_base[ntohs(type) & PTYPE_HASH_MASK], list) {
-		if (ptype->type == type && !ptype->dev && ptype->gso_segment) {
-			if (unlikely(skb->ip_summed != CHECKSUM_PARTIAL)) {
-				err = ptype->gso_send_check(skb);
-				segs = ERR_PTR(err);
-				if (err || skb_gso_ok(skb, features))
-					break;
-				__skb_push(skb, (skb->data -
-						 skb_network_header(skb)));
-			}
-			segs = ptype->gso_segment(skb, features);
-			break;
-		}
-	}
-	rcu_read_unlock();
+	segs = skb_mac_gso_segment(skb, features);
 
 	__skb_push(skb, skb->data - skb_mac_header(skb));
 
@@ -1765,6 +1890,62 @@ struct sk_buff *skb_gso_segment(struct sk_buff *skb, int features)
 }
 EXPORT_SYMBOL(skb_gso_segment);
 
+/**
+ *	skb_encap_gso_segment - segment an encapsulated skb.
+ *	@skb: buffer to segment, skb->data pointing at the tunnel header
+ *	@features: features for the output path (see dev->features)
+ *	@hlen: length of the tunnel header
+ *	@protocol: ethertype of the encapsulated packet
+ *
+ *	Called from the gso_segment handler of a tunnel protocol.  The outer
+ *	headers, up to and including the tunnel header, are treated as part
+ *	of the mac header while the inner packet is segmented, so that
+ *	skb_segment() replicates them into every segment.  The outer header
+ *	offsets are restored on the resulting segments; the outer network
+ *	handler then fixes up its own header as usual.
+ *
+ *	Devices cannot be expected to checksum the inner transport header,
+ *	so segments are always checksummed in software.
+ */
+struct sk_buff *skb_encap_gso_segment(struct sk_buff *skb, int features,
+				      unsigned int hlen, __be16 protocol)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	__be16 outer_protocol = skb->protocol;
+	unsigned int outer_mac_len = skb->mac_len;
+	int nhoff = skb->network_header - skb->mac_header;
+	int thoff = skb->transport_header - skb->mac_header;
+
+	if (unlikely(!pskb_may_pull(skb, hlen)))
+		goto out;
+
+	__skb_pull(skb, hlen);
+	skb_reset_network_header(skb);
+	skb->mac_len = skb->network_header - skb->mac_header;
+	skb->protocol = protocol;
+
+	segs = skb_mac_gso_segment(skb, features & ~NETIF_F_ALL_CSUM);
+
+	skb->protocol = outer_protocol;
+	skb->mac_len = outer_mac_len;
+	skb->network_header = skb->mac_header + nhoff;
+	skb->transport_header = skb->mac_header + thoff;
+
+	if (!segs || IS_ERR(segs))
+		goto out;
+
+	for (skb = segs; skb; skb = skb->next) {
+		skb->protocol = outer_protocol;
+		skb->mac_len = outer_mac_len;
+		skb->network_header = skb->mac_header + nhoff;
+		skb->transport_header = skb->mac_header + thoff;
+	}
+
+out:
+	return segs;
+}
+EXPORT_SYMBOL(skb_encap_gso_segment);
+
 /* Take action when hardware reception checksum errors are detected. */
 #ifdef CONFIG_BUG
 void netdev_rx_csum_fault(struct net_device *dev)
@@ -1969,13 +2150,56 @@ static inline u16 dev_cap_txqueue(struct net_device *dev, u16 queue_index)
 	return queue_index;
 }
 
+static inline int get_xps_queue(struct net_device *dev, struct sk_buff *skb)
+{
+#ifdef CONFIG_XPS
+	struct xps_dev_maps *dev_maps;
+	struct xps_map *map;
+	int queue_index = -1;
+
+	rcu_read_lock();
+	dev_maps = rcu_dereference(dev->xps_maps);
+	if (dev_maps) {
+		map = rcu_dereference(
+		    dev_maps->cpu_map[raw_smp_processor_id()]);
+		if (map) {
+			if (map->len == 1)
+				queue_index = map->queues[0];
+			else {
+				u32 hash;
+				if (skb->sk && skb->sk->sk_hash)
+					hash = skb->sk->sk_hash;
+				else
+					hash = skb->protocol;
+				hash = jhash_1word(hash, skb_tx_hashrnd);
+				queue_index = map->queues[
+				    ((u64)hash * map->len) >> 32];
+			}
+			if (unlikely(queue_index >= dev->real_num_tx_queues))
+				queue_index = -1;
+		}
+	}
+	rcu_read_unlock();
+
+	return queue_index;
+#else
+	return -1;
+#endif
+}
+
 static struct netdev_queue *dev_pick_tx(struct net_device *dev,
 					struct sk_buff *skb)
 {
-	u16 queue_index;
+	int queue_index;
 	struct sock *sk = skb->sk;
 
-	if (sk_tx_queue_recorded(sk)) {
+	/*
+	 * A queue recorded on the socket is kept until the socket has no
+	 * packets left in lower layers (skb->ooo_okay); only then is it
+	 * safe to move the flow to another queue without reordering.
+	 */
+	if (sk_tx_queue_recorded(sk) && !skb->ooo_okay &&
+	    sk_tx_queue_get(sk) < dev->real_num_tx_queues) {
 		queue_index = sk_tx_queue_get(sk);
 	} else {
 		const struct net_device_ops *ops = dev->netdev_ops;
@@ -1985,8 +2209,11 @@ static struct netdev_queue *dev_pick_tx(struct net_device *dev,
 			queue_index = dev_cap_txqueue(dev, queue_index);
 		} else {
 			queue_index = 0;
-			if (dev->real_num_tx_queues > 1)
-				queue_index = skb_tx_hash(dev, skb);
+			if (dev->real_num_tx_queues > 1) {
+				queue_index = get_xps_queue(dev, skb);
+				if (queue_index < 0)
+					queue_index = skb_tx_hash(dev, skb);
+			}
 
 			if (sk) {
 				struct dst_entry *dst = rcu_dereference_bh(sk->sk_dst_cache);
@@ -2506,6 +2733,8 @@ int netif_receive_skb(struct sk_buff *skb)
 	if (!skb->skb_iif)
 		skb->skb_iif = skb->dev->ifindex;
 
+	skb_mark_napi_id(skb);
+
 	null_or_orig = NULL;
 	orig_dev = skb->dev;
 	master = ACCESS_ONCE(orig_dev->master);
@@ -2627,7 +2856,7 @@ static int napi_gro_complete(struct sk_buff *skb)
 		if (ptype->type != type || ptype->dev || !ptype->gro_complete)
 			continue;
 
-		err = ptype->gro_complete(skb);
+		err = ptype->gro_complete(skb, 0);
 		break;
 	}
 	rcu_read_unlock();
@@ -2642,6 +2871,48 @@ out:
 	return netif_receive_skb(skb);
 }
 
+/**
+ *	gro_find_receive_by_type - find the GRO handler of an ethertype
+ *	@type: ethertype of the encapsulated packet
+ *
+ *	Used by tunnel gro_receive handlers to hand the inner packet on to
+ *	the next layer.  Must be called under rcu_read_lock().
+ */
+struct packet_type *gro_find_receive_by_type(__be16 type)
+{
+	struct list_head *head = &ptype_base[ntohs(type) & PTYPE_HASH_MASK];
+	struct packet_type *ptype;
+
+	list_for_each_entry_rcu(ptype, head, list) {
+		if (ptype->type != type || ptype->dev || !ptype->gro_receive)
+			continue;
+		return ptype;
+	}
+	return NULL;
+}
+EXPORT_SYMBOL(gro_find_receive_by_type);
+
+/**
+ *	gro_find_complete_by_type - find the GRO completion of an ethertype
+ *	@type: ethertype of the encapsulated packet
+ *
+ *	Counterpart of gro_find_receive_by_type() for gro_complete handlers.
+ *	Must be called under rcu_read_lock().
+ */
+struct packet_type *gro_find_complete_by_type(__be16 type)
+{
+	struct list_head *head = &ptype_base[ntohs(type) & PTYPE_HASH_MASK];
+	struct packet_type *ptype;
+
+	list_for_each_entry_rcu(ptype, head, list) {
+		if (ptype->type != type || ptype->dev || !ptype->gro_complete)
+			continue;
+		return ptype;
+	}
+	return NULL;
+}
+EXPORT_SYMBOL(gro_find_complete_by_type);
+
 static void napi_gro_flush(struct napi_struct *napi)
 {
 	struct sk_buff *skb, *next;
@@ -2656,6 +2927,31 @@ static void napi_gro_flush(struct napi_struct *napi)
 	napi->gro_list = NULL;
 }
 
+/*
+ * Move @grow bytes at the start of the first page fragment, where frag0
+ * points, to the end of the linear area.
+ */
+static void gro_pull_from_frag0(struct sk_buff *skb, int grow)
+{
+	struct skb_shared_info *pinfo = skb_shinfo(skb);
+
+	BUG_ON(skb->end - skb->tail < grow);
+
+	memcpy(skb_tail_pointer(skb), NAPI_GRO_CB(skb)->frag0, grow);
+
+	skb->tail += grow;
+	skb->data_len -= grow;
+
+	pinfo->frags[0].page_offset += grow;
+	pinfo->frags[0].size -= grow;
+
+	if (unlikely(!pinfo->frags[0].size)) {
+		put_page(pinfo->frags[0].page);
+		memmove(pinfo->frags, pinfo->frags + 1,
+			--pinfo->nr_frags * sizeof(pinfo->frags[0]));
+	}
+}
+
 enum gro_result dev_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 {
 	struct sk_buff **pp = NULL;
@@ -2683,6 +2979,7 @@ enum gro_result dev_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 		NAPI_GRO_CB(skb)->same_flow = 0;
 		NAPI_GRO_CB(skb)->flush = 0;
 		NAPI_GRO_CB(skb)->free = 0;
+		NAPI_GRO_CB(skb)->csum = skb->csum;
 
 		pp = ptype->gro_receive(&napi->gro_list, skb);
 		break;
@@ -2718,26 +3015,8 @@ enum gro_result dev_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 	ret = GRO_HELD;
 
 pull:
-	if (skb_headlen(skb) < skb_gro_offset(skb)) {
-		int grow = skb_gro_offset(skb) - skb_headlen(skb);
-
-		BUG_ON(skb->end - skb->tail < grow);
-
-		memcpy(skb_tail_pointer(skb), NAPI_GRO_CB(skb)->frag0, grow);
-
-		skb->tail += grow;
-		skb->data_len -= grow;
-
-		skb_shinfo(skb)->frags[0].page_offset += grow;
-		skb_shinfo(skb)->frags[0].size -= grow;
-
-		if (unlikely(!skb_shinfo(skb)->frags[0].size)) {
-			put_page(skb_shinfo(skb)->frags[0].page);
-			memmove(skb_shinfo(skb)->frags,
-				skb_shinfo(skb)->frags + 1,
-				--skb_shinfo(skb)->nr_frags);
-		}
-	}
+	if (skb_headlen(skb) < skb_gro_offset(skb))
+		gro_pull_from_frag0(skb, skb_gro_offset(skb) - skb_headlen(skb));
 
 ok:
 	return ret;
@@ -2760,7 +3039,7 @@ __napi_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 		NAPI_GRO_CB(p)->same_flow =
 			(p->dev == skb->dev) &&
 			!compare_ether_header(skb_mac_header(p),
-					      skb_gro_mac_header(skb));
+					      skb_mac_header(skb));
 		NAPI_GRO_CB(p)->flush = 0;
 	}
 
@@ -2841,11 +3120,10 @@ gro_result_t napi_frags_finish(struct napi_struct *napi, struct sk_buff *skb,
 	switch (ret) {
 	case GRO_NORMAL:
 	case GRO_HELD:
+		__skb_push(skb, ETH_HLEN);
 		skb->protocol = eth_type_trans(skb, skb->dev);
 
-		if (ret == GRO_HELD)
-			skb_gro_pull(skb, -ETH_HLEN);
-		else if (netif_receive_skb(skb))
+		if (ret == GRO_NORMAL && netif_receive_skb(skb))
 			ret = GRO_DROP;
 		break;
 
@@ -2862,39 +3140,43 @@ gro_result_t napi_frags_finish(struct napi_struct *napi, struct sk_buff *skb,
 }
 EXPORT_SYMBOL(napi_frags_finish);
 
+/*
+ * The Ethernet header is moved to the linear area and pulled, so that
+ * GRO offsets count from the network header as they do for packets from
+ * napi_gro_receive(), whose drivers ran eth_type_trans() already.
+ */
 struct sk_buff *napi_frags_skb(struct napi_struct *napi)
 {
 	struct sk_buff *skb = napi->skb;
 	struct ethhdr *eth;
-	unsigned int hlen;
-	unsigned int off;
+	unsigned int hlen = sizeof(*eth);
 
 	napi->skb = NULL;
 
 	skb_reset_mac_header(skb);
 	skb_gro_reset_offset(skb);
 
-	off = skb_gro_offset(skb);
-	hlen = off + sizeof(*eth);
-	eth = skb_gro_header_fast(skb, off);
+	eth = skb_gro_header_fast(skb, 0);
 	if (skb_gro_header_hard(skb, hlen)) {
-		eth = skb_gro_header_slow(skb, hlen, off);
+		eth = skb_gro_header_slow(skb, hlen, 0);
 		if (unlikely(!eth)) {
 			napi_reuse_skb(napi, skb);
-			skb = NULL;
-			goto out;
+			return NULL;
 		}
+	} else {
+		gro_pull_from_frag0(skb, hlen);
+		NAPI_GRO_CB(skb)->frag0 += hlen;
+		NAPI_GRO_CB(skb)->frag0_len -= hlen;
 	}
-
-	skb_gro_pull(skb, sizeof(*eth));
+	eth = (struct ethhdr *)skb_mac_header(skb);
+	__skb_pull(skb, hlen);
 
 	/*
 	 * This works because the only protocols we care about don't require
-	 * special handling.  We'll fix it up properly at the end.
+	 * special handling.  We'll fix it up properly in napi_frags_finish().
 	 */
 	skb->protocol = eth->h_proto;
 
-out:
 	return skb;
 }
 EXPORT_SYMBOL(napi_frags_skb);
@@ -2997,6 +3279,7 @@ void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 	napi->poll_owner = -1;
 #endif
 	set_bit(NAPI_STATE_SCHED, &napi->state);
+	napi_hash_add(napi);
 }
 EXPORT_SYMBOL(netif_napi_add);
 
@@ -3015,9 +3298,88 @@ void netif_napi_del(struct napi_struct *napi)
 
 	napi->gro_list = NULL;
 	napi->gro_count = 0;
+
+	/* Busy polling sockets may still be looking at it. */
+	if (napi_hash_del(napi))
+		synchronize_net();
 }
 EXPORT_SYMBOL(netif_napi_del);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/**
+ *	sk_busy_loop - poll for a socket's data from process context
+ *	@sk: socket whose receive queue is empty
+ *	@nonblock: poll once rather than until data or timeout
+ *
+ *	Runs the ->poll() routine of the NAPI context that last delivered
+ *	data to @sk for up to sk->sk_ll_usec microseconds, until data is
+ *	queued to @sk, or until the task has something better to do.
+ *	The NAPI context is claimed with NAPI_STATE_SCHED just as for a
+ *	softirq poll; if another cpu holds it we spin without polling.
+ *
+ *	Returns non-zero if the receive queue of @sk is not empty.
+ */
+int sk_busy_loop(struct sock *sk, int nonblock)
+{
+	struct napi_struct *napi;
+	unsigned long long end_time;
+	int owned = 0;
+	int rc = 0;
+
+	local_bh_disable();
+	rcu_read_lock();
+
+	napi = napi_by_id(sk->sk_napi_id);
+	if (!napi)
+		goto out;
+
+	end_time = sched_clock() +
+		   (unsigned long long)ACCESS_ONCE(sk->sk_ll_usec) * NSEC_PER_USEC;
+	napi_rx_begin(napi);
+
+	for (;;) {
+		if (owned || napi_schedule_prep(napi)) {
+			void *have = netpoll_poll_lock(napi);
+			int work;
+
+			/* Not on any poll list; ->poll() may list_del() it. */
+			if (!owned)
+				INIT_LIST_HEAD(&napi->poll_list);
+			work = napi->poll(napi, napi->weight);
+			trace_napi_poll(napi);
+			netpoll_poll_unlock(have);
+
+			/* With the weight used up the driver did not
+			 * complete, so the context is still ours.
+			 */
+			owned = (work == napi->weight);
+		}
+
+		rc = !skb_queue_empty(&sk->sk_receive_queue);
+		if (rc || nonblock || need_resched() ||
+		    signal_pending(current) || napi_disable_pending(napi) ||
+		    sched_clock() >= end_time)
+			break;
+		cpu_relax();
+	}
+
+	napi_rx_end();
+
+	/* Hand an unfinished context back as net_rx_action() would. */
+	if (owned) {
+		if (unlikely(napi_disable_pending(napi)))
+			napi_complete(napi);
+		else
+			__napi_schedule(napi);
+	}
+out:
+	rcu_read_unlock();
+	local_bh_enable();
+	return rc;
+}
+EXPORT_SYMBOL(sk_busy_loop);
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
 
 static void net_rx_action(struct softirq_action *h)
 {
@@ -3060,7 +3422,9 @@ static void net_rx_action(struct softirq_action *h)
 		 */
 		work = 0;
 		if (test_bit(NAPI_STATE_SCHED, &n->state)) {
+			napi_rx_begin(n);
 			work = n->poll(n, weight);
+			napi_rx_end();
 			trace_napi_poll(n);
 		}
 
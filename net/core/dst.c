@@ -251,7 +251,7 @@ again:
 
 		if (atomic_dec_and_test(&dst->__refcnt)) {
 			/* We were real parent of this dst, so kill child. */
-			if (nohash)
+			if (nohash || (dst->flags & DST_NOCACHE))
 				goto again;
 		} else {
 			/* Child is still referenced, return it for freeing. */
@@ -263,6 +263,15 @@ again:
 	return NULL;
 }
 
+static void dst_destroy_rcu(struct rcu_head *head)
+{
+	struct dst_entry *dst = container_of(head, struct dst_entry, rcu_head);
+
+	dst = dst_destroy(dst);
+	if (dst)
+		__dst_free(dst);
+}
+
 void dst_release(struct dst_entry *dst)
 {
 	if (dst) {
@@ -271,10 +280,46 @@ void dst_release(struct dst_entry *dst)
 		smp_mb__before_atomic_dec();
                newrefcnt = atomic_dec_return(&dst->__refcnt);
                WARN_ON(newrefcnt < 0);
+		if (unlikely(dst->flags & DST_NOCACHE) && !newrefcnt)
+			call_rcu_bh(&dst->rcu_head, dst_destroy_rcu);
 	}
 }
 EXPORT_SYMBOL(dst_release);
 
+struct dst_release_rcu {
+	struct rcu_head		rcu;
+	struct dst_entry	*dst;
+};
+
+static void dst_release_rcu_cb(struct rcu_head *head)
+{
+	struct dst_release_rcu *r = container_of(head, struct dst_release_rcu,
+						 rcu);
+
+	dst_release(r->dst);
+	kfree(r);
+}
+
+/*
+ * Drop a reference after an RCU grace period, for a pointer that readers
+ * pick up under rcu_read_lock() and take their own reference on with
+ * atomic_inc_not_zero().  The entry may be freed as soon as its count
+ * hits zero, so it must outlive those readers.  Returns -ENOMEM, with
+ * the reference still held, if that can't be arranged.
+ */
+int dst_release_rcu(struct dst_entry *dst)
+{
+	struct dst_release_rcu *r;
+
+	r = kmalloc(sizeof(*r), GFP_ATOMIC);
+	if (!r)
+		return -ENOMEM;
+	r->dst = dst;
+	call_rcu(&r->rcu, dst_release_rcu_cb);
+	return 0;
+}
+EXPORT_SYMBOL(dst_release_rcu);
+
 /* Dirty hack. We did it in 2.2 (in __dst_free),
  * we have _very_ good reasons not to repeat
  * this mistake in 2.3, but we have no choice
@@ -283,8 +328,11 @@ EXPORT_SYMBOL(dst_release);
  *
  * Commented and originally written by Alexey.
  */
-static inline void dst_ifdown(struct dst_entry *dst, struct net_device *dev,
-			      int unregister)
+/*
+ * Take @dev from @dst: it stops passing traffic when the device goes
+ * down, and its device references move to loopback on unregister.
+ */
+void dst_ifdown(struct dst_entry *dst, struct net_device *dev, int unregister)
 {
 	if (dst->ops->ifdown)
 		dst->ops->ifdown(dst, dev, unregister);
@@ -305,6 +353,7 @@ static inline void dst_ifdown(struct dst_entry *dst, struct net_device *dev,
 		}
 	}
 }
+EXPORT_SYMBOL(dst_ifdown);
 
 static int dst_dev_event(struct notifier_block *this, unsigned long event, void *ptr)
 {
@@ -17,6 +17,7 @@
 #include <net/sock.h>
 #include <linux/rtnetlink.h>
 #include <linux/wireless.h>
+#include <linux/cpumask.h>
 #include <net/wext.h>
 
 #include "net-sysfs.h"
@@ -469,6 +470,341 @@ static struct attribute_group wireless_group = {
 
 #endif /* CONFIG_SYSFS */
 
+#ifdef CONFIG_XPS
+/*
+ * netdev_queue sysfs structures and functions.
+ */
+struct netdev_queue_attribute {
+	struct attribute attr;
+	ssize_t (*show)(struct netdev_queue *queue,
+	    struct netdev_queue_attribute *attr, char *buf);
+	ssize_t (*store)(struct netdev_queue *queue,
+	    struct netdev_queue_attribute *attr, const char *buf, size_t len);
+};
+#define to_netdev_queue_attr(_attr) container_of(_attr,		\
+    struct netdev_queue_attribute, attr)
+
+#define to_netdev_queue(obj) container_of(obj, struct netdev_queue, kobj)
+
+static ssize_t netdev_queue_attr_show(struct kobject *kobj,
+				      struct attribute *attr, char *buf)
+{
+	struct netdev_queue_attribute *attribute = to_netdev_queue_attr(attr);
+	struct netdev_queue *queue = to_netdev_queue(kobj);
+
+	if (!attribute->show)
+		return -EIO;
+
+	return attribute->show(queue, attribute, buf);
+}
+
+static ssize_t netdev_queue_attr_store(struct kobject *kobj,
+				       struct attribute *attr,
+				       const char *buf, size_t count)
+{
+	struct netdev_queue_attribute *attribute = to_netdev_queue_attr(attr);
+	struct netdev_queue *queue = to_netdev_queue(kobj);
+
+	if (!attribute->store)
+		return -EIO;
+
+	return attribute->store(queue, attribute, buf, count);
+}
+
+static const struct sysfs_ops netdev_queue_sysfs_ops = {
+	.show = netdev_queue_attr_show,
+	.store = netdev_queue_attr_store,
+};
+
+static inline unsigned int get_netdev_queue_index(struct netdev_queue *queue)
+{
+	return queue - queue->dev->_tx;
+}
+
+static ssize_t show_xps_map(struct netdev_queue *queue,
+			    struct netdev_queue_attribute *attribute, char *buf)
+{
+	struct net_device *dev = queue->dev;
+	struct xps_dev_maps *dev_maps;
+	cpumask_var_t mask;
+	unsigned int index;
+	size_t len = 0;
+	int i, j;
+
+	if (!zalloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	index = get_netdev_queue_index(queue);
+
+	rcu_read_lock();
+	dev_maps = rcu_dereference(dev->xps_maps);
+	if (dev_maps) {
+		for_each_possible_cpu(i) {
+			struct xps_map *map =
+			    rcu_dereference(dev_maps->cpu_map[i]);
+
+			if (!map)
+				continue;
+			for (j = 0; j < map->len; j++) {
+				if (map->queues[j] == index) {
+					cpumask_set_cpu(i, mask);
+					break;
+				}
+			}
+		}
+	}
+	rcu_read_unlock();
+
+	len += cpumask_scnprintf(buf + len, PAGE_SIZE, mask);
+	free_cpumask_var(mask);
+	if (PAGE_SIZE - len < 3)
+		return -EINVAL;
+
+	len += sprintf(buf + len, "\n");
+	return len;
+}
+
+static DEFINE_MUTEX(xps_map_mutex);
+
+static void xps_map_release(struct rcu_head *rcu)
+{
+	kfree(container_of(rcu, struct xps_map, rcu));
+}
+
+static void xps_dev_maps_release(struct rcu_head *rcu)
+{
+	kfree(container_of(rcu, struct xps_dev_maps, rcu));
+}
+
+/*
+ * Build a copy of @map with queue @index added (@add) or removed.
+ * Returns NULL on allocation failure or when the resulting map is empty;
+ * the caller tells the two apart by @add.
+ */
+static struct xps_map *xps_map_copy(struct xps_map *map, unsigned int pos,
+				    u16 index, bool add, int cpu)
+{
+	unsigned int map_len = map ? map->len : 0;
+	unsigned int new_len = add ? map_len + 1 : map_len - 1;
+	struct xps_map *new_map;
+	unsigned int i, j;
+
+	if (!new_len)
+		return NULL;
+
+	new_map = kzalloc_node(XPS_MAP_SIZE(new_len), GFP_KERNEL,
+			       cpu_to_node(cpu));
+	if (!new_map)
+		return NULL;
+
+	for (i = 0, j = 0; i < map_len; i++)
+		if (add || i != pos)
+			new_map->queues[j++] = map->queues[i];
+	if (add)
+		new_map->queues[j++] = index;
+	new_map->len = j;
+
+	return new_map;
+}
+
+static ssize_t store_xps_map(struct netdev_queue *queue,
+			     struct netdev_queue_attribute *attribute,
+			     const char *buf, size_t len)
+{
+	struct net_device *dev = queue->dev;
+	struct xps_dev_maps *dev_maps, *new_dev_maps;
+	struct xps_map *map, *new_map;
+	cpumask_var_t mask;
+	unsigned int index, pos;
+	int err, cpu, need_set;
+	int nonempty = 0;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	index = get_netdev_queue_index(queue);
+
+	err = bitmap_parse(buf, len, cpumask_bits(mask), nr_cpumask_bits);
+	if (err) {
+		free_cpumask_var(mask);
+		return err;
+	}
+
+	new_dev_maps = kzalloc(max_t(unsigned, XPS_DEV_MAPS_SIZE,
+				     L1_CACHE_BYTES), GFP_KERNEL);
+	if (!new_dev_maps) {
+		free_cpumask_var(mask);
+		return -ENOMEM;
+	}
+
+	mutex_lock(&xps_map_mutex);
+
+	dev_maps = dev->xps_maps;
+
+	for_each_possible_cpu(cpu) {
+		map = dev_maps ? dev_maps->cpu_map[cpu] : NULL;
+		new_map = map;
+		pos = 0;
+		if (map) {
+			for (pos = 0; pos < map->len; pos++)
+				if (map->queues[pos] == index)
+					break;
+		}
+
+		need_set = cpumask_test_cpu(cpu, mask) && cpu_online(cpu);
+		if (need_set && (!map || pos >= map->len)) {
+			/* Need to add queue to this CPU's map */
+			new_map = xps_map_copy(map, pos, index, true, cpu);
+			if (!new_map)
+				goto error;
+		} else if (!need_set && map && pos < map->len) {
+			/* Need to remove queue from this CPU's map */
+			new_map = xps_map_copy(map, pos, index, false, cpu);
+			if (!new_map && map->len > 1)
+				goto error;
+		}
+		new_dev_maps->cpu_map[cpu] = new_map;
+		if (new_map)
+			nonempty = 1;
+	}
+
+	/* Cleanup old maps */
+	for_each_possible_cpu(cpu) {
+		map = dev_maps ? dev_maps->cpu_map[cpu] : NULL;
+		if (map && new_dev_maps->cpu_map[cpu] != map)
+			call_rcu(&map->rcu, xps_map_release);
+	}
+
+	if (nonempty)
+		rcu_assign_pointer(dev->xps_maps, new_dev_maps);
+	else {
+		kfree(new_dev_maps);
+		rcu_assign_pointer(dev->xps_maps, NULL);
+	}
+
+	if (dev_maps)
+		call_rcu(&dev_maps->rcu, xps_dev_maps_release);
+
+	mutex_unlock(&xps_map_mutex);
+
+	free_cpumask_var(mask);
+	return len;
+
+error:
+	mutex_unlock(&xps_map_mutex);
+
+	for_each_possible_cpu(cpu) {
+		map = dev_maps ? dev_maps->cpu_map[cpu] : NULL;
+		if (new_dev_maps->cpu_map[cpu] != map)
+			kfree(new_dev_maps->cpu_map[cpu]);
+	}
+	kfree(new_dev_maps);
+	free_cpumask_var(mask);
+	return -ENOMEM;
+}
+
+/* Drop all XPS maps of a device that is going away. */
+static void xps_dev_maps_flush(struct net_device *dev)
+{
+	struct xps_dev_maps *dev_maps;
+	struct xps_map *map;
+	int cpu;
+
+	mutex_lock(&xps_map_mutex);
+	dev_maps = dev->xps_maps;
+	if (dev_maps) {
+		rcu_assign_pointer(dev->xps_maps, NULL);
+		for_each_possible_cpu(cpu) {
+			map = dev_maps->cpu_map[cpu];
+			if (map)
+				call_rcu(&map->rcu, xps_map_release);
+		}
+		call_rcu(&dev_maps->rcu, xps_dev_maps_release);
+	}
+	mutex_unlock(&xps_map_mutex);
+}
+
+static struct netdev_queue_attribute xps_cpus_attribute =
+    __ATTR(xps_cpus, S_IRUGO | S_IWUSR, show_xps_map, store_xps_map);
+
+static struct attribute *netdev_queue_default_attrs[] = {
+	&xps_cpus_attribute.attr,
+	NULL
+};
+
+static void netdev_queue_release(struct kobject *kobj)
+{
+	struct netdev_queue *queue = to_netdev_queue(kobj);
+
+	memset(kobj, 0, sizeof(*kobj));
+	dev_put(queue->dev);
+}
+
+static struct kobj_type netdev_queue_ktype = {
+	.sysfs_ops = &netdev_queue_sysfs_ops,
+	.release = netdev_queue_release,
+	.default_attrs = netdev_queue_default_attrs,
+};
+
+static int netdev_queue_add_kobject(struct net_device *net, int index)
+{
+	struct netdev_queue *queue = net->_tx + index;
+	struct kobject *kobj = &queue->kobj;
+	int error;
+
+	/* Dropped again by netdev_queue_release() */
+	dev_hold(queue->dev);
+
+	kobj->kset = net->queues_kset;
+	error = kobject_init_and_add(kobj, &netdev_queue_ktype, NULL,
+				     "tx-%u", index);
+	if (error) {
+		kobject_put(kobj);
+		return error;
+	}
+
+	kobject_uevent(kobj, KOBJ_ADD);
+	return 0;
+}
+
+static int register_queue_kobjects(struct net_device *net)
+{
+	int txq;
+	int error = 0;
+
+	net->queues_kset = kset_create_and_add("queues",
+	    NULL, &net->dev.kobj);
+	if (!net->queues_kset)
+		return -ENOMEM;
+
+	for (txq = 0; txq < net->num_tx_queues; txq++) {
+		error = netdev_queue_add_kobject(net, txq);
+		if (error)
+			break;
+	}
+
+	if (error) {
+		while (--txq >= 0)
+			kobject_put(&net->_tx[txq].kobj);
+		kset_unregister(net->queues_kset);
+	}
+
+	return error;
+}
+
+static void remove_queue_kobjects(struct net_device *net)
+{
+	int txq;
+
+	for (txq = 0; txq < net->num_tx_queues; txq++)
+		kobject_put(&net->_tx[txq].kobj);
+	kset_unregister(net->queues_kset);
+}
+#endif /* CONFIG_XPS */
+
 #ifdef CONFIG_HOTPLUG
 static int netdev_uevent(struct device *d, struct kobj_uevent_env *env)
 {
@@ -530,6 +866,11 @@ void netdev_unregister_kobject(struct net_device * net)
 	if (!net_eq(dev_net(net), &init_net))
 		return;
 
+#ifdef CONFIG_XPS
+	remove_queue_kobjects(net);
+	xps_dev_maps_flush(net);
+#endif
+
 	device_del(dev);
 }
 
@@ -538,6 +879,7 @@ int netdev_register_kobject(struct net_device *net)
 {
 	struct device *dev = &(net->dev);
 	const struct attribute_group **groups = net->sysfs_groups;
+	int error;
 
 	dev->class = &net_class;
 	dev->platform_data = net;
@@ -564,7 +906,19 @@ int netdev_register_kobject(struct net_device *net)
 	if (!net_eq(dev_net(net), &init_net))
 		return 0;
 
-	return device_add(dev);
+	error = device_add(dev);
+	if (error)
+		return error;
+
+#ifdef CONFIG_XPS
+	error = register_queue_kobjects(net);
+	if (error) {
+		device_del(dev);
+		return error;
+	}
+#endif
+
+	return 0;
 }
 
 int netdev_class_create_file(struct class_attribute *class_attr)
@@ -562,6 +562,9 @@ static void __copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 #endif
 #endif
 	new->vlan_tci		= old->vlan_tci;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	new->napi_id		= old->napi_id;
+#endif
 
 	skb_copy_secmark(new, old);
 }
@@ -1525,15 +1528,46 @@ static int __skb_splice_bits(struct sk_buff *skb, unsigned int *offset,
 	return 0;
 }
 
+/*
+ * Move the pages collected in @spd into @pipe on behalf of a socket whose
+ * lock the caller holds.
+ *
+ * The socket lock is dropped meanwhile, otherwise we have reverse
+ * locking dependencies between sk_lock and i_mutex here as compared to
+ * sendfile(). We enter here with the socket lock held, and
+ * splice_to_pipe() will grab the pipe inode lock. For sendfile()
+ * emulation, we call into ->sendpage() with the i_mutex lock held and
+ * networking will grab the socket lock.
+ */
+ssize_t skb_socket_splice(struct sock *sk, struct pipe_inode_info *pipe,
+			  struct splice_pipe_desc *spd)
+{
+	ssize_t ret;
+
+	release_sock(sk);
+	ret = splice_to_pipe(pipe, spd);
+	lock_sock(sk);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(skb_socket_splice);
+
 /*
  * Map data from the skb to a pipe. Should handle both the linear part,
  * the fragments, and the frag list. It does NOT handle frag lists within
  * the frag list, if such a thing exists. We'd probably need to recurse to
  * handle that cleanly.
+ *
+ * @sk is the socket the data is read from, which need not be the owner of
+ * @skb. @splice_cb moves the collected pages into the pipe and is
+ * expected to drop whatever lock the caller holds on @sk meanwhile.
  */
-int skb_splice_bits(struct sk_buff *skb, unsigned int offset,
+int skb_splice_bits(struct sk_buff *skb, struct sock *sk, unsigned int offset,
 		    struct pipe_inode_info *pipe, unsigned int tlen,
-		    unsigned int flags)
+		    unsigned int flags,
+		    ssize_t (*splice_cb)(struct sock *,
+					 struct pipe_inode_info *,
+					 struct splice_pipe_desc *))
 {
 	struct partial_page partial[PIPE_BUFFERS];
 	struct page *pages[PIPE_BUFFERS];
@@ -1545,7 +1579,7 @@ int skb_splice_bits(struct sk_buff *skb, unsigned int offset,
 		.spd_release = sock_spd_release,
 	};
 	struct sk_buff *frag_iter;
-	struct sock *sk = skb->sk;
+	int ret = 0;
 
 	/*
 	 * __skb_splice_bits() only fails if the output has no room left,
@@ -1567,25 +1601,10 @@ int skb_splice_bits(struct sk_buff *skb, unsigned int offset,
 	}
 
 done:
-	if (spd.nr_pages) {
-		int ret;
+	if (spd.nr_pages)
+		ret = splice_cb(sk, pipe, &spd);
 
-		/*
-		 * Drop the socket lock, otherwise we have reverse
-		 * locking dependencies between sk_lock and i_mutex
-		 * here as compared to sendfile(). We enter here
-		 * with the socket lock held, and splice_to_pipe() will
-		 * grab the pipe inode lock. For sendfile() emulation,
-		 * we call into ->sendpage() with the i_mutex lock held
-		 * and networking will grab the socket lock.
-		 */
-		release_sock(sk);
-		ret = splice_to_pipe(pipe, &spd);
-		lock_sock(sk);
-		return ret;
-	}
-
-	return 0;
+	return ret;
 }
 
 /**
@@ -15,6 +15,7 @@
 
 #include <linux/module.h>
 #include <linux/jhash.h>
+#include <linux/tcp.h>
 
 #include <net/inet_connection_sock.h>
 #include <net/inet_hashtables.h>
@@ -290,7 +291,10 @@ struct sock *inet_csk_accept(struct sock *sk, int flags, int *err)
 	}
 
 	newsk = reqsk_queue_get_child(&icsk->icsk_accept_queue, sk);
-	WARN_ON(newsk->sk_state == TCP_SYN_RECV);
+	/* TCP Fast Open children are queued before the handshake completes */
+	WARN_ON(newsk->sk_state == TCP_SYN_RECV &&
+		!(sk->sk_protocol == IPPROTO_TCP &&
+		  tcp_sk(newsk)->fastopen_listener));
 out:
 	release_sock(sk);
 	return newsk;
@@ -430,6 +434,21 @@ struct request_sock *inet_csk_search_req(const struct sock *sk,
 
 EXPORT_SYMBOL_GPL(inet_csk_search_req);
 
+/* The lock to hold across inet_csk_search_req() and the processing of
+ * the request found, when the listener's lock is not held.
+ */
+spinlock_t *inet_csk_synq_lock(const struct sock *sk, const __be16 rport,
+			       const __be32 raddr)
+{
+	struct listen_sock *lopt = inet_csk(sk)->icsk_accept_queue.listen_opt;
+
+	return reqsk_queue_syn_lock(lopt, inet_synq_hash(raddr, rport,
+							 lopt->hash_rnd,
+							 lopt->nr_table_entries));
+}
+
+EXPORT_SYMBOL_GPL(inet_csk_synq_lock);
+
 void inet_csk_reqsk_queue_hash_add(struct sock *sk, struct request_sock *req,
 				   unsigned long timeout)
 {
@@ -481,9 +500,9 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 	int thresh = max_retries;
 	unsigned long now = jiffies;
 	struct request_sock **reqp, *req;
-	int i, budget;
+	int i, budget, qlen;
 
-	if (lopt == NULL || lopt->qlen == 0)
+	if (lopt == NULL || atomic_read(&lopt->qlen) == 0)
 		return;
 
 	/* Normally all the openreqs are young and become mature
@@ -503,11 +522,12 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 	 * embrions; and abort old ones without pity, if old
 	 * ones are about to clog our table.
 	 */
-	if (lopt->qlen>>(lopt->max_qlen_log-1)) {
-		int young = (lopt->qlen_young<<1);
+	qlen = atomic_read(&lopt->qlen);
+	if (qlen>>(lopt->max_qlen_log-1)) {
+		int young = (atomic_read(&lopt->qlen_young)<<1);
 
 		while (thresh > 2) {
-			if (lopt->qlen < young)
+			if (qlen < young)
 				break;
 			thresh--;
 			young <<= 1;
@@ -521,6 +541,9 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 	i = lopt->clock_hand;
 
 	do {
+		spinlock_t *lock = reqsk_queue_syn_lock(lopt, i);
+
+		spin_lock(lock);
 		reqp=&lopt->syn_table[i];
 		while ((req = *reqp) != NULL) {
 			if (time_after_eq(now, req->expires)) {
@@ -538,7 +561,7 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 					unsigned long timeo;
 
 					if (req->retrans++ == 0)
-						lopt->qlen_young--;
+						atomic_dec(&lopt->qlen_young);
 					timeo = min((timeout << req->retrans), max_rto);
 					req->expires = now + timeo;
 					reqp = &req->dl_next;
@@ -553,6 +576,7 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 			}
 			reqp = &req->dl_next;
 		}
+		spin_unlock(lock);
 
 		i = (i + 1) & (lopt->nr_table_entries - 1);
 
@@ -560,7 +584,7 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 
 	lopt->clock_hand = i;
 
-	if (lopt->qlen)
+	if (atomic_read(&lopt->qlen))
 		inet_csk_reset_keepalive_timer(parent, interval);
 }
 
@@ -672,6 +696,12 @@ void inet_csk_listen_stop(struct sock *sk)
 	struct request_sock *acc_req;
 	struct request_sock *req;
 
+	/* SYNs and handshake ACKs may be processed without the listener's
+	 * lock.  The socket is unhashed by now, so wait for the handlers
+	 * still running before tearing down the queues they use.
+	 */
+	synchronize_net();
+
 	inet_csk_delete_keepalive_timer(sk);
 
 	/* make all the listen_opt local to us */
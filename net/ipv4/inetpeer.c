@@ -65,6 +65,9 @@
  *		dtime: unused node list lock
  *		v4daddr: unchangeable
  *		ip_id_count: idlock
+ *		rate_*, error_*, pmtu_*, redirect_*: unlocked, the
+ *		   values are hints and a lost update is harmless
+ *		tfo_*: tfo_lock
  */
 
 static struct kmem_cache *peer_cachep __read_mostly;
@@ -389,6 +392,19 @@ struct inet_peer *inet_getpeer(__be32 daddr, int create)
 	atomic_set(&n->rid, 0);
 	atomic_set(&n->ip_id_count, secure_ip_id(daddr));
 	n->tcp_ts_stamp = 0;
+	n->rate_tokens = 0;
+	n->rate_last = 0;
+	n->error_tokens = 0;
+	n->error_last = 0;
+	n->pmtu_expires = 0;
+	n->pmtu_learned = 0;
+	n->redirect_learned = 0;
+	n->redirect_genid = 0;
+	seqlock_init(&n->tfo_lock);
+	n->tfo_mss = 0;
+	n->tfo_cookie_len = 0;
+	n->tfo_syn_loss = 0;
+	n->tfo_syn_loss_ts = 0;
 
 	write_lock_bh(&peer_pool_lock);
 	/* Check if an entry has suddenly appeared. */
@@ -458,3 +474,32 @@ void inet_putpeer(struct inet_peer *p)
 	}
 	spin_unlock_bh(&inet_peer_unused_lock);
 }
+
+/*
+ *	Check transmit rate limitation for given message.
+ *	The token bucket is kept in the peer, so that it survives the
+ *	short lived routes used to reach it.  See xrlim_allow() in icmp.c.
+ */
+#define XRLIM_BURST_FACTOR 6
+bool inet_peer_xrlim_allow(struct inet_peer *peer, int timeout)
+{
+	unsigned long now, token;
+	bool rc = false;
+
+	if (!peer)
+		return true;
+
+	token = peer->rate_tokens;
+	now = jiffies;
+	token += now - peer->rate_last;
+	peer->rate_last = now;
+	if (token > XRLIM_BURST_FACTOR * timeout)
+		token = XRLIM_BURST_FACTOR * timeout;
+	if (token >= timeout) {
+		token -= timeout;
+		rc = true;
+	}
+	peer->rate_tokens = token;
+	return rc;
+}
+EXPORT_SYMBOL(inet_peer_xrlim_allow);
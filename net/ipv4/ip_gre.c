@@ -162,6 +162,10 @@ struct ipgre_net {
  */
 static DEFINE_SPINLOCK(ipgre_lock);
 
+/* Offloads of tunnels whose GRE header is the same for every segment */
+#define IPGRE_FEATURES	(NETIF_F_SG | NETIF_F_HW_CSUM | NETIF_F_HIGHDMA | \
+			 NETIF_F_GSO_SOFTWARE)
+
 #define for_each_ip_tunnel_rcu(start) \
 	for (t = rcu_dereference(start); t; t = rcu_dereference(t->next))
 
@@ -603,6 +607,9 @@ static int ipgre_rcv(struct sk_buff *skb)
 		__pskb_pull(skb, offset);
 		skb_postpull_rcsum(skb, skb_transport_header(skb), offset);
 		skb->pkt_type = PACKET_HOST;
+		/* Aggregated by GRO: what is left is no longer GRE. */
+		if (skb_is_gso(skb))
+			skb_shinfo(skb)->gso_type &= ~SKB_GSO_GRE;
 #ifdef CONFIG_NET_IPGRE_BROADCAST
 		if (ipv4_is_multicast(iph->daddr)) {
 			/* Looped back packet, drop it! */
@@ -666,6 +673,31 @@ drop_nolock:
 	return(0);
 }
 
+static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb,
+				     struct net_device *dev);
+
+static netdev_tx_t ipgre_tunnel_xmit_segs(struct sk_buff *skb,
+					  struct net_device *dev)
+{
+	struct sk_buff *segs = skb_gso_segment(skb, 0);
+
+	dev_kfree_skb(skb);
+	if (IS_ERR(segs)) {
+		dev->stats.tx_errors++;
+		return NETDEV_TX_OK;
+	}
+
+	while (segs) {
+		struct sk_buff *nskb = segs->next;
+
+		segs->next = NULL;
+		ipgre_tunnel_xmit(segs, dev);
+		segs = nskb;
+	}
+
+	return NETDEV_TX_OK;
+}
+
 static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct ip_tunnel *tunnel = netdev_priv(dev);
@@ -683,6 +715,17 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 	__be32 dst;
 	int    mtu;
 
+	if (skb_is_gso(skb)) {
+		/* Checksummed or sequenced GRE headers differ per packet,
+		 * so segment here; the features of the device say we would
+		 * not get such an skb, but sockets may have cached them.
+		 */
+		if (tunnel->parms.o_flags & (GRE_CSUM | GRE_SEQ))
+			return ipgre_tunnel_xmit_segs(skb, dev);
+	} else if (skb->ip_summed == CHECKSUM_PARTIAL &&
+		   skb_checksum_help(skb))
+		goto tx_error;
+
 	if (dev->type == ARPHRD_ETHER)
 		IPCB(skb)->flags = 0;
 
@@ -773,7 +816,7 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 	if (skb->protocol == htons(ETH_P_IP)) {
 		df |= (old_iph->frag_off&htons(IP_DF));
 
-		if ((old_iph->frag_off&htons(IP_DF)) &&
+		if ((old_iph->frag_off&htons(IP_DF)) && !skb_is_gso(skb) &&
 		    mtu < ntohs(old_iph->tot_len)) {
 			icmp_send(skb, ICMP_DEST_UNREACH, ICMP_FRAG_NEEDED, htonl(mtu));
 			ip_rt_put(rt);
@@ -793,7 +836,8 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 			}
 		}
 
-		if (mtu >= IPV6_MIN_MTU && mtu < skb->len - tunnel->hlen + gre_hlen) {
+		if (mtu >= IPV6_MIN_MTU && !skb_is_gso(skb) &&
+		    mtu < skb->len - tunnel->hlen + gre_hlen) {
 			icmpv6_send(skb, ICMPV6_PKT_TOOBIG, 0, mtu);
 			ip_rt_put(rt);
 			goto tx_error;
@@ -886,6 +930,9 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 		}
 	}
 
+	if (skb_is_gso(skb))
+		skb_shinfo(skb)->gso_type |= SKB_GSO_GRE;
+
 	nf_reset(skb);
 
 	IPTUNNEL_XMIT();
@@ -957,6 +1004,16 @@ static int ipgre_tunnel_bind_dev(struct net_device *dev)
 
 	tunnel->hlen = addend;
 
+	/* Let the stack hand us GSO packets when every segment can carry
+	 * a copy of the same GRE header.
+	 */
+	if (dev->type == ARPHRD_IPGRE) {
+		if (tunnel->parms.o_flags & (GRE_CSUM | GRE_SEQ))
+			dev->features &= ~IPGRE_FEATURES;
+		else
+			dev->features |= IPGRE_FEATURES;
+	}
+
 	return mtu;
 }
 
@@ -1283,10 +1340,134 @@ static void ipgre_fb_tunnel_init(struct net_device *dev)
 	ign->tunnels_wc[0]	= tunnel;
 }
 
+/*
+ * GRO/GSO for GRE.  Only packets whose GRE header carries nothing but
+ * an optional key are handled: checksummed or sequenced headers differ
+ * from packet to packet and cannot be merged or replicated.
+ */
+static inline int ipgre_offload_hlen(__be16 flags)
+{
+	if (flags & ~GRE_KEY)
+		return -1;
+	return (flags & GRE_KEY) ? 8 : 4;
+}
+
+static struct sk_buff **ipgre_gro_receive(struct sk_buff **head,
+					  struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	struct packet_type *ptype;
+	struct sk_buff *p;
+	__be16 *greh;
+	unsigned int hlen;
+	unsigned int off;
+	int grehlen;
+	int flush = 1;
+
+	off = skb_gro_offset(skb);
+	hlen = off + 4;
+	greh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	grehlen = ipgre_offload_hlen(greh[0]);
+	if (grehlen < 0)
+		goto out;
+
+	hlen = off + grehlen;
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	rcu_read_lock();
+	ptype = gro_find_receive_by_type(greh[1]);
+	if (!ptype)
+		goto out_unlock;
+
+	flush = 0;
+
+	for (p = *head; p; p = p->next) {
+		__be16 *greh2;
+
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		greh2 = (__be16 *)(p->data + off);
+
+		/* Same flags and protocol, and the same key if any. */
+		if (*(__be32 *)greh ^ *(__be32 *)greh2 ||
+		    (grehlen > 4 &&
+		     *(__be32 *)(greh + 2) ^ *(__be32 *)(greh2 + 2))) {
+			NAPI_GRO_CB(p)->same_flow = 0;
+			continue;
+		}
+	}
+
+	skb_gro_pull(skb, grehlen);
+	skb_gro_postpull_rcsum(skb, greh, grehlen);
+
+	pp = ptype->gro_receive(head, skb);
+
+out_unlock:
+	rcu_read_unlock();
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+
+static int ipgre_gro_complete(struct sk_buff *skb, int nhoff)
+{
+	__be16 *greh = (__be16 *)(skb->data + nhoff);
+	struct packet_type *ptype;
+	int err = -ENOENT;
+
+	rcu_read_lock();
+	ptype = gro_find_complete_by_type(greh[1]);
+	if (ptype)
+		err = ptype->gro_complete(skb,
+					  nhoff + ipgre_offload_hlen(greh[0]));
+	rcu_read_unlock();
+
+	/* The inner protocol sets gso_type, so this has to come last. */
+	skb_shinfo(skb)->gso_type |= SKB_GSO_GRE;
+
+	return err;
+}
+
+static struct sk_buff *ipgre_gso_segment(struct sk_buff *skb, int features)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	__be16 *greh;
+	int grehlen;
+
+	if (unlikely(!(skb_shinfo(skb)->gso_type & SKB_GSO_GRE)))
+		goto out;
+
+	if (unlikely(!pskb_may_pull(skb, 4)))
+		goto out;
+
+	greh = (__be16 *)skb->data;
+	grehlen = ipgre_offload_hlen(greh[0]);
+	if (grehlen < 0 || greh[1] == htons(ETH_P_TEB))
+		goto out;
+
+	segs = skb_encap_gso_segment(skb, features, grehlen, greh[1]);
+out:
+	return segs;
+}
 
 static const struct net_protocol ipgre_protocol = {
 	.handler	=	ipgre_rcv,
 	.err_handler	=	ipgre_err,
+	.gso_segment	=	ipgre_gso_segment,
+	.gro_receive	=	ipgre_gro_receive,
+	.gro_complete	=	ipgre_gro_complete,
 	.netns_ok	=	1,
 };
 
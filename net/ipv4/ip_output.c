@@ -756,9 +756,14 @@ static inline int ip_ufo_append_data(struct sock *sk,
 		skb->csum = 0;
 		sk->sk_sndmsg_off = 0;
 
-		/* specify the length of each IP datagram fragment */
-		skb_shinfo(skb)->gso_size = mtu - fragheaderlen;
-		skb_shinfo(skb)->gso_type = SKB_GSO_UDP;
+		/* specify the length of each IP datagram fragment; with
+		 * UDP_SEGMENT the UDP layer sets up the GSO fields itself
+		 * once the datagram is complete.
+		 */
+		if (!inet_sk(sk)->cork.gso_size) {
+			skb_shinfo(skb)->gso_size = mtu - fragheaderlen;
+			skb_shinfo(skb)->gso_type = SKB_GSO_UDP;
+		}
 		__skb_queue_tail(&sk->sk_write_queue, skb);
 	}
 
@@ -865,9 +870,10 @@ int ip_append_data(struct sock *sk,
 		csummode = CHECKSUM_PARTIAL;
 
 	inet->cork.length += length;
-	if (((length> mtu) || !skb_queue_empty(&sk->sk_write_queue)) &&
-	    (sk->sk_protocol == IPPROTO_UDP) &&
-	    (rt->u.dst.dev->features & NETIF_F_UFO)) {
+	if ((sk->sk_protocol == IPPROTO_UDP) &&
+	    (inet->cork.gso_size ||
+	     (((length > mtu) || !skb_queue_empty(&sk->sk_write_queue)) &&
+	      (rt->u.dst.dev->features & NETIF_F_UFO)))) {
 		err = ip_ufo_append_data(sk, getfrag, from, length, hh_len,
 					 fragheaderlen, transhdrlen, mtu,
 					 flags);
@@ -1112,7 +1118,7 @@ ssize_t	ip_append_page(struct sock *sk, struct page *page,
 		return -EINVAL;
 
 	inet->cork.length += size;
-	if ((sk->sk_protocol == IPPROTO_UDP) &&
+	if ((sk->sk_protocol == IPPROTO_UDP) && !inet->cork.gso_size &&
 	    (rt->u.dst.dev->features & NETIF_F_UFO)) {
 		skb_shinfo(skb)->gso_size = mtu - fragheaderlen;
 		skb_shinfo(skb)->gso_type = SKB_GSO_UDP;
@@ -1122,7 +1128,7 @@ ssize_t	ip_append_page(struct sock *sk, struct page *page,
 	while (size > 0) {
 		int i;
 
-		if (skb_is_gso(skb))
+		if (skb_is_gso(skb) || inet->cork.gso_size)
 			len = size;
 		else {
 
@@ -1217,6 +1223,7 @@ static void ip_cork_release(struct inet_sock *inet)
 	inet->cork.opt = NULL;
 	dst_release(inet->cork.dst);
 	inet->cork.dst = NULL;
+	inet->cork.gso_size = 0;
 }
 
 /*
@@ -1265,7 +1272,8 @@ int ip_push_pending_frames(struct sock *sk)
 	 * If local_df is set too, we still allow to fragment this frame
 	 * locally. */
 	if (inet->pmtudisc >= IP_PMTUDISC_DO ||
-	    (skb->len <= dst_mtu(&rt->u.dst) &&
+	    ((skb->len <= dst_mtu(&rt->u.dst) ||
+	      (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4)) &&
 	     ip_dont_fragment(sk, &rt->u.dst)))
 		df = htons(IP_DF);
 
@@ -1286,7 +1294,9 @@ int ip_push_pending_frames(struct sock *sk)
 	}
 	iph->tos = inet->tos;
 	iph->frag_off = df;
-	ip_select_ident(iph, &rt->u.dst, sk);
+	/* a UDP_SEGMENT datagram becomes gso_segs packets on the wire */
+	ip_select_ident_more(iph, &rt->u.dst, sk,
+			     (skb_shinfo(skb)->gso_segs ?: 1) - 1);
 	iph->ttl = ttl;
 	iph->protocol = sk->sk_protocol;
 	iph->saddr = rt->rt_src;
@@ -1372,7 +1382,7 @@ void ip_send_reply(struct sock *sk, struct sk_buff *skb, struct ip_reply_arg *ar
 	if (ip_options_echo(&replyopts.opt, skb))
 		return;
 
-	daddr = ipc.addr = rt->rt_src;
+	daddr = ipc.addr = ip_hdr(skb)->saddr;
 	ipc.opt = NULL;
 	ipc.shtx.flags = 0;
 
@@ -1387,7 +1397,7 @@ void ip_send_reply(struct sock *sk, struct sk_buff *skb, struct ip_reply_arg *ar
 		struct flowi fl = { .oif = arg->bound_dev_if,
 				    .nl_u = { .ip4_u =
 					      { .daddr = daddr,
-						.saddr = rt->rt_spec_dst,
+						.saddr = ip_rt_spec_dst(skb),
 						.tos = RT_TOS(ip_hdr(skb)->tos) } },
 				    /* Not quite clean, but right. */
 				    .uli_u = { .ports =
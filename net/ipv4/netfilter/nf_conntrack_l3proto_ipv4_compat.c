@@ -29,12 +29,15 @@ static struct hlist_nulls_node *ct_get_first(struct seq_file *seq)
 {
 	struct net *net = seq_file_net(seq);
 	struct ct_iter_state *st = seq->private;
+	struct hlist_nulls_head *hash;
 	struct hlist_nulls_node *n;
+	unsigned int hsize;
 
+	nf_conntrack_get_ht(net, &hash, &hsize);
 	for (st->bucket = 0;
-	     st->bucket < net->ct.htable_size;
+	     st->bucket < hsize;
 	     st->bucket++) {
-		n = rcu_dereference(net->ct.hash[st->bucket].first);
+		n = rcu_dereference(hash[st->bucket].first);
 		if (!is_a_nulls(n))
 			return n;
 	}
@@ -46,14 +49,17 @@ static struct hlist_nulls_node *ct_get_next(struct seq_file *seq,
 {
 	struct net *net = seq_file_net(seq);
 	struct ct_iter_state *st = seq->private;
+	struct hlist_nulls_head *hash;
+	unsigned int hsize;
 
 	head = rcu_dereference(head->next);
 	while (is_a_nulls(head)) {
-		if (likely(get_nulls_value(head) == st->bucket)) {
-			if (++st->bucket >= net->ct.htable_size)
-				return NULL;
-		}
-		head = rcu_dereference(net->ct.hash[st->bucket].first);
+		nf_conntrack_get_ht(net, &hash, &hsize);
+		if (likely(get_nulls_value(head) == st->bucket))
+			st->bucket++;
+		if (st->bucket >= hsize)
+			return NULL;
+		head = rcu_dereference(hash[st->bucket].first);
 	}
 	return head;
 }
@@ -0,0 +1,177 @@
+/*
+ * TCP Fast Open: data in the SYN, authenticated by a cookie the server
+ * handed out on an earlier connection.
+ *
+ * The server side derives cookies from the client address with a
+ * locally held AES key; the client side caches the cookies it learns,
+ * together with the peer's MSS, in the inet_peer entry of the server.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/crypto.h>
+#include <linux/random.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <net/inetpeer.h>
+#include <net/route.h>
+#include <net/tcp.h>
+
+int sysctl_tcp_fastopen __read_mostly;
+
+struct tcp_fastopen_context *tcp_fastopen_ctx;
+
+static DEFINE_SPINLOCK(tcp_fastopen_ctx_lock);
+
+static void tcp_fastopen_ctx_free(struct rcu_head *head)
+{
+	struct tcp_fastopen_context *ctx =
+	    container_of(head, struct tcp_fastopen_context, rcu);
+
+	crypto_free_cipher(ctx->tfm);
+	kfree(ctx);
+}
+
+int tcp_fastopen_reset_cipher(void *key, unsigned int len)
+{
+	struct tcp_fastopen_context *ctx, *octx;
+	int err;
+
+	ctx = kmalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+	ctx->tfm = crypto_alloc_cipher("aes", 0, 0);
+	if (IS_ERR(ctx->tfm)) {
+		err = PTR_ERR(ctx->tfm);
+		printk(KERN_ERR "TCP: TFO aes cipher alloc error: %d\n", err);
+		goto out_free;
+	}
+	err = crypto_cipher_setkey(ctx->tfm, key, len);
+	if (err) {
+		printk(KERN_ERR "TCP: TFO cipher key error: %d\n", err);
+		crypto_free_cipher(ctx->tfm);
+		goto out_free;
+	}
+	memcpy(ctx->key, key, len);
+
+	spin_lock(&tcp_fastopen_ctx_lock);
+	octx = tcp_fastopen_ctx;
+	rcu_assign_pointer(tcp_fastopen_ctx, ctx);
+	spin_unlock(&tcp_fastopen_ctx_lock);
+
+	if (octx)
+		call_rcu(&octx->rcu, tcp_fastopen_ctx_free);
+	return 0;
+
+out_free:
+	kfree(ctx);
+	return err;
+}
+
+/* Computes the cookie for a client address.  The address is padded
+ * to a full AES block, so the cookie is simply the first half of the
+ * encrypted block.
+ */
+void tcp_fastopen_cookie_gen(__be32 addr, struct tcp_fastopen_cookie *foc)
+{
+	__be32 peer_addr[4] = { addr, 0, 0, 0 };
+	__be32 out[4];
+	struct tcp_fastopen_context *ctx;
+
+	rcu_read_lock();
+	ctx = rcu_dereference(tcp_fastopen_ctx);
+	if (ctx) {
+		crypto_cipher_encrypt_one(ctx->tfm, (__u8 *)out,
+					  (__u8 *)peer_addr);
+		memcpy(foc->val, out, TCP_FASTOPEN_COOKIE_SIZE);
+		foc->len = TCP_FASTOPEN_COOKIE_SIZE;
+	}
+	rcu_read_unlock();
+}
+
+/* The client cache lives in the inet_peer of the destination, which
+ * limits active Fast Open to IPv4.
+ */
+static struct inet_peer *tcp_fastopen_peer(struct sock *sk)
+{
+	struct rtable *rt = (struct rtable *)__sk_dst_get(sk);
+
+	if (sk->sk_family != AF_INET || rt == NULL)
+		return NULL;
+	if (rt->peer == NULL)
+		rt_bind_peer(rt, 1);
+	return rt->peer;
+}
+
+void tcp_fastopen_cache_get(struct sock *sk, u16 *mss,
+			    struct tcp_fastopen_cookie *cookie,
+			    int *syn_loss, unsigned long *last_syn_loss)
+{
+	struct inet_peer *peer = tcp_fastopen_peer(sk);
+	unsigned int seq;
+
+	if (peer == NULL) {
+		cookie->len = 0;
+		return;
+	}
+
+	do {
+		seq = read_seqbegin(&peer->tfo_lock);
+		if (peer->tfo_mss)
+			*mss = peer->tfo_mss;
+		cookie->len = peer->tfo_cookie_len;
+		memcpy(cookie->val, peer->tfo_cookie, sizeof(cookie->val));
+		*syn_loss = peer->tfo_syn_loss;
+		*last_syn_loss = peer->tfo_syn_loss_ts;
+	} while (read_seqretry(&peer->tfo_lock, seq));
+}
+
+void tcp_fastopen_cache_set(struct sock *sk, u16 mss,
+			    struct tcp_fastopen_cookie *cookie,
+			    int syn_lost)
+{
+	struct inet_peer *peer = tcp_fastopen_peer(sk);
+
+	if (peer == NULL)
+		return;
+
+	write_seqlock_bh(&peer->tfo_lock);
+	if (mss)
+		peer->tfo_mss = mss;
+	if (cookie->len > 0) {
+		peer->tfo_cookie_len = cookie->len;
+		memcpy(peer->tfo_cookie, cookie->val, cookie->len);
+	}
+	if (syn_lost) {
+		peer->tfo_syn_loss++;
+		peer->tfo_syn_loss_ts = jiffies;
+	} else {
+		peer->tfo_syn_loss = 0;
+	}
+	write_sequnlock_bh(&peer->tfo_lock);
+}
+
+/* Called once a passive Fast Open child leaves SYN_RECV: drop its slot
+ * in the listener's queue and the reference it held on the listener.
+ */
+void tcp_fastopen_release(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct sock *listener = tp->fastopen_listener;
+
+	tp->fastopen_listener = NULL;
+	atomic_dec(&tcp_sk(listener)->fastopen_qlen);
+	sock_put(listener);
+}
+
+static int __init tcp_fastopen_init(void)
+{
+	__u8 key[TCP_FASTOPEN_KEY_LENGTH];
+
+	get_random_bytes(key, sizeof(key));
+	tcp_fastopen_reset_cipher(key, sizeof(key));
+	return 0;
+}
+
+late_initcall(tcp_fastopen_init);
@@ -94,6 +94,7 @@ int sysctl_tcp_thin_dupack __read_mostly;
 
 int sysctl_tcp_moderate_rcvbuf __read_mostly = 1;
 int sysctl_tcp_abc __read_mostly;
+int sysctl_tcp_recovery __read_mostly = TCP_RACK_LOSS_DETECTION;
 
 #define FLAG_DATA		0x01 /* Incoming frame contained data.		*/
 #define FLAG_WIN_UPDATE		0x02 /* Incoming ACK was a window update.	*/
@@ -349,7 +350,7 @@ static void tcp_fixup_rcvbuf(struct sock *sk)
 /* 4. Try to fixup all. It is made immediately after connection enters
  *    established state.
  */
-static void tcp_init_buffer_space(struct sock *sk)
+void tcp_init_buffer_space(struct sock *sk)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 	int maxwin;
@@ -866,7 +867,7 @@ static void tcp_dsack_seen(struct tcp_sock *tp)
 
 /* Initialize metrics on socket. */
 
-static void tcp_init_metrics(struct sock *sk)
+void tcp_init_metrics(struct sock *sk)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct dst_entry *dst = __sk_dst_get(sk);
@@ -1138,6 +1139,29 @@ static int tcp_is_sackblock_valid(struct tcp_sock *tp, int is_dsack,
 	return !before(start_seq, end_seq - tp->max_window);
 }
 
+/* RACK: remember the most recently sent segment known to be delivered.
+ * A retransmission acknowledged in less than half the smoothed RTT is
+ * more likely the original getting through, so its send time is not
+ * trusted.
+ */
+static void tcp_rack_advance(struct tcp_sock *tp, u8 sacked, u32 end_seq,
+			     u32 xmit_time)
+{
+	u32 rtt = tcp_time_stamp - xmit_time;
+
+	if ((sacked & TCPCB_RETRANS) && rtt < (tp->srtt >> 4))
+		return;
+
+	if (after(xmit_time, tp->rack.xmit_time) ||
+	    (xmit_time == tp->rack.xmit_time &&
+	     after(end_seq, tp->rack.end_seq))) {
+		tp->rack.xmit_time = xmit_time;
+		tp->rack.end_seq = end_seq;
+		tp->rack.rtt = rtt;
+		tp->rack.advanced = 1;
+	}
+}
+
 /* Check for lost retransmit. This superb idea is borrowed from "ratehalving".
  * Event "C". Later note: FACK people cheated me again 8), we have to account
  * for reordering! Ugly, but should help.
@@ -1308,6 +1332,7 @@ static u8 tcp_sacktag_one(struct sk_buff *skb, struct sock *sk,
 	if (dup_sack && (sacked & TCPCB_RETRANS)) {
 		if (after(TCP_SKB_CB(skb)->end_seq, tp->undo_marker))
 			tp->undo_retrans--;
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPSPURIOUSRETRANS);
 		if (sacked & TCPCB_SACKED_ACKED)
 			state->reord = min(fack_count, state->reord);
 	}
@@ -1317,6 +1342,9 @@ static u8 tcp_sacktag_one(struct sk_buff *skb, struct sock *sk,
 		return sacked;
 
 	if (!(sacked & TCPCB_SACKED_ACKED)) {
+		tcp_rack_advance(tp, sacked, TCP_SKB_CB(skb)->end_seq,
+				 TCP_SKB_CB(skb)->when);
+
 		if (sacked & TCPCB_SACKED_RETRANS) {
 			/* If the segment is not tagged as lost,
 			 * we do not clear RETRANS, believing
@@ -2579,6 +2607,78 @@ static void tcp_update_scoreboard(struct sock *sk, int fast_rexmit)
 	tcp_timeout_skbs(sk);
 }
 
+/* RACK loss detection: a segment is lost once a segment sent after it
+ * has been delivered and it has not been delivered itself within the
+ * RTT of that delivery plus a reordering window of a quarter RTT.
+ * Unlike the dupack counting above, this also catches lost
+ * retransmissions and losses at the tail of a flight.
+ */
+static void tcp_rack_mark_lost(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct sk_buff *skb;
+	u32 now = tcp_time_stamp;
+	u32 reo_wnd;
+	int lost = 0;
+
+	if (!tp->rack.advanced)
+		return;
+	tp->rack.advanced = 0;
+
+	reo_wnd = max_t(u32, tp->srtt >> 5, 1);
+
+	tcp_for_write_queue(skb, sk) {
+		struct tcp_skb_cb *scb = TCP_SKB_CB(skb);
+
+		if (skb == tcp_send_head(sk))
+			break;
+
+		/* Delivered, or lost and waiting to be retransmitted */
+		if ((scb->sacked & TCPCB_SACKED_ACKED) ||
+		    (scb->sacked & (TCPCB_LOST|TCPCB_SACKED_RETRANS)) ==
+		    TCPCB_LOST)
+			continue;
+
+		if (after(scb->when, tp->rack.xmit_time) ||
+		    (scb->when == tp->rack.xmit_time &&
+		     !before(scb->end_seq, tp->rack.end_seq))) {
+			/* Sent after the delivered segment. Original
+			 * transmissions leave in sequence order, so no
+			 * later one in the queue can be lost yet.
+			 */
+			if (!(scb->sacked & TCPCB_RETRANS))
+				break;
+			continue;
+		}
+
+		if ((s32)(now - scb->when) <= (s32)(tp->rack.rtt + reo_wnd))
+			continue;
+
+		if (scb->sacked & TCPCB_SACKED_RETRANS) {
+			scb->sacked &= ~TCPCB_SACKED_RETRANS;
+			tp->retrans_out -= tcp_skb_pcount(skb);
+			NET_INC_STATS_BH(sock_net(sk),
+					 LINUX_MIB_TCPLOSTRETRANSMIT);
+		} else {
+			lost += tcp_skb_pcount(skb);
+		}
+		tcp_skb_mark_lost_uncond_verify(tp, skb);
+	}
+
+	if (lost)
+		NET_ADD_STATS_BH(sock_net(sk), LINUX_MIB_TCPRACKLOST, lost);
+	tcp_verify_left_out(tp);
+}
+
+static void tcp_rack_identify_loss(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	if ((sysctl_tcp_recovery & TCP_RACK_LOSS_DETECTION) &&
+	    tcp_is_sack(tp) && !tp->frto_counter)
+		tcp_rack_mark_lost(sk);
+}
+
 /* CWND moderation, preventing bursts due to too big ACKs
  * in dubious situations.
  */
@@ -2618,6 +2718,35 @@ static void tcp_cwnd_down(struct sock *sk, int flag)
 	}
 }
 
+/* Proportional Rate Reduction (RFC 6937): spread the window reduction
+ * over the ACKs of the recovery episode so that, when recovery ends,
+ * about ssthresh packets are in flight. While more than ssthresh are in
+ * flight, send in proportion to what was delivered; once below, grow
+ * back towards ssthresh no faster than slow start.
+ */
+static void tcp_cwnd_reduction(struct sock *sk, int newly_acked_sacked,
+			       int fast_rexmit)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	int sndcnt = 0;
+	int delta = tp->snd_ssthresh - tcp_packets_in_flight(tp);
+
+	tp->prr_delivered += newly_acked_sacked;
+	if (tcp_packets_in_flight(tp) > tp->snd_ssthresh) {
+		u64 dividend = (u64)tp->snd_ssthresh * tp->prr_delivered +
+			       tp->prior_cwnd - 1;
+		sndcnt = div_u64(dividend, tp->prior_cwnd) - tp->prr_out;
+	} else {
+		sndcnt = min_t(int, delta,
+			       max_t(int, tp->prr_delivered - tp->prr_out,
+				     newly_acked_sacked) + 1);
+	}
+
+	sndcnt = max(sndcnt, (fast_rexmit ? 1 : 0));
+	tp->snd_cwnd = tcp_packets_in_flight(tp) + sndcnt;
+	tp->snd_cwnd_stamp = tcp_time_stamp;
+}
+
 /* Nothing was retransmitted or returned timestamp is less
  * than timestamp of the first retransmission.
  */
@@ -2820,10 +2949,25 @@ static int tcp_try_undo_loss(struct sock *sk)
 	return 0;
 }
 
-static inline void tcp_complete_cwr(struct sock *sk)
+/* @ca_state is the state being left: tcp_try_undo_recovery() has
+ * already moved a socket out of Recovery by the time this is called.
+ */
+static inline void tcp_complete_cwr(struct sock *sk, u8 ca_state)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
-	tp->snd_cwnd = min(tp->snd_cwnd, tp->snd_ssthresh);
+
+	if (ca_state == TCP_CA_Recovery) {
+		/* PRR may have left cwnd below ssthresh.  A reduction
+		 * that was undone already restored cwnd, leave it be.
+		 */
+		if (tp->undo_marker) {
+			tp->snd_cwnd = tp->snd_ssthresh;
+			NET_INC_STATS_BH(sock_net(sk),
+					 LINUX_MIB_TCPRECOVERYCOMPLETE);
+		}
+	} else {
+		tp->snd_cwnd = min(tp->snd_cwnd, tp->snd_ssthresh);
+	}
 	tp->snd_cwnd_stamp = tcp_time_stamp;
 	tcp_ca_event(sk, CA_EVENT_COMPLETE_CWR);
 }
@@ -2950,7 +3094,8 @@ void tcp_simple_retransmit(struct sock *sk)
  * It does _not_ decide what to send, it is made in function
  * tcp_xmit_retransmit_queue().
  */
-static void tcp_fastretrans_alert(struct sock *sk, int pkts_acked, int flag)
+static void tcp_fastretrans_alert(struct sock *sk, int pkts_acked,
+				  int newly_acked_sacked, int flag)
 {
 	struct inet_connection_sock *icsk = inet_csk(sk);
 	struct tcp_sock *tp = tcp_sk(sk);
@@ -3002,7 +3147,7 @@ static void tcp_fastretrans_alert(struct sock *sk, int pkts_acked, int flag)
 			/* CWR is to be held something *above* high_seq
 			 * is ACKed for CWR bit to reach receiver. */
 			if (tp->snd_una != tp->high_seq) {
-				tcp_complete_cwr(sk);
+				tcp_complete_cwr(sk, TCP_CA_CWR);
 				tcp_set_ca_state(sk, TCP_CA_Open);
 			}
 			break;
@@ -3023,7 +3168,7 @@ static void tcp_fastretrans_alert(struct sock *sk, int pkts_acked, int flag)
 				tcp_reset_reno_sack(tp);
 			if (tcp_try_undo_recovery(sk))
 				return;
-			tcp_complete_cwr(sk);
+			tcp_complete_cwr(sk, TCP_CA_Recovery);
 			break;
 		}
 	}
@@ -3036,6 +3181,7 @@ static void tcp_fastretrans_alert(struct sock *sk, int pkts_acked, int flag)
 				tcp_add_reno_sack(sk);
 		} else
 			do_lost = tcp_try_undo_partial(sk, pkts_acked);
+		tcp_rack_identify_loss(sk);
 		break;
 	case TCP_CA_Loss:
 		if (flag & FLAG_DATA_ACKED)
@@ -3061,6 +3207,8 @@ static void tcp_fastretrans_alert(struct sock *sk, int pkts_acked, int flag)
 		if (icsk->icsk_ca_state == TCP_CA_Disorder)
 			tcp_try_undo_dsack(sk);
 
+		tcp_rack_identify_loss(sk);
+
 		if (!tcp_time_to_recover(sk)) {
 			tcp_try_to_open(sk, flag);
 			return;
@@ -3100,13 +3248,16 @@ static void tcp_fastretrans_alert(struct sock *sk, int pkts_acked, int flag)
 
 		tp->bytes_acked = 0;
 		tp->snd_cwnd_cnt = 0;
+		tp->prior_cwnd = tp->snd_cwnd;
+		tp->prr_delivered = 0;
+		tp->prr_out = 0;
 		tcp_set_ca_state(sk, TCP_CA_Recovery);
 		fast_rexmit = 1;
 	}
 
 	if (do_lost || (tcp_is_fack(tp) && tcp_head_timedout(sk)))
 		tcp_update_scoreboard(sk, fast_rexmit);
-	tcp_cwnd_down(sk, flag);
+	tcp_cwnd_reduction(sk, newly_acked_sacked, fast_rexmit);
 	tcp_xmit_retransmit_queue(sk);
 }
 
@@ -3273,6 +3424,8 @@ static int tcp_clean_rtx_queue(struct sock *sk, int prior_fackets,
 
 		if (sacked & TCPCB_SACKED_ACKED)
 			tp->sacked_out -= acked_pcount;
+		else
+			tcp_rack_advance(tp, sacked, scb->end_seq, scb->when);
 		if (sacked & TCPCB_LOST)
 			tp->lost_out -= acked_pcount;
 
@@ -3620,6 +3773,8 @@ static int tcp_ack(struct sock *sk, struct sk_buff *skb, int flag)
 	u32 prior_in_flight;
 	u32 prior_fackets;
 	int prior_packets;
+	int prior_sacked = tp->sacked_out;
+	int newly_acked_sacked;
 	int frto_cwnd = 0;
 
 	/* If the ack is older than previous acks
@@ -3702,8 +3857,10 @@ static int tcp_ack(struct sock *sk, struct sk_buff *skb, int flag)
 		if ((flag & FLAG_DATA_ACKED) && !frto_cwnd &&
 		    tcp_may_raise_cwnd(sk, flag))
 			tcp_cong_avoid(sk, ack, prior_in_flight);
+		newly_acked_sacked = (prior_packets - prior_sacked) -
+				     (tp->packets_out - tp->sacked_out);
 		tcp_fastretrans_alert(sk, prior_packets - tp->packets_out,
-				      flag);
+				      newly_acked_sacked, flag);
 	} else {
 		if ((flag & FLAG_DATA_ACKED) && !frto_cwnd)
 			tcp_cong_avoid(sk, ack, prior_in_flight);
@@ -3743,7 +3900,7 @@ old_ack:
  * the fast version below fails.
  */
 void tcp_parse_options(struct sk_buff *skb, struct tcp_options_received *opt_rx,
-		       u8 **hvpp, int estab)
+		       u8 **hvpp, int estab, struct tcp_fastopen_cookie *foc)
 {
 	unsigned char *ptr;
 	struct tcphdr *th = tcp_hdr(skb);
@@ -3850,6 +4007,23 @@ void tcp_parse_options(struct sk_buff *skb, struct tcp_options_received *opt_rx,
 					break;
 				};
 				break;
+
+			case TCPOPT_EXP:
+				/* Fast Open option shares code 254 using a
+				 * 16 bits magic number. It's valid only in
+				 * SYN or SYN-ACK with an even size.
+				 */
+				if (opsize < TCPOLEN_EXP_FASTOPEN_BASE ||
+				    get_unaligned_be16(ptr) != TCPOPT_FASTOPEN_MAGIC ||
+				    foc == NULL || !th->syn || (opsize & 1))
+					break;
+				foc->len = opsize - TCPOLEN_EXP_FASTOPEN_BASE;
+				if (foc->len >= TCP_FASTOPEN_COOKIE_MIN &&
+				    foc->len <= TCP_FASTOPEN_COOKIE_MAX)
+					memcpy(foc->val, ptr + 2, foc->len);
+				else if (foc->len != 0)
+					foc->len = -1;
+				break;
 			};
 
 			ptr += opsize-2;
@@ -3891,7 +4065,7 @@ static int tcp_fast_parse_options(struct sk_buff *skb, struct tcphdr *th,
 		if (tcp_parse_aligned_timestamp(tp, th))
 			return 1;
 	}
-	tcp_parse_options(skb, &tp->rx_opt, hvpp, 1);
+	tcp_parse_options(skb, &tp->rx_opt, hvpp, 1, NULL);
 	return 1;
 }
 
@@ -5431,6 +5605,53 @@ discard:
 	return 0;
 }
 
+/* The SYN-ACK of a Fast Open connect arrived: remember the cookie and
+ * the MSS of the server, and resend whatever part of the SYN data it
+ * did not acknowledge.  Returns 1 if data was retransmitted, which
+ * also carries the ACK of the SYN-ACK.
+ */
+static int tcp_rcv_fastopen_synack(struct sock *sk, struct sk_buff *synack,
+				   struct tcp_fastopen_cookie *cookie)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct sk_buff *data = tp->syn_data ? tcp_write_queue_head(sk) : NULL;
+	u16 mss = tp->rx_opt.mss_clamp;
+	int syn_drop;
+
+	if (mss == tp->rx_opt.user_mss) {
+		struct tcp_options_received opt;
+		u8 *hash_location;
+
+		/* Get original SYNACK MSS value if user MSS sets mss_clamp */
+		tcp_clear_options(&opt);
+		opt.user_mss = opt.mss_clamp = 0;
+		tcp_parse_options(synack, &opt, &hash_location, 0, NULL);
+		mss = opt.mss_clamp;
+	}
+
+	if (!tp->syn_fastopen)  /* Ignore an unsolicited cookie */
+		cookie->len = -1;
+
+	/* The SYN-ACK neither has cookie nor acknowledges the data. Presumably
+	 * the remote receives only the retransmitted (regular) SYNs: either
+	 * the original SYN-data or the corresponding SYN-ACK is lost.
+	 */
+	syn_drop = (cookie->len <= 0 && data && tp->total_retrans);
+
+	tcp_fastopen_cache_set(sk, mss, cookie, syn_drop);
+
+	if (data) { /* Retransmit unacked data in SYN */
+		tcp_for_write_queue_from(data, sk) {
+			if (data == tcp_send_head(sk) ||
+			    tcp_retransmit_skb(sk, data))
+				break;
+		}
+		tcp_rearm_rto(sk);
+		return 1;
+	}
+	return 0;
+}
+
 static int tcp_rcv_synsent_state_process(struct sock *sk, struct sk_buff *skb,
 					 struct tcphdr *th, unsigned len)
 {
@@ -5438,9 +5659,10 @@ static int tcp_rcv_synsent_state_process(struct sock *sk, struct sk_buff *skb,
 	struct inet_connection_sock *icsk = inet_csk(sk);
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct tcp_cookie_values *cvp = tp->cookie_values;
+	struct tcp_fastopen_cookie foc = { .len = -1 };
 	int saved_clamp = tp->rx_opt.mss_clamp;
 
-	tcp_parse_options(skb, &tp->rx_opt, &hash_location, 0);
+	tcp_parse_options(skb, &tp->rx_opt, &hash_location, 0, &foc);
 
 	if (th->ack) {
 		/* rfc793:
@@ -5450,11 +5672,9 @@ static int tcp_rcv_synsent_state_process(struct sock *sk, struct sk_buff *skb,
 		 *	  If SEG.ACK =< ISS, or SEG.ACK > SND.NXT, send
 		 *        a reset (unless the RST bit is set, if so drop
 		 *        the segment and return)"
-		 *
-		 *  We do not send data with SYN, so that RFC-correct
-		 *  test reduces to:
 		 */
-		if (TCP_SKB_CB(skb)->ack_seq != tp->snd_nxt)
+		if (!after(TCP_SKB_CB(skb)->ack_seq, tp->snd_una) ||
+		    after(TCP_SKB_CB(skb)->ack_seq, tp->snd_nxt))
 			goto reset_and_undo;
 
 		if (tp->rx_opt.saw_tstamp && tp->rx_opt.rcv_tsecr &&
@@ -5594,6 +5814,10 @@ static int tcp_rcv_synsent_state_process(struct sock *sk, struct sk_buff *skb,
 			sk_wake_async(sk, SOCK_WAKE_IO, POLL_OUT);
 		}
 
+		if ((tp->syn_fastopen || tp->syn_data) &&
+		    tcp_rcv_fastopen_synack(sk, skb, &foc))
+			return -1;
+
 		if (sk->sk_write_pending ||
 		    icsk->icsk_accept_queue.rskq_defer_accept ||
 		    icsk->icsk_ack.pingpong) {
@@ -5716,8 +5940,6 @@ int tcp_rcv_state_process(struct sock *sk, struct sk_buff *skb,
 	int queued = 0;
 	int res;
 
-	tp->rx_opt.saw_tstamp = 0;
-
 	switch (sk->sk_state) {
 	case TCP_CLOSE:
 		goto discard;
@@ -5756,6 +5978,7 @@ int tcp_rcv_state_process(struct sock *sk, struct sk_buff *skb,
 		goto discard;
 
 	case TCP_SYN_SENT:
+		tp->rx_opt.saw_tstamp = 0;
 		queued = tcp_rcv_synsent_state_process(sk, skb, th, len);
 		if (queued >= 0)
 			return queued;
@@ -5767,6 +5990,8 @@ int tcp_rcv_state_process(struct sock *sk, struct sk_buff *skb,
 		return 0;
 	}
 
+	/* Not done above: a listener may be processed without its lock */
+	tp->rx_opt.saw_tstamp = 0;
 	res = tcp_validate_incoming(sk, skb, th, 0);
 	if (res <= 0)
 		return -res;
@@ -5778,7 +6003,14 @@ int tcp_rcv_state_process(struct sock *sk, struct sk_buff *skb,
 		switch (sk->sk_state) {
 		case TCP_SYN_RECV:
 			if (acceptable) {
-				tp->copied_seq = tp->rcv_nxt;
+				/* A Fast Open child was set up when the SYN
+				 * arrived and may hold unread SYN data; this
+				 * ACK merely confirms its SYN-ACK.
+				 */
+				int fastopen = tp->fastopen_listener != NULL;
+
+				if (!fastopen)
+					tp->copied_seq = tp->rcv_nxt;
 				smp_mb();
 				tcp_set_state(sk, TCP_ESTABLISHED);
 				sk->sk_state_change(sk);
@@ -5799,30 +6031,36 @@ int tcp_rcv_state_process(struct sock *sk, struct sk_buff *skb,
 
 				/* tcp_ack considers this ACK as duplicate
 				 * and does not calculate rtt.
-				 * Force it here.
+				 * Force it here.  The SYN-ACK of a Fast
+				 * Open child was on its write queue, so
+				 * tcp_ack has measured it already.
 				 */
-				tcp_ack_update_rtt(sk, 0, 0);
+				if (!fastopen)
+					tcp_ack_update_rtt(sk, 0, 0);
 
 				if (tp->rx_opt.tstamp_ok)
 					tp->advmss -= TCPOLEN_TSTAMP_ALIGNED;
 
-				/* Make sure socket is routed, for
-				 * correct metrics.
-				 */
-				icsk->icsk_af_ops->rebuild_header(sk);
+				if (!fastopen) {
+					/* Make sure socket is routed, for
+					 * correct metrics.
+					 */
+					icsk->icsk_af_ops->rebuild_header(sk);
+
+					tcp_init_metrics(sk);
 
-				tcp_init_metrics(sk);
+					tcp_init_congestion_control(sk);
 
-				tcp_init_congestion_control(sk);
+					tcp_mtup_init(sk);
+					tcp_init_buffer_space(sk);
+				}
 
 				/* Prevent spurious tcp_cwnd_restart() on
 				 * first data packet.
 				 */
 				tp->lsndtime = tcp_time_stamp;
 
-				tcp_mtup_init(sk);
 				tcp_initialize_rcv_mss(sk);
-				tcp_init_buffer_space(sk);
 				tcp_fast_path_on(tp);
 			} else {
 				return 1;
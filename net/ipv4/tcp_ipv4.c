@@ -750,7 +750,8 @@ static void tcp_v4_reqsk_send_ack(struct sock *sk, struct sk_buff *skb,
  */
 static int tcp_v4_send_synack(struct sock *sk, struct dst_entry *dst,
 			      struct request_sock *req,
-			      struct request_values *rvp)
+			      struct request_values *rvp,
+			      struct tcp_fastopen_cookie *foc)
 {
 	const struct inet_request_sock *ireq = inet_rsk(req);
 	int err = -1;
@@ -760,7 +761,7 @@ static int tcp_v4_send_synack(struct sock *sk, struct dst_entry *dst,
 	if (!dst && (dst = inet_csk_route_req(sk, req)) == NULL)
 		return -1;
 
-	skb = tcp_make_synack(sk, dst, req, rvp);
+	skb = tcp_make_synack(sk, dst, req, rvp, foc);
 
 	if (skb) {
 		struct tcphdr *th = tcp_hdr(skb);
@@ -785,7 +786,7 @@ static int tcp_v4_rtx_synack(struct sock *sk, struct request_sock *req,
 			      struct request_values *rvp)
 {
 	TCP_INC_STATS_BH(sock_net(sk), TCP_MIB_RETRANSSEGS);
-	return tcp_v4_send_synack(sk, NULL, req, rvp);
+	return tcp_v4_send_synack(sk, NULL, req, rvp, NULL);
 }
 
 /*
@@ -1025,6 +1026,12 @@ static int tcp_v4_parse_md5_keys(struct sock *sk, char __user *optval,
 
 		tp->md5sig_info = p;
 		sk->sk_route_caps &= ~NETIF_F_GSO_MASK;
+
+		/* Let lockless listener handlers that did not see the
+		 * keys finish before we start changing them.
+		 */
+		if (sk->sk_state == TCP_LISTEN)
+			synchronize_net();
 	}
 
 	newkey = kmemdup(cmd.tcpm_key, cmd.tcpm_keylen, sk->sk_allocation);
@@ -1219,10 +1226,126 @@ static struct timewait_sock_ops tcp_timewait_sock_ops = {
 	.twsk_destructor= tcp_twsk_destructor,
 };
 
+/* Decide whether the data in this SYN may be accepted right away.  A
+ * cookie request, or a cookie that does not validate, is answered with
+ * a fresh cookie in @valid_foc and the regular three way handshake.
+ */
+static int tcp_fastopen_check(struct sock *sk, struct sk_buff *skb,
+			      struct tcp_fastopen_cookie *foc,
+			      struct tcp_fastopen_cookie *valid_foc)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	if (likely(foc->len < 0))
+		return 0;
+
+	/* A Fast Open option is present.  Make sure the listener has
+	 * enabled Fast Open and has room for another pending child before
+	 * spending cycles on the cookie.
+	 */
+	if (!(sysctl_tcp_fastopen & TFO_SERVER_ENABLE) ||
+	    tp->fastopen_max_qlen == 0)
+		return 0;
+
+	NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVE);
+
+	if (atomic_read(&tp->fastopen_qlen) >= tp->fastopen_max_qlen) {
+		NET_INC_STATS_BH(sock_net(sk),
+				 LINUX_MIB_TCPFASTOPENLISTENOVERFLOW);
+		return 0;
+	}
+
+	tcp_fastopen_cookie_gen(ip_hdr(skb)->saddr, valid_foc);
+
+	if (foc->len == 0) {
+		/* Client requesting a cookie */
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENCOOKIEREQD);
+		return 0;
+	}
+
+	if (valid_foc->len == TCP_FASTOPEN_COOKIE_SIZE &&
+	    foc->len == TCP_FASTOPEN_COOKIE_SIZE &&
+	    memcmp(foc->val, valid_foc->val, TCP_FASTOPEN_COOKIE_SIZE) == 0 &&
+	    !tcp_hdr(skb)->fin) {
+		valid_foc->len = -1;
+		return 1;
+	}
+
+	/* Wrong cookie, or one we cannot use: hand out a valid one */
+	NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVEFAIL);
+	return 0;
+}
+
+/* Create the child of a Fast Open SYN at once and put it on the accept
+ * queue, with the SYN data already in its receive queue.  The child
+ * sends the SYN-ACK itself and stays in SYN_RECV, counted against the
+ * TCP_FASTOPEN limit of the listener, until the handshake completes.
+ */
+static int tcp_v4_conn_req_fastopen(struct sock *sk, struct sk_buff *skb,
+				    struct request_sock *req,
+				    struct dst_entry *dst)
+{
+	struct sock *child;
+	struct tcp_sock *tp;
+
+	child = inet_csk(sk)->icsk_af_ops->syn_recv_sock(sk, skb, req, dst);
+	if (child == NULL) {
+		NET_INC_STATS_BH(sock_net(sk),
+				 LINUX_MIB_TCPFASTOPENPASSIVEFAIL);
+		return -1;
+	}
+
+	tp = tcp_sk(child);
+	sock_hold(sk);
+	atomic_inc(&tcp_sk(sk)->fastopen_qlen);
+	tp->fastopen_listener = sk;
+
+	/* RFC1323: The window in SYN & SYN/ACK segments is never
+	 * scaled. So correct it appropriately.
+	 */
+	tp->snd_wnd = ntohs(tcp_hdr(skb)->window);
+	tp->max_window = tp->snd_wnd;
+
+	/* Our SYN-ACK is not acknowledged yet. */
+	tp->snd_una = tcp_rsk(req)->snt_isn;
+
+	/* Now finish what the third ACK would have done for a regular
+	 * child: the socket may send and receive data right away.
+	 */
+	inet_csk(child)->icsk_af_ops->rebuild_header(child);
+	tcp_init_metrics(child);
+	tcp_init_congestion_control(child);
+	tcp_init_buffer_space(child);
+
+	/* Queue the data carried in the SYN packet.  We need to first
+	 * bump the refcnt of skb because the caller will free it.
+	 */
+	if (TCP_SKB_CB(skb)->end_seq != TCP_SKB_CB(skb)->seq + 1) {
+		skb = skb_get(skb);
+		skb_dst_drop(skb);
+		__skb_pull(skb, tcp_hdrlen(skb));
+		skb_set_owner_r(skb, child);
+		__skb_queue_tail(&child->sk_receive_queue, skb);
+		tp->rcv_nxt = TCP_SKB_CB(skb)->end_seq;
+	}
+
+	tcp_send_fastopen_synack(child);
+
+	/* Add the child socket directly into the accept queue */
+	inet_csk_reqsk_queue_add(sk, req, child);
+	sk->sk_data_ready(sk, 0);
+
+	bh_unlock_sock(child);
+	sock_put(child);
+	return 0;
+}
+
 int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 {
 	struct tcp_extend_values tmp_ext;
 	struct tcp_options_received tmp_opt;
+	struct tcp_fastopen_cookie foc = { .len = -1 };
+	struct tcp_fastopen_cookie valid_foc = { .len = -1 };
 	u8 *hash_location;
 	struct request_sock *req;
 	struct inet_request_sock *ireq;
@@ -1273,7 +1396,8 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	tcp_clear_options(&tmp_opt);
 	tmp_opt.mss_clamp = TCP_MSS_DEFAULT;
 	tmp_opt.user_mss  = tp->rx_opt.user_mss;
-	tcp_parse_options(skb, &tmp_opt, &hash_location, 0);
+	tcp_parse_options(skb, &tmp_opt, &hash_location, 0,
+			  want_cookie ? NULL : &foc);
 
 	if (tmp_opt.cookie_plus > 0 &&
 	    tmp_opt.saw_tstamp &&
@@ -1381,8 +1505,20 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	}
 	tcp_rsk(req)->snt_isn = isn;
 
+	/* Fast Open is left to plain handshakes: no syncookie, no cookie
+	 * transaction and no MD5 signature to be carried by the child.
+	 */
+	if (!want_cookie && !tmp_ext.cookie_plus &&
+	    tcp_v4_md5_do_lookup(sk, saddr) == NULL &&
+	    tcp_fastopen_check(sk, skb, &foc, &valid_foc)) {
+		if (tcp_v4_conn_req_fastopen(sk, skb, req, dst) == 0)
+			return 0;
+		/* syn_recv_sock() consumed the route either way */
+		dst = NULL;
+	}
+
 	if (tcp_v4_send_synack(sk, dst, req,
-			       (struct request_values *)&tmp_ext) ||
+			       (struct request_values *)&tmp_ext, &valid_foc) ||
 	    want_cookie)
 		goto drop_and_free;
 
@@ -1486,13 +1622,23 @@ static struct sock *tcp_v4_hnd_req(struct sock *sk, struct sk_buff *skb)
 {
 	struct tcphdr *th = tcp_hdr(skb);
 	const struct iphdr *iph = ip_hdr(skb);
+	spinlock_t *lock = inet_csk_synq_lock(sk, th->source, iph->saddr);
 	struct sock *nsk;
 	struct request_sock **prev;
-	/* Find possible connection requests. */
-	struct request_sock *req = inet_csk_search_req(sk, &prev, th->source,
-						       iph->saddr, iph->daddr);
-	if (req)
-		return tcp_check_req(sk, skb, req, prev);
+	struct request_sock *req;
+
+	/* Find possible connection requests.  The bucket lock serializes
+	 * the request with other CPUs, the listener may not be locked.
+	 */
+	spin_lock(lock);
+	req = inet_csk_search_req(sk, &prev, th->source, iph->saddr,
+				  iph->daddr);
+	if (req) {
+		nsk = tcp_check_req(sk, skb, req, prev);
+		spin_unlock(lock);
+		return nsk;
+	}
+	spin_unlock(lock);
 
 	nsk = inet_lookup_established(sock_net(sk), &tcp_hashinfo, iph->saddr,
 			th->source, iph->daddr, th->dest, inet_iif(skb));
@@ -1536,7 +1682,7 @@ static __sum16 tcp_v4_checksum_init(struct sk_buff *skb)
 
 
 /* The socket must have it's spinlock held when we get
- * here.
+ * here, unless it is a listener (see tcp_v4_rcv()).
  *
  * We have a potential double-lock case here, so even when
  * doing backlog processing we use the BH locking scheme.
@@ -1558,6 +1704,25 @@ int tcp_v4_do_rcv(struct sock *sk, struct sk_buff *skb)
 #endif
 
 	if (sk->sk_state == TCP_ESTABLISHED) { /* Fast path */
+		struct dst_entry *dst = sk->sk_rx_dst;
+
+		/* tcp_v4_early_demux() reads sk_rx_dst locklessly, so an
+		 * old route is released only after a grace period.  If that
+		 * can't be set up, keep it and try again with a later packet.
+		 */
+		if (dst) {
+			if ((inet_sk(sk)->rx_dst_ifindex != skb->skb_iif ||
+			     dst_check(dst, 0) == NULL) &&
+			    !dst_release_rcu(dst))
+				rcu_assign_pointer(sk->sk_rx_dst, NULL);
+		}
+		if (sk->sk_rx_dst == NULL && skb_dst(skb)) {
+			dst = skb_dst(skb);
+			dst_hold(dst);
+			inet_sk(sk)->rx_dst_ifindex = skb->skb_iif;
+			rcu_assign_pointer(sk->sk_rx_dst, dst);
+		}
+
 		TCP_CHECK_TIMER(sk);
 		if (tcp_rcv_established(sk, skb, tcp_hdr(skb), skb->len)) {
 			rsk = sk;
@@ -1608,6 +1773,56 @@ csum_err:
 	goto discard;
 }
 
+/*
+ * Called from ip_rcv_finish() before the route lookup.  If the segment
+ * belongs to an established socket, attach the socket to it and, when
+ * still valid, the input route the socket saw last time.
+ */
+void tcp_v4_early_demux(struct sk_buff *skb)
+{
+	const struct iphdr *iph;
+	const struct tcphdr *th;
+	struct dst_entry *dst;
+	struct sock *sk;
+
+	if (skb->pkt_type != PACKET_HOST)
+		return;
+
+	if (!pskb_may_pull(skb, ip_hdrlen(skb) + sizeof(struct tcphdr)))
+		return;
+
+	iph = ip_hdr(skb);
+	th = (struct tcphdr *)((char *)iph + ip_hdrlen(skb));
+
+	if (th->doff < sizeof(struct tcphdr) / 4)
+		return;
+
+	sk = __inet_lookup_established(dev_net(skb->dev), &tcp_hashinfo,
+				       iph->saddr, th->source,
+				       iph->daddr, ntohs(th->dest),
+				       skb->skb_iif);
+	if (!sk)
+		return;
+
+	skb->sk = sk;
+	skb->destructor = sock_edemux;
+	if (sk->sk_state == TCP_TIME_WAIT)
+		return;
+
+	dst = rcu_dereference(sk->sk_rx_dst);
+	if (dst == NULL || inet_sk(sk)->rx_dst_ifindex != skb->skb_iif)
+		return;
+
+	/* The socket may be dropping the route under its own lock right
+	 * now, so only take a reference if it is still alive.  The entry
+	 * itself stays around until our RCU read section ends: the socket
+	 * releases it with dst_release_rcu().
+	 */
+	dst = dst_check(dst, 0);
+	if (dst && atomic_inc_not_zero(&dst->__refcnt))
+		skb_dst_set(skb, dst);
+}
+
 /*
  *	From tcp_input.c
  */
@@ -1675,6 +1890,16 @@ process:
 
 	skb->dev = NULL;
 
+	/* SYNs and handshake ACKs for a listener are processed without
+	 * its lock: the SYN table has its own hashed locks and the accept
+	 * queue a spinlock, so a busy listener no longer serializes all
+	 * CPUs on its socket lock.
+	 */
+	if (sk->sk_state == TCP_LISTEN && tcp_listen_lockless(sk)) {
+		ret = tcp_v4_do_rcv(sk, skb);
+		goto put_and_return;
+	}
+
 	bh_lock_sock_nested(sk);
 	ret = 0;
 	if (!sock_owned_by_user(sk)) {
@@ -1697,6 +1922,7 @@ process:
 	}
 	bh_unlock_sock(sk);
 
+put_and_return:
 	sock_put(sk);
 
 	return ret;
@@ -1851,6 +2077,7 @@ static int tcp_v4_init_sock(struct sock *sk)
 	struct tcp_sock *tp = tcp_sk(sk);
 
 	skb_queue_head_init(&tp->out_of_order_queue);
+	INIT_LIST_HEAD(&tp->tsq_node);
 	tcp_init_xmit_timers(sk);
 	tcp_prequeue_init(tp);
 
@@ -1958,6 +2185,9 @@ void tcp_v4_destroy_sock(struct sock *sk)
 		tp->cookie_values = NULL;
 	}
 
+	/* If socket is aborted during connect operation */
+	tcp_free_fastopen_req(tp);
+
 	percpu_counter_dec(&tcp_sockets_allocated);
 }
 
@@ -2474,7 +2704,7 @@ struct sk_buff **tcp4_gro_receive(struct sk_buff **head, struct sk_buff *skb)
 	switch (skb->ip_summed) {
 	case CHECKSUM_COMPLETE:
 		if (!tcp_v4_check(skb_gro_len(skb), iph->saddr, iph->daddr,
-				  skb->csum)) {
+				  NAPI_GRO_CB(skb)->csum)) {
 			skb->ip_summed = CHECKSUM_UNNECESSARY;
 			break;
 		}
@@ -2489,13 +2719,13 @@ struct sk_buff **tcp4_gro_receive(struct sk_buff **head, struct sk_buff *skb)
 }
 EXPORT_SYMBOL(tcp4_gro_receive);
 
-int tcp4_gro_complete(struct sk_buff *skb)
+int tcp4_gro_complete(struct sk_buff *skb, int thoff)
 {
 	struct iphdr *iph = ip_hdr(skb);
-	struct tcphdr *th = tcp_hdr(skb);
+	struct tcphdr *th = (struct tcphdr *)(skb->data + thoff);
 
-	th->check = ~tcp_v4_check(skb->len - skb_transport_offset(skb),
-				  iph->saddr, iph->daddr, 0);
+	skb_set_transport_header(skb, thoff);
+	th->check = ~tcp_v4_check(skb->len - thoff, iph->saddr, iph->daddr, 0);
 	skb_shinfo(skb)->gso_type = SKB_GSO_TCPV4;
 
 	return tcp_gro_complete(skb);
@@ -2517,6 +2747,7 @@ struct proto tcp_prot = {
 	.getsockopt		= tcp_getsockopt,
 	.recvmsg		= tcp_recvmsg,
 	.backlog_rcv		= tcp_v4_do_rcv,
+	.release_cb		= tcp_release_cb,
 	.hash			= inet_hash,
 	.unhash			= inet_unhash,
 	.get_port		= inet_csk_get_port,
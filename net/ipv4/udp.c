@@ -105,6 +105,7 @@
 #include <net/route.h>
 #include <net/checksum.h>
 #include <net/xfrm.h>
+#include <net/busy_poll.h>
 #include "udp_impl.h"
 
 struct udp_table udp_table __read_mostly;
@@ -122,6 +123,9 @@ EXPORT_SYMBOL(sysctl_udp_wmem_min);
 atomic_t udp_memory_allocated;
 EXPORT_SYMBOL(udp_memory_allocated);
 
+/* Sockets with UDP_GRO set; GRO skips the socket lookup while zero. */
+static atomic_t udp_gro_socks = ATOMIC_INIT(0);
+
 #define MAX_UDP_PORTS 65536
 #define PORTS_PER_CHAIN (MAX_UDP_PORTS / UDP_HTABLE_SIZE_MIN)
 
@@ -720,6 +724,30 @@ static int udp_push_pending_frames(struct sock *sk)
 	if ((skb = skb_peek(&sk->sk_write_queue)) == NULL)
 		goto out;
 
+	if (inet->cork.gso_size) {
+		unsigned int hlen = skb_network_header_len(skb) +
+				    sizeof(struct udphdr);
+		unsigned int datalen = up->len - sizeof(struct udphdr);
+		unsigned int mss = inet->cork.gso_size;
+
+		/* Every segment must fit the path MTU on its own and carry
+		 * a checksum the segmentation code can recompute.
+		 */
+		if (hlen + mss > inet->cork.fragsize ||
+		    datalen > mss * UDP_MAX_SEGMENTS ||
+		    sk->sk_no_check == UDP_CSUM_NOXMIT) {
+			ip_flush_pending_frames(sk);
+			err = -EINVAL;
+			goto out;
+		}
+
+		if (datalen > mss) {
+			skb_shinfo(skb)->gso_size = mss;
+			skb_shinfo(skb)->gso_type = SKB_GSO_UDP_L4;
+			skb_shinfo(skb)->gso_segs = DIV_ROUND_UP(datalen, mss);
+		}
+	}
+
 	/*
 	 * Create a UDP header
 	 */
@@ -941,6 +969,7 @@ back_from_confirm:
 	inet->cork.fl.fl_ip_dport = dport;
 	inet->cork.fl.fl4_src = saddr;
 	inet->cork.fl.fl_ip_sport = inet->inet_sport;
+	inet->cork.gso_size = up->gso_size;
 	up->pending = AF_INET;
 
 do_append_data:
@@ -1061,12 +1090,7 @@ static unsigned int first_packet_length(struct sock *sk)
 	res = skb ? skb->len : 0;
 	spin_unlock_bh(&rcvq->lock);
 
-	if (!skb_queue_empty(&list_kill)) {
-		lock_sock(sk);
-		__skb_queue_purge(&list_kill);
-		sk_mem_reclaim_partial(sk);
-		release_sock(sk);
-	}
+	__skb_queue_purge(&list_kill);
 	return res;
 }
 
@@ -1185,21 +1209,21 @@ try_again:
 	}
 	if (inet->cmsg_flags)
 		ip_cmsg_recv(msg, skb);
+	if (udp_sk(sk)->gro_enabled)
+		udp_cmsg_recv(msg, skb);
 
 	err = len;
 	if (flags & MSG_TRUNC)
 		err = ulen;
 
 out_free:
-	skb_free_datagram_locked(sk, skb);
+	consume_skb(skb);
 out:
 	return err;
 
 csum_copy_err:
-	lock_sock(sk);
-	if (!skb_kill_datagram(sk, skb, flags))
+	if (!__skb_kill_datagram(sk, skb, flags))
 		UDP_INC_STATS_USER(sock_net(sk), UDP_MIB_INERRORS, is_udplite);
-	release_sock(sk);
 
 	if (noblock)
 		return -EAGAIN;
@@ -1256,9 +1280,81 @@ void udp_lib_unhash(struct sock *sk)
 }
 EXPORT_SYMBOL(udp_lib_unhash);
 
+/*
+ * UDP receive memory is accounted under the receive queue lock rather
+ * than the socket lock: softirq queues datagrams without waiting for a
+ * reader that holds lock_sock(), and readers free them without taking
+ * it.  sk_forward_alloc of a UDP socket is therefore only ever touched
+ * with sk_receive_queue.lock held.
+ */
+static void udp_rmem_free(struct sk_buff *skb)
+{
+	struct sock *sk = skb->sk;
+	struct sk_buff_head *list = &sk->sk_receive_queue;
+	unsigned long flags;
+
+	spin_lock_irqsave(&list->lock, flags);
+	sk_mem_uncharge(sk, skb->truesize);
+	sk_mem_reclaim_partial(sk);
+	spin_unlock_irqrestore(&list->lock, flags);
+
+	atomic_sub(skb->truesize, &sk->sk_rmem_alloc);
+}
+
+/**
+ *	__udp_enqueue_schedule_skb - charge and queue a datagram to a socket
+ *	@sk: receiving UDP socket
+ *	@skb: datagram
+ *
+ *	The UDP counterpart of sock_queue_rcv_skb().  It does not need the
+ *	socket lock, so it must not be used together with the socket
+ *	backlog.  On error the caller still owns @skb.
+ */
+int __udp_enqueue_schedule_skb(struct sock *sk, struct sk_buff *skb)
+{
+	struct sk_buff_head *list = &sk->sk_receive_queue;
+	int size = skb->truesize;
+	unsigned long flags;
+	int err, skb_len;
+
+	if (atomic_read(&sk->sk_rmem_alloc) + size >= (unsigned)sk->sk_rcvbuf) {
+		atomic_inc(&sk->sk_drops);
+		return -ENOMEM;
+	}
+
+	err = sk_filter(sk, skb);
+	if (err)
+		return err;
+
+	spin_lock_irqsave(&list->lock, flags);
+	if (!sk_rmem_schedule(sk, size)) {
+		spin_unlock_irqrestore(&list->lock, flags);
+		atomic_inc(&sk->sk_drops);
+		return -ENOBUFS;
+	}
+	sk_mem_charge(sk, size);
+	atomic_add(size, &sk->sk_rmem_alloc);
+
+	skb->dev = NULL;
+	skb->sk = sk;
+	skb->destructor = udp_rmem_free;
+	skb->dropcount = atomic_read(&sk->sk_drops);
+	sk_mark_napi_id(sk, skb);
+
+	/* Once queued the skb may be freed by a reader at any time. */
+	skb_len = skb->len;
+	__skb_queue_tail(list, skb);
+	spin_unlock_irqrestore(&list->lock, flags);
+
+	if (!sock_flag(sk, SOCK_DEAD))
+		sk->sk_data_ready(sk, skb_len);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(__udp_enqueue_schedule_skb);
+
 static int __udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 {
-	int rc = sock_queue_rcv_skb(sk, skb);
+	int rc = __udp_enqueue_schedule_skb(sk, skb);
 
 	if (rc < 0) {
 		int is_udplite = IS_UDPLITE(sk);
@@ -1284,10 +1380,9 @@ static int __udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
  * Note that in the success and error cases, the skb is assumed to
  * have either been requeued or freed.
  */
-int udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
+static int udp_queue_rcv_one_skb(struct sock *sk, struct sk_buff *skb)
 {
 	struct udp_sock *up = udp_sk(sk);
-	int rc;
 	int is_udplite = IS_UDPLITE(sk);
 
 	/*
@@ -1367,18 +1462,7 @@ int udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 			goto drop;
 	}
 
-	rc = 0;
-
-	bh_lock_sock(sk);
-	if (!sock_owned_by_user(sk))
-		rc = __udp_queue_rcv_skb(sk, skb);
-	else if (sk_add_backlog(sk, skb)) {
-		bh_unlock_sock(sk);
-		goto drop;
-	}
-	bh_unlock_sock(sk);
-
-	return rc;
+	return __udp_queue_rcv_skb(sk, skb);
 
 drop:
 	UDP_INC_STATS_BH(sock_net(sk), UDP_MIB_INERRORS, is_udplite);
@@ -1387,6 +1471,45 @@ drop:
 	return -1;
 }
 
+/*
+ * A datagram coalesced by GRO for a socket that has since cleared UDP_GRO
+ * is split back into the datagrams that came off the wire.  Segments
+ * cannot be resubmitted to an encapsulation handler, so those are dropped.
+ */
+static int udp_queue_rcv_segs(struct sock *sk, struct sk_buff *skb)
+{
+	struct sk_buff *segs, *next;
+
+	__skb_push(skb, -skb_network_offset(skb));
+	segs = skb_gso_segment(skb, NETIF_F_SG | NETIF_F_HW_CSUM);
+	if (IS_ERR(segs) || !segs) {
+		UDP_INC_STATS_BH(sock_net(sk), UDP_MIB_INERRORS, 0);
+		atomic_inc(&sk->sk_drops);
+		kfree_skb(skb);
+		return -1;
+	}
+	consume_skb(skb);
+
+	for (skb = segs; skb; skb = next) {
+		next = skb->next;
+		skb->next = NULL;
+		__skb_pull(skb, skb_transport_offset(skb));
+		if (udp_queue_rcv_one_skb(sk, skb) > 0)
+			kfree_skb(skb);
+	}
+	return 0;
+}
+
+int udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
+{
+	if (unlikely(skb_is_gso(skb) &&
+		     (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4) &&
+		     !udp_sk(sk)->gro_enabled))
+		return udp_queue_rcv_segs(sk, skb);
+
+	return udp_queue_rcv_one_skb(sk, skb);
+}
+
 
 static void flush_stack(struct sock **stack, unsigned int count,
 			struct sk_buff *skb, unsigned int final)
@@ -1617,6 +1740,8 @@ void udp_destroy_sock(struct sock *sk)
 {
 	lock_sock(sk);
 	udp_flush_pending_frames(sk);
+	if (udp_sk(sk)->gro_enabled)
+		atomic_dec(&udp_gro_socks);
 	release_sock(sk);
 }
 
@@ -1696,6 +1821,27 @@ int udp_lib_setsockopt(struct sock *sk, int level, int optname,
 		up->pcflag |= UDPLITE_RECV_CC;
 		break;
 
+	/* Segmentation and coalescing are only wired up for IPv4 UDP. */
+	case UDP_SEGMENT:
+		if (is_udplite || sk->sk_family != AF_INET)
+			return -ENOPROTOOPT;
+		if (val < 0 || val > USHORT_MAX)
+			return -EINVAL;
+		up->gso_size = val;
+		break;
+
+	case UDP_GRO:
+		if (is_udplite || sk->sk_family != AF_INET)
+			return -ENOPROTOOPT;
+		lock_sock(sk);
+		if (val && !up->gro_enabled)
+			atomic_inc(&udp_gro_socks);
+		else if (!val && up->gro_enabled)
+			atomic_dec(&udp_gro_socks);
+		up->gro_enabled = !!val;
+		release_sock(sk);
+		break;
+
 	default:
 		err = -ENOPROTOOPT;
 		break;
@@ -1758,6 +1904,14 @@ int udp_lib_getsockopt(struct sock *sk, int level, int optname,
 		val = up->pcrlen;
 		break;
 
+	case UDP_SEGMENT:
+		val = up->gso_size;
+		break;
+
+	case UDP_GRO:
+		val = up->gro_enabled;
+		break;
+
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -2144,6 +2298,350 @@ int udp4_ufo_send_check(struct sk_buff *skb)
 	return 0;
 }
 
+/*
+ * UDP encapsulations registered for GRO/GSO, keyed by destination port.
+ * Readers walk the list under rcu_read_lock() from softirq context.
+ */
+static LIST_HEAD(udp_offload_base);
+static DEFINE_SPINLOCK(udp_offload_lock);
+
+static struct udp_offload *udp_offload_lookup(__be16 port)
+{
+	struct udp_offload *uo;
+
+	list_for_each_entry_rcu(uo, &udp_offload_base, list) {
+		if (uo->port == port)
+			return uo;
+	}
+	return NULL;
+}
+
+/**
+ *	udp_add_offload - register GRO/GSO handlers for a UDP encapsulation
+ *	@uo: offload description, port in network byte order
+ *
+ *	Returns -EEXIST if another encapsulation already owns the port.
+ */
+int udp_add_offload(struct udp_offload *uo)
+{
+	int err = -EEXIST;
+
+	spin_lock(&udp_offload_lock);
+	if (!udp_offload_lookup(uo->port)) {
+		list_add_rcu(&uo->list, &udp_offload_base);
+		err = 0;
+	}
+	spin_unlock(&udp_offload_lock);
+
+	return err;
+}
+EXPORT_SYMBOL(udp_add_offload);
+
+/**
+ *	udp_del_offload - unregister a UDP encapsulation
+ *	@uo: offload previously passed to udp_add_offload()
+ *
+ *	Waits for softirq users of the handlers to finish.
+ */
+void udp_del_offload(struct udp_offload *uo)
+{
+	spin_lock(&udp_offload_lock);
+	list_del_rcu(&uo->list);
+	spin_unlock(&udp_offload_lock);
+
+	synchronize_net();
+}
+EXPORT_SYMBOL(udp_del_offload);
+
+/* Does the datagram go to a local socket that accepts GRO datagrams? */
+static int udp4_gro_socket(struct sk_buff *skb, const struct iphdr *iph,
+			   const struct udphdr *uh)
+{
+	struct sock *sk;
+	int enabled = 0;
+
+	if (!atomic_read(&udp_gro_socks))
+		return 0;
+
+	sk = __udp4_lib_lookup(dev_net(skb->dev), iph->saddr, uh->source,
+			       iph->daddr, uh->dest, skb->dev->ifindex,
+			       &udp_table);
+	if (sk) {
+		enabled = udp_sk(sk)->gro_enabled;
+		sock_put(sk);
+	}
+	return enabled;
+}
+
+/*
+ * Chain datagrams of one flow into a single skb for a UDP_GRO socket.
+ * All but the last datagram must have the size of the first; gso_size
+ * ends up as that size, which recvmsg() reports back to the reader.
+ */
+static struct sk_buff **udp_gro_receive_segment(struct sk_buff **head,
+						struct sk_buff *skb,
+						struct udphdr *uh,
+						unsigned int off)
+{
+	struct sk_buff **pp = NULL;
+	struct sk_buff *p;
+	struct udphdr *uh2;
+	unsigned int ulen, ulen2;
+
+	/* A datagram without checksum cannot be given a partial one. */
+	ulen = ntohs(uh->len);
+	if (!uh->check || ulen <= sizeof(*uh) || ulen != skb_gro_len(skb)) {
+		NAPI_GRO_CB(skb)->flush = 1;
+		return NULL;
+	}
+
+	skb_gro_pull(skb, sizeof(*uh));
+	skb_gro_postpull_rcsum(skb, uh, sizeof(*uh));
+
+	for (; (p = *head); head = &p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		uh2 = (struct udphdr *)(p->data + off);
+		if (*(u32 *)&uh->source != *(u32 *)&uh2->source) {
+			NAPI_GRO_CB(p)->same_flow = 0;
+			continue;
+		}
+
+		/* A larger datagram starts a new train; a shorter one
+		 * ends the current one.
+		 */
+		ulen2 = ntohs(uh2->len);
+		if (NAPI_GRO_CB(p)->flush || ulen > ulen2 ||
+		    skb_gro_receive(head, skb) || ulen != ulen2)
+			pp = head;
+		break;
+	}
+
+	return pp;
+}
+
+struct sk_buff **udp4_gro_receive(struct sk_buff **head, struct sk_buff *skb)
+{
+	const struct iphdr *iph = skb_gro_network_header(skb);
+	struct sk_buff **pp = NULL;
+	struct udp_offload *uo;
+	struct sk_buff *p;
+	struct udphdr *uh;
+	struct udphdr *uh2;
+	unsigned int hlen;
+	unsigned int off;
+	int flush = 1;
+
+	off = skb_gro_offset(skb);
+	hlen = off + sizeof(*uh);
+	uh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		uh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!uh))
+			goto out;
+	}
+
+	rcu_read_lock();
+	uo = udp_offload_lookup(uh->dest);
+	if (!uo && !udp4_gro_socket(skb, iph, uh))
+		goto out_unlock;
+
+	/*
+	 * Only aggregate datagrams whose checksum is absent or already
+	 * known to be good; the inner protocol checks its own checksum
+	 * against the remaining NAPI_GRO_CB(skb)->csum.
+	 */
+	if (uh->check) {
+		switch (skb->ip_summed) {
+		case CHECKSUM_UNNECESSARY:
+			break;
+		case CHECKSUM_COMPLETE:
+			if (!csum_tcpudp_magic(iph->saddr, iph->daddr,
+					       skb_gro_len(skb), IPPROTO_UDP,
+					       NAPI_GRO_CB(skb)->csum))
+				break;
+			/* fall through */
+		default:
+			goto out_unlock;
+		}
+	}
+
+	if (!uo) {
+		flush = 0;
+		pp = udp_gro_receive_segment(head, skb, uh, off);
+		goto out_unlock;
+	}
+
+	flush = ntohs(uh->len) != skb_gro_len(skb);
+
+	for (p = *head; p; p = p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		uh2 = (struct udphdr *)(p->data + off);
+		if (*(u32 *)&uh->source != *(u32 *)&uh2->source) {
+			NAPI_GRO_CB(p)->same_flow = 0;
+			continue;
+		}
+
+		NAPI_GRO_CB(p)->flush |= flush;
+	}
+
+	NAPI_GRO_CB(skb)->flush |= flush;
+	skb_gro_pull(skb, sizeof(*uh));
+	skb_gro_postpull_rcsum(skb, uh, sizeof(*uh));
+
+	pp = uo->gro_receive(head, skb);
+
+out_unlock:
+	rcu_read_unlock();
+
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+
+/*
+ * The chained datagrams are delivered as one UDP_SEGMENT style skb: the
+ * checksums were verified in udp4_gro_receive(), so the outer one is set
+ * up as if for transmit and the datagram can be segmented again.
+ */
+static int udp4_gro_complete_segment(struct sk_buff *skb, struct udphdr *uh)
+{
+	const struct iphdr *iph = ip_hdr(skb);
+
+	uh->check = ~csum_tcpudp_magic(iph->saddr, iph->daddr, ntohs(uh->len),
+				       IPPROTO_UDP, 0);
+	skb->csum_start = (unsigned char *)uh - skb->head;
+	skb->csum_offset = offsetof(struct udphdr, check);
+	skb->ip_summed = CHECKSUM_PARTIAL;
+
+	skb_shinfo(skb)->gso_segs = NAPI_GRO_CB(skb)->count;
+	skb_shinfo(skb)->gso_type |= SKB_GSO_UDP_L4;
+	return 0;
+}
+
+int udp4_gro_complete(struct sk_buff *skb, int nhoff)
+{
+	struct udphdr *uh = (struct udphdr *)(skb->data + nhoff);
+	struct udp_offload *uo;
+	int err;
+
+	uh->len = htons(skb->len - nhoff);
+
+	rcu_read_lock();
+	uo = udp_offload_lookup(uh->dest);
+	if (!uo) {
+		rcu_read_unlock();
+		return udp4_gro_complete_segment(skb, uh);
+	}
+	err = uo->gro_complete(skb, nhoff + sizeof(*uh));
+	rcu_read_unlock();
+
+	/* The inner protocol sets gso_type, so this has to come last. */
+	skb_shinfo(skb)->gso_type |= SKB_GSO_UDP_TUNNEL;
+
+	return err;
+}
+
+static struct sk_buff *udp4_tunnel_segment(struct sk_buff *skb, int features)
+{
+	struct sk_buff *segs = ERR_PTR(-EPROTONOSUPPORT);
+	struct udp_offload *uo;
+	struct udphdr *uh;
+
+	if (unlikely(!pskb_may_pull(skb, sizeof(*uh))))
+		return ERR_PTR(-EINVAL);
+
+	uh = udp_hdr(skb);
+
+	rcu_read_lock();
+	uo = udp_offload_lookup(uh->dest);
+	if (likely(uo && uo->gso_segment)) {
+		__skb_pull(skb, sizeof(*uh));
+		segs = uo->gso_segment(skb, features);
+	}
+	rcu_read_unlock();
+
+	if (!segs || IS_ERR(segs))
+		return segs;
+
+	/* Segments are checksummed in software by now and a zero UDP
+	 * checksum is valid over IPv4, so skip the outer one.
+	 */
+	for (skb = segs; skb; skb = skb->next) {
+		uh = udp_hdr(skb);
+		uh->len = htons(skb->len - skb_transport_offset(skb));
+		uh->check = 0;
+	}
+
+	return segs;
+}
+
+/*
+ * Split a UDP_SEGMENT datagram into gso_size sized datagrams, each with
+ * its own UDP header.  IP headers are fixed up in inet_gso_segment().
+ */
+static struct sk_buff *udp4_gso_segment(struct sk_buff *skb, int features)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	unsigned int mss = skb_shinfo(skb)->gso_size;
+	const struct iphdr *iph;
+	struct udphdr *uh;
+	unsigned int ulen;
+
+	if (unlikely(!pskb_may_pull(skb, sizeof(*uh))))
+		goto out;
+
+	if (unlikely(skb->len <= sizeof(*uh) + mss))
+		goto out;
+
+	if (skb_gso_ok(skb, features | NETIF_F_GSO_ROBUST)) {
+		/* Packet is from an untrusted source, reset gso_segs. */
+		int type = skb_shinfo(skb)->gso_type;
+
+		if (unlikely(type & ~(SKB_GSO_UDP_L4 | SKB_GSO_DODGY)))
+			goto out;
+
+		skb_shinfo(skb)->gso_segs =
+			DIV_ROUND_UP(skb->len - sizeof(*uh), mss);
+
+		segs = NULL;
+		goto out;
+	}
+
+	__skb_pull(skb, sizeof(*uh));
+	segs = skb_segment(skb, features);
+	if (IS_ERR(segs))
+		goto out;
+
+	for (skb = segs; skb; skb = skb->next) {
+		iph = ip_hdr(skb);
+		uh = udp_hdr(skb);
+		ulen = skb->len - skb_transport_offset(skb);
+
+		uh->len = htons(ulen);
+		uh->check = 0;
+		if (skb->ip_summed == CHECKSUM_PARTIAL) {
+			uh->check = ~csum_tcpudp_magic(iph->saddr, iph->daddr,
+						       ulen, IPPROTO_UDP, 0);
+			skb->csum_start = skb_transport_header(skb) -
+					  skb->head;
+			skb->csum_offset = offsetof(struct udphdr, check);
+		} else {
+			uh->check = csum_tcpudp_magic(iph->saddr, iph->daddr,
+					ulen, IPPROTO_UDP,
+					csum_partial(uh, sizeof(*uh), skb->csum));
+			if (uh->check == 0)
+				uh->check = CSUM_MANGLED_0;
+		}
+	}
+out:
+	return segs;
+}
+
 struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, int features)
 {
 	struct sk_buff *segs = ERR_PTR(-EINVAL);
@@ -2151,6 +2649,11 @@ struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, int features)
 	int offset;
 	__wsum csum;
 
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_TUNNEL)
+		return udp4_tunnel_segment(skb, features);
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4)
+		return udp4_gso_segment(skb, features);
+
 	mss = skb_shinfo(skb)->gso_size;
 	if (unlikely(skb->len <= mss))
 		goto out;
@@ -110,6 +110,18 @@ struct request_sock *inet6_csk_search_req(const struct sock *sk,
 
 EXPORT_SYMBOL_GPL(inet6_csk_search_req);
 
+spinlock_t *inet6_csk_synq_lock(const struct sock *sk, const __be16 rport,
+				const struct in6_addr *raddr)
+{
+	struct listen_sock *lopt = inet_csk(sk)->icsk_accept_queue.listen_opt;
+
+	return reqsk_queue_syn_lock(lopt, inet6_synq_hash(raddr, rport,
+							  lopt->hash_rnd,
+							  lopt->nr_table_entries));
+}
+
+EXPORT_SYMBOL_GPL(inet6_csk_synq_lock);
+
 void inet6_csk_reqsk_queue_hash_add(struct sock *sk,
 				    struct request_sock *req,
 				    const unsigned long timeout)
@@ -0,0 +1,130 @@
+/* Copyright (C) 2003-2010 Jozsef Kadlecsik <kadlec@blackhole.kfki.hu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* Kernel module implementing an IP set type: the hash:ip type */
+
+#include <linux/module.h>
+#include <linux/skbuff.h>
+#include <linux/netlink.h>
+#include <net/netlink.h>
+
+#include <linux/netfilter.h>
+#include <linux/netfilter/ipset/ip_set.h>
+#include <linux/netfilter/ipset/ip_set_hash.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Jozsef Kadlecsik <kadlec@blackhole.kfki.hu>");
+MODULE_DESCRIPTION("hash:ip type of IP sets");
+MODULE_ALIAS("ip_set_hash:ip");
+
+static int
+hash_ip_kadt(struct ip_set *set, const struct sk_buff *skb,
+	     enum ipset_adt adt, u8 pf, u8 dim, u8 flags)
+{
+	struct ip_set_hash *h = set->data;
+	union nf_inet_addr ip;
+
+	memset(&ip, 0, sizeof(ip));
+	if (pf == NFPROTO_IPV4)
+		ip4addrptr(skb, flags & IPSET_DIM_ONE_SRC, &ip.ip);
+	else
+		ip6addrptr(skb, flags & IPSET_DIM_ONE_SRC, &ip.in6);
+	ip_set_mask_addr(&ip, h->family, h->netmask);
+
+	return ip_set_hash_adt(h, adt, &ip, h->netmask, false);
+}
+
+static int
+hash_ip_uadt(struct ip_set *set, struct nlattr *tb[],
+	     enum ipset_adt adt, u32 flags)
+{
+	struct ip_set_hash *h = set->data;
+	union nf_inet_addr ip;
+	int ret;
+
+	if (unlikely(!tb[IPSET_ATTR_IP]))
+		return -IPSET_ERR_PROTOCOL;
+
+	ret = ip_set_hash_get_ip(h, tb[IPSET_ATTR_IP], &ip);
+	if (ret)
+		return ret;
+	ip_set_mask_addr(&ip, h->family, h->netmask);
+
+	return ip_set_hash_adt(h, adt, &ip, h->netmask, true);
+}
+
+static const struct ip_set_type_variant hash_ip_variant = {
+	.kadt	= hash_ip_kadt,
+	.uadt	= hash_ip_uadt,
+	.resize	= ip_set_hash_resize,
+	.destroy = ip_set_hash_destroy,
+	.flush	= ip_set_hash_flush,
+	.head	= ip_set_hash_head,
+	.list	= ip_set_hash_list,
+	.same_set = ip_set_hash_same_set,
+};
+
+static int
+hash_ip_create(struct ip_set *set, struct nlattr *tb[], u32 flags)
+{
+	u32 hashsize = IPSET_DEFAULT_HASHSIZE, maxelem = IPSET_DEFAULT_MAXELEM;
+	u8 netmask = IPSET_HOST_MASK(set->family);
+
+	if (unlikely(!ip_set_optattr_netorder(tb, IPSET_ATTR_HASHSIZE) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_MAXELEM)))
+		return -IPSET_ERR_PROTOCOL;
+
+	if (tb[IPSET_ATTR_HASHSIZE])
+		hashsize = ip_set_get_h32(tb[IPSET_ATTR_HASHSIZE]);
+
+	if (tb[IPSET_ATTR_MAXELEM])
+		maxelem = ip_set_get_h32(tb[IPSET_ATTR_MAXELEM]);
+
+	if (tb[IPSET_ATTR_NETMASK]) {
+		netmask = nla_get_u8(tb[IPSET_ATTR_NETMASK]);
+
+		if (netmask == 0 || netmask > IPSET_HOST_MASK(set->family))
+			return -IPSET_ERR_INVALID_NETMASK;
+	}
+
+	return ip_set_hash_create(set, &hash_ip_variant,
+				  hashsize, maxelem, netmask);
+}
+
+static struct ip_set_type hash_ip_type __read_mostly = {
+	.name		= "hash:ip",
+	.protocol	= IPSET_PROTOCOL,
+	.features	= IPSET_TYPE_IP,
+	.dimension	= IPSET_DIM_ONE,
+	.family		= NFPROTO_UNSPEC,
+	.revision	= 0,
+	.create		= hash_ip_create,
+	.create_policy	= {
+		[IPSET_ATTR_HASHSIZE]	= { .type = NLA_U32 },
+		[IPSET_ATTR_MAXELEM]	= { .type = NLA_U32 },
+		[IPSET_ATTR_NETMASK]	= { .type = NLA_U8  },
+	},
+	.adt_policy	= {
+		[IPSET_ATTR_IP]		= { .type = NLA_NESTED },
+	},
+	.me		= THIS_MODULE,
+};
+
+static int __init
+hash_ip_init(void)
+{
+	return ip_set_type_register(&hash_ip_type);
+}
+
+static void __exit
+hash_ip_fini(void)
+{
+	ip_set_type_unregister(&hash_ip_type);
+}
+
+module_init(hash_ip_init);
+module_exit(hash_ip_fini);
@@ -0,0 +1,140 @@
+/* Copyright (C) 2003-2010 Jozsef Kadlecsik <kadlec@blackhole.kfki.hu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* Kernel module implementing an IP set type: the hash:net type */
+
+#include <linux/module.h>
+#include <linux/skbuff.h>
+#include <linux/netlink.h>
+#include <net/netlink.h>
+
+#include <linux/netfilter.h>
+#include <linux/netfilter/ipset/ip_set.h>
+#include <linux/netfilter/ipset/ip_set_hash.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Jozsef Kadlecsik <kadlec@blackhole.kfki.hu>");
+MODULE_DESCRIPTION("hash:net type of IP sets");
+MODULE_ALIAS("ip_set_hash:net");
+
+/* Packets are looked up once per distinct prefix length stored in the
+ * set, from the longest prefix down. Elements added from the packet path
+ * are host addresses.
+ */
+static int
+hash_net_kadt(struct ip_set *set, const struct sk_buff *skb,
+	      enum ipset_adt adt, u8 pf, u8 dim, u8 flags)
+{
+	struct ip_set_hash *h = set->data;
+	union nf_inet_addr ip;
+
+	memset(&ip, 0, sizeof(ip));
+	if (pf == NFPROTO_IPV4)
+		ip4addrptr(skb, flags & IPSET_DIM_ONE_SRC, &ip.ip);
+	else
+		ip6addrptr(skb, flags & IPSET_DIM_ONE_SRC, &ip.in6);
+
+	if (adt == IPSET_TEST)
+		return ip_set_hash_test_cidrs(h, &ip);
+
+	return ip_set_hash_adt(h, adt, &ip, IPSET_HOST_MASK(h->family), false);
+}
+
+static int
+hash_net_uadt(struct ip_set *set, struct nlattr *tb[],
+	      enum ipset_adt adt, u32 flags)
+{
+	struct ip_set_hash *h = set->data;
+	union nf_inet_addr ip;
+	u8 cidr = IPSET_HOST_MASK(h->family);
+	int ret;
+
+	if (unlikely(!tb[IPSET_ATTR_IP]))
+		return -IPSET_ERR_PROTOCOL;
+
+	ret = ip_set_hash_get_ip(h, tb[IPSET_ATTR_IP], &ip);
+	if (ret)
+		return ret;
+
+	if (tb[IPSET_ATTR_CIDR]) {
+		cidr = nla_get_u8(tb[IPSET_ATTR_CIDR]);
+		if (!cidr || cidr > IPSET_HOST_MASK(h->family))
+			return -IPSET_ERR_INVALID_CIDR;
+	} else if (adt == IPSET_TEST) {
+		/* Test an address: is it covered by any of the networks? */
+		return ip_set_hash_test_cidrs(h, &ip);
+	}
+
+	ip_set_mask_addr(&ip, h->family, cidr);
+
+	return ip_set_hash_adt(h, adt, &ip, cidr, true);
+}
+
+static const struct ip_set_type_variant hash_net_variant = {
+	.kadt	= hash_net_kadt,
+	.uadt	= hash_net_uadt,
+	.resize	= ip_set_hash_resize,
+	.destroy = ip_set_hash_destroy,
+	.flush	= ip_set_hash_flush,
+	.head	= ip_set_hash_head,
+	.list	= ip_set_hash_list,
+	.same_set = ip_set_hash_same_set,
+};
+
+static int
+hash_net_create(struct ip_set *set, struct nlattr *tb[], u32 flags)
+{
+	u32 hashsize = IPSET_DEFAULT_HASHSIZE, maxelem = IPSET_DEFAULT_MAXELEM;
+
+	if (unlikely(!ip_set_optattr_netorder(tb, IPSET_ATTR_HASHSIZE) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_MAXELEM)))
+		return -IPSET_ERR_PROTOCOL;
+
+	if (tb[IPSET_ATTR_HASHSIZE])
+		hashsize = ip_set_get_h32(tb[IPSET_ATTR_HASHSIZE]);
+
+	if (tb[IPSET_ATTR_MAXELEM])
+		maxelem = ip_set_get_h32(tb[IPSET_ATTR_MAXELEM]);
+
+	/* No fixed netmask: every element carries its own prefix length */
+	return ip_set_hash_create(set, &hash_net_variant,
+				  hashsize, maxelem, 0);
+}
+
+static struct ip_set_type hash_net_type __read_mostly = {
+	.name		= "hash:net",
+	.protocol	= IPSET_PROTOCOL,
+	.features	= IPSET_TYPE_IP,
+	.dimension	= IPSET_DIM_ONE,
+	.family		= NFPROTO_UNSPEC,
+	.revision	= 0,
+	.create		= hash_net_create,
+	.create_policy	= {
+		[IPSET_ATTR_HASHSIZE]	= { .type = NLA_U32 },
+		[IPSET_ATTR_MAXELEM]	= { .type = NLA_U32 },
+	},
+	.adt_policy	= {
+		[IPSET_ATTR_IP]		= { .type = NLA_NESTED },
+		[IPSET_ATTR_CIDR]	= { .type = NLA_U8 },
+	},
+	.me		= THIS_MODULE,
+};
+
+static int __init
+hash_net_init(void)
+{
+	return ip_set_type_register(&hash_net_type);
+}
+
+static void __exit
+hash_net_fini(void)
+{
+	ip_set_type_unregister(&hash_net_type);
+}
+
+module_init(hash_net_init);
+module_exit(hash_net_fini);
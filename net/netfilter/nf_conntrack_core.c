@@ -32,6 +32,7 @@
 #include <linux/mm.h>
 #include <linux/nsproxy.h>
 #include <linux/rculist_nulls.h>
+#include <linux/mutex.h>
 
 #include <net/netfilter/nf_conntrack.h>
 #include <net/netfilter/nf_conntrack_l3proto.h>
@@ -56,6 +57,13 @@ EXPORT_SYMBOL_GPL(nfnetlink_parse_nat_setup_hook);
 DEFINE_SPINLOCK(nf_conntrack_lock);
 EXPORT_SYMBOL_GPL(nf_conntrack_lock);
 
+spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS] __cacheline_aligned_in_smp;
+EXPORT_SYMBOL_GPL(nf_conntrack_locks);
+
+/* Serializes hash resizes against walkers that must see every entry */
+DEFINE_MUTEX(nf_conntrack_resize_mutex);
+EXPORT_SYMBOL_GPL(nf_conntrack_resize_mutex);
+
 unsigned int nf_conntrack_htable_size __read_mostly;
 EXPORT_SYMBOL_GPL(nf_conntrack_htable_size);
 
@@ -68,29 +76,132 @@ EXPORT_SYMBOL_GPL(nf_conntrack_untracked);
 static int nf_conntrack_hash_rnd_initted;
 static unsigned int nf_conntrack_hash_rnd;
 
-static u_int32_t __hash_conntrack(const struct nf_conntrack_tuple *tuple,
-				  u16 zone, unsigned int size, unsigned int rnd)
+static u_int32_t hash_conntrack_raw(const struct nf_conntrack_tuple *tuple,
+				    u16 zone)
 {
 	unsigned int n;
-	u_int32_t h;
 
 	/* The direction must be ignored, so we hash everything up to the
 	 * destination ports (which is a multiple of 4) and treat the last
 	 * three bytes manually.
 	 */
 	n = (sizeof(tuple->src) + sizeof(tuple->dst.u3)) / sizeof(u32);
-	h = jhash2((u32 *)tuple, n,
-		   zone ^ rnd ^ (((__force __u16)tuple->dst.u.all << 16) |
-				 tuple->dst.protonum));
+	return jhash2((u32 *)tuple, n,
+		      zone ^ nf_conntrack_hash_rnd ^
+		      (((__force __u16)tuple->dst.u.all << 16) |
+		       tuple->dst.protonum));
+}
+
+static inline u_int32_t __hash_bucket(u_int32_t hash, unsigned int size)
+{
+	return ((u64)hash * size) >> 32;
+}
+
+/* Since table sizes are multiples of CONNTRACK_LOCKS, the stripe of a hash
+ * value is the same in every table it may live in.
+ */
+static inline unsigned int hash_stripe(u_int32_t hash)
+{
+	return __hash_bucket(hash, CONNTRACK_LOCKS);
+}
+
+/*
+ * Return the chain a raw hash value currently maps to.  While the table is
+ * being resized, stripes that have not been migrated yet still live in the
+ * old table.
+ *
+ * Lockless readers call this inside a net->ct.generation read section and
+ * retry a failed lookup if the generation changed.  Writers hold the stripe
+ * lock of @hash, which keeps the stripe from moving under them, and use
+ * nf_conntrack_chain_locked().
+ */
+static struct hlist_nulls_head *
+nf_conntrack_chain(const struct net *net, u_int32_t hash,
+		   unsigned int *bucket)
+{
+	struct hlist_nulls_head *old_hash = rcu_dereference_raw(net->ct.old_hash);
+
+	if (unlikely(old_hash) &&
+	    hash_stripe(hash) >= ACCESS_ONCE(net->ct.resize_stripe)) {
+		*bucket = __hash_bucket(hash, net->ct.old_htable_size);
+		return &old_hash[*bucket];
+	}
+	*bucket = __hash_bucket(hash, net->ct.htable_size);
+	return &rcu_dereference_raw(net->ct.hash)[*bucket];
+}
+
+static struct hlist_nulls_head *
+nf_conntrack_chain_locked(const struct net *net, u_int32_t hash)
+{
+	struct hlist_nulls_head *head;
+	unsigned int bucket, seq;
 
-	return ((u64)h * size) >> 32;
+	do {
+		seq = read_seqcount_begin(&net->ct.generation);
+		head = nf_conntrack_chain(net, hash, &bucket);
+	} while (read_seqcount_retry(&net->ct.generation, seq));
+
+	return head;
 }
 
-static inline u_int32_t hash_conntrack(const struct net *net, u16 zone,
-				       const struct nf_conntrack_tuple *tuple)
+/* Lock the stripes of both directions; caller has BHs disabled. */
+static void nf_conntrack_double_lock(u_int32_t h1, u_int32_t h2)
 {
-	return __hash_conntrack(tuple, zone, net->ct.htable_size,
-				nf_conntrack_hash_rnd);
+	unsigned int s1 = hash_stripe(h1), s2 = hash_stripe(h2);
+
+	if (s1 > s2)
+		swap(s1, s2);
+	spin_lock(&nf_conntrack_locks[s1]);
+	if (s1 != s2)
+		spin_lock_nested(&nf_conntrack_locks[s2], SINGLE_DEPTH_NESTING);
+}
+
+static void nf_conntrack_double_unlock(u_int32_t h1, u_int32_t h2)
+{
+	unsigned int s1 = hash_stripe(h1), s2 = hash_stripe(h2);
+
+	if (s1 != s2)
+		spin_unlock(&nf_conntrack_locks[s2]);
+	spin_unlock(&nf_conntrack_locks[s1]);
+}
+
+static void nf_ct_add_to_unconfirmed_list(struct nf_conn *ct)
+{
+	struct ct_pcpu *pcpu;
+
+	local_bh_disable();
+	ct->cpu = smp_processor_id();
+	pcpu = per_cpu_ptr(nf_ct_net(ct)->ct.pcpu_lists, ct->cpu);
+
+	spin_lock(&pcpu->lock);
+	hlist_nulls_add_head_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode,
+				 &pcpu->unconfirmed);
+	spin_unlock(&pcpu->lock);
+	local_bh_enable();
+}
+
+static void nf_ct_del_from_unconfirmed_list(struct nf_conn *ct)
+{
+	struct ct_pcpu *pcpu;
+
+	pcpu = per_cpu_ptr(nf_ct_net(ct)->ct.pcpu_lists, ct->cpu);
+
+	spin_lock_bh(&pcpu->lock);
+	BUG_ON(hlist_nulls_unhashed(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode));
+	hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
+	spin_unlock_bh(&pcpu->lock);
+}
+
+/* Expectations are still protected by nf_conntrack_lock. */
+static void nf_ct_remove_all_expectations(struct nf_conn *ct)
+{
+	/* Most connections never expect any others, skip the lock. */
+	if (!nfct_help(ct))
+		return;
+
+	spin_lock_bh(&nf_conntrack_lock);
+	nf_ct_remove_expectations(ct);
+	spin_unlock_bh(&nf_conntrack_lock);
 }
 
 bool
@@ -166,12 +277,20 @@ EXPORT_SYMBOL_GPL(nf_ct_invert_tuple);
 static void
 clean_from_lists(struct nf_conn *ct)
 {
+	u16 zone = nf_ct_zone(ct);
+	u_int32_t hash, repl_hash;
+
 	pr_debug("clean_from_lists(%p)\n", ct);
+	hash = hash_conntrack_raw(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple, zone);
+	repl_hash = hash_conntrack_raw(&ct->tuplehash[IP_CT_DIR_REPLY].tuple, zone);
+
+	nf_conntrack_double_lock(hash, repl_hash);
 	hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
 	hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_REPLY].hnnode);
+	nf_conntrack_double_unlock(hash, repl_hash);
 
 	/* Destroy all pending expectations */
-	nf_ct_remove_expectations(ct);
+	nf_ct_remove_all_expectations(ct);
 }
 
 static void
@@ -195,21 +314,17 @@ destroy_conntrack(struct nf_conntrack *nfct)
 
 	rcu_read_unlock();
 
-	spin_lock_bh(&nf_conntrack_lock);
 	/* Expectations will have been removed in clean_from_lists,
 	 * except TFTP can create an expectation on the first packet,
 	 * before connection is in the list, so we need to clean here,
 	 * too. */
-	nf_ct_remove_expectations(ct);
+	nf_ct_remove_all_expectations(ct);
 
 	/* We overload first tuple to link into unconfirmed list. */
-	if (!nf_ct_is_confirmed(ct)) {
-		BUG_ON(hlist_nulls_unhashed(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode));
-		hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
-	}
+	if (!nf_ct_is_confirmed(ct))
+		nf_ct_del_from_unconfirmed_list(ct);
 
-	NF_CT_STAT_INC(net, delete);
-	spin_unlock_bh(&nf_conntrack_lock);
+	NF_CT_STAT_INC_ATOMIC(net, delete);
 
 	if (ct->master)
 		nf_ct_put(ct->master);
@@ -223,12 +338,12 @@ void nf_ct_delete_from_lists(struct nf_conn *ct)
 	struct net *net = nf_ct_net(ct);
 
 	nf_ct_helper_destroy(ct);
-	spin_lock_bh(&nf_conntrack_lock);
-	/* Inside lock so preempt is disabled on module removal path.
+	/* BHs are disabled so preempt is disabled on module removal path.
 	 * Otherwise we can get spurious warnings. */
+	local_bh_disable();
 	NF_CT_STAT_INC(net, delete_list);
 	clean_from_lists(ct);
-	spin_unlock_bh(&nf_conntrack_lock);
+	local_bh_enable();
 }
 EXPORT_SYMBOL_GPL(nf_ct_delete_from_lists);
 
@@ -287,25 +402,27 @@ static void death_by_timeout(unsigned long ul_conntrack)
 
 /*
  * Warning :
- * - Caller must take a reference on returned object
+ * - Caller must hold rcu_read_lock, take a reference on returned object
  *   and recheck nf_ct_tuple_equal(tuple, &h->tuple)
- * OR
- * - Caller must lock nf_conntrack_lock before calling this function
  */
 struct nf_conntrack_tuple_hash *
 __nf_conntrack_find(struct net *net, u16 zone,
 		    const struct nf_conntrack_tuple *tuple)
 {
 	struct nf_conntrack_tuple_hash *h;
+	struct hlist_nulls_head *head;
 	struct hlist_nulls_node *n;
-	unsigned int hash = hash_conntrack(net, zone, tuple);
+	u_int32_t hash = hash_conntrack_raw(tuple, zone);
+	unsigned int bucket, seq;
 
 	/* Disable BHs the entire time since we normally need to disable them
 	 * at least once for the stats anyway.
 	 */
 	local_bh_disable();
 begin:
-	hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[hash], hnnode) {
+	seq = read_seqcount_begin(&net->ct.generation);
+	head = nf_conntrack_chain(net, hash, &bucket);
+	hlist_nulls_for_each_entry_rcu(h, n, head, hnnode) {
 		if (nf_ct_tuple_equal(tuple, &h->tuple) &&
 		    nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)) == zone) {
 			NF_CT_STAT_INC(net, found);
@@ -319,7 +436,10 @@ begin:
 	 * not the expected one, we must restart lookup.
 	 * We probably met an item that was moved to another chain.
 	 */
-	if (get_nulls_value(n) != hash)
+	if (get_nulls_value(n) != bucket)
+		goto begin;
+	/* A resize step may have moved the entry while we were looking. */
+	if (read_seqcount_retry(&net->ct.generation, seq))
 		goto begin;
 	local_bh_enable();
 
@@ -358,40 +478,81 @@ begin:
 EXPORT_SYMBOL_GPL(nf_conntrack_find_get);
 
 static void __nf_conntrack_hash_insert(struct nf_conn *ct,
-				       unsigned int hash,
-				       unsigned int repl_hash)
+				       struct hlist_nulls_head *head,
+				       struct hlist_nulls_head *repl_head)
 {
-	struct net *net = nf_ct_net(ct);
-
 	hlist_nulls_add_head_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode,
-			   &net->ct.hash[hash]);
+			   head);
 	hlist_nulls_add_head_rcu(&ct->tuplehash[IP_CT_DIR_REPLY].hnnode,
-			   &net->ct.hash[repl_hash]);
+			   repl_head);
+}
+
+/* Is either tuple of @ct already in the chains?  Stripe locks held. */
+static bool nf_conntrack_clash(struct nf_conn *ct,
+			       struct hlist_nulls_head *head,
+			       struct hlist_nulls_head *repl_head)
+{
+	struct nf_conntrack_tuple_hash *h;
+	struct hlist_nulls_node *n;
+	u16 zone = nf_ct_zone(ct);
+
+	hlist_nulls_for_each_entry(h, n, head, hnnode)
+		if (nf_ct_tuple_equal(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple,
+				      &h->tuple) &&
+		    zone == nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)))
+			return true;
+	hlist_nulls_for_each_entry(h, n, repl_head, hnnode)
+		if (nf_ct_tuple_equal(&ct->tuplehash[IP_CT_DIR_REPLY].tuple,
+				      &h->tuple) &&
+		    zone == nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)))
+			return true;
+	return false;
 }
 
-void nf_conntrack_hash_insert(struct nf_conn *ct)
+/* Insert a conntrack that was built by hand (ctnetlink) into the hash,
+ * unless a conntrack with the same tuples already exists.  The timer is
+ * started on success.
+ */
+int nf_conntrack_hash_check_insert(struct nf_conn *ct)
 {
 	struct net *net = nf_ct_net(ct);
-	unsigned int hash, repl_hash;
+	struct hlist_nulls_head *head, *repl_head;
+	u_int32_t hash, repl_hash;
 	u16 zone;
 
 	zone = nf_ct_zone(ct);
-	hash = hash_conntrack(net, zone, &ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
-	repl_hash = hash_conntrack(net, zone, &ct->tuplehash[IP_CT_DIR_REPLY].tuple);
+	hash = hash_conntrack_raw(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple, zone);
+	repl_hash = hash_conntrack_raw(&ct->tuplehash[IP_CT_DIR_REPLY].tuple, zone);
+
+	local_bh_disable();
+	nf_conntrack_double_lock(hash, repl_hash);
+	head = nf_conntrack_chain_locked(net, hash);
+	repl_head = nf_conntrack_chain_locked(net, repl_hash);
+
+	if (nf_conntrack_clash(ct, head, repl_head)) {
+		NF_CT_STAT_INC(net, insert_failed);
+		nf_conntrack_double_unlock(hash, repl_hash);
+		local_bh_enable();
+		return -EEXIST;
+	}
 
-	__nf_conntrack_hash_insert(ct, hash, repl_hash);
+	add_timer(&ct->timeout);
+	__nf_conntrack_hash_insert(ct, head, repl_head);
+	NF_CT_STAT_INC(net, insert);
+	nf_conntrack_double_unlock(hash, repl_hash);
+	local_bh_enable();
+	return 0;
 }
-EXPORT_SYMBOL_GPL(nf_conntrack_hash_insert);
+EXPORT_SYMBOL_GPL(nf_conntrack_hash_check_insert);
 
 /* Confirm a connection given skb; places it in hash table */
 int
 __nf_conntrack_confirm(struct sk_buff *skb)
 {
-	unsigned int hash, repl_hash;
-	struct nf_conntrack_tuple_hash *h;
+	u_int32_t hash, repl_hash;
+	struct hlist_nulls_head *head, *repl_head;
 	struct nf_conn *ct;
 	struct nf_conn_help *help;
-	struct hlist_nulls_node *n;
 	enum ip_conntrack_info ctinfo;
 	struct net *net;
 	u16 zone;
@@ -407,8 +568,8 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 		return NF_ACCEPT;
 
 	zone = nf_ct_zone(ct);
-	hash = hash_conntrack(net, zone, &ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
-	repl_hash = hash_conntrack(net, zone, &ct->tuplehash[IP_CT_DIR_REPLY].tuple);
+	hash = hash_conntrack_raw(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple, zone);
+	repl_hash = hash_conntrack_raw(&ct->tuplehash[IP_CT_DIR_REPLY].tuple, zone);
 
 	/* We're not in hash table, and we refuse to set up related
 	   connections for unconfirmed conns.  But packet copies and
@@ -420,24 +581,23 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 	NF_CT_ASSERT(!nf_ct_is_confirmed(ct));
 	pr_debug("Confirming conntrack %p\n", ct);
 
-	spin_lock_bh(&nf_conntrack_lock);
+	local_bh_disable();
+	nf_conntrack_double_lock(hash, repl_hash);
+	head = nf_conntrack_chain_locked(net, hash);
+	repl_head = nf_conntrack_chain_locked(net, repl_hash);
+
+	/* A cleanup walk may have killed us while unconfirmed. */
+	if (unlikely(nf_ct_is_dying(ct)))
+		goto out;
 
 	/* See if there's one in the list already, including reverse:
 	   NAT could have grabbed it without realizing, since we're
 	   not in the hash.  If there is, we lost race. */
-	hlist_nulls_for_each_entry(h, n, &net->ct.hash[hash], hnnode)
-		if (nf_ct_tuple_equal(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple,
-				      &h->tuple) &&
-		    zone == nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)))
-			goto out;
-	hlist_nulls_for_each_entry(h, n, &net->ct.hash[repl_hash], hnnode)
-		if (nf_ct_tuple_equal(&ct->tuplehash[IP_CT_DIR_REPLY].tuple,
-				      &h->tuple) &&
-		    zone == nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)))
-			goto out;
+	if (nf_conntrack_clash(ct, head, repl_head))
+		goto out;
 
 	/* Remove from unconfirmed list */
-	hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
+	nf_ct_del_from_unconfirmed_list(ct);
 
 	/* Timer relative to confirmation time, not original
 	   setting time, otherwise we'd get timer wrap in
@@ -452,9 +612,10 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 	 * guarantee that no other CPU can find the conntrack before the above
 	 * stores are visible.
 	 */
-	__nf_conntrack_hash_insert(ct, hash, repl_hash);
+	__nf_conntrack_hash_insert(ct, head, repl_head);
 	NF_CT_STAT_INC(net, insert);
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_conntrack_double_unlock(hash, repl_hash);
+	local_bh_enable();
 
 	help = nfct_help(ct);
 	if (help && help->helper)
@@ -466,7 +627,8 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 
 out:
 	NF_CT_STAT_INC(net, insert_failed);
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_conntrack_double_unlock(hash, repl_hash);
+	local_bh_enable();
 	return NF_DROP;
 }
 EXPORT_SYMBOL_GPL(__nf_conntrack_confirm);
@@ -479,16 +641,21 @@ nf_conntrack_tuple_taken(const struct nf_conntrack_tuple *tuple,
 {
 	struct net *net = nf_ct_net(ignored_conntrack);
 	struct nf_conntrack_tuple_hash *h;
+	struct hlist_nulls_head *head;
 	struct hlist_nulls_node *n;
 	struct nf_conn *ct;
 	u16 zone = nf_ct_zone(ignored_conntrack);
-	unsigned int hash = hash_conntrack(net, zone, tuple);
+	u_int32_t hash = hash_conntrack_raw(tuple, zone);
+	unsigned int bucket, seq;
 
 	/* Disable BHs the entire time since we need to disable them at
 	 * least once for the stats anyway.
 	 */
 	rcu_read_lock_bh();
-	hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[hash], hnnode) {
+begin:
+	seq = read_seqcount_begin(&net->ct.generation);
+	head = nf_conntrack_chain(net, hash, &bucket);
+	hlist_nulls_for_each_entry_rcu(h, n, head, hnnode) {
 		ct = nf_ct_tuplehash_to_ctrack(h);
 		if (ct != ignored_conntrack &&
 		    nf_ct_tuple_equal(tuple, &h->tuple) &&
@@ -499,6 +666,9 @@ nf_conntrack_tuple_taken(const struct nf_conntrack_tuple *tuple,
 		}
 		NF_CT_STAT_INC(net, searched);
 	}
+	if (get_nulls_value(n) != bucket ||
+	    read_seqcount_retry(&net->ct.generation, seq))
+		goto begin;
 	rcu_read_unlock_bh();
 
 	return 0;
@@ -509,19 +679,25 @@ EXPORT_SYMBOL_GPL(nf_conntrack_tuple_taken);
 
 /* There's a small race here where we may free a just-assured
    connection.  Too bad: we're in trouble anyway. */
-static noinline int early_drop(struct net *net, unsigned int hash)
+static noinline int early_drop(struct net *net, u_int32_t raw_hash)
 {
 	/* Use oldest entry, which is roughly LRU */
 	struct nf_conntrack_tuple_hash *h;
 	struct nf_conn *ct = NULL, *tmp;
+	struct hlist_nulls_head *table;
 	struct hlist_nulls_node *n;
-	unsigned int i, cnt = 0;
+	unsigned int i, hash, hsize, cnt = 0;
 	int dropped = 0;
 
 	rcu_read_lock();
-	for (i = 0; i < net->ct.htable_size; i++) {
-		hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[hash],
-					 hnnode) {
+	/* Only the current table is scanned while a resize is running,
+	 * which is good enough for picking a victim.
+	 */
+	nf_conntrack_get_ht(net, &table, &hsize);
+
+	hash = __hash_bucket(raw_hash, hsize);
+	for (i = 0; i < hsize; i++) {
+		hlist_nulls_for_each_entry_rcu(h, n, &table[hash], hnnode) {
 			tmp = nf_ct_tuplehash_to_ctrack(h);
 			if (!test_bit(IPS_ASSURED_BIT, &tmp->status))
 				ct = tmp;
@@ -539,7 +715,7 @@ static noinline int early_drop(struct net *net, unsigned int hash)
 		if (cnt >= NF_CT_EVICTION_RANGE)
 			break;
 
-		hash = (hash + 1) % net->ct.htable_size;
+		hash = (hash + 1) % hsize;
 	}
 	rcu_read_unlock();
 
@@ -573,8 +749,7 @@ struct nf_conn *nf_conntrack_alloc(struct net *net, u16 zone,
 
 	if (nf_conntrack_max &&
 	    unlikely(atomic_read(&net->ct.count) > nf_conntrack_max)) {
-		unsigned int hash = hash_conntrack(net, zone, orig);
-		if (!early_drop(net, hash)) {
+		if (!early_drop(net, hash_conntrack_raw(orig, zone))) {
 			atomic_dec(&net->ct.count);
 			if (net_ratelimit())
 				printk(KERN_WARNING
@@ -687,38 +862,42 @@ init_conntrack(struct net *net, struct nf_conn *tmpl,
 				 ecache ? ecache->expmask : 0,
 			     GFP_ATOMIC);
 
-	spin_lock_bh(&nf_conntrack_lock);
-	exp = nf_ct_find_expectation(net, zone, tuple);
-	if (exp) {
-		pr_debug("conntrack: expectation arrives ct=%p exp=%p\n",
-			 ct, exp);
-		/* Welcome, Mr. Bond.  We've been expecting you... */
-		__set_bit(IPS_EXPECTED_BIT, &ct->status);
-		ct->master = exp->master;
-		if (exp->helper) {
-			help = nf_ct_helper_ext_add(ct, GFP_ATOMIC);
-			if (help)
-				rcu_assign_pointer(help->helper, exp->helper);
-		}
+	exp = NULL;
+	/* Only take the expectation lock if there is anything to find. */
+	if (net->ct.expect_count) {
+		spin_lock_bh(&nf_conntrack_lock);
+		exp = nf_ct_find_expectation(net, zone, tuple);
+		if (exp) {
+			pr_debug("conntrack: expectation arrives ct=%p exp=%p\n",
+				 ct, exp);
+			/* Welcome, Mr. Bond.  We've been expecting you... */
+			__set_bit(IPS_EXPECTED_BIT, &ct->status);
+			ct->master = exp->master;
+			if (exp->helper) {
+				help = nf_ct_helper_ext_add(ct, GFP_ATOMIC);
+				if (help)
+					rcu_assign_pointer(help->helper, exp->helper);
+			}
 
 #ifdef CONFIG_NF_CONNTRACK_MARK
-		ct->mark = exp->master->mark;
+			ct->mark = exp->master->mark;
 #endif
 #ifdef CONFIG_NF_CONNTRACK_SECMARK
-		ct->secmark = exp->master->secmark;
+			ct->secmark = exp->master->secmark;
 #endif
-		nf_conntrack_get(&ct->master->ct_general);
-		NF_CT_STAT_INC(net, expect_new);
-	} else {
+			nf_conntrack_get(&ct->master->ct_general);
+			NF_CT_STAT_INC(net, expect_new);
+		}
+		spin_unlock_bh(&nf_conntrack_lock);
+	}
+
+	if (!exp) {
 		__nf_ct_try_assign_helper(ct, tmpl, GFP_ATOMIC);
-		NF_CT_STAT_INC(net, new);
+		NF_CT_STAT_INC_ATOMIC(net, new);
 	}
 
 	/* Overload tuple linked list to put us in unconfirmed list. */
-	hlist_nulls_add_head_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode,
-		       &net->ct.unconfirmed);
-
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_ct_add_to_unconfirmed_list(ct);
 
 	if (exp) {
 		if (exp->expectfn)
@@ -1072,25 +1251,37 @@ get_next_corpse(struct net *net, int (*iter)(struct nf_conn *i, void *data),
 	struct nf_conntrack_tuple_hash *h;
 	struct nf_conn *ct;
 	struct hlist_nulls_node *n;
+	struct ct_pcpu *pcpu;
+	spinlock_t *lockp;
+	int cpu;
 
-	spin_lock_bh(&nf_conntrack_lock);
+	/* Caller holds nf_conntrack_resize_mutex, the table is stable. */
 	for (; *bucket < net->ct.htable_size; (*bucket)++) {
+		lockp = nf_conntrack_bucket_lock(net, *bucket);
+		spin_lock_bh(lockp);
 		hlist_nulls_for_each_entry(h, n, &net->ct.hash[*bucket], hnnode) {
 			ct = nf_ct_tuplehash_to_ctrack(h);
 			if (iter(ct, data))
 				goto found;
 		}
+		spin_unlock_bh(lockp);
 	}
-	hlist_nulls_for_each_entry(h, n, &net->ct.unconfirmed, hnnode) {
-		ct = nf_ct_tuplehash_to_ctrack(h);
-		if (iter(ct, data))
-			set_bit(IPS_DYING_BIT, &ct->status);
+
+	for_each_possible_cpu(cpu) {
+		pcpu = per_cpu_ptr(net->ct.pcpu_lists, cpu);
+
+		spin_lock_bh(&pcpu->lock);
+		hlist_nulls_for_each_entry(h, n, &pcpu->unconfirmed, hnnode) {
+			ct = nf_ct_tuplehash_to_ctrack(h);
+			if (iter(ct, data))
+				set_bit(IPS_DYING_BIT, &ct->status);
+		}
+		spin_unlock_bh(&pcpu->lock);
 	}
-	spin_unlock_bh(&nf_conntrack_lock);
 	return NULL;
 found:
 	atomic_inc(&ct->ct_general.use);
-	spin_unlock_bh(&nf_conntrack_lock);
+	spin_unlock_bh(lockp);
 	return ct;
 }
 
@@ -1101,6 +1292,7 @@ void nf_ct_iterate_cleanup(struct net *net,
 	struct nf_conn *ct;
 	unsigned int bucket = 0;
 
+	mutex_lock(&nf_conntrack_resize_mutex);
 	while ((ct = get_next_corpse(net, iter, data, &bucket)) != NULL) {
 		/* Time to push up daises... */
 		if (del_timer(&ct->timeout))
@@ -1109,6 +1301,7 @@ void nf_ct_iterate_cleanup(struct net *net,
 
 		nf_ct_put(ct);
 	}
+	mutex_unlock(&nf_conntrack_resize_mutex);
 }
 EXPORT_SYMBOL_GPL(nf_ct_iterate_cleanup);
 
@@ -1202,6 +1395,7 @@ static void nf_conntrack_cleanup_net(struct net *net)
 	kmem_cache_destroy(net->ct.nf_conntrack_cachep);
 	kfree(net->ct.slabname);
 	free_percpu(net->ct.stat);
+	free_percpu(net->ct.pcpu_lists);
 }
 
 /* Mishearing the voices in his head, our hero wonders how he's
@@ -1251,59 +1445,113 @@ void *nf_ct_alloc_hashtable(unsigned int *sizep, int *vmalloced, int nulls)
 }
 EXPORT_SYMBOL_GPL(nf_ct_alloc_hashtable);
 
-int nf_conntrack_set_hashsize(const char *val, struct kernel_param *kp)
+/*
+ * Move every entry of one lock stripe from the old table into the new one.
+ * Both tables are sized in multiples of CONNTRACK_LOCKS, so a stripe covers
+ * a contiguous range of buckets in each of them and its lock is all that is
+ * needed; inserts and deletes on other stripes keep running meanwhile.
+ */
+static void nf_conntrack_migrate_stripe(struct net *net, unsigned int stripe)
 {
-	int i, bucket, vmalloced, old_vmalloced;
-	unsigned int hashsize, old_size;
-	struct hlist_nulls_head *hash, *old_hash;
+	unsigned int per_stripe = net->ct.old_htable_size / CONNTRACK_LOCKS;
+	struct hlist_nulls_head *old_hash = net->ct.old_hash;
 	struct nf_conntrack_tuple_hash *h;
 	struct nf_conn *ct;
+	unsigned int i, bucket;
 
-	if (current->nsproxy->net_ns != &init_net)
-		return -EOPNOTSUPP;
+	spin_lock_bh(&nf_conntrack_locks[stripe]);
+	write_seqcount_begin(&net->ct.generation);
+	for (i = stripe * per_stripe; i < (stripe + 1) * per_stripe; i++) {
+		while (!hlist_nulls_empty(&old_hash[i])) {
+			h = hlist_nulls_entry(old_hash[i].first,
+					struct nf_conntrack_tuple_hash, hnnode);
+			ct = nf_ct_tuplehash_to_ctrack(h);
+			hlist_nulls_del_rcu(&h->hnnode);
+			bucket = __hash_bucket(hash_conntrack_raw(&h->tuple,
+							nf_ct_zone(ct)),
+					       net->ct.htable_size);
+			hlist_nulls_add_head_rcu(&h->hnnode,
+						 &net->ct.hash[bucket]);
+		}
+	}
+	net->ct.resize_stripe = stripe + 1;
+	write_seqcount_end(&net->ct.generation);
+	spin_unlock_bh(&nf_conntrack_locks[stripe]);
+}
 
-	/* On boot, we can set this without any fancy locking. */
-	if (!nf_conntrack_htable_size)
-		return param_set_uint(val, kp);
+/*
+ * Resize the conntrack hash of @net without flushing it and without
+ * stopping packet processing: the new table is published first, then the
+ * entries are moved over one lock stripe at a time.  Lookups never block;
+ * a lookup that misses while a stripe is being moved is retried.
+ */
+int nf_conntrack_hash_resize(struct net *net, unsigned int hashsize)
+{
+	struct hlist_nulls_head *hash, *old_hash;
+	unsigned int old_size, stripe;
+	int vmalloced, old_vmalloced;
 
-	hashsize = simple_strtoul(val, NULL, 0);
 	if (!hashsize)
 		return -EINVAL;
 
+	hashsize = roundup(hashsize, CONNTRACK_LOCKS);
 	hash = nf_ct_alloc_hashtable(&hashsize, &vmalloced, 1);
 	if (!hash)
 		return -ENOMEM;
 
-	/* Lookups in the old hash might happen in parallel, which means we
-	 * might get false negatives during connection lookup. New connections
-	 * created because of a false negative won't make it into the hash
-	 * though since that required taking the lock.
-	 */
-	spin_lock_bh(&nf_conntrack_lock);
-	for (i = 0; i < init_net.ct.htable_size; i++) {
-		while (!hlist_nulls_empty(&init_net.ct.hash[i])) {
-			h = hlist_nulls_entry(init_net.ct.hash[i].first,
-					struct nf_conntrack_tuple_hash, hnnode);
-			ct = nf_ct_tuplehash_to_ctrack(h);
-			hlist_nulls_del_rcu(&h->hnnode);
-			bucket = __hash_conntrack(&h->tuple, nf_ct_zone(ct),
-						  hashsize,
-						  nf_conntrack_hash_rnd);
-			hlist_nulls_add_head_rcu(&h->hnnode, &hash[bucket]);
-		}
+	mutex_lock(&nf_conntrack_resize_mutex);
+	old_size = net->ct.htable_size;
+	old_vmalloced = net->ct.hash_vmalloc;
+	old_hash = net->ct.hash;
+
+	local_bh_disable();
+	write_seqcount_begin(&net->ct.generation);
+	net->ct.old_htable_size = old_size;
+	net->ct.resize_stripe = 0;
+	rcu_assign_pointer(net->ct.old_hash, old_hash);
+	/* Table walkers pick both up with nf_conntrack_get_ht() */
+	rcu_assign_pointer(net->ct.hash, hash);
+	net->ct.htable_size = hashsize;
+	net->ct.hash_vmalloc = vmalloced;
+	write_seqcount_end(&net->ct.generation);
+	local_bh_enable();
+
+	for (stripe = 0; stripe < CONNTRACK_LOCKS; stripe++) {
+		nf_conntrack_migrate_stripe(net, stripe);
+		cond_resched();
 	}
-	old_size = init_net.ct.htable_size;
-	old_vmalloced = init_net.ct.hash_vmalloc;
-	old_hash = init_net.ct.hash;
 
-	init_net.ct.htable_size = nf_conntrack_htable_size = hashsize;
-	init_net.ct.hash_vmalloc = vmalloced;
-	init_net.ct.hash = hash;
-	spin_unlock_bh(&nf_conntrack_lock);
+	local_bh_disable();
+	write_seqcount_begin(&net->ct.generation);
+	rcu_assign_pointer(net->ct.old_hash, NULL);
+	write_seqcount_end(&net->ct.generation);
+	local_bh_enable();
+
+	if (net_eq(net, &init_net))
+		nf_conntrack_htable_size = hashsize;
+	mutex_unlock(&nf_conntrack_resize_mutex);
 
+	/* Wait for lockless readers still walking the old table */
+	synchronize_net();
 	nf_ct_free_hashtable(old_hash, old_vmalloced, old_size);
 	return 0;
 }
+EXPORT_SYMBOL_GPL(nf_conntrack_hash_resize);
+
+int nf_conntrack_set_hashsize(const char *val, struct kernel_param *kp)
+{
+	unsigned int hashsize;
+
+	if (current->nsproxy->net_ns != &init_net)
+		return -EOPNOTSUPP;
+
+	/* On boot, we can set this without any fancy locking. */
+	if (!nf_conntrack_htable_size)
+		return param_set_uint(val, kp);
+
+	hashsize = simple_strtoul(val, NULL, 0);
+	return nf_conntrack_hash_resize(&init_net, hashsize);
+}
 EXPORT_SYMBOL_GPL(nf_conntrack_set_hashsize);
 
 module_param_call(hashsize, nf_conntrack_set_hashsize, param_get_uint,
@@ -1312,7 +1560,7 @@ module_param_call(hashsize, nf_conntrack_set_hashsize, param_get_uint,
 static int nf_conntrack_init_init_net(void)
 {
 	int max_factor = 8;
-	int ret;
+	int ret, i;
 
 	/* Idea from tcp.c: use 1/16384 of memory.  On i386: 32MB
 	 * machine has 512 buckets. >= 1GB machines have 16384 buckets. */
@@ -1333,6 +1581,12 @@ static int nf_conntrack_init_init_net(void)
 	}
 	nf_conntrack_max = max_factor * nf_conntrack_htable_size;
 
+	/* Every stripe lock must cover a whole number of buckets */
+	nf_conntrack_htable_size = roundup(nf_conntrack_htable_size,
+					   CONNTRACK_LOCKS);
+	for (i = 0; i < CONNTRACK_LOCKS; i++)
+		spin_lock_init(&nf_conntrack_locks[i]);
+
 	printk("nf_conntrack version %s (%u buckets, %d max)\n",
 	       NF_CONNTRACK_VERSION, nf_conntrack_htable_size,
 	       nf_conntrack_max);
@@ -1378,11 +1632,23 @@ err_proto:
 
 static int nf_conntrack_init_net(struct net *net)
 {
-	int ret;
+	int ret, cpu;
 
 	atomic_set(&net->ct.count, 0);
-	INIT_HLIST_NULLS_HEAD(&net->ct.unconfirmed, UNCONFIRMED_NULLS_VAL);
+	seqcount_init(&net->ct.generation);
 	INIT_HLIST_NULLS_HEAD(&net->ct.dying, DYING_NULLS_VAL);
+	net->ct.pcpu_lists = alloc_percpu(struct ct_pcpu);
+	if (!net->ct.pcpu_lists) {
+		ret = -ENOMEM;
+		goto err_pcpu_lists;
+	}
+	for_each_possible_cpu(cpu) {
+		struct ct_pcpu *pcpu = per_cpu_ptr(net->ct.pcpu_lists, cpu);
+
+		spin_lock_init(&pcpu->lock);
+		INIT_HLIST_NULLS_HEAD(&pcpu->unconfirmed, UNCONFIRMED_NULLS_VAL);
+	}
+
 	net->ct.stat = alloc_percpu(struct ip_conntrack_stat);
 	if (!net->ct.stat) {
 		ret = -ENOMEM;
@@ -1438,6 +1704,8 @@ err_cache:
 err_slabname:
 	free_percpu(net->ct.stat);
 err_stat:
+	free_percpu(net->ct.pcpu_lists);
+err_pcpu_lists:
 	return ret;
 }
 
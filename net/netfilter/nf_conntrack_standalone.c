@@ -50,12 +50,15 @@ static struct hlist_nulls_node *ct_get_first(struct seq_file *seq)
 {
 	struct net *net = seq_file_net(seq);
 	struct ct_iter_state *st = seq->private;
+	struct hlist_nulls_head *hash;
 	struct hlist_nulls_node *n;
+	unsigned int hsize;
 
+	nf_conntrack_get_ht(net, &hash, &hsize);
 	for (st->bucket = 0;
-	     st->bucket < net->ct.htable_size;
+	     st->bucket < hsize;
 	     st->bucket++) {
-		n = rcu_dereference(net->ct.hash[st->bucket].first);
+		n = rcu_dereference(hash[st->bucket].first);
 		if (!is_a_nulls(n))
 			return n;
 	}
@@ -67,14 +70,17 @@ static struct hlist_nulls_node *ct_get_next(struct seq_file *seq,
 {
 	struct net *net = seq_file_net(seq);
 	struct ct_iter_state *st = seq->private;
+	struct hlist_nulls_head *hash;
+	unsigned int hsize;
 
 	head = rcu_dereference(head->next);
 	while (is_a_nulls(head)) {
-		if (likely(get_nulls_value(head) == st->bucket)) {
-			if (++st->bucket >= net->ct.htable_size)
-				return NULL;
-		}
-		head = rcu_dereference(net->ct.hash[st->bucket].first);
+		nf_conntrack_get_ht(net, &hash, &hsize);
+		if (likely(get_nulls_value(head) == st->bucket))
+			st->bucket++;
+		if (st->bucket >= hsize)
+			return NULL;
+		head = rcu_dereference(hash[st->bucket].first);
 	}
 	return head;
 }
@@ -345,6 +351,27 @@ static int log_invalid_proto_max = 255;
 
 static struct ctl_table_header *nf_ct_netfilter_header;
 
+/* Writing nf_conntrack_buckets resizes the hash of that namespace online */
+static int nf_conntrack_buckets_sysctl(ctl_table *table, int write,
+				       void __user *buffer, size_t *lenp,
+				       loff_t *ppos)
+{
+	struct net *net = container_of(table->data, struct net,
+				       ct.htable_size);
+	ctl_table tmp = *table;
+	int size = net->ct.htable_size;
+	int ret;
+
+	tmp.data = &size;
+	ret = proc_dointvec(&tmp, write, buffer, lenp, ppos);
+	if (ret || !write)
+		return ret;
+
+	if (size <= 0)
+		return -EINVAL;
+	return nf_conntrack_hash_resize(net, size);
+}
+
 static ctl_table nf_ct_sysctl_table[] = {
 	{
 		.procname	= "nf_conntrack_max",
@@ -364,8 +391,8 @@ static ctl_table nf_ct_sysctl_table[] = {
 		.procname       = "nf_conntrack_buckets",
 		.data           = &init_net.ct.htable_size,
 		.maxlen         = sizeof(unsigned int),
-		.mode           = 0444,
-		.proc_handler   = proc_dointvec,
+		.mode           = 0644,
+		.proc_handler   = nf_conntrack_buckets_sysctl,
 	},
 	{
 		.procname	= "nf_conntrack_checksum",
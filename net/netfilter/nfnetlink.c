@@ -155,7 +155,7 @@ replay:
 	}
 
 	nc = nfnetlink_find_client(type, ss);
-	if (!nc)
+	if (!nc || !nc->call)
 		return -EINVAL;
 
 	{
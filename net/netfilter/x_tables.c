@@ -14,6 +14,7 @@
  */
 
 #include <linux/kernel.h>
+#include <linux/module.h>
 #include <linux/socket.h>
 #include <linux/net.h>
 #include <linux/proc_fs.h>
@@ -621,34 +622,33 @@ EXPORT_SYMBOL_GPL(xt_compat_target_to_user);
 struct xt_table_info *xt_alloc_table_info(unsigned int size)
 {
 	struct xt_table_info *newinfo;
-	int cpu;
 
 	/* Pedantry: prevent them from hitting BUG() in vmalloc.c --RR */
 	if ((SMP_ALIGN(size) >> PAGE_SHIFT) + 2 > totalram_pages)
 		return NULL;
 
-	newinfo = kzalloc(XT_TABLE_INFO_SZ, GFP_KERNEL);
+	newinfo = kzalloc(sizeof(*newinfo), GFP_KERNEL);
 	if (!newinfo)
 		return NULL;
 
 	newinfo->size = size;
 
-	for_each_possible_cpu(cpu) {
-		if (size <= PAGE_SIZE)
-			newinfo->entries[cpu] = kmalloc_node(size,
-							GFP_KERNEL,
-							cpu_to_node(cpu));
-		else
-			newinfo->entries[cpu] = vmalloc_node(size,
-							cpu_to_node(cpu));
+	newinfo->stackptr = alloc_percpu(unsigned int);
+	if (newinfo->stackptr == NULL)
+		goto err;
 
-		if (newinfo->entries[cpu] == NULL) {
-			xt_free_table_info(newinfo);
-			return NULL;
-		}
-	}
+	if (size <= PAGE_SIZE)
+		newinfo->entries = kmalloc(size, GFP_KERNEL);
+	else
+		newinfo->entries = vmalloc(size);
+	if (newinfo->entries == NULL)
+		goto err;
 
 	return newinfo;
+
+err:
+	xt_free_table_info(newinfo);
+	return NULL;
 }
 EXPORT_SYMBOL(xt_alloc_table_info);
 
@@ -656,12 +656,26 @@ void xt_free_table_info(struct xt_table_info *info)
 {
 	int cpu;
 
-	for_each_possible_cpu(cpu) {
-		if (info->size <= PAGE_SIZE)
-			kfree(info->entries[cpu]);
+	if (info->size <= PAGE_SIZE)
+		kfree(info->entries);
+	else
+		vfree(info->entries);
+
+	if (info->jumpstack != NULL) {
+		if (sizeof(void *) * info->stacksize > PAGE_SIZE) {
+			for_each_possible_cpu(cpu)
+				vfree(info->jumpstack[cpu]);
+		} else {
+			for_each_possible_cpu(cpu)
+				kfree(info->jumpstack[cpu]);
+		}
+		if (sizeof(void **) * nr_cpu_ids > PAGE_SIZE)
+			vfree(info->jumpstack);
 		else
-			vfree(info->entries[cpu]);
+			kfree(info->jumpstack);
 	}
+
+	free_percpu(info->stackptr);
 	kfree(info);
 }
 EXPORT_SYMBOL(xt_free_table_info);
@@ -703,8 +717,51 @@ void xt_compat_unlock(u_int8_t af)
 EXPORT_SYMBOL_GPL(xt_compat_unlock);
 #endif
 
-DEFINE_PER_CPU(struct xt_info_lock, xt_info_locks);
-EXPORT_PER_CPU_SYMBOL_GPL(xt_info_locks);
+DEFINE_PER_CPU(seqcount_t, xt_recseq);
+EXPORT_PER_CPU_SYMBOL_GPL(xt_recseq);
+
+/*
+ * The rule blob is shared by all CPUs and read-only once loaded, so
+ * the chain return addresses of a table walk live in a per-cpu stack.
+ * Re-entering the same table on one CPU (a target emitting a packet that
+ * goes through this table again) needs room for another walk, hence the
+ * multiplier.
+ */
+static unsigned int xt_jumpstack_multiplier = 2;
+module_param(xt_jumpstack_multiplier, uint, 0);
+
+static int xt_jumpstack_alloc(struct xt_table_info *i)
+{
+	unsigned int size;
+	int cpu;
+
+	size = sizeof(void **) * nr_cpu_ids;
+	if (size > PAGE_SIZE) {
+		i->jumpstack = vmalloc(size);
+		if (i->jumpstack != NULL)
+			memset(i->jumpstack, 0, size);
+	} else {
+		i->jumpstack = kzalloc(size, GFP_KERNEL);
+	}
+	if (i->jumpstack == NULL)
+		return -ENOMEM;
+
+	i->stacksize *= xt_jumpstack_multiplier;
+	size = sizeof(void *) * i->stacksize;
+	for_each_possible_cpu(cpu) {
+		if (size > PAGE_SIZE)
+			i->jumpstack[cpu] = vmalloc_node(size,
+							 cpu_to_node(cpu));
+		else
+			i->jumpstack[cpu] = kmalloc_node(size, GFP_KERNEL,
+							 cpu_to_node(cpu));
+		if (i->jumpstack[cpu] == NULL)
+			/* Freeing will be done later on by the callers. */
+			return -ENOMEM;
+	}
+
+	return 0;
+}
 
 
 struct xt_table_info *
@@ -714,6 +771,14 @@ xt_replace_table(struct xt_table *table,
 	      int *error)
 {
 	struct xt_table_info *private;
+	unsigned int cpu;
+	int ret;
+
+	ret = xt_jumpstack_alloc(newinfo);
+	if (ret < 0) {
+		*error = ret;
+		return NULL;
+	}
 
 	/* Do the substitution. */
 	local_bh_disable();
@@ -728,16 +793,30 @@ xt_replace_table(struct xt_table *table,
 		return NULL;
 	}
 
-	table->private = newinfo;
 	newinfo->initial_entries = private->initial_entries;
+	/* Contents of newinfo must be visible before it is published. */
+	smp_wmb();
+	table->private = newinfo;
+	local_bh_enable();
 
 	/*
-	 * Even though table entries have now been swapped, other CPU's
-	 * may still be using the old entries. This is okay, because
-	 * resynchronization happens because of the locking done
-	 * during the get_counters() routine.
+	 * Even though table entries have now been swapped, other CPUs
+	 * may still be walking the old entries: wait until each of them
+	 * has left the table walk it was in, so the caller can read the
+	 * final counters and free the old table.
 	 */
-	local_bh_enable();
+	smp_mb();
+	for_each_possible_cpu(cpu) {
+		seqcount_t *s = &per_cpu(xt_recseq, cpu);
+		unsigned int seq = ACCESS_ONCE(s->sequence);
+
+		if (seq & 1) {
+			do {
+				cond_resched();
+				cpu_relax();
+			} while (seq == ACCESS_ONCE(s->sequence));
+		}
+	}
 
 	return private;
 }
@@ -1242,11 +1321,8 @@ static int __init xt_init(void)
 	unsigned int i;
 	int rv;
 
-	for_each_possible_cpu(i) {
-		struct xt_info_lock *lock = &per_cpu(xt_info_locks, i);
-		spin_lock_init(&lock->lock);
-		lock->readers = 0;
-	}
+	for_each_possible_cpu(i)
+		seqcount_init(&per_cpu(xt_recseq, i));
 
 	xt = kmalloc(sizeof(struct xt_af) * NFPROTO_NUMPROTO, GFP_KERNEL);
 	if (!xt)
@@ -864,7 +864,7 @@ static void xs_udp_data_ready(struct sock *sk, int len)
  out_unlock:
 	spin_unlock(&xprt->transport_lock);
  dropit:
-	skb_free_datagram(sk, skb);
+	consume_skb(skb);
  out:
 	read_unlock(&sk->sk_callback_lock);
 }
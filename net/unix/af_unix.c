@@ -98,6 +98,9 @@
 #include <linux/in.h>
 #include <linux/fs.h>
 #include <linux/slab.h>
+#include <linux/hash.h>
+#include <linux/splice.h>
+#include <linux/pipe_fs_i.h>
 #include <asm/uaccess.h>
 #include <linux/skbuff.h>
 #include <linux/netdevice.h>
@@ -115,11 +118,23 @@
 #include <net/checksum.h>
 #include <linux/security.h>
 
-static struct hlist_head unix_socket_table[UNIX_HASH_SIZE + 1];
-static DEFINE_SPINLOCK(unix_table_lock);
+/*
+ * Bound sockets hash into the first UNIX_HASH_SIZE buckets, abstract ones
+ * by name and type, filesystem ones by inode. Unbound sockets, which
+ * includes the server side of accepted connections, are spread over the
+ * second half by address so that creating sockets does not serialise on
+ * a single chain. sk->sk_hash records the bucket a socket sits in.
+ */
+#define UNIX_HASH_TABLE_SIZE	(2 * UNIX_HASH_SIZE)
+
+static struct hlist_head unix_socket_table[UNIX_HASH_TABLE_SIZE];
+static spinlock_t unix_table_locks[UNIX_HASH_TABLE_SIZE];
 static atomic_t unix_nr_socks = ATOMIC_INIT(0);
 
-#define unix_sockets_unbound	(&unix_socket_table[UNIX_HASH_SIZE])
+static inline unsigned int unix_unbound_hash(struct sock *sk)
+{
+	return UNIX_HASH_SIZE + hash_ptr(sk, UNIX_HASH_BITS);
+}
 
 #define UNIX_ABSTRACT(sk)	(unix_sk(sk)->addr->hash != UNIX_HASH_SIZE)
 
@@ -143,7 +158,9 @@ static inline void unix_set_secdata(struct scm_cookie *scm, struct sk_buff *skb)
 
 /*
  *  SMP locking strategy:
- *    hash table is protected with spinlock unix_table_lock
+ *    each hash chain is protected by its own spinlock in unix_table_locks;
+ *    a socket moving between chains on bind holds both, the lower one
+ *    first.
  *    each socket state is protected by separate spin lock.
  */
 
@@ -172,6 +189,11 @@ static inline int unix_recvq_full(struct sock const *sk)
 	return skb_queue_len(&sk->sk_receive_queue) > sk->sk_max_ack_backlog;
 }
 
+static inline unsigned int unix_skb_len(const struct sk_buff *skb)
+{
+	return skb->len - UNIXCB(skb).consumed;
+}
+
 static struct sock *unix_peer_get(struct sock *s)
 {
 	struct sock *peer;
@@ -220,29 +242,48 @@ static int unix_mkname(struct sockaddr_un *sunaddr, int len, unsigned *hashp)
 	return len;
 }
 
+static void unix_table_double_lock(unsigned int hash1, unsigned int hash2)
+{
+	/* One of them is always an unbound chain and the other a bound one */
+	if (hash1 > hash2)
+		swap(hash1, hash2);
+
+	spin_lock(&unix_table_locks[hash1]);
+	spin_lock_nested(&unix_table_locks[hash2], SINGLE_DEPTH_NESTING);
+}
+
+static void unix_table_double_unlock(unsigned int hash1, unsigned int hash2)
+{
+	spin_unlock(&unix_table_locks[hash1]);
+	spin_unlock(&unix_table_locks[hash2]);
+}
+
 static void __unix_remove_socket(struct sock *sk)
 {
 	sk_del_node_init(sk);
 }
 
-static void __unix_insert_socket(struct hlist_head *list, struct sock *sk)
+static void __unix_insert_socket(unsigned int hash, struct sock *sk)
 {
 	WARN_ON(!sk_unhashed(sk));
-	sk_add_node(sk, list);
+	sk->sk_hash = hash;
+	sk_add_node(sk, &unix_socket_table[hash]);
 }
 
 static inline void unix_remove_socket(struct sock *sk)
 {
-	spin_lock(&unix_table_lock);
+	spinlock_t *lock = &unix_table_locks[sk->sk_hash];
+
+	spin_lock(lock);
 	__unix_remove_socket(sk);
-	spin_unlock(&unix_table_lock);
+	spin_unlock(lock);
 }
 
-static inline void unix_insert_socket(struct hlist_head *list, struct sock *sk)
+static inline void unix_insert_socket(unsigned int hash, struct sock *sk)
 {
-	spin_lock(&unix_table_lock);
-	__unix_insert_socket(list, sk);
-	spin_unlock(&unix_table_lock);
+	spin_lock(&unix_table_locks[hash]);
+	__unix_insert_socket(hash, sk);
+	spin_unlock(&unix_table_locks[hash]);
 }
 
 static struct sock *__unix_find_socket_byname(struct net *net,
@@ -272,24 +313,25 @@ static inline struct sock *unix_find_socket_byname(struct net *net,
 						   int len, int type,
 						   unsigned hash)
 {
+	spinlock_t *lock = &unix_table_locks[hash ^ type];
 	struct sock *s;
 
-	spin_lock(&unix_table_lock);
+	spin_lock(lock);
 	s = __unix_find_socket_byname(net, sunname, len, type, hash);
 	if (s)
 		sock_hold(s);
-	spin_unlock(&unix_table_lock);
+	spin_unlock(lock);
 	return s;
 }
 
 static struct sock *unix_find_socket_byinode(struct net *net, struct inode *i)
 {
+	unsigned int hash = i->i_ino & (UNIX_HASH_SIZE - 1);
 	struct sock *s;
 	struct hlist_node *node;
 
-	spin_lock(&unix_table_lock);
-	sk_for_each(s, node,
-		    &unix_socket_table[i->i_ino & (UNIX_HASH_SIZE - 1)]) {
+	spin_lock(&unix_table_locks[hash]);
+	sk_for_each(s, node, &unix_socket_table[hash]) {
 		struct dentry *dentry = unix_sk(s)->dentry;
 
 		if (!net_eq(sock_net(s), net))
@@ -302,7 +344,7 @@ static struct sock *unix_find_socket_byinode(struct net *net, struct inode *i)
 	}
 	s = NULL;
 found:
-	spin_unlock(&unix_table_lock);
+	spin_unlock(&unix_table_locks[hash]);
 	return s;
 }
 
@@ -360,6 +402,12 @@ static void unix_sock_destructor(struct sock *sk)
 	if (u->addr)
 		unix_release_addr(u->addr);
 
+	/* Left over by splice copying linear data out to a pipe */
+	if (sk->sk_sndmsg_page) {
+		__free_page(sk->sk_sndmsg_page);
+		sk->sk_sndmsg_page = NULL;
+	}
+
 	atomic_dec(&unix_nr_socks);
 	local_bh_disable();
 	sock_prot_inuse_add(sock_net(sk), sk->sk_prot, -1);
@@ -495,6 +543,11 @@ static int unix_stream_sendmsg(struct kiocb *, struct socket *,
 			       struct msghdr *, size_t);
 static int unix_stream_recvmsg(struct kiocb *, struct socket *,
 			       struct msghdr *, size_t, int);
+static ssize_t unix_stream_sendpage(struct socket *, struct page *, int offset,
+				    size_t size, int flags);
+static ssize_t unix_stream_splice_read(struct socket *, loff_t *ppos,
+				       struct pipe_inode_info *, size_t size,
+				       unsigned int flags);
 static int unix_dgram_sendmsg(struct kiocb *, struct socket *,
 			      struct msghdr *, size_t);
 static int unix_dgram_recvmsg(struct kiocb *, struct socket *,
@@ -522,7 +575,8 @@ static const struct proto_ops unix_stream_ops = {
 	.sendmsg =	unix_stream_sendmsg,
 	.recvmsg =	unix_stream_recvmsg,
 	.mmap =		sock_no_mmap,
-	.sendpage =	sock_no_sendpage,
+	.sendpage =	unix_stream_sendpage,
+	.splice_read =	unix_stream_splice_read,
 };
 
 static const struct proto_ops unix_dgram_ops = {
@@ -609,7 +663,7 @@ static struct sock *unix_create1(struct net *net, struct socket *sock)
 	INIT_LIST_HEAD(&u->link);
 	mutex_init(&u->readlock); /* single task reading lock */
 	init_waitqueue_head(&u->peer_wait);
-	unix_insert_socket(unix_sockets_unbound, sk);
+	unix_insert_socket(unix_unbound_hash(sk), sk);
 out:
 	if (sk == NULL)
 		atomic_dec(&unix_nr_socks);
@@ -669,8 +723,10 @@ static int unix_autobind(struct socket *sock)
 	struct sock *sk = sock->sk;
 	struct net *net = sock_net(sk);
 	struct unix_sock *u = unix_sk(sk);
-	static u32 ordernum = 1;
+	static atomic_t ordernum = ATOMIC_INIT(0);
+	u32 num;
 	struct unix_address *addr;
+	unsigned int new_hash, old_hash = sk->sk_hash;
 	int err;
 
 	mutex_lock(&u->readlock);
@@ -688,26 +744,28 @@ static int unix_autobind(struct socket *sock)
 	atomic_set(&addr->refcnt, 1);
 
 retry:
-	addr->len = sprintf(addr->name->sun_path+1, "%05x", ordernum) + 1 + sizeof(short);
+	/* Autobinds on other chains run concurrently with this one */
+	num = atomic_inc_return(&ordernum) & 0xFFFFF;
+	addr->len = sprintf(addr->name->sun_path+1, "%05x", num) + 1 + sizeof(short);
 	addr->hash = unix_hash_fold(csum_partial(addr->name, addr->len, 0));
 
-	spin_lock(&unix_table_lock);
-	ordernum = (ordernum+1)&0xFFFFF;
+	new_hash = addr->hash ^ sk->sk_type;
+	unix_table_double_lock(old_hash, new_hash);
 
 	if (__unix_find_socket_byname(net, addr->name, addr->len, sock->type,
 				      addr->hash)) {
-		spin_unlock(&unix_table_lock);
+		unix_table_double_unlock(old_hash, new_hash);
 		/* Sanity yield. It is unusual case, but yet... */
-		if (!(ordernum&0xFF))
+		if (!(num&0xFF))
 			yield();
 		goto retry;
 	}
-	addr->hash ^= sk->sk_type;
+	addr->hash = new_hash;
 
 	__unix_remove_socket(sk);
 	u->addr = addr;
-	__unix_insert_socket(&unix_socket_table[addr->hash], sk);
-	spin_unlock(&unix_table_lock);
+	__unix_insert_socket(new_hash, sk);
+	unix_table_double_unlock(old_hash, new_hash);
 	err = 0;
 
 out:	mutex_unlock(&u->readlock);
@@ -781,7 +839,7 @@ static int unix_bind(struct socket *sock, struct sockaddr *uaddr, int addr_len)
 	int err;
 	unsigned hash;
 	struct unix_address *addr;
-	struct hlist_head *list;
+	unsigned int new_hash, old_hash = sk->sk_hash;
 
 	err = -EINVAL;
 	if (sunaddr->sun_family != AF_UNIX)
@@ -852,7 +910,12 @@ out_mknod_drop_write:
 		addr->hash = UNIX_HASH_SIZE;
 	}
 
-	spin_lock(&unix_table_lock);
+	if (!sunaddr->sun_path[0])
+		new_hash = addr->hash;
+	else
+		new_hash = dentry->d_inode->i_ino & (UNIX_HASH_SIZE-1);
+
+	unix_table_double_lock(old_hash, new_hash);
 
 	if (!sunaddr->sun_path[0]) {
 		err = -EADDRINUSE;
@@ -861,10 +924,7 @@ out_mknod_drop_write:
 			unix_release_addr(addr);
 			goto out_unlock;
 		}
-
-		list = &unix_socket_table[addr->hash];
 	} else {
-		list = &unix_socket_table[dentry->d_inode->i_ino & (UNIX_HASH_SIZE-1)];
 		u->dentry = nd.path.dentry;
 		u->mnt    = nd.path.mnt;
 	}
@@ -872,10 +932,10 @@ out_mknod_drop_write:
 	err = 0;
 	__unix_remove_socket(sk);
 	u->addr = addr;
-	__unix_insert_socket(list, sk);
+	__unix_insert_socket(new_hash, sk);
 
 out_unlock:
-	spin_unlock(&unix_table_lock);
+	unix_table_double_unlock(old_hash, new_hash);
 out_up:
 	mutex_unlock(&u->readlock);
 out:
@@ -1612,6 +1672,63 @@ out_err:
 	return sent ? : err;
 }
 
+/*
+ * The page is queued to the peer as a fragment of an skb of its own, so
+ * it is never copied on the way; the peer reads it like any other data.
+ */
+static ssize_t unix_stream_sendpage(struct socket *socket, struct page *page,
+				    int offset, size_t size, int flags)
+{
+	struct sock *sk = socket->sk;
+	struct sock *other;
+	struct sk_buff *skb;
+	int err;
+
+	if (flags & MSG_OOB)
+		return -EOPNOTSUPP;
+
+	other = unix_peer(sk);
+	if (!other || sk->sk_state != TCP_ESTABLISHED)
+		return -ENOTCONN;
+
+	if (sk->sk_shutdown & SEND_SHUTDOWN)
+		goto pipe_err;
+
+	skb = sock_alloc_send_skb(sk, 0, flags & MSG_DONTWAIT, &err);
+	if (skb == NULL)
+		return err;
+
+	get_page(page);
+	skb_fill_page_desc(skb, 0, page, offset, size);
+	skb->len = size;
+	skb->data_len = size;
+	skb->truesize += size;
+	atomic_add(size, &sk->sk_wmem_alloc);
+
+	UNIXCREDS(skb)->pid = task_tgid_vnr(current);
+	UNIXCREDS(skb)->uid = current_uid();
+	UNIXCREDS(skb)->gid = current_gid();
+
+	unix_state_lock(other);
+
+	if (sock_flag(other, SOCK_DEAD) ||
+	    (other->sk_shutdown & RCV_SHUTDOWN)) {
+		unix_state_unlock(other);
+		kfree_skb(skb);
+		goto pipe_err;
+	}
+
+	skb_queue_tail(&other->sk_receive_queue, skb);
+	unix_state_unlock(other);
+	other->sk_data_ready(other, size);
+	return size;
+
+pipe_err:
+	if (!(flags & MSG_NOSIGNAL))
+		send_sig(SIGPIPE, current, 0);
+	return -EPIPE;
+}
+
 static int unix_seqpacket_sendmsg(struct kiocb *kiocb, struct socket *sock,
 				  struct msghdr *msg, size_t len)
 {
@@ -1857,8 +1974,9 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 			sunaddr = NULL;
 		}
 
-		chunk = min_t(unsigned int, skb->len, size);
-		if (memcpy_toiovec(msg->msg_iov, skb->data, chunk)) {
+		chunk = min_t(unsigned int, unix_skb_len(skb), size);
+		if (skb_copy_datagram_iovec(skb, UNIXCB(skb).consumed,
+					    msg->msg_iov, chunk)) {
 			skb_queue_head(&sk->sk_receive_queue, skb);
 			if (copied == 0)
 				copied = -EFAULT;
@@ -1869,13 +1987,13 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 
 		/* Mark read part of skb as used */
 		if (!(flags & MSG_PEEK)) {
-			skb_pull(skb, chunk);
+			UNIXCB(skb).consumed += chunk;
 
 			if (UNIXCB(skb).fp)
 				unix_detach_fds(siocb->scm, skb);
 
 			/* put the skb back if we didn't use it up.. */
-			if (skb->len) {
+			if (unix_skb_len(skb)) {
 				skb_queue_head(&sk->sk_receive_queue, skb);
 				break;
 			}
@@ -1902,6 +2020,98 @@ out:
 	return copied ? : err;
 }
 
+static ssize_t unix_stream_splice_to_pipe(struct sock *sk,
+					  struct pipe_inode_info *pipe,
+					  struct splice_pipe_desc *spd)
+{
+	/* u->readlock stays held, nothing takes it under the pipe lock */
+	return splice_to_pipe(pipe, spd);
+}
+
+static ssize_t unix_stream_splice_read(struct socket *sock, loff_t *ppos,
+				       struct pipe_inode_info *pipe,
+				       size_t len, unsigned int flags)
+{
+	struct sock *sk = sock->sk;
+	struct unix_sock *u = unix_sk(sk);
+	ssize_t spliced = 0;
+	int err = 0;
+	long timeo;
+
+	if (unlikely(*ppos))
+		return -ESPIPE;
+
+	if (sk->sk_state != TCP_ESTABLISHED)
+		return -EINVAL;
+
+	timeo = sock_rcvtimeo(sk, (sock->file->f_flags & O_NONBLOCK) ||
+				  (flags & SPLICE_F_NONBLOCK));
+
+	mutex_lock(&u->readlock);
+
+	while (len) {
+		struct sk_buff *skb;
+		int chunk;
+
+		unix_state_lock(sk);
+		skb = skb_peek(&sk->sk_receive_queue);
+		if (skb == NULL) {
+			if (spliced)
+				goto unlock;
+
+			err = sock_error(sk);
+			if (err)
+				goto unlock;
+			if (sk->sk_shutdown & RCV_SHUTDOWN)
+				goto unlock;
+
+			unix_state_unlock(sk);
+			err = -EAGAIN;
+			if (!timeo)
+				break;
+			mutex_unlock(&u->readlock);
+
+			timeo = unix_stream_data_wait(sk, timeo);
+
+			if (signal_pending(current)) {
+				err = sock_intr_errno(timeo);
+				goto out;
+			}
+			mutex_lock(&u->readlock);
+			continue;
+ unlock:
+			unix_state_unlock(sk);
+			break;
+		}
+		unix_state_unlock(sk);
+
+		/* Only this reader unlinks skbs, so the peeked one stays */
+		chunk = skb_splice_bits(skb, sk, UNIXCB(skb).consumed, pipe,
+					min_t(size_t, unix_skb_len(skb), len),
+					flags, unix_stream_splice_to_pipe);
+		if (chunk <= 0) {
+			err = chunk;
+			break;
+		}
+		spliced += chunk;
+		len -= chunk;
+
+		UNIXCB(skb).consumed += chunk;
+		if (unix_skb_len(skb))
+			break;
+
+		/* Passed fds are dropped by the destructor, as they are
+		 * for a reader that gives no room for them.
+		 */
+		skb_unlink(skb, &sk->sk_receive_queue);
+		kfree_skb(skb);
+	}
+
+	mutex_unlock(&u->readlock);
+out:
+	return spliced ? : err;
+}
+
 static int unix_shutdown(struct socket *sock, int mode)
 {
 	struct sock *sk = sock->sk;
@@ -1968,7 +2178,7 @@ static int unix_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg)
 			if (sk->sk_type == SOCK_STREAM ||
 			    sk->sk_type == SOCK_SEQPACKET) {
 				skb_queue_walk(&sk->sk_receive_queue, skb)
-					amount += skb->len;
+					amount += unix_skb_len(skb);
 			} else {
 				skb = skb_peek(&sk->sk_receive_queue);
 				if (skb)
@@ -2078,76 +2288,69 @@ static unsigned int unix_dgram_poll(struct file *file, struct socket *sock,
 }
 
 #ifdef CONFIG_PROC_FS
-static struct sock *first_unix_socket(int *i)
+struct unix_iter_state {
+	struct seq_net_private p;
+	int i;
+};
+
+/*
+ * Returns the socket after @sk, or the first one in or after chain
+ * iter->i if @sk is NULL, with the lock of its chain held.
+ */
+static struct sock *unix_next_socket(struct seq_file *seq, struct sock *sk)
 {
-	for (*i = 0; *i <= UNIX_HASH_SIZE; (*i)++) {
-		if (!hlist_empty(&unix_socket_table[*i]))
-			return __sk_head(&unix_socket_table[*i]);
+	struct unix_iter_state *iter = seq->private;
+	struct hlist_node *node;
+
+	if (sk) {
+		for (sk = sk_next(sk); sk; sk = sk_next(sk))
+			if (net_eq(sock_net(sk), seq_file_net(seq)))
+				return sk;
+		spin_unlock(&unix_table_locks[iter->i]);
+		iter->i++;
 	}
-	return NULL;
-}
 
-static struct sock *next_unix_socket(int *i, struct sock *s)
-{
-	struct sock *next = sk_next(s);
-	/* More in this chain? */
-	if (next)
-		return next;
-	/* Look for next non-empty chain. */
-	for ((*i)++; *i <= UNIX_HASH_SIZE; (*i)++) {
-		if (!hlist_empty(&unix_socket_table[*i]))
-			return __sk_head(&unix_socket_table[*i]);
+	for (; iter->i < UNIX_HASH_TABLE_SIZE; iter->i++) {
+		spin_lock(&unix_table_locks[iter->i]);
+		sk_for_each(sk, node, &unix_socket_table[iter->i])
+			if (net_eq(sock_net(sk), seq_file_net(seq)))
+				return sk;
+		spin_unlock(&unix_table_locks[iter->i]);
 	}
 	return NULL;
 }
 
-struct unix_iter_state {
-	struct seq_net_private p;
-	int i;
-};
-
 static struct sock *unix_seq_idx(struct seq_file *seq, loff_t pos)
 {
 	struct unix_iter_state *iter = seq->private;
-	loff_t off = 0;
 	struct sock *s;
 
-	for (s = first_unix_socket(&iter->i); s; s = next_unix_socket(&iter->i, s)) {
-		if (sock_net(s) != seq_file_net(seq))
-			continue;
-		if (off == pos)
-			return s;
-		++off;
-	}
-	return NULL;
+	iter->i = 0;
+	for (s = unix_next_socket(seq, NULL); s && pos; pos--)
+		s = unix_next_socket(seq, s);
+	return s;
 }
 
 static void *unix_seq_start(struct seq_file *seq, loff_t *pos)
-	__acquires(unix_table_lock)
 {
-	spin_lock(&unix_table_lock);
 	return *pos ? unix_seq_idx(seq, *pos - 1) : SEQ_START_TOKEN;
 }
 
 static void *unix_seq_next(struct seq_file *seq, void *v, loff_t *pos)
 {
-	struct unix_iter_state *iter = seq->private;
-	struct sock *sk = v;
 	++*pos;
 
 	if (v == SEQ_START_TOKEN)
-		sk = first_unix_socket(&iter->i);
-	else
-		sk = next_unix_socket(&iter->i, sk);
-	while (sk && (sock_net(sk) != seq_file_net(seq)))
-		sk = next_unix_socket(&iter->i, sk);
-	return sk;
+		return unix_seq_idx(seq, 0);
+	return unix_next_socket(seq, v);
 }
 
 static void unix_seq_stop(struct seq_file *seq, void *v)
-	__releases(unix_table_lock)
 {
-	spin_unlock(&unix_table_lock);
+	struct unix_iter_state *iter = seq->private;
+
+	if (v && v != SEQ_START_TOKEN)
+		spin_unlock(&unix_table_locks[iter->i]);
 }
 
 static int unix_seq_show(struct seq_file *seq, void *v)
@@ -2257,10 +2460,14 @@ static struct pernet_operations unix_net_ops = {
 static int __init af_unix_init(void)
 {
 	int rc = -1;
+	int i;
 	struct sk_buff *dummy_skb;
 
 	BUILD_BUG_ON(sizeof(struct unix_skb_parms) > sizeof(dummy_skb->cb));
 
+	for (i = 0; i < UNIX_HASH_TABLE_SIZE; i++)
+		spin_lock_init(&unix_table_locks[i]);
+
 	rc = proto_register(&unix_proto, 1);
 	if (rc != 0) {
 		printk(KERN_CRIT "%s: Cannot create unix_sock SLAB cache!\n",